@@ -0,0 +1,153 @@
+/*
+    Measures how the runner's -host mode scales with threads. For each thread
+    count from one up to the number of cores, doubling each time, the runner
+    is started as "runner gamefile -host socket -threads N [runner options]"
+    and the given number of sessions are all connected at once. Each session
+    plays the game's first turn and then finds its player gone, so a benchmark
+    game is played through once per session. The time until every session has
+    ended is printed with the sessions completed per second and the speedup
+    over a single thread.
+
+    USAGE: ./hostbench runner sessions [runner options] gamefile
+*/
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const char *SOCKET_PATH = "./hostbench.sock";
+const int START_ATTEMPTS = 500;     // tries to connect while the runner starts
+
+static int connectTo(const std::string &path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns the seconds taken for every session to end, or a negative number
+// if the runner couldn't be started or a session failed.
+static double runHost(const std::string &runner, const std::string &gameFile,
+                      const std::vector<std::string> &options, int threads, int sessions) {
+    std::vector<std::string> args{runner, gameFile, "-host", SOCKET_PATH,
+                                  "-threads", std::to_string(threads)};
+    args.insert(args.end(), options.begin(), options.end());
+    std::vector<char*> argv;
+    for (std::string &arg : args) argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    unlink(SOCKET_PATH);
+    pid_t child = fork();
+    if (child < 0) {
+        std::cerr << "Could not start " << runner << ": " << strerror(errno) << '\n';
+        return -1;
+    }
+    if (child == 0) {
+        execv(runner.c_str(), argv.data());
+        std::cerr << "Could not run " << runner << ": " << strerror(errno) << '\n';
+        _exit(127);
+    }
+
+    // wait for the runner to create its socket
+    int attempts = 0;
+    while (access(SOCKET_PATH, F_OK) != 0 && ++attempts < START_ATTEMPTS) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pollfd> open;
+    for (int i = 0; i < sessions; ++i) {
+        int fd = connectTo(SOCKET_PATH);
+        // it may not be listening quite yet
+        for (int j = 0; fd < 0 && i == 0 && j < START_ATTEMPTS; ++j) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            fd = connectTo(SOCKET_PATH);
+        }
+        if (fd < 0) {
+            std::cerr << "Could not connect: " << strerror(errno) << '\n';
+            break;
+        }
+        shutdown(fd, SHUT_WR);
+        open.push_back(pollfd{fd, POLLIN, 0});
+    }
+    const bool allConnected = static_cast<int>(open.size()) == sessions;
+
+    // read until every session has closed its connection
+    char buffer[4096];
+    unsigned remaining = open.size();
+    while (remaining > 0 && poll(open.data(), open.size(), -1) >= 0) {
+        for (pollfd &session : open) {
+            if (session.fd < 0 || !session.revents) continue;
+            if (read(session.fd, buffer, sizeof(buffer)) <= 0) {
+                close(session.fd);
+                session.fd = -1;
+                --remaining;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    kill(child, SIGTERM);
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!allConnected || remaining > 0) return -1;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cerr << "USAGE: " << argv[0] << " runner sessions [runner options] gamefile\n";
+        return 1;
+    }
+    const std::string runner = argv[1];
+    const int sessions = atoi(argv[2]);
+    if (sessions <= 0) {
+        std::cerr << "The number of sessions must be positive.\n";
+        return 1;
+    }
+    std::vector<std::string> options;
+    std::string gameFile;
+    for (int i = 3; i < argc; ++i) {
+        if (argv[i][0] == '-') options.push_back(argv[i]);
+        else                   gameFile = argv[i];
+    }
+
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << gameFile << ", " << sessions << " sessions, " << cores << " cores\n";
+    std::cout << std::setw(8) << "threads" << std::setw(10) << "seconds";
+    std::cout << std::setw(14) << "sessions/s" << std::setw(10) << "speedup" << '\n';
+
+    double single = 0;
+    for (unsigned threads = 1; ; threads *= 2) {
+        if (threads > cores) threads = cores;
+        double seconds = runHost(runner, gameFile, options, threads, sessions);
+        if (seconds < 0) return 1;
+        if (threads == 1) single = seconds;
+        std::cout << std::setw(8) << threads << std::setw(10) << std::fixed << std::setprecision(3) << seconds;
+        std::cout << std::setw(14) << std::setprecision(1) << sessions / seconds;
+        std::cout << std::setw(10) << std::setprecision(2) << single / seconds << '\n';
+        if (threads == cores) break;
+    }
+    unlink(SOCKET_PATH);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+    Runs each benchmark gamefile with the runner and records the time it took,
+    the number of instructions executed, and the most memory it used. The
+    results are printed and written to a tab separated file with a header line.
+
+    USAGE: ./runbench runner results-file [runner options] gamefile...
+
+    Each game is run as "runner gamefile -silent -debug [runner options]"; the
+    instruction counts are taken from the lines -debug prints after each turn.
+*/
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct BenchResult {
+    std::string name;
+    double seconds;
+    long instructions;
+    long peakKilobytes;
+    bool succeeded;
+};
+
+// total of the "N opcodes executed" reports in the runner's output
+static long countInstructions(const std::string &output) {
+    const std::string marker = " opcodes executed";
+    long total = 0;
+    std::string::size_type pos = output.find(marker);
+    while (pos != std::string::npos) {
+        std::string::size_type start = pos;
+        while (start > 0 && isdigit(output[start - 1])) --start;
+        if (start < pos) total += std::stol(output.substr(start, pos - start));
+        pos = output.find(marker, pos + marker.size());
+    }
+    return total;
+}
+
+static BenchResult runBenchmark(const std::string &runner, const std::string &gameFile,
+                                const std::vector<std::string> &options) {
+    BenchResult result{gameFile, 0.0, 0, 0, false};
+    std::string::size_type slash = result.name.find_last_of('/');
+    if (slash != std::string::npos) result.name.erase(0, slash + 1);
+    std::string::size_type dot = result.name.rfind('.');
+    if (dot != std::string::npos) result.name.erase(dot);
+
+    std::vector<std::string> args{runner, gameFile, "-silent", "-debug"};
+    args.insert(args.end(), options.begin(), options.end());
+    std::vector<char*> argv;
+    for (std::string &arg : args) argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    int output[2];
+    if (pipe(output) != 0) {
+        std::cerr << "Could not create pipe: " << strerror(errno) << '\n';
+        return result;
+    }
+    auto start = std::chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child < 0) {
+        std::cerr << "Could not start " << runner << ": " << strerror(errno) << '\n';
+        return result;
+    }
+    if (child == 0) {
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execv(runner.c_str(), argv.data());
+        std::cerr << "Could not run " << runner << ": " << strerror(errno) << '\n';
+        _exit(127);
+    }
+    close(output[1]);
+
+    std::string text;
+    char buffer[4096];
+    ssize_t amount;
+    while ((amount = read(output[0], buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, amount);
+    }
+    close(output[0]);
+
+    int status = 0;
+    struct rusage usage;
+    wait4(child, &status, 0, &usage);
+    auto end = std::chrono::steady_clock::now();
+
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.instructions = countInstructions(text);
+    result.peakKilobytes = usage.ru_maxrss;
+    result.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cerr << "USAGE: " << argv[0] << " runner results-file [runner options] gamefile...\n";
+        return 1;
+    }
+    const std::string runner = argv[1];
+    const std::string resultsFile = argv[2];
+    std::vector<std::string> options, games;
+    for (int i = 3; i < argc; ++i) {
+        if (argv[i][0] == '-') options.push_back(argv[i]);
+        else                   games.push_back(argv[i]);
+    }
+
+    std::ofstream results(resultsFile);
+    if (!results) {
+        std::cerr << "Could not open " << resultsFile << " for writing.\n";
+        return 1;
+    }
+    results << "benchmark\tseconds\tinstructions\tinstructions_per_second\tpeak_rss_kb\tstatus\n";
+
+    std::cout << std::left << std::setw(16) << "benchmark" << std::right;
+    std::cout << std::setw(10) << "seconds" << std::setw(14) << "instructions";
+    std::cout << std::setw(14) << "per second" << std::setw(12) << "peak KB" << '\n';
+
+    bool allSucceeded = true;
+    for (const std::string &game : games) {
+        BenchResult result = runBenchmark(runner, game, options);
+        long perSecond = result.seconds > 0 ? static_cast<long>(result.instructions / result.seconds) : 0;
+        const char *status = result.succeeded ? "ok" : "failed";
+        if (!result.succeeded) allSucceeded = false;
+
+        results << result.name << '\t' << std::fixed << std::setprecision(3) << result.seconds;
+        results << '\t' << result.instructions << '\t' << perSecond;
+        results << '\t' << result.peakKilobytes << '\t' << status << '\n';
+
+        std::cout << std::left << std::setw(16) << result.name << std::right;
+        std::cout << std::setw(10) << std::fixed << std::setprecision(3) << result.seconds;
+        std::cout << std::setw(14) << result.instructions << std::setw(14) << perSecond;
+        std::cout << std::setw(12) << result.peakKilobytes;
+        if (!result.succeeded) std::cout << "  FAILED";
+        std::cout << '\n';
+    }
+    std::cout << "Results written to " << resultsFile << ".\n";
+    return allSucceeded ? 0 : 1;
+}
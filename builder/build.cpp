@@ -39,6 +39,7 @@ int main(int argc, char *argv[]) {
     bool useAnsiEscapes = true;
     bool showFiles = false;
     bool showNextIdent = false;
+    bool useSuperinstructions = true;
 
     auto runStart = std::chrono::system_clock::now();
 
@@ -62,6 +63,8 @@ int main(int argc, char *argv[]) {
             dump_irFlag = true;
         } else if (strcmp(argv[i], "-skip-ident-check") == 0) {
             skipIdentCheck = true;
+        } else if (strcmp(argv[i], "-no-superinstructions") == 0) {
+            useSuperinstructions = false;
 
         } else if (strcmp(argv[i], "-color") == 0) {
             useAnsiEscapes = true;
@@ -95,6 +98,7 @@ int main(int argc, char *argv[]) {
     int nextIdent = -1;
     std::vector<Token> tokens;
     GameData gamedata;
+    gamedata.useSuperinstructions = useSuperinstructions;
     add_default_constants(gamedata);
 
     try {
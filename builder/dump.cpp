@@ -179,6 +179,25 @@ void dump_asm(GameData &gamedata, std::ostream &out) {
                         out << ' ' << value;
                         out << ": " << static_cast<Value::Type>(type);
                         break;
+                    case OpcodeDef::AddLocal:
+                    case OpcodeDef::SubLocal:
+                    case OpcodeDef::StoreLocal:
+                    case OpcodeDef::LoadLocal:
+                        out << ' ' << function->code.read_16(i);
+                        i += 2;
+                        break;
+                    case OpcodeDef::IncLocal:
+                        out << ' ' << function->code.read_16(i);
+                        out << " by " << static_cast<int32_t>(function->code.read_32(i + 2));
+                        i += 6;
+                        break;
+                    case OpcodeDef::CompareJumpZero:
+                    case OpcodeDef::CompareJumpNotZero: {
+                        const OpcodeDef *compare = getOpcodeByCode(function->code.read_8(i));
+                        out << ' ' << (compare ? compare->name : "?");
+                        out << ' ' << function->code.read_32(i + 1);
+                        i += 5;
+                        break; }
                 }
                 out << "\n";
             }
@@ -266,6 +285,23 @@ void dump_ir(GameData &gamedata, std::ostream &out) {
                 continue;
             }
 
+            const AsmImmediate *immediate = dynamic_cast<const AsmImmediate*>(line);
+            if (immediate) {
+                const OpcodeDef *opdef = getOpcodeByCode(immediate->opcode);
+                if (opdef)  work << opdef->name;
+                else        work << '(' << immediate->opcode << ')';
+                if (immediate->label.empty()) {
+                    const LocalDef *def = function->getLocal(immediate->operand);
+                    work << ' ' << immediate->operand << " (" << (def ? def->name : "INVALID") << ')';
+                    if (immediate->opcode == OpcodeDef::IncLocal) work << " by " << immediate->aux;
+                } else {
+                    const OpcodeDef *compare = getOpcodeByCode(immediate->aux);
+                    work << ' ' << (compare ? compare->name : "?") << ' ' << immediate->label;
+                }
+                out << std::setw(IR_WIDTH) << work.str() << line->getOrigin() << "\n";
+                continue;
+            }
+
             const AsmValue *value = dynamic_cast<const AsmValue*>(line);
             if (value) {
                 work << "push " << value->value;
@@ -591,6 +591,7 @@ void stmt_while(GameData &gamedata, FunctionDef *function, List *list) {
     function->addValue(origin, Value{Value::Symbol, 0, after_label});
     function->addOpcode(origin, OpcodeDef::JumpZero);
     process_value(gamedata, function, list->values[2]);
+    function->addOpcode(origin, OpcodeDef::StackPop);
     function->addValue(origin, Value{Value::Symbol, 0, start_label});
     function->addOpcode(origin, OpcodeDef::Jump);
     function->addLabel(origin, after_label);
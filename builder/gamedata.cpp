@@ -74,7 +74,7 @@ int FunctionDef::getLocalNumber(const std::string &name) const {
 }
 
 GameData::GameData()
-: errorCount(0), vocabStart(0), stringsStart(0), listsStart(0), mapsStart(0), objectsStart(0),
+: errorCount(0), useSuperinstructions(true), gameFlags(0), vocabStart(0), stringsStart(0), listsStart(0), mapsStart(0), objectsStart(0),
   functionsStart(0), bytecodeStart(0), fileEnd(0),
   nextAnonymousId(firstAnonymousId) {
     objects.push_back(nullptr);
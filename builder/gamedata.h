@@ -13,6 +13,10 @@
 
 const int firstAnonymousId = 10000000;
 
+// gamefile flags
+const unsigned GAMEFLAG_SUPERINSTRUCTIONS = 0x01;
+const unsigned GAMEFLAG_LOCAL_OPCODES     = 0x02;
+
 struct ErrorMsg {
     enum Type {
         Fatal, Error, Warning
@@ -72,12 +76,14 @@ struct Backpatch {
 struct AsmValue;
 struct AsmLabel;
 struct AsmOpcode;
+struct AsmImmediate;
 struct FunctionDef;
 class GameData;
 struct FunctionBuilder {
     void build(const AsmValue *value);
     void build(const AsmLabel *label);
     void build(const AsmOpcode *opcode);
+    void build(const AsmImmediate *opcode);
     FunctionDef *forFunction;
     GameData &gamedata;
     std::vector<Backpatch> patches;
@@ -128,6 +134,24 @@ struct AsmValue : public AsmLine {
     unsigned mSize;
 };
 
+// An opcode whose operands follow it in the bytecode. Depending on the
+// opcode, operand is a local number and aux either the amount to add to it or
+// the comparison opcode, while label is the target of a jump.
+struct AsmImmediate : public AsmLine {
+    AsmImmediate(const Origin &origin, int opcode, int operand, int aux,
+                 const std::string &label = "")
+    : AsmLine(origin), opcode(opcode), operand(operand), aux(aux), label(label)
+    { }
+    virtual ~AsmImmediate() override { }
+    virtual void build(FunctionBuilder &builder) const override { builder.build(this); }
+    virtual unsigned getSize() const override { return 1; };
+
+    int opcode;
+    int operand;
+    int aux;
+    std::string label;
+};
+
 struct LocalDef {
     std::string name;
     Value::Type type;
@@ -196,6 +220,8 @@ public:
     FlagSet*     flagSetById(int ident);
 
     int errorCount;
+    bool useSuperinstructions;
+    unsigned gameFlags;
     std::vector<ErrorMsg> errors;
     SymbolTable symbols;
     SymbolTable defaults;
@@ -78,7 +78,7 @@ void generate(GameData &gamedata, const std::string &outputFile) {
         write_32(out, 0);
     }
     // 12: write gamefile flags
-    write_32(out, 0);
+    write_32(out, gamedata.gameFlags);
 
     // 16, 20, 24, 28: title, author, version, gameid, and build number
     write_symbol(out, "TITLE",   Value::String,  gamedata, outputFile); // 16: game title
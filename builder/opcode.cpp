@@ -80,6 +80,13 @@ OpcodeDef opcodes[] = {
     {   "file_write",   OpcodeDef::FileWrite,               2, 1 },
     {   "file_delete",  OpcodeDef::FileDelete,              1, 1 },
     {   "tokenize",     OpcodeDef::Tokenize,                3, 0 },
+    {   "add_local",    OpcodeDef::AddLocal,                1, 1, FORBID_ALWAYS },
+    {   "sub_local",    OpcodeDef::SubLocal,                1, 1, FORBID_ALWAYS },
+    {   "cmp_jz",       OpcodeDef::CompareJumpZero,         2, 0, FORBID_ALWAYS },
+    {   "cmp_jnz",      OpcodeDef::CompareJumpNotZero,      2, 0, FORBID_ALWAYS },
+    {   "inc_local",    OpcodeDef::IncLocal,                0, 0, FORBID_ALWAYS },
+    {   "store_local",  OpcodeDef::StoreLocal,              1, 0, FORBID_ALWAYS },
+    {   "load_local",   OpcodeDef::LoadLocal,                0, 1, FORBID_ALWAYS },
     {   ""                                                       }
 };
 
@@ -93,6 +93,16 @@ struct OpcodeDef {
         FileWrite           = 81,
         FileDelete          = 82,
         Tokenize            = 83,
+
+        // these are only produced by the builder and take their operands from
+        // the bytecode instead of the stack; the first four are superinstructions
+        AddLocal            = 84,
+        SubLocal            = 85,
+        CompareJumpZero     = 86,
+        CompareJumpNotZero  = 87,
+        IncLocal            = 88,
+        StoreLocal          = 89,
+        LoadLocal           = 90,
     };
 
     std::string name;
@@ -173,6 +173,22 @@ List* parse_list(GameData &gamedata, FunctionDef *function, ParseState &state) {
     return list;
 }
 
+static const AsmValue* valueOfType(const AsmLine *line, Value::Type type) {
+    const AsmValue *value = dynamic_cast<const AsmValue*>(line);
+    if (value && value->value.type == type) return value;
+    return nullptr;
+}
+static int opcodeOf(const AsmLine *line) {
+    const AsmOpcode *opcode = dynamic_cast<const AsmOpcode*>(line);
+    return opcode ? opcode->opcode : -1;
+}
+static bool isComparison(int opcode) {
+    return opcode >= OpcodeDef::Equal && opcode <= OpcodeDef::GreaterThanEqual;
+}
+static bool fitsLocal(int localId) {
+    return localId >= 0 && localId <= 0xFFFF;
+}
+
 void FunctionBuilder::build(const AsmValue *value) {
     if (value->value.type == Value::Symbol) {
         auto labelIter = forFunction->labels.find(value->value.text);
@@ -198,12 +214,168 @@ void FunctionBuilder::build(const AsmLabel *label) {
 void FunctionBuilder::build(const AsmOpcode *opcode) {
     forFunction->code.add_8(opcode->opcode);
 }
+void FunctionBuilder::build(const AsmImmediate *opcode) {
+    ByteStream &code = forFunction->code;
+    code.add_8(opcode->opcode);
+    if (opcode->opcode == OpcodeDef::CompareJumpZero || opcode->opcode == OpcodeDef::CompareJumpNotZero) {
+        code.add_8(opcode->aux);
+        auto labelIter = forFunction->labels.find(opcode->label);
+        if (labelIter != forFunction->labels.end()) {
+            code.add_32(labelIter->second);
+        } else {
+            patches.push_back(Backpatch{code.size(), opcode->label, opcode->getOrigin()});
+            code.add_32(0xFFFFFFFF);
+        }
+        return;
+    }
+
+    code.add_16(opcode->operand);
+    if (opcode->opcode == OpcodeDef::IncLocal) code.add_32(opcode->aux);
+    LocalDef *def = forFunction->getLocal(opcode->operand);
+    if (def) ++def->reads;
+}
+
+// A local pushed onto the stack is only read when it is popped again, so it
+// can be read with load_local when pushed only if nothing between the push and
+// the instruction that pops it can store to it. Stack depth is followed past
+// instructions that take and leave a fixed number of values; anything else
+// (jumps, calls, labels, stack shuffling, or a store to the local or through
+// a reference not known here) keeps the local as a push.
+static bool loadsLocalEarly(const std::vector<AsmLine*> &lines, unsigned start) {
+    const int localId = static_cast<const AsmValue*>(lines[start])->value.value;
+    int depth = 1; // values on the stack down to and including the local
+    for (unsigned i = start + 1; i < lines.size(); ++i) {
+        if (dynamic_cast<const AsmValue*>(lines[i])) {
+            ++depth;
+            continue;
+        }
+        const int code = opcodeOf(lines[i]);
+        const OpcodeDef *def = getOpcodeByCode(code);
+        if (!def) return false;
+        switch (code) {
+            case OpcodeDef::StackDup:
+            case OpcodeDef::StackPeek:
+            case OpcodeDef::StackSwap:
+            case OpcodeDef::Call:
+                return false;
+        }
+        if (def->inputs >= depth) return true;
+        switch (code) {
+            case OpcodeDef::Return:
+            case OpcodeDef::Jump:
+            case OpcodeDef::JumpZero:
+            case OpcodeDef::JumpNotZero:
+                return false;
+            case OpcodeDef::Store: {
+                const AsmValue *ref = valueOfType(lines[i - 1], Value::VarRef);
+                if (!ref || ref->value.value == localId) return false;
+                break; }
+        }
+        depth += def->outputs - def->inputs;
+    }
+    return false;
+}
+
+// Replace sequences of instructions with single instructions that take their
+// operands from the bytecode: loads, stores and constant increments of locals
+// always, and the most frequent other sequences if superinstructions are
+// enabled.
+// Since labels are lines of their own, nothing can jump into the middle of a
+// sequence that is replaced.
+static void combine_instructions(GameData &gamedata, FunctionDef *function) {
+    std::vector<AsmLine*> &lines = function->asmCode;
+    std::vector<AsmLine*> combined;
+    unsigned i = 0;
+    while (i < lines.size()) {
+        const unsigned left = lines.size() - i;
+        AsmLine *replacement = nullptr;
+        unsigned replaced = 0;
+        unsigned flag = GAMEFLAG_LOCAL_OPCODES;
+
+        // inc and dec of a local by a constant
+        if (left >= 5) {
+            const AsmValue *amount = valueOfType(lines[i], Value::Integer);
+            const AsmValue *local = valueOfType(lines[i + 1], Value::LocalVar);
+            const AsmValue *ref = valueOfType(lines[i + 3], Value::VarRef);
+            int math = opcodeOf(lines[i + 2]);
+            if (amount && local && ref && local->value.value == ref->value.value
+                    && fitsLocal(local->value.value)
+                    && (math == OpcodeDef::Add || math == OpcodeDef::Sub)
+                    && opcodeOf(lines[i + 4]) == OpcodeDef::Store
+                    && amount->value.value != INT32_MIN) {
+                int by = math == OpcodeDef::Add ? amount->value.value : -amount->value.value;
+                replacement = new AsmImmediate(lines[i]->getOrigin(), OpcodeDef::IncLocal,
+                                               local->value.value, by);
+                replaced = 5;
+            }
+        }
+        // storing to a local
+        if (!replacement && left >= 2) {
+            const AsmValue *ref = valueOfType(lines[i], Value::VarRef);
+            if (ref && fitsLocal(ref->value.value) && opcodeOf(lines[i + 1]) == OpcodeDef::Store) {
+                replacement = new AsmImmediate(lines[i]->getOrigin(), OpcodeDef::StoreLocal,
+                                               ref->value.value, 0);
+                replaced = 2;
+            }
+        }
+
+        // comparison followed by a conditional jump
+        if (!replacement && gamedata.useSuperinstructions && left >= 3) {
+            int compare = opcodeOf(lines[i]);
+            const AsmValue *target = valueOfType(lines[i + 1], Value::Symbol);
+            int jump = opcodeOf(lines[i + 2]);
+            if (isComparison(compare) && target
+                    && (jump == OpcodeDef::JumpZero || jump == OpcodeDef::JumpNotZero)) {
+                replacement = new AsmImmediate(lines[i]->getOrigin(),
+                        jump == OpcodeDef::JumpZero ? OpcodeDef::CompareJumpZero
+                                                    : OpcodeDef::CompareJumpNotZero,
+                        0, compare, target->value.text);
+                replaced = 3;
+                flag = GAMEFLAG_SUPERINSTRUCTIONS;
+            }
+        }
+        // local used as the first operand of add or sub
+        if (!replacement && gamedata.useSuperinstructions && left >= 2) {
+            const AsmValue *local = valueOfType(lines[i], Value::LocalVar);
+            int next = opcodeOf(lines[i + 1]);
+            if (local && fitsLocal(local->value.value)
+                    && (next == OpcodeDef::Add || next == OpcodeDef::Sub)) {
+                replacement = new AsmImmediate(lines[i]->getOrigin(),
+                        next == OpcodeDef::Add ? OpcodeDef::AddLocal : OpcodeDef::SubLocal,
+                        local->value.value, 0);
+                replaced = 2;
+                flag = GAMEFLAG_SUPERINSTRUCTIONS;
+            }
+        }
+        // reading a local
+        if (!replacement) {
+            const AsmValue *local = valueOfType(lines[i], Value::LocalVar);
+            if (local && fitsLocal(local->value.value) && loadsLocalEarly(lines, i)) {
+                replacement = new AsmImmediate(lines[i]->getOrigin(), OpcodeDef::LoadLocal,
+                                               local->value.value, 0);
+                replaced = 1;
+            }
+        }
+
+        if (replacement) {
+            for (unsigned j = 0; j < replaced; ++j) delete lines[i + j];
+            combined.push_back(replacement);
+            gamedata.gameFlags |= flag;
+            i += replaced;
+        } else {
+            combined.push_back(lines[i]);
+            ++i;
+        }
+    }
+    lines.swap(combined);
+}
 
 void build_function(GameData &gamedata, FunctionDef *function) {
     FunctionBuilder builder{function, gamedata};
 
     function->addValue(function->origin, Value{Value::Integer, 0});
     function->addOpcode(function->origin, OpcodeDef::Return);
+    combine_instructions(gamedata, function);
     for (const AsmLine *line : function->asmCode) {
         line->build(builder);
     }
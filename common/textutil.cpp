@@ -19,6 +19,29 @@ void normalize(std::string &s) {
     free(result);
 }
 
+// Find a position in s before end such that normalizing the text from there
+// onwards, together with anything appended after end, leaves the text before
+// it unchanged. This is the start of the second to last starter (a character
+// with combining class zero); nothing appended can combine across two of
+// them. Returns zero if there is no such position.
+std::size_t normalizationBoundary(const std::string &s, std::size_t end) {
+    const unsigned char *source = reinterpret_cast<const unsigned char*>(s.c_str());
+    std::size_t pos = end;
+    int starters = 0;
+    while (pos > 0) {
+        --pos;
+        while (pos > 0 && (source[pos] & 0xC0) == 0x80) --pos;
+        utf8proc_int32_t codepoint = 0;
+        utf8proc_iterate(source + pos, end - pos, &codepoint);
+        if (codepoint < 0) continue;
+        if (utf8proc_get_property(codepoint)->combining_class == 0) {
+            ++starters;
+            if (starters == 2) return pos;
+        }
+    }
+    return 0;
+}
+
 void upperFirst(std::string &s) {
     const unsigned char *source = reinterpret_cast<const unsigned char*>(s.c_str());
     unsigned char dest[6] = { 0 };
@@ -14,6 +14,7 @@ bool c_isspace(int c);
 int c_tolower(int c);
 bool isValidIdentifier(int c);
 void normalize(std::string &s);
+std::size_t normalizationBoundary(const std::string &s, std::size_t end);
 IntParseError parseAsInt(std::string text, int &result);
 void upperFirst(std::string &s);
 bool validSymbol(const std::string &name);
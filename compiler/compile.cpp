@@ -0,0 +1,306 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gamedata.h"
+#include "opcode.h"
+
+// Translates the functions of a gamefile into C++ for a native build of the
+// game. Each function becomes a body that starts with a switch on the
+// bytecode position to enter at, covering every instruction since any of them
+// may be the target of a jump whose target is computed, and then runs its
+// instructions in sequence using the helpers in runner/native.h. Jumps whose
+// targets are known when translating, including the common case of a target
+// pushed by the instruction just before the jump, go straight to the label of
+// their target. The generated code works on the same call stack as the
+// interpreters and is linked against the runtime library for everything else.
+
+static std::string intLiteral(int value) {
+    if (value >= 0) return std::to_string(value);
+    return "static_cast<int>(" + std::to_string(static_cast<unsigned>(value)) + "u)";
+}
+
+static std::string stringLiteral(const std::string &text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result + '"';
+}
+
+class FunctionWriter {
+public:
+    FunctionWriter(GameData &data, int id, const FunctionDef &function)
+    : data(data), id(id), function(function), ops(function.decoded.ops),
+      verified(function.verified ? "true" : "false"),
+      computedJumps(false), execute(false), calls(false) { }
+
+    void write(std::ostream &out);
+
+private:
+    // the index of the instruction at an offset within the function, or -1
+    int indexAt(int offset) const {
+        const std::vector<int> &index = function.decoded.index;
+        if (offset < 0 || static_cast<unsigned>(offset) >= index.size()) return -1;
+        return index[offset];
+    }
+    // continue at the instruction at index, which starts at IP if it exists
+    std::string goTo(int index, unsigned IP) const {
+        if (index < 0 || static_cast<unsigned>(index) >= ops.size()) {
+            return "nativeBadPosition(" + std::to_string(IP) + ");";
+        }
+        return "goto op_" + std::to_string(index) + ";";
+    }
+    std::string goToOffset(int offset) const {
+        return goTo(indexAt(offset), function.position + offset);
+    }
+    std::string pop() const {
+        return "nativePop<" + verified + ">(stack)";
+    }
+    bool writeFusedJump(std::ostream &out, unsigned i);
+    void writeOp(std::ostream &out, unsigned i);
+
+    GameData &data;
+    const int id;
+    const FunctionDef &function;
+    const std::vector<DecodedOp> &ops;
+    const std::string verified;
+    bool computedJumps;     // the body needs its enter label
+    bool execute;           // the body needs a result for nativeExecute
+    bool calls;             // and its depth for calls
+};
+
+// A jump target pushed immediately before a jump is known when translating.
+// The jump's own label stays in place for code that reaches it otherwise.
+bool FunctionWriter::writeFusedJump(std::ostream &out, unsigned i) {
+    const DecodedOp &op = ops[i];
+    if (op.opcode != OpcodeDef::Push32 || op.operand.type != Value::JumpTarget
+            || i + 1 >= ops.size() || indexAt(op.operand.value) < 0) {
+        return false;
+    }
+    const std::string target = goToOffset(op.operand.value);
+    const std::string next = goTo(i + 2, ops[i + 1].nextIP);
+    switch(ops[i + 1].opcode) {
+        case OpcodeDef::Jump:
+            out << "    " << target << '\n';
+            return true;
+        case OpcodeDef::JumpZero:
+            out << "    if (!" << pop() << ".isTrue()) " << target << '\n';
+            out << "    " << next << '\n';
+            return true;
+        case OpcodeDef::JumpNotZero:
+            out << "    if (" << pop() << ".isTrue()) " << target << '\n';
+            out << "    " << next << '\n';
+            return true;
+        default:
+            return false;
+    }
+}
+
+void FunctionWriter::writeOp(std::ostream &out, unsigned i) {
+    const DecodedOp &op = ops[i];
+    const std::string args = "<" + std::to_string(op.opcode) + ", " + verified + ">";
+    const int local = op.operand.value;
+    if (writeFusedJump(out, i)) return;
+
+    switch(op.opcode) {
+        case OpcodeDef::Push32:
+            if (op.operand.selfObj) {
+                out << "    { Value value(static_cast<Value::Type>(" << static_cast<int>(op.operand.type) << "), "
+                    << intLiteral(op.operand.value) << ");\n";
+                out << "      value.selfObj = " << op.operand.selfObj << "u;\n";
+                out << "      stack.push(value); }\n";
+            } else {
+                out << "    stack.push(Value(static_cast<Value::Type>(" << static_cast<int>(op.operand.type) << "), "
+                    << intLiteral(op.operand.value) << "));\n";
+            }
+            break;
+        case OpcodeDef::Store:
+            out << "    nativeStore(data);\n";
+            break;
+        case OpcodeDef::StackPop:
+            out << "    " << pop() << ";\n";
+            break;
+        case OpcodeDef::StackDup:
+            out << "    stack.push(stack.peek());\n";
+            break;
+        case OpcodeDef::Call:
+            calls = true;
+            out << "    nativeCall(data, " << op.nextIP << ", " << verified << ");\n";
+            out << "    if (nativeRunCall(data, depth, result)) return result;\n";
+            break;
+        case OpcodeDef::Return:
+            out << "    return nativeReturn(data, " << verified << ");\n";
+            break;
+        case OpcodeDef::GetItem:
+            out << "    nativeGetItem(data, " << op.nextIP - 1 << ");\n";
+            break;
+        case OpcodeDef::SetItem:
+            out << "    nativeSetItem(data);\n";
+            break;
+
+        case OpcodeDef::Equal:
+        case OpcodeDef::NotEqual:
+        case OpcodeDef::LessThan:
+        case OpcodeDef::LessThanEqual:
+        case OpcodeDef::GreaterThan:
+        case OpcodeDef::GreaterThanEqual:
+            out << "    nativeCompare" << args << "(stack);\n";
+            break;
+        case OpcodeDef::Not:
+            out << "    nativeNot<" << verified << ">(stack);\n";
+            break;
+        case OpcodeDef::Add:
+        case OpcodeDef::Sub:
+        case OpcodeDef::Mult:
+        case OpcodeDef::Div:
+        case OpcodeDef::Mod:
+            out << "    nativeArithmetic" << args << "(stack);\n";
+            break;
+
+        case OpcodeDef::Jump:
+            computedJumps = true;
+            out << "    IP = " << function.position << "u + nativeJumpTarget<" << verified << ">(stack);\n";
+            out << "    goto enter;\n";
+            break;
+        case OpcodeDef::JumpZero:
+        case OpcodeDef::JumpNotZero:
+            computedJumps = true;
+            out << "    IP = " << function.position << "u + nativeJumpTarget<" << verified << ">(stack);\n";
+            out << "    if (" << (op.opcode == OpcodeDef::JumpZero ? "!" : "") << pop() << ".isTrue()) goto enter;\n";
+            break;
+        case OpcodeDef::CompareJumpZero:
+        case OpcodeDef::CompareJumpNotZero:
+            out << "    if (" << (op.opcode == OpcodeDef::CompareJumpZero ? "!" : "")
+                << "nativeCompareJump<" << op.aux << ", " << verified << ">(stack)) "
+                << goToOffset(op.operand.value) << '\n';
+            break;
+
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+            out << "    nativeLocalArithmetic" << args << "(stack, " << local << ");\n";
+            break;
+        case OpcodeDef::IncLocal:
+            out << "    nativeIncLocal(stack, " << local << ", " << intLiteral(op.aux) << ");\n";
+            break;
+        case OpcodeDef::StoreLocal:
+            out << "    stack.localAt(" << local << ") = " << pop() << ";\n";
+            break;
+        case OpcodeDef::LoadLocal:
+            out << "    stack.push(Value(stack.localAt(" << local << ")));\n";
+            break;
+
+        default:
+            execute = true;
+            out << "    if (nativeExecute(data, " << op.opcode << ", " << op.nextIP
+                << ", result)) return result;\n";
+    }
+}
+
+void FunctionWriter::write(std::ostream &out) {
+    std::stringstream body;
+    for (unsigned i = 0; i < ops.size(); ++i) {
+        body << "op_" << i << ":\n";
+        writeOp(body, i);
+    }
+    // running past the end of the function
+    const unsigned end = ops.empty() ? function.position : ops.back().nextIP;
+    body << "    nativeBadPosition(" << end << ");\n";
+
+    out << "\n// ";
+    if (function.srcName >= 0) out << data.getString(function.srcName).text();
+    else                       out << "(no debug info)";
+    out << " #" << id;
+    if (function.srcFile >= 0) {
+        out << " (" << data.getString(function.srcFile).text();
+        if (function.srcLine >= 0) out << ':' << function.srcLine;
+        out << ')';
+    }
+    out << "\nstatic NativeResult function_" << id << "(GameData &data, unsigned IP) {\n";
+    out << "    gtCallStack &stack = data.callStack;\n";
+    if (calls) out << "    const int depth = stack.size();\n";
+    if (calls || execute) out << "    NativeResult result;\n";
+    if (computedJumps) out << "enter:\n";
+    out << "    switch(IP) {\n";
+    for (unsigned i = 0; i < ops.size(); ++i) {
+        const unsigned IP = i == 0 ? function.position : ops[i - 1].nextIP;
+        out << "        case " << IP << ": goto op_" << i << ";\n";
+    }
+    out << "        default: nativeBadPosition(IP);\n";
+    out << "    }\n";
+    out << body.str();
+    out << "}\n";
+}
+
+static void writeGame(GameData &data, const std::string &gameFile, std::ostream &out) {
+    out << "// Generated by compile from " << gameFile << ". Link against the QuollVM\n";
+    out << "// runtime library; the game file is still needed to run it.\n";
+    out << "#include \"native.h\"\n";
+    for (const auto &def : data.functions) {
+        FunctionWriter(data, def.first, def.second).write(out);
+    }
+
+    out << "\nstatic const NativeFunction functions[] = {\n";
+    for (const auto &def : data.functions) {
+        const FunctionDef &function = def.second;
+        out << "    { " << def.first << ", " << function.position << ", " << function.end
+            << ", function_" << def.first << " },\n";
+    }
+    out << "};\n\n";
+    out << "int main(int argc, char *argv[]) {\n";
+    out << "    return nativeMain(argc, argv, functions,\n";
+    out << "                      sizeof(functions) / sizeof(functions[0]), "
+        << data.bytecode.checksum() << "u,\n";
+    out << "                      " << stringLiteral(gameFile) << ");\n";
+    out << "}\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string gameFile;
+    std::string outputFile = "game.cpp";
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0) {
+            std::cerr << "USAGE: ./compile [options] [game file]\n";
+            std::cerr << "    -o (filename)  Write the C++ source to filename.\n";
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            ++i;
+            if (i >= argc) {
+                std::cerr << "-o requires a filename.\n";
+                return 1;
+            }
+            outputFile = argv[i];
+        } else if (argv[i][0] == '-') {
+            std::cerr << "Unrecognized option " << argv[i] << ".\n";
+            return 1;
+        } else if (gameFile.empty()) {
+            gameFile = argv[i];
+        } else {
+            std::cerr << "Only one game file may be specified.\n";
+            return 1;
+        }
+    }
+    if (gameFile.empty()) gameFile = "game.rvm";
+
+    GameData data;
+    data.load(gameFile);
+    if (!data.gameLoaded) return 1;
+    if (data.image->functions.empty()) {
+        std::cerr << gameFile << " has no functions.\n";
+        return 1;
+    }
+    data.decodeFunctions();
+
+    std::ofstream out(outputFile);
+    if (!out) {
+        std::cerr << "Could not open " << outputFile << " for writing.\n";
+        return 1;
+    }
+    writeGame(data, gameFile, out);
+    return 0;
+}
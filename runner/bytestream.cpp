@@ -4,72 +4,98 @@
 
 #include "bytestream.h"
 
+void ByteStream::view(const uint8_t *bytes, unsigned size) {
+    data.clear();
+    mBytes = bytes;
+    mSize = size;
+}
+
+void ByteStream::own() {
+    if (mBytes != data.data()) data.assign(mBytes, mBytes + mSize);
+}
+
 void ByteStream::add_8(uint8_t value) {
+    own();
     data.push_back(value);
+    update();
 }
 
 void ByteStream::add_16(uint16_t value) {
+    own();
     data.push_back(value & 0xFF);
     data.push_back((value >> 8) & 0xFF);
+    update();
 }
 
 void ByteStream::add_32(uint32_t value) {
+    own();
     data.push_back(value & 0xFF);
     data.push_back((value >> 8) & 0xFF);
     data.push_back((value >> 16) & 0xFF);
     data.push_back((value >> 24) & 0xFF);
+    update();
 }
 
 void ByteStream::append(const ByteStream &other) {
-    data.insert(data.end(), other.data.begin(), other.data.end());
+    own();
+    data.insert(data.end(), other.mBytes, other.mBytes + other.mSize);
+    update();
 }
 
 void ByteStream::padTo(unsigned toMultiple) {
     if (toMultiple == 0) return;
+    own();
     while (data.size() == 0 || data.size() % toMultiple != 0) {
         data.push_back(0);
     }
+    update();
 }
 
 uint8_t ByteStream::read_8(unsigned where) const {
-    if (where > data.size()) return 0;
-    return data[where];
+    if (where >= mSize) return 0;
+    return mBytes[where];
 }
 
 uint16_t ByteStream::read_16(unsigned where) const {
-    if (where + 1 > data.size()) return 0;
+    if (where + 2 > mSize) return 0;
     uint32_t value = 0;
-    value |= data[where];
+    value |= mBytes[where];
     ++where;
-    value |= data[where] << 8;
+    value |= mBytes[where] << 8;
     return value;
 }
 
 uint32_t ByteStream::read_32(unsigned where) const {
-    if (where + 3 > data.size()) return 0;
+    if (where + 4 > mSize) return 0;
     uint32_t value = 0;
-    value |= data[where];
+    value |= mBytes[where];
     ++where;
-    value |= data[where] << 8;
+    value |= mBytes[where] << 8;
     ++where;
-    value |= data[where] << 16;
+    value |= mBytes[where] << 16;
     ++where;
-    value |= data[where] << 24;
+    value |= mBytes[where] << 24;
     return value;
 }
 
 void ByteStream::overwrite_8(unsigned where, uint32_t value) {
+    own();
+    update();
     if (where >= data.size()) return;
     data[where] = value;
 }
 
 void ByteStream::overwrite_16(unsigned where, uint32_t value) {
+    own();
+    update();
     if (where + 1 >= data.size()) return;
     data[where]     = value & 0xFF;
     data[where + 1] = (value >> 8) & 0xFF;
 }
 
 void ByteStream::overwrite_32(unsigned where, uint32_t value) {
+    own();
+    update();
     if (where + 3 >= data.size()) return;
     data[where]     = value & 0xFF;
     data[where + 1] = (value >> 8) & 0xFF;
@@ -78,18 +104,29 @@ void ByteStream::overwrite_32(unsigned where, uint32_t value) {
 }
 
 unsigned ByteStream::size() const {
-    return static_cast<unsigned>(data.size());
+    return mSize;
+}
+
+// A 32-bit FNV-1a hash of the bytes, for telling whether two streams hold the
+// same bytes.
+uint32_t ByteStream::checksum() const {
+    uint32_t hash = 2166136261u;
+    for (unsigned i = 0; i < mSize; ++i) {
+        hash ^= mBytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
 void ByteStream::write(std::ostream &out) const {
-    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    out.write(reinterpret_cast<const char*>(mBytes), mSize);
 }
 
 void ByteStream::dump(std::ostream &out, int indentSize) const {
     char oldFill = out.fill();
     out.fill('0');
     out << std::hex;
-    for (unsigned i = 0; i < data.size(); ++i) {
+    for (unsigned i = 0; i < mSize; ++i) {
         if (i % 16 == 0) {
             out << '\n';
             for (int i = 0; i < indentSize; ++i) out << ' ';
@@ -97,7 +134,7 @@ void ByteStream::dump(std::ostream &out, int indentSize) const {
         } else if (i % 8 == 0) {
             out << "  ";
         }
-        out << ' ' << std::setw(2) << static_cast<int>(data[i]);
+        out << ' ' << std::setw(2) << static_cast<int>(mBytes[i]);
     }
     out << '\n' << std::dec;
     out.fill(oldFill);
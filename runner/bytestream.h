@@ -5,8 +5,18 @@
 #include <iosfwd>
 #include <vector>
 
+// Bytes are either held by the stream itself or viewed in place in memory
+// owned by something else (such as a mapped gamefile); writing to a stream
+// that is viewing memory copies the bytes first.
 class ByteStream {
 public:
+    ByteStream()
+    : mBytes(nullptr), mSize(0)
+    { }
+    ByteStream(const ByteStream&) = delete;
+    ByteStream& operator=(const ByteStream&) = delete;
+
+    void view(const uint8_t *bytes, unsigned size);
     void add_8(uint8_t value);
     void add_16(uint16_t value);
     void add_32(uint32_t value);
@@ -19,11 +29,23 @@ public:
     void overwrite_16(unsigned where, uint32_t value);
     void overwrite_32(unsigned where, uint32_t value);
     unsigned size() const;
+    uint32_t checksum() const;
+    const uint8_t* bytes() const {
+        return mBytes;
+    }
     void write(std::ostream &out) const;
 
     void dump(std::ostream &out, int indentSize = 0) const;
 private:
+    void own();
+    void update() {
+        mBytes = data.data();
+        mSize = static_cast<unsigned>(data.size());
+    }
+
     std::vector<uint8_t> data;
+    const uint8_t *mBytes;
+    unsigned mSize;
 };
 
 #endif
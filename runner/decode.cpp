@@ -0,0 +1,93 @@
+#include <vector>
+
+#include "gamedata.h"
+#include "opcode.h"
+
+static void decodeCode(const ByteStream &bytecode, FunctionDef &function,
+                       unsigned start, unsigned end) {
+    DecodedCode &code = function.decoded;
+    code.ops.clear();
+    code.index.assign(end - start, -1);
+
+    unsigned IP = start;
+    while (IP < end) {
+        code.index[IP - start] = code.ops.size();
+        DecodedOp op{nullptr, bytecode.read_8(IP), Value(), 0, 0, 0};
+        ++IP;
+
+        switch(op.opcode) {
+            case OpcodeDef::PushNone:
+                op.opcode = OpcodeDef::Push32;
+                break;
+            case OpcodeDef::Push0:
+            case OpcodeDef::Push1:
+                op.operand.type = static_cast<Value::Type>(bytecode.read_8(IP));
+                op.operand.value = op.opcode == OpcodeDef::Push1 ? 1 : 0;
+                op.opcode = OpcodeDef::Push32;
+                ++IP;
+                break;
+            case OpcodeDef::Push8: {
+                op.operand.type = static_cast<Value::Type>(bytecode.read_8(IP));
+                int value = bytecode.read_8(IP + 1);
+                if (value & 0x80) value |= 0xFFFFFF00;
+                op.operand.value = value;
+                op.opcode = OpcodeDef::Push32;
+                IP += 2;
+                break; }
+            case OpcodeDef::Push16: {
+                op.operand.type = static_cast<Value::Type>(bytecode.read_8(IP));
+                int value = bytecode.read_16(IP + 1);
+                if (value & 0x8000) value |= 0xFFFF0000;
+                op.operand.value = value;
+                op.opcode = OpcodeDef::Push32;
+                IP += 3;
+                break; }
+            case OpcodeDef::Push32:
+                op.operand.type = static_cast<Value::Type>(bytecode.read_8(IP));
+                op.operand.value = bytecode.read_32(IP + 1);
+                IP += 5;
+                break;
+
+            case OpcodeDef::AddLocal:
+            case OpcodeDef::SubLocal:
+            case OpcodeDef::StoreLocal:
+            case OpcodeDef::LoadLocal:
+                op.operand.value = bytecode.read_16(IP);
+                IP += 2;
+                break;
+            case OpcodeDef::CompareJumpZero:
+            case OpcodeDef::CompareJumpNotZero:
+                op.aux = bytecode.read_8(IP);
+                op.operand.type = Value::JumpTarget;
+                op.operand.value = bytecode.read_32(IP + 1);
+                IP += 5;
+                break;
+            case OpcodeDef::IncLocal:
+                op.operand.value = bytecode.read_16(IP);
+                op.aux = bytecode.read_32(IP + 2);
+                IP += 6;
+                break;
+        }
+
+        op.nextIP = IP;
+        code.ops.push_back(op);
+    }
+}
+
+// Translate the bytecode of a function into its pre-decoded form. The
+// bytecode has already been checked by verifyFunctions.
+void GameData::decodeFunction(FunctionDef &function) {
+    if (function.position >= function.end) {
+        function.decoded.ops.clear();
+        function.decoded.index.clear();
+    } else {
+        decodeCode(bytecode, function, function.position, function.end);
+    }
+    function.isDecoded = true;
+}
+
+// Decode every function of the game, not just those the session has used.
+void GameData::decodeFunctions() {
+    for (const auto &def : image->functions) findFunction(def.first);
+    for (auto &def : functions) decodeFunction(def.second);
+}
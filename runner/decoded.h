@@ -0,0 +1,57 @@
+#ifndef DECODED_H_8351920
+#define DECODED_H_8351920
+
+#include <vector>
+#include "value.h"
+
+// A single instruction translated from the gamefile bytecode. All forms of
+// push are collapsed into Push32 with their operand already widened, so the
+// decoded engine never touches the raw bytecode while running. Superinstructions
+// keep their local number or jump target in the operand and their second
+// immediate, if any, in aux. The handler and opcode may be rewritten while the
+// engine runs, replacing the instruction with a form specialised for the types
+// of the operands it has seen ("quickening").
+struct DecodedOp {
+    mutable const void *handler;    // dispatch target used by the direct-threaded engine
+    mutable int opcode;
+    Value operand;
+    int aux;
+    unsigned nextIP;                // bytecode position of the following instruction
+    mutable unsigned deopts;        // times a specialised form has been abandoned
+};
+
+// The specialised forms that instructions are quickened into. They are
+// numbered beyond the bytecode opcodes so they can share the same switch.
+struct QuickOpcode {
+    enum {
+        AddInt = 0x100,
+        SubInt,
+        MultInt,
+        EqualInt,
+        NotEqualInt,
+        LessThanInt,
+        LessThanEqualInt,
+        GreaterThanInt,
+        GreaterThanEqualInt,
+        EqualIdent,             // same type, compared by identity
+        NotEqualIdent,
+        CompareJumpZeroInt,
+        CompareJumpNotZeroInt,
+        AddLocalInt,
+        SubLocalInt,
+        GetProperty,
+    };
+};
+
+// An instruction is no longer quickened once it has been deoptimised this many
+// times, so one whose operand types keep changing stays generic.
+const unsigned QUICKEN_LIMIT = 4;
+
+struct DecodedCode {
+    std::vector<DecodedOp> ops;
+    // maps a bytecode offset (relative to the start of the function) to the
+    // index of the instruction starting there, or -1 if none does
+    std::vector<int> index;
+};
+
+#endif
@@ -18,57 +18,47 @@ void dump_string(const std::string &text) {
 
 void GameData::dump() const {
     std::cout << "\n## Strings\n";
-    for (const auto &def : strings) {
-        std::cout << '[' << def.first << ((def.second && def.second->isStatic) ? 's' : ' ') << "] ~";
-        if (def.second)     dump_string(def.second->text);
-        else                std::cout << "(nullptr)";
+    for (const StringDef *def : strings) {
+        std::cout << '[' << def->ident << (def->isStatic ? 's' : ' ') << "] ~";
+        dump_string(def->text());
         std::cout << "~\n";
     }
 
     std::cout << "\n## Lists\n";
-    for (const auto &def : lists) {
-        std::cout << '[' << def.first << ((def.second && def.second->isStatic) ? 's' : ' ') << "] {";
-        if (!def.second) {
-            std::cout << "(nullptr)";
-        } else {
-            for (const Value &value : def.second->items) {
-                std::cout << ' ' << value;
-            }
+    for (const ListDef *def : lists) {
+        std::cout << '[' << def->ident << (def->isStatic ? 's' : ' ') << "] {";
+        for (const Value &value : def->items) {
+            std::cout << ' ' << value;
         }
         std::cout << " }\n";
     }
 
     std::cout << "\n## Maps\n";
-    for (const auto &def : maps) {
-        std::cout << '[' << def.first << ((def.second && def.second->isStatic) ? 's' : ' ') << "] {";
-        if (!def.second) {
-            std::cout << "(nullptr)";
-        } else {
-            for (const MapDef::Row &row : def.second->rows) {
-                std::cout << " (" << row.key << ", " << row.value << ")";
-            }
+    for (const MapDef *def : maps) {
+        std::cout << '[' << def->ident << (def->isStatic ? 's' : ' ') << "] {";
+        for (const MapDef::Row &row : def->rows) {
+            if (row.deleted) continue;
+            std::cout << " (" << row.key << ", " << row.value << ")";
         }
         std::cout << " }\n";
     }
 
     std::cout << "\n## Objects\n";
-    for (const auto &def : objects) {
-        std::cout << '[' << def.first << ((def.second && def.second->isStatic) ? 's' : ' ') << "] {";
-        if (!def.second) {
-            std::cout << "(nullptr)";
-        } else {
-            for (const auto &property : def.second->properties) {
-                std::cout << " (" << property.first << ", " << property.second << ")";
-            }
+    for (const ObjectDef *def : objects) {
+        std::cout << '[' << def->ident << (def->isStatic ? 's' : ' ') << "] {";
+        for (const auto &property : def->properties) {
+            std::cout << " (" << property.first << ", " << property.second << ")";
         }
         std::cout << " }\n";
     }
 
     std::cout << "\n## Function Headers\n";
-    for (const auto &def : functions) {
+    for (const auto &def : image->functions) {
         std::cout << '[' << def.first << "] args: ";
         std::cout << def.second.arg_count << " locals: ";
         std::cout << def.second.local_count << " position: ";
-        std::cout << def.second.position << "\n";
+        std::cout << def.second.position;
+        if (def.second.verified) std::cout << " verified";
+        std::cout << "\n";
     }
 }
@@ -122,7 +122,7 @@ bool GameData::saveFileList(const FileList &files) {
         write32(out, file.fileId);
         writeString(out, file.name);
         write32(out, file.date);
-        writeString(out, getString(refGameid).text);
+        writeString(out, getString(refGameid).text());
     }
     return true;
 }
@@ -148,7 +148,7 @@ Value GameData::getFile(const std::string &fileName) {
     if (newListId.type != Value::List) {
         throw GameError("Failed to create list for new file.");
     }
-    ListDef &newList = getList(newListId.value);
+    ListDef &newList = editList(newListId.value);
     std::stringstream realFilename;
     realFilename << "rat" << std::setfill('0') << std::setw(5) << file.fileId << ".fil";
     std::ifstream inf(getRealPath(realFilename.str()));
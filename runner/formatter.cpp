@@ -1,6 +1,5 @@
-#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <cctype>
 #include <string>
 #include <vector>
 
@@ -9,307 +8,265 @@
 
 
 struct TagInfo {
-    std::string name;
+    const char *name;
     bool hasContent;
     bool topLevel;
     bool hasAttributes;
+    const char *code;
 };
 
-struct TextToken {
-    enum Type { Text, Tag, EndTag, Paragraph, End };
-    Type type;
-    std::string text;
+TagInfo tags[] = {
+    { "b",      true,   false,  false,  "\x1b[1m" },
+    { "br",     false,  false,  false,  "" },
+    { "hr",     false,  true,   false,  "" },
+    { "i",      true,   false,  false,  "\x1b[4m" },
+    { "color",  true,   false,  true,   "" },
 };
 
-struct TextNode {
-    ~TextNode() {
-        for (TextNode *n : children) delete n;
-    }
-
-    enum Type { Root, Text, Tag, Paragraph };
-    Type type;
-    std::string text;
-    const TagInfo *tagInfo;
-    std::vector<std::string> attributes;
-    std::vector<TextNode*> children;
+struct ColorInfo {
+    const char *name;
+    const char *code;
+};
 
-    void add(TextNode *node) {
-        if (node) children.push_back(node);
-    }
-    void addParagraph() {
-        if (children.empty()) return;
-        if (children.back()->type == TextNode::Paragraph) return;
-        TextNode *text = new TextNode;
-        text->type = TextNode::Paragraph;
-        children.push_back(text);
-    }
+ColorInfo colors[] = {
+    { "red",        "\x1b[31m" },
+    { "green",      "\x1b[32m" },
+    { "yellow",     "\x1b[33m" },
+    { "blue",       "\x1b[34m" },
+    { "magenta",    "\x1b[35m" },
+    { "cyan",       "\x1b[36m" },
+    { "default",    "\x1b[37m" },
 };
 
-struct TextBuildState {
-    const std::vector<TextToken> &tokens;
-    std::vector<TextToken>::size_type pos;
+const char *RESET_CODE = "\x1b[0m";
+const char *HORIZONTAL_RULE = "--------------------------------------------------";
 
-    static const TextToken endToken;
-    bool end() const {
-        return pos >= tokens.size();
-    }
-    const TextToken&  here() const {
-        if (end()) return endToken;
-        return tokens[pos];
-    }
-    void advance() {
-        if (!end()) ++pos;
-    }
-};
-const TextToken TextBuildState::endToken{TextToken::End};
+// the most words in a tag that are kept track of; any more are only counted
+const unsigned MAX_TAG_WORDS = 3;
 
-struct TextParseState {
-    const std::string &text;
-    std::string::size_type pos;
+struct Word {
+    const char *start;
+    std::size_t length;
 
-    bool end() const {
-        return pos >= text.size();
+    bool operator==(const char *text) const {
+        return std::strlen(text) == length && std::memcmp(start, text, length) == 0;
     }
-    char here() const {
-        if (end()) return 0;
-        return text[pos];
+    std::string str() const {
+        return std::string(start, length);
     }
-    void advance() {
-        if (!end()) ++pos;
-    }
-};
-
-
-static std::vector<TextToken> parseSourceText(const std::string &text, ParseResult &results);
-static TextNode* buildParseTree(const std::vector<TextToken> &tokens, ParseResult &results);
-static std::string formatAsText(TextNode *n, ParseResult &results, std::vector<std::string> &formats);
-
-
-TagInfo tags[] = {
-    { "b",      true,   false,  false },
-    { "br",     false,  false,  false },
-    { "hr",     false,  true,   false  },
-    { "i",      true,   false,  false },
-    { "color",  true,   false,  true },
 };
-TagInfo badTag = { "", false };
 
+// Split a tag into whitespace separated words in place. Returns the total
+// number of words, of which up to MAX_TAG_WORDS are stored.
+static unsigned splitTag(const char *start, const char *end, Word *words) {
+    unsigned count = 0;
+    const char *here = start;
+    while (here < end) {
+        while (here < end && c_isspace(*here)) ++here;
+        if (here >= end) break;
+        const char *wordStart = here;
+        while (here < end && !c_isspace(*here)) ++here;
+        if (count < MAX_TAG_WORDS) words[count] = Word{wordStart, static_cast<std::size_t>(here - wordStart)};
+        ++count;
+    }
+    return count;
+}
 
-const TagInfo &getTagInfo(const std::string &tag) {
+static const TagInfo* getTagInfo(const Word &name) {
     for (const TagInfo &t : tags) {
-        if (t.name == tag) return t;
+        if (name == t.name) return &t;
     }
-    return badTag;
+    return nullptr;
 }
 
 
+TextFormatter::TextFormatter(std::ostream &out)
+: mStream(&out), mOut(mBuffer) {
+    reset();
+}
 
-std::vector<TextToken> parseSourceText(const std::string &text, ParseResult &results) {
-    TextParseState state{text};
-    std::vector<TextToken> nodes;
-    if (state.end()) return nodes;
+TextFormatter::TextFormatter(std::string &out)
+: mStream(nullptr), mOut(out) {
+    reset();
+}
 
-    while (!state.end()) {
-        if (state.here() == '[') {
-            state.advance();
-            std::string::size_type start = state.pos;
-            while (!state.end() &&  state.here() != ']') {
-                state.advance();
+void TextFormatter::write(const std::string &text) {
+    const char *here = text.c_str();
+    const char *end = here + text.size();
+    while (here < end) {
+        if (mInTag) {
+            const char *close = static_cast<const char*>(std::memchr(here, ']', end - here));
+            if (!close) {
+                mPartialTag.append(here, end);
+                break;
             }
-            std::string::size_type end = state.pos;
-            state.advance();
-            TextToken node;
-            node.text = state.text.substr(start, end - start);
-            if (node.text[0] == '/')    node.type = TextToken::EndTag;
-            else                        node.type = TextToken::Tag;
-            nodes.push_back(node);
-        } else if (state.here() == '\n') {
-            state.advance();
-            nodes.push_back(TextToken{TextToken::Paragraph});
-        } else {
-            std::string::size_type start = state.pos;
-            while (!state.end() && state.here() != '\n' && state.here() != '[') {
-                state.advance();
+            mInTag = false;
+            if (mPartialTag.empty()) {
+                tag(here, close);
+            } else {
+                mPartialTag.append(here, close);
+                tag(mPartialTag.c_str(), mPartialTag.c_str() + mPartialTag.size());
+                mPartialTag.clear();
             }
-            std::string::size_type end = state.pos;
-            TextToken node;
-            node.text = state.text.substr(start, end - start);
-            for (char &c : node.text) {
-                if (c == '\t') c = ' ';
-                if (c == '\r') c = '\n';
+            here = close + 1;
+        } else {
+            const char *stop = here;
+            while (stop < end && *stop != '[' && *stop != '\n') ++stop;
+            this->text(here, stop);
+            if (stop < end) {
+                if (*stop == '[')   mInTag = true;
+                else                paragraph();
             }
-            node.type = TextToken::Text;
-            nodes.push_back(node);
+            here = stop + 1;
         }
     }
+    flush();
+}
 
-    return nodes;
-};
+ParseResult TextFormatter::finish() {
+    // an unterminated tag runs to the end of the text
+    if (mInTag) {
+        mInTag = false;
+        tag(mPartialTag.c_str(), mPartialTag.c_str() + mPartialTag.size());
+        mPartialTag.clear();
+    }
+    for (unsigned i = 1; i <= mDepth; ++i) {
+        mResults.addError(std::string("Tag ") + mLevels[i].tag->name + " not closed.");
+    }
+    // tags left open are closed so their styling doesn't carry into later text
+    if (mDepth > 0) mOut += RESET_CODE;
+    // paragraph breaks at the very end of the text are dropped
+    reset();
+    flush();
 
+    ParseResult results;
+    std::swap(results, mResults);
+    return results;
+}
 
-TextNode* buildParseTree(const std::vector<TextToken> &tokens, ParseResult &results) {
-    TextBuildState state{tokens};
-    TextNode *root = new TextNode;
-    root->type = TextNode::Root;
-
-    std::vector<TextNode*> parent;
-    parent.push_back(root);
-    std::vector<TextNode*> tags;
-
-    while (!state.end()) {
-        if (state.here().type == TextToken::Text) {
-            TextNode *text = new TextNode;
-            text->type = TextNode::Text;
-            text->text = state.here().text;
-            parent.back()->add(text);
-        } else if (state.here().type == TextToken::Paragraph) {
-            if (!tags.empty()) results.addError("Paragraph break may only occur at top level.");
-            parent.back()->addParagraph();
-        } else if (state.here().type == TextToken::Tag) {
-            auto parts = explodeString(state.here().text);
-            if (!parts.empty()) {
-                const TagInfo &tag = getTagInfo(parts[0]);
-                if (!tag.name.empty()) {
-                    if (tag.topLevel) {
-                        if (!tags.empty()) {
-                            results.addError("Tag " + tag.name + " may only occur at top level.");
-                        }
-                        parent.back()->addParagraph();
-                    }
-
-                    TextNode *tagNode = new TextNode;
-                    tagNode->type = TextNode::Tag;
-                    tagNode->text = tag.name;
-                    if (parts.size() > 1) {
-                        if (tag.hasAttributes) {
-                            parts.erase(parts.begin());
-                            tagNode->attributes = parts;
-                        } else {
-                            results.addError("Tag " + tag.name + " does not take attributes.");
-                        }
-                    }
-                    parent.back()->add(tagNode);
-                    tagNode->tagInfo = &tag;
-
-                    if (tag.topLevel) {
-                        parent.back()->addParagraph();
-                    }
-
-                    if (tag.hasContent) {
-                        tags.push_back(tagNode);
-                        parent.push_back(tagNode);
-                    }
-                } else {
-                    results.addError("Unknown tag " + parts[0] + ".");
-                }
-            } else {
-                results.addError("Empty tag name.");
-            }
-        } else if (state.here().type == TextToken::EndTag) {
-            if (tags.empty()) results.addError("Closing tag with no opened tags.");
-            else {
-                std::string tagName = state.here().text.substr(1);
-                if (tagName != tags.back()->text) {
-                    results.addError("Closing tag " + tagName + " does not match opening tag " + tags.back()->text + ".");
-                } else {
-                    parent.pop_back();
-                    tags.pop_back();
-                }
+void TextFormatter::text(const char *start, const char *end) {
+    if (start >= end) return;
+    addNode();
+    std::string::size_type first = mOut.size();
+    mOut.append(start, end);
+    for (std::string::size_type i = first; i < mOut.size(); ++i) {
+        if (mOut[i] == '\t') mOut[i] = ' ';
+        else if (mOut[i] == '\r') mOut[i] = '\n';
+    }
+}
+
+void TextFormatter::tag(const char *start, const char *end) {
+    if (start < end && *start == '/') {
+        endTag(start + 1, end);
+        return;
+    }
+
+    Word words[MAX_TAG_WORDS];
+    unsigned wordCount = splitTag(start, end, words);
+    if (wordCount == 0) {
+        mResults.addError("Empty tag name.");
+        return;
+    }
+    const TagInfo *tag = getTagInfo(words[0]);
+    if (!tag) {
+        mResults.addError("Unknown tag " + words[0].str() + ".");
+        return;
+    }
+
+    if (tag->topLevel) {
+        if (mDepth > 0) {
+            mResults.addError(std::string("Tag ") + tag->name + " may only occur at top level.");
+        }
+        addParagraph();
+    }
+    if (wordCount > 1 && !tag->hasAttributes) {
+        mResults.addError(std::string("Tag ") + tag->name + " does not take attributes.");
+    }
+    addNode();
+
+    const char *code = tag->code;
+    if (std::strcmp(tag->name, "br") == 0) mOut += '\n';
+    if (std::strcmp(tag->name, "hr") == 0) mOut += HORIZONTAL_RULE;
+    if (std::strcmp(tag->name, "color") == 0) {
+        if (wordCount < 2) mResults.addError("Color tag requires name of color.");
+        else if (wordCount > 2) mResults.addError("Too many arguments to color tag.");
+        else {
+            for (const ColorInfo &color : colors) {
+                if (words[1] == color.name) code = color.code;
             }
+            if (!*code) mResults.addError("Unrecognized colour name " + words[1].str() + ".");
         }
-        state.advance();
     }
+    mOut += code;
 
-    if (!tags.empty()) {
-        for (const TextNode *tag : tags) {
-            results.addError("Tag " + tag->text + " not closed.");
+    if (tag->topLevel) addParagraph();
+    if (tag->hasContent) {
+        if (mDepth >= MAX_TAG_DEPTH) {
+            mResults.addError("Tags nested too deeply.");
+        } else {
+            mLevels[++mDepth] = Level{tag, code, false, false};
         }
     }
-    return root;
 }
 
-void applyFormats(std::string &text, std::vector<std::string> &formats) {
-    for (const std::string s : formats) text += s;
+void TextFormatter::endTag(const char *start, const char *end) {
+    if (mDepth == 0) {
+        mResults.addError("Closing tag with no opened tags.");
+        return;
+    }
+    Word name{start, static_cast<std::size_t>(end - start)};
+    if (!(name == mLevels[mDepth].tag->name)) {
+        mResults.addError("Closing tag " + name.str() + " does not match opening tag "
+                          + mLevels[mDepth].tag->name + ".");
+        return;
+    }
+    if (mLevels[mDepth].pendingParagraph) mOut += "\n\n";
+    --mDepth;
+
+    // reset the styling, then reapply that of the tags still open
+    mOut += RESET_CODE;
+    for (unsigned i = 1; i <= mDepth; ++i) mOut += mLevels[i].code;
 }
 
-std::string formatAsText(TextNode *n, ParseResult &results, std::vector<std::string> &formats) {
-    std::string result;
-    if (!n) {
-        results.addError("Null parse tree.");
-        return "";
-    }
+void TextFormatter::paragraph() {
+    if (mDepth > 0) mResults.addError("Paragraph break may only occur at top level.");
+    addParagraph();
+}
 
-    switch(n->type) {
-        case TextNode::Root:
-            if (n->children.empty()) break;
-            while (n->children.back()->type == TextNode::Paragraph) {
-                n->children.erase(n->children.end() - 1);
-            }
-            break;
-        case TextNode::Paragraph:
-            result += "\n\n";
-            break;
-        case TextNode::Text:
-            result += n->text;
-            break;
-        case TextNode::Tag:
-            if (n->text == "br") result += "\n";
-            if (n->text == "hr") result += "--------------------------------------------------";
-            if (n->text == "b") {
-                const std::string code = "\x1b[1m";
-                formats.push_back(code);
-                result += code;
-            }
-            if (n->text == "i") {
-                const std::string code = "\x1b[4m";
-                formats.push_back(code);
-                result += code;
-            }
-            if (n->text == "color") {
-                if (n->attributes.empty()) results.addError("Color tag requires name of color.");
-                else if (n->attributes.size() > 1) results.addError("Too many arguments to color tag.");
-                else {
-                    std::string code;
-                    if (n->attributes[0] == "red") code = "\x1b[31m";
-                    else if (n->attributes[0] == "green") code = "\x1b[32m";
-                    else if (n->attributes[0] == "yellow") code = "\x1b[33m";
-                    else if (n->attributes[0] == "blue") code = "\x1b[34m";
-                    else if (n->attributes[0] == "magenta") code = "\x1b[35m";
-                    else if (n->attributes[0] == "cyan") code = "\x1b[36m";
-                    else if (n->attributes[0] == "default") code = "\x1b[37m";
-                    else results.addError("Unrecognized colour name " + n->attributes[0] + ".");
-                    formats.push_back(code);
-                    result += code;
-                }
-            }
-            break;
-    }
+// Paragraph breaks are only written once something follows them, so any
+// number of breaks in a row produce a single one and breaks before anything
+// else in the same tag are ignored.
+void TextFormatter::addParagraph() {
+    Level &level = mLevels[mDepth];
+    if (level.hasContent) level.pendingParagraph = true;
+}
 
-    for (TextNode *c : n->children) {
-        result += formatAsText(c, results, formats);
+void TextFormatter::addNode() {
+    Level &level = mLevels[mDepth];
+    if (level.pendingParagraph) {
+        mOut += "\n\n";
+        level.pendingParagraph = false;
     }
+    level.hasContent = true;
+}
 
-    if (n->type == TextNode::Tag) {
-        if (n->text == "b" || n->text == "i" || n->text == "color") {
-            result += "\x1b[0m";
-            formats.pop_back();
-            applyFormats(result, formats);
-        }
-    }
+void TextFormatter::reset() {
+    mDepth = 0;
+    mLevels[0] = Level{nullptr, "", false, false};
+    mInTag = false;
+}
 
-    return result;
+void TextFormatter::flush() {
+    if (!mStream || mBuffer.empty()) return;
+    mStream->write(mBuffer.data(), mBuffer.size());
+    mBuffer.clear();
 }
 
+
 ParseResult formatText(const std::string &text) {
     ParseResult results;
-    auto nodes = parseSourceText(text, results);
-    TextNode *root = buildParseTree(nodes, results);
-    if (!root) {
-        results.addError("Failed to build parse tree.");
-        return results;
-    }
-    std::vector<std::string> formats;
-    results.finalResult = formatAsText(root, results, formats);
-    delete root;
+    TextFormatter formatter(results.finalResult);
+    formatter.write(text);
+    results.errors = formatter.finish().errors;
     return results;
-}
\ No newline at end of file
+}
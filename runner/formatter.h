@@ -1,9 +1,12 @@
 #ifndef FORMATTER_H
 #define FORMATTER_H
 
+#include <iosfwd>
 #include <string>
 #include <vector>
 
+struct TagInfo;
+
 struct ParseResult {
     std::vector<std::string> errors;
     std::string finalResult;
@@ -13,6 +16,55 @@ struct ParseResult {
     }
 };
 
+// Receives the text a game says as it is produced.
+class OutputSink {
+public:
+    virtual ~OutputSink() { }
+    virtual void write(const std::string &text) = 0;
+};
+
+// The deepest tags may be nested.
+const unsigned MAX_TAG_DEPTH = 32;
+
+// Formats text as it arrives, replacing the markup with terminal escape codes.
+// Output is appended to a string, or collected and written to a stream after
+// each write. Only an unfinished tag is ever held back; call finish at the end
+// of each turn to complete the text and collect any errors. Once its buffers
+// have grown, formatting text without errors doesn't allocate.
+class TextFormatter : public OutputSink {
+public:
+    TextFormatter(std::ostream &out);
+    TextFormatter(std::string &out);
+
+    void write(const std::string &text) override;
+    ParseResult finish();
+private:
+    struct Level {
+        const TagInfo *tag;     // nullptr for the top level
+        const char *code;       // escape code applied by the tag
+        bool hasContent;        // whether anything has been placed in it
+        bool pendingParagraph;  // a paragraph break is waiting for more content
+    };
+
+    void text(const char *start, const char *end);
+    void tag(const char *start, const char *end);
+    void endTag(const char *start, const char *end);
+    void paragraph();
+    void addParagraph();
+    void addNode();
+    void reset();
+    void flush();
+
+    std::ostream *mStream;
+    std::string mBuffer;
+    std::string &mOut;
+    Level mLevels[MAX_TAG_DEPTH + 1];
+    unsigned mDepth;            // number of open tags
+    bool mInTag;
+    std::string mPartialTag;
+    ParseResult mResults;
+};
+
 ParseResult formatText(const std::string &text);
 
 #endif
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include "formatter.h"
 #include "gamedata.h"
 #include "textutil.h"
 
@@ -34,45 +35,195 @@ void ListDef::del(int key) {
 }
 
 
-Value MapDef::get(const Value &key) const {
-    for (const Row &row : rows) {
-        if (row.key == key) return row.value;
+static unsigned hashValue(const Value &value) {
+    // all None values compare equal regardless of their value
+    if (value.type == Value::None) return 0;
+    unsigned hash = static_cast<unsigned>(value.value) * 0x9E3779B1u;
+    hash ^= static_cast<unsigned>(value.type) * 0x85EBCA77u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// When a gamefile gives a key more than once, the first of its rows is the
+// one found, as with a scan of the rows, and the next is found once that one
+// is deleted.
+int MapDef::find(const Value &key) const {
+    if (mIndex.empty()) {
+        for (unsigned i = 0; i < rows.size(); ++i) {
+            if (!rows[i].deleted && rows[i].key == key) return i;
+        }
+        return -1;
+    }
+
+    const unsigned mask = mIndex.size() - 1;
+    unsigned slot = hashValue(key) & mask;
+    int found = -1;
+    while (mIndex[slot] >= 0) {
+        const int row = mIndex[slot];
+        if (rows[row].key == key) {
+            if (!mDuplicates) return row;
+            if (found < 0 || row < found) found = row;
+        }
+        slot = (slot + 1) & mask;
     }
-    return Value(Value::Integer, 0);
+    return found;
 }
 
-bool MapDef::has(const Value &key) const {
-    for (const Row &row : rows) {
-        if (row.key == key) return true;
+void MapDef::indexAdd(int row) {
+    const unsigned mask = mIndex.size() - 1;
+    unsigned slot = hashValue(rows[row].key) & mask;
+    while (mIndex[slot] >= 0) slot = (slot + 1) & mask;
+    mIndex[slot] = row;
+}
+
+// Remove a row from the index using backward-shift deletion.
+void MapDef::indexRemove(int row) {
+    const unsigned mask = mIndex.size() - 1;
+    unsigned hole = hashValue(rows[row].key) & mask;
+    while (mIndex[hole] != row) hole = (hole + 1) & mask;
+
+    unsigned next = (hole + 1) & mask;
+    while (mIndex[next] >= 0) {
+        unsigned home = hashValue(rows[mIndex[next]].key) & mask;
+        bool canMove = hole <= next ? (home <= hole || home > next)
+                                    : (home <= hole && home > next);
+        if (canMove) {
+            mIndex[hole] = mIndex[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    mIndex[hole] = -1;
+}
+
+void MapDef::rebuildIndex() {
+    rows.erase(std::remove_if(rows.begin(), rows.end(),
+                              [](const Row &row) { return row.deleted; }),
+               rows.end());
+    mDeleted = 0;
+    mDuplicates = false;
+    mIndex.clear();
+    if (rows.size() <= MAP_INDEX_THRESHOLD) return;
+
+    unsigned capacity = 16;
+    while (capacity < rows.size() * 2) capacity *= 2;
+    mIndex.assign(capacity, -1);
+    for (unsigned i = 0; i < rows.size(); ++i) {
+        if (find(rows[i].key) >= 0) mDuplicates = true;
+        indexAdd(i);
     }
-    return false;
+}
+
+Value MapDef::get(const Value &key) const {
+    int row = find(key);
+    if (row < 0) return Value(Value::Integer, 0);
+    return rows[row].value;
+}
+
+bool MapDef::has(const Value &key) const {
+    return find(key) >= 0;
 }
 
 void MapDef::set(const Value &key, const Value &value) {
-    for (Row &row : rows) {
-        if (row.key == key) {
-            row.value = value;
-            return;
-        }
+    int row = find(key);
+    if (row >= 0) {
+        rows[row].value = value;
+        return;
+    }
+
+    rows.push_back(Row{key, value, false});
+    if (mIndex.empty() || rows.size() * 2 > mIndex.size()) {
+        rebuildIndex();
+    } else {
+        indexAdd(rows.size() - 1);
     }
-    rows.push_back(Row{key, value});
 }
 
 void MapDef::del(const Value &key) {
-    auto iter = rows.begin();
-    while (iter != rows.end()) {
-        if (iter->key == key) {
-            rows.erase(iter);
-            return;
-        }
-        ++iter;
+    int row = find(key);
+    if (row < 0) return;
+
+    if (mIndex.empty()) {
+        rows.erase(rows.begin() + row);
+        return;
     }
+    indexRemove(row);
+    rows[row].deleted = true;
+    ++mDeleted;
+    if (mDeleted * 2 >= rows.size()) rebuildIndex();
+}
+
+
+const std::string& StringDef::text() const {
+    static const std::string emptyString;
+    if (!mTail.empty() || (mBase && mBaseLength != mBase->size())) flatten();
+    return mBase ? *mBase : emptyString;
+}
+
+void StringDef::flatten() const {
+    std::string *flat = new std::string;
+    flat->reserve(mBaseLength + mTail.size());
+    if (mBase) flat->append(*mBase, 0, mBaseLength);
+    flat->append(mTail);
+    mBase.reset(flat);
+    mBaseLength = flat->size();
+    mTail.clear();
+}
+
+void StringDef::setText(const std::string &text) {
+    setText(std::make_shared<const std::string>(text));
+}
+
+void StringDef::setText(std::shared_ptr<const std::string> text, bool normalized) {
+    mBase = text;
+    mBaseLength = mBase->size();
+    mTail.clear();
+    mNormalized = normalized;
+}
+
+void StringDef::share(const StringDef &other) {
+    other.text();
+    mBase = other.mBase;
+    mBaseLength = other.mBaseLength;
+    mTail.clear();
+    mNormalized = other.mNormalized;
+}
+
+void StringDef::append(const std::string &text) {
+    if (!mNormalized) {
+        std::string whole = this->text() + text;
+        normalize(whole);
+        setText(whole);
+        mNormalized = true;
+        return;
+    }
+
+    // the join needs enough text before it to find a safe boundary; take it
+    // from the shared buffer if the tail doesn't have it
+    std::size_t start = normalizationBoundary(mTail, mTail.size());
+    if (start == 0 && mBaseLength > 0) {
+        std::size_t baseStart = normalizationBoundary(*mBase, mBaseLength);
+        mTail.insert(0, *mBase, baseStart, mBaseLength - baseStart);
+        mBaseLength = baseStart;
+        start = normalizationBoundary(mTail, mTail.size());
+    }
+
+    std::string joined = mTail.substr(start) + text;
+    normalize(joined);
+    mTail.replace(start, std::string::npos, joined);
+}
+
+void StringDef::clear() {
+    mBase.reset();
+    mBaseLength = 0;
+    mTail.clear();
+    mNormalized = true;
 }
 
 
 Value ObjectDef::get(GameData &gamedata, unsigned propId, bool checkParent) const {
-    auto iter = properties.find(propId);
-    if (iter == properties.end()) {
+    const Value *value = find(propId);
+    if (!value) {
         if (checkParent) {
             Value parent = get(gamedata, PROP_PARENT, false);
             if (parent.type == Value::Object) {
@@ -81,285 +232,143 @@ Value ObjectDef::get(GameData &gamedata, unsigned propId, bool checkParent) cons
         }
         return Value{Value::Integer, 0};
     }
-    Value result = iter->second;
+    Value result = *value;
     result.selfObj = ident;
     return result;
 }
 
-bool ObjectDef::has(unsigned propId) const {
-    auto iter = properties.find(propId);
-    if (iter == properties.end()) return false;
-    return true;
+static bool propertyLess(const ObjectDef::Property &prop, unsigned propId) {
+    return prop.first < propId;
 }
 
-void ObjectDef::set(unsigned propId, const Value &value) {
-    properties[propId] = value;
+const Value* ObjectDef::find(unsigned propId) const {
+    auto iter = std::lower_bound(properties.begin(), properties.end(), propId, propertyLess);
+    if (iter == properties.end() || iter->first != propId) return nullptr;
+    return &iter->second;
 }
 
+bool ObjectDef::has(unsigned propId) const {
+    return find(propId) != nullptr;
+}
 
-GameData::~GameData() {
-    for (const auto &def : objects)  if (def.second) delete def.second;
-    for (const auto &def : lists)    if (def.second) delete def.second;
-    for (const auto &def : maps)     if (def.second) delete def.second;
-    for (const auto &def : strings)  if (def.second) delete def.second;
+bool ObjectDef::set(unsigned propId, const Value &value) {
+    auto iter = std::lower_bound(properties.begin(), properties.end(), propId, propertyLess);
+    if (iter != properties.end() && iter->first == propId) {
+        iter->second = value;
+        return propId == PROP_PARENT;
+    }
+    properties.insert(iter, Property(propId, value));
+    return true;
 }
 
+
 const StringDef& GameData::getString(int index) const {
-    const auto &def = strings.find(index);
-    if (def == strings.end()) {
+    const StringDef *def = strings.find(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid string number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
-StringDef& GameData::getString(int index) {
-    auto def = strings.find(index);
-    if (def == strings.end()) {
+StringDef& GameData::editString(int index) {
+    StringDef *def = strings.edit(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid string number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
 const ListDef& GameData::getList(int index) const {
-    const auto &def = lists.find(index);
-    if (def == lists.end()) {
+    const ListDef *def = lists.find(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid list number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
-ListDef& GameData::getList(int index) {
-    auto def = lists.find(index);
-    if (def == lists.end()) {
+ListDef& GameData::editList(int index) {
+    ListDef *def = lists.edit(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid list number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
 const MapDef& GameData::getMap(int index) const {
-    const auto &def = maps.find(index);
-    if (def == maps.end()) {
+    const MapDef *def = maps.find(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid map number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
-MapDef& GameData::getMap(int index) {
-    auto def = maps.find(index);
-    if (def == maps.end()) {
+MapDef& GameData::editMap(int index) {
+    MapDef *def = maps.edit(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid map number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
 const ObjectDef& GameData::getObject(int index) const {
-    const auto &def = objects.find(index);
-    if (def == objects.end()) {
+    const ObjectDef *def = objects.find(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid object number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
-ObjectDef& GameData::getObject(int index) {
-    auto def = objects.find(index);
-    if (def == objects.end()) {
+ObjectDef& GameData::editObject(int index) {
+    // cached property lookups may point into the shared object
+    if (objects.isShared(index)) invalidatePropertyCache();
+    ObjectDef *def = objects.edit(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid object number "
                         + std::to_string(index));
     }
-    return *def->second;
+    return *def;
 }
 const FunctionDef& GameData::getFunction(int index) const {
-    const auto &def = functions.find(index);
-    if (def == functions.end()) {
+    auto def = functions.find(index);
+    if (def != functions.end()) return def->second;
+    def = image->functions.find(index);
+    if (def == image->functions.end()) {
         throw GameBadReference("Tried to access invalid function number "
                         + std::to_string(index));
     }
     return def->second;
 }
 FunctionDef& GameData::getFunction(int index) {
-    auto def = functions.find(index);
-    if (def == functions.end()) {
+    FunctionDef *def = findFunction(index);
+    if (!def) {
         throw GameBadReference("Tried to access invalid funtion number "
                         + std::to_string(index));
     }
-    return def->second;
+    return *def;
+}
+FunctionDef* GameData::findFunction(int index) {
+    auto def = functions.find(index);
+    if (def != functions.end()) return &def->second;
+    auto original = image->functions.find(index);
+    if (original == image->functions.end()) return nullptr;
+    return &functions.insert(*original).first->second;
 }
 
 std::string NO_SUCH_VOCAB("INVALID VOCAB");
 const std::string& GameData::getVocab(int index) const {
-    if (index < 0 || index >= static_cast<int>(vocab.size())) {
+    if (index < 0 || index >= static_cast<int>(image->vocab.size())) {
         NO_SUCH_VOCAB = "INVALID VOCAB " + std::to_string(index);
         return NO_SUCH_VOCAB;
     }
-    return vocab[index];
+    return image->vocab[index];
 }
 int GameData::getVocab(const std::string &text) const {
-    for (unsigned i = 0; i < vocab.size(); ++i) {
-        if (vocab[i] == text) return i;
+    for (unsigned i = 0; i < image->vocab.size(); ++i) {
+        if (image->vocab[i] == text) return i;
     }
     return -1;
 }
 
-int GameData::collectGarbage() {
-    // clear existing marks
-    for (auto &def : objects) if (def.second)  def.second->gcMark = false;
-    for (auto &def : lists)   if (def.second)  def.second->gcMark = false;
-    for (auto &def : maps)    if (def.second)  def.second->gcMark = false;
-    for (auto &def : strings) if (def.second)  def.second->gcMark = false;
-
-    // mark objects
-    for (auto &def : objects)   if (def.second && def.second->isStatic) mark(*def.second);
-    for (auto &def : lists)     if (def.second && def.second->isStatic) mark(*def.second);
-    for (auto &def : maps)      if (def.second && def.second->isStatic) mark(*def.second);
-    for (auto &def : strings)   if (def.second && def.second->isStatic) mark(*def.second);
-    // mark options
-    for (GameOption &option : options) {
-        mark(option.extra);
-        mark(option.value);
-        mark(Value(Value::String, option.strId));
-    }
-    for (int i = 0; i < callStack.size(); ++i) {
-        const gtCallStack::Frame &frame = callStack[i];
-        for (unsigned j = 0; j < frame.stack.size(); ++j) {
-            mark(frame.stack[j]);
-        }
-        for (const Value &value : frame.stack.argList) {
-            mark(value);
-        }
-    }
-
-    // collect objects
-    int collectionCount = 0;
-    for (auto iter = objects.begin(); iter != objects.end(); ) {
-        if (!iter->second || !iter->second->gcMark) {
-            if (iter->second) delete iter->second;
-            iter = objects.erase(iter);
-            ++collectionCount;
-        } else {
-            ++iter;
-        }
-    }
-
-    for (auto iter = lists.begin(); iter != lists.end(); ) {
-        if (!iter->second || !iter->second->gcMark) {
-            if (iter->second) delete iter->second;
-            iter = lists.erase(iter);
-            ++collectionCount;
-        } else {
-            ++iter;
-        }
-    }
-    for (auto iter = maps.begin(); iter != maps.end(); ) {
-        if (!iter->second || !iter->second->gcMark) {
-            if (iter->second) delete iter->second;
-            iter = maps.erase(iter);
-            ++collectionCount;
-        } else {
-            ++iter;
-        }
-    }
-    for (auto iter = strings.begin(); iter != strings.end(); ) {
-        if (!iter->second || !iter->second->gcMark) {
-            if (iter->second) delete iter->second;
-            iter = strings.erase(iter);
-            ++collectionCount;
-        } else {
-            ++iter;
-        }
-    }
-
-
-    // for (unsigned i = 0; i < objects.size(); ++i) {
-    //     ObjectDef *def = objects[i];
-    //     if (!def || def->gcMark) continue;
-    //     delete def;
-    //     objects[i] = nullptr;
-    //     ++collectionCount;
-    // }
-    // for (unsigned i = 0; i < lists.size(); ++i) {
-    //     ListDef *def = lists[i];
-    //     if (!def || def->gcMark) continue;
-    //     delete def;
-    //     lists[i] = nullptr;
-    //     ++collectionCount;
-    // }
-    // for (unsigned i = 0; i < maps.size(); ++i) {
-    //     MapDef *def = maps[i];
-    //     if (!def || def->gcMark) continue;
-    //     delete def;
-    //     maps[i] = nullptr;
-    //     ++collectionCount;
-    // }
-    // for (unsigned i = 0; i < strings.size(); ++i) {
-    //     StringDef *def = strings[i];
-    //     if (!def || def->gcMark) continue;
-    //     delete def;
-    //     strings[i] = nullptr;
-    //     ++collectionCount;
-    // }
-
-    return collectionCount;
-}
-
-void GameData::mark(ObjectDef &object) {
-    object.gcMark = true;
-    for (const auto &prop : object.properties) {
-        mark(prop.second);
-    }
-}
-
-void GameData::mark(ListDef &list) {
-    list.gcMark = true;
-    for (const Value &value : list.items) mark(value);
-}
-
-void GameData::mark(MapDef &map) {
-    map.gcMark = true;
-    for (const auto &row : map.rows) {
-        mark(row.key);
-        mark(row.value);
-    }
-}
-
-void GameData::mark(StringDef &str) {
-    str.gcMark = true;
-}
-
-void GameData::mark(const Value &value) {
-    try {
-        switch(value.type) {
-            case Value::Object:
-                mark(getList(value.value));
-                break;
-            case Value::List:
-                mark(getList(value.value));
-                break;
-            case Value::Map:
-                mark(getList(value.value));
-                break;
-            case Value::String:
-                mark(getList(value.value));
-                break;
-
-            // remaining types not handled by garbage collector so just skip them
-            case Value::Any:
-            case Value::None:
-            case Value::Integer:
-            case Value::Function:
-            case Value::Property:
-            case Value::TypeId:
-            case Value::LocalVar:
-            case Value::JumpTarget:
-            case Value::Vocab:
-            case Value::VarRef:
-                break;
-        }
-    } catch (const GameBadReference&) {
-        // do nothing; no need to mark non-existance objects
-    }
-}
-
-
 std::string GameData::getSource(const Value &value) {
     std::string text;
     const DataItem *item = nullptr;
@@ -393,22 +402,51 @@ std::string GameData::getSource(const Value &value) {
     if (!item || item->srcFile == -1) return "no debug info";
     if (item->srcFile == ORIGIN_DYNAMIC) return "dynamic";
 
-    if (item->srcName >= 0) text = "\"" + getString(item->srcName).text + "\" ";
-    if (item->srcLine >= 0) text += getString(item->srcFile).text
+    if (item->srcName >= 0) text = "\"" + getString(item->srcName).text() + "\" ";
+    if (item->srcLine >= 0) text += getString(item->srcFile).text()
                                   + ":" + std::to_string(item->srcLine);
-    else                    text += getString(item->srcFile).text;
+    else                    text += getString(item->srcFile).text();
 
     return text;
 }
 
+// Look up a property for the GetItem instruction at site, following the
+// object's parent chain if needed.
+Value GameData::getProperty(unsigned site, int objectId, unsigned propId) {
+    PropertyCacheEntry &entry = mPropertyCache[site & (PROPERTY_CACHE_SIZE - 1)];
+    if (entry.version != mPropertyVersion || entry.site != site
+            || entry.object != static_cast<unsigned>(objectId) || entry.propId != propId) {
+        const ObjectDef *object = &getObject(objectId);
+        const Value *slot = object->find(propId);
+        while (!slot) {
+            const Value *parent = object->find(PROP_PARENT);
+            if (!parent || parent->type != Value::Object) break;
+            object = &getObject(parent->value);
+            slot = object->find(propId);
+        }
+        entry = PropertyCacheEntry{site, static_cast<unsigned>(objectId), propId,
+                                   mPropertyVersion, object->ident, slot};
+    }
+
+    if (!entry.slot) return Value{Value::Integer, 0};
+    Value result = *entry.slot;
+    result.selfObj = entry.holder;
+    return result;
+}
+
+void GameData::setProperty(ObjectDef &object, unsigned propId, const Value &value) {
+    if (object.set(propId, value)) invalidatePropertyCache();
+    writeBarrier(Value::Object, object, value);
+}
+
 void GameData::setExtra(const Value &newValue) {
     if (extraValue >= 0) {
-        callStack.getStack().setArg(extraValue, newValue);
+        callStack.setLocal(extraValue, newValue);
     }
 }
 
 void GameData::say(const std::string &what) {
-    textBuffer += what;
+    if (output) output->write(what);
 }
 
 void GameData::say(const Value &what) {
@@ -419,35 +457,31 @@ Value GameData::makeNew(Value::Type type) {
     switch(type) {
         case Value::List: {
             ListDef *newDef = new ListDef;
-            newDef->ident = nextList;
-            ++nextList;
             newDef->srcFile = newDef->srcLine = newDef->srcName = ORIGIN_DYNAMIC;
-            lists.insert(std::make_pair(newDef->ident, newDef));
-            return Value(Value::List, newDef->ident);
+            Value newValue(Value::List, lists.add(newDef));
+            gcAdopt(newValue);
+            return newValue;
         }
         case Value::Map: {
             MapDef *newDef = new MapDef;
-            newDef->ident = nextMap;
-            ++nextMap;
             newDef->srcFile = newDef->srcLine = newDef->srcName = ORIGIN_DYNAMIC;
-            maps.insert(std::make_pair(newDef->ident, newDef));
-            return Value(Value::Map, newDef->ident);
+            Value newValue(Value::Map, maps.add(newDef));
+            gcAdopt(newValue);
+            return newValue;
         }
         case Value::Object: {
             ObjectDef *newDef = new ObjectDef;
-            newDef->ident = nextObject;
-            ++nextObject;
             newDef->srcFile = newDef->srcLine = newDef->srcName = ORIGIN_DYNAMIC;
-            objects.insert(std::make_pair(newDef->ident, newDef));
-            return Value(Value::Object, newDef->ident);
+            Value newValue(Value::Object, objects.add(newDef));
+            gcAdopt(newValue);
+            return newValue;
         }
         case Value::String: {
             StringDef *newDef = new StringDef;
-            newDef->ident = nextString;
-            ++nextString;
             newDef->srcFile = newDef->srcLine = newDef->srcName = ORIGIN_DYNAMIC;
-            strings.insert(std::make_pair(newDef->ident, newDef));
-            return Value(Value::String, newDef->ident);
+            Value newValue(Value::String, strings.add(newDef));
+            gcAdopt(newValue);
+            return newValue;
         }
         default:
             std::stringstream ss;
@@ -459,52 +493,57 @@ Value GameData::makeNew(Value::Type type) {
 
 Value GameData::makeNewString(const std::string &str) {
     Value newId = makeNew(Value::String);
-    StringDef &def = getString(newId.value);
-    def.text = str;
+    StringDef &def = editString(newId.value);
+    def.setText(str);
     return newId;
 }
 
 bool GameData::isStatic(const Value &what) const {
+    const DataItem *item = nullptr;
     switch(what.type) {
-        case Value::Object: return static_cast<unsigned>(what.value) <= staticObjects;
-        case Value::List:   return static_cast<unsigned>(what.value) <= staticLists;
-        case Value::Map:    return static_cast<unsigned>(what.value) <= staticMaps;
-        case Value::String: return static_cast<unsigned>(what.value) < staticStrings;
+        case Value::Object: item = objects.find(what.value);    break;
+        case Value::List:   item = lists.find(what.value);      break;
+        case Value::Map:    item = maps.find(what.value);       break;
+        case Value::String: item = strings.find(what.value);    break;
         default:            return true;
     }
+    return item && item->isStatic;
 }
 
 bool GameData::isValid(const Value &what) const {
-    try {
-        switch(what.type) {
-            case Value::Object:     getObject(what.value);      break;
-            case Value::List:       getList(what.value);        break;
-            case Value::Map:        getMap(what.value);         break;
-            case Value::String:     getString(what.value);      break;
-            case Value::Function:   getFunction(what.value);    break;
-            case Value::Vocab:      return what.value > 0 && what.value < static_cast<int>(vocab.size());
-            default:                return true;
-        }
-    } catch (const GameBadReference&) {
-        return false;
+    switch(what.type) {
+        case Value::Object:     return objects.find(what.value) != nullptr;
+        case Value::List:       return lists.find(what.value) != nullptr;
+        case Value::Map:        return maps.find(what.value) != nullptr;
+        case Value::String:     return strings.find(what.value) != nullptr;
+        case Value::Function:   return functions.count(what.value) > 0
+                                    || image->functions.count(what.value) > 0;
+        case Value::Vocab:      return what.value > 0 && what.value < static_cast<int>(image->vocab.size());
+        default:                return true;
     }
-    return true;
 }
 
 void GameData::stringAppend(const Value &stringId, const Value &toAppend, bool wantUpperFirst) {
     stringId.requireType(Value::String);
+    StringDef &strDef = editString(stringId.value);
+    if (toAppend.type == Value::String && !wantUpperFirst && strDef.empty()) {
+        // appending a normalized string to an empty one can share its text
+        const StringDef &source = getString(toAppend.value);
+        if (source.isNormalized()) {
+            strDef.share(source);
+            return;
+        }
+    }
     std::string newText = asString(toAppend);
-    StringDef &strDef = getString(stringId.value);
     if (wantUpperFirst) upperFirst(newText);
-    strDef.text += newText;
-    normalize(strDef.text);
+    strDef.append(newText);
 }
 
 std::string GameData::asString(const Value &value) {
     switch(value.type) {
         case Value::String: {
             const StringDef &strDef = getString(value.value);
-            return strDef.text;
+            return strDef.text();
         }
         case Value::Vocab: {
             return getVocab(value.value);
@@ -529,7 +568,7 @@ public:
     bool operator() (const Value &left, const Value &right) {
         if (left.type != right.type) return left.type < right.type;
         if (left.type == Value::String) {
-            return data.getString(left.value).text < data.getString(right.value).text;
+            return data.getString(left.value).text() < data.getString(right.value).text();
         } else {
             return left.value < right.value;
         }
@@ -538,7 +577,7 @@ private:
     const GameData &data;
 };
 void GameData::sortList(const Value &listId) {
-    ListDef &theList = getList(listId.value);
+    ListDef &theList = editList(listId.value);
     ListItemSorter sorter(*this);
     std::sort(theList.items.begin(), theList.items.end(), sorter);
 }
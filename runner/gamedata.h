@@ -2,18 +2,36 @@
 #define GAMEDATA_H
 
 #include <array>
+#include <climits>
+#include <exception>
 #include <string>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <vector>
 #include "bytestream.h"
+#include "decoded.h"
 #include "gameerror.h"
+#include "heap.h"
+#include "mappedfile.h"
 #include "stack.h"
 #include "value.h"
 
+class OutputSink;
+class Profiler;
+
 const int FILETYPE_ID = 0x47505254;
 const int HEADER_SIZE = 64;
+// gamefile flags; a gamefile using a feature this runner doesn't know about
+// is refused when loaded
+const unsigned GAMEFLAG_SUPERINSTRUCTIONS   = 0x01;
+const unsigned GAMEFLAG_LOCAL_OPCODES       = 0x02;
+const unsigned GAMEFLAG_KNOWN               = GAMEFLAG_SUPERINSTRUCTIONS | GAMEFLAG_LOCAL_OPCODES;
 const int ORIGIN_DYNAMIC = -2;
 const int GARBAGE_FREQUENCY = 100;
+const long GARBAGE_STEP_BUDGET = 2000;  // microseconds of marking per turn
+const long NO_INSTRUCTION_LIMIT = LONG_MAX;
 
 const int INFO_TITLE  = 0;
 const int INFO_LEFT   = 1;
@@ -32,19 +50,53 @@ const int PROP_IDENT             = 2;
 const int PROP_PARENT            = 3;
 
 struct GameData;
+struct NativeCode;
+
+// The body of a function translated to C++ by compile, entered at the bytecode
+// position IP. Continue means the current frame changed (by a call or return)
+// and the runner should enter the body of the function now on top; Stop means
+// the game is waiting for input or has ended.
+enum class NativeResult {
+    Continue, Stop
+};
+typedef NativeResult (*NativeBody)(GameData &data, unsigned IP);
 
 struct DataItem {
     DataItem()
-    : ident(-1), srcFile(-1), srcLine(-1), srcName(-1), gcMark(false), isStatic(false) { }
+    : ident(-1), srcFile(-1), srcLine(-1), srcName(-1), isStatic(false) { }
 
     unsigned ident;
     int srcFile, srcLine, srcName;
-    bool gcMark;
     bool isStatic;
 };
 
+// A string's text is an immutable buffer, which may be shared with other
+// strings, followed by a tail that has been appended since. Appends only
+// normalize the text around the join, and the two parts are combined into a
+// single buffer again only when something needs the whole text.
 struct StringDef : public DataItem {
-    std::string text;
+    StringDef()
+    : mBaseLength(0), mNormalized(false) { }
+
+    const std::string& text() const;
+    bool empty() const {
+        return mBaseLength == 0 && mTail.empty();
+    }
+    bool isNormalized() const {
+        return mNormalized;
+    }
+    void setText(const std::string &text);
+    void setText(std::shared_ptr<const std::string> text, bool normalized = false);
+    void share(const StringDef &other);
+    void append(const std::string &text);
+    void clear();
+private:
+    void flatten() const;
+
+    mutable std::shared_ptr<const std::string> mBase;
+    mutable std::size_t mBaseLength;    // only this much of mBase is used
+    mutable std::string mTail;
+    bool mNormalized;                   // text is known to be in NFC form
 };
 
 struct ListDef : public DataItem {
@@ -55,9 +107,22 @@ struct ListDef : public DataItem {
     void set(int key, const Value &value);
     void del(int key);
 };
+// Maps keep their rows in insertion order. Once a map grows beyond
+// MAP_INDEX_THRESHOLD rows, an open-addressed hash index of row numbers is
+// maintained alongside them so lookups no longer need to scan every row.
+// Deleting from an indexed map only marks the row as deleted, so the row
+// numbers in the index stay valid; the deleted rows are dropped and the index
+// rebuilt once they make up half the rows. Anything going through rows must
+// skip the deleted ones.
+const unsigned MAP_INDEX_THRESHOLD = 8;
+
 struct MapDef : public DataItem  {
+    MapDef()
+    : mDeleted(0), mDuplicates(false) { }
+
     struct Row {
         Value key, value;
+        bool deleted;
     };
     std::vector<Row> rows;
 
@@ -65,23 +130,90 @@ struct MapDef : public DataItem  {
     bool has(const Value &key) const;
     void set(const Value &key, const Value &value);
     void del(const Value &key);
+    // Drops deleted rows and rebuilds the index to fit the rest.
+    void rebuildIndex();
+    // the number of rows not deleted
+    unsigned size() const {
+        return rows.size() - mDeleted;
+    }
+private:
+    int find(const Value &key) const;
+    void indexAdd(int row);
+    void indexRemove(int row);
+
+    std::vector<int> mIndex;
+    unsigned mDeleted;      // rows marked as deleted
+    bool mDuplicates;       // some key has more than one row (only in gamefiles)
 };
+// Properties are kept in a vector sorted by property number, which is more
+// compact than a tree and quicker to search.
 struct ObjectDef : public DataItem  {
-    std::map<unsigned, Value> properties;
+    typedef std::pair<unsigned, Value> Property;
+    std::vector<Property> properties;
 
     Value get(GameData &gamedata, unsigned propId, bool checkParent = true) const;
+    const Value* find(unsigned propId) const;
     bool has(unsigned propId) const;
-    void set(unsigned propId, const Value &value);
+    // Returns true if the property was newly added or is the object's parent;
+    // either change can alter where inherited property lookups end up.
+    bool set(unsigned propId, const Value &value);
 };
 struct FunctionDef : public DataItem  {
+    FunctionDef()
+    : typedArgs(true), verified(false), isDecoded(false), callCount(0), compiled(nullptr) { }
+
     int arg_count;
     int local_count;
     std::vector<Value::Type> argTypes;
     unsigned position;
+    unsigned end;           // position just past the function's bytecode
+    bool typedArgs;         // some argument or local has a type other than Any
+    // the function's stack use and jumps were proven safe when the game was
+    // loaded, so the decoded engine may run it without runtime checks
+    bool verified;
+    bool isDecoded;         // decoded holds the function's code, ready to run
+    DecodedCode decoded;
+    unsigned callCount;     // calls made by the decoded engine, for the JIT
+    std::shared_ptr<NativeCode> native;
+    NativeBody compiled;    // set when running a game built with compile
+};
+
+// Full runs a complete mark and sweep every GARBAGE_FREQUENCY turns.
+// Generational also collects the young generation after every turn.
+// Incremental replaces the complete collection with one whose marking is
+// spread over several turns, GARBAGE_STEP_BUDGET at a time.
+enum class GcMode {
+    Full, Generational, Incremental
+};
+
+// Hot compiles a function to machine code once the decoded engine has called
+// it JIT_THRESHOLD times; Always compiles each function when it's first
+// called. Either falls back to the decoded engine where there's no JIT.
+enum class JitMode {
+    Off, Hot, Always
+};
+const unsigned JIT_THRESHOLD = 50;
+
+// Results of GetItem on objects are cached per instruction in a direct-mapped
+// table indexed by the instruction's bytecode position. An entry records where
+// the property was found, either in the object itself or one of its ancestors,
+// and stays valid until a change that could move it: a property being added,
+// a parent being changed, or an object being freed.
+const unsigned PROPERTY_CACHE_SIZE = 1024;
+
+struct PropertyCacheEntry {
+    unsigned site;
+    unsigned object;
+    unsigned propId;
+    unsigned version;
+    unsigned holder;        // ident of the object the property was found in
+    const Value *slot;      // nullptr if no object in the chain has it
 };
 
+// Yield is left by a resume that ran out of its instruction budget; resuming
+// without a value continues from where it stopped.
 enum class OptionType {
-    None, Choice, Key, Line, EndOfProgram
+    None, Choice, Key, Line, EndOfProgram, Yield
 };
 
 struct GameOption {
@@ -100,40 +232,168 @@ struct FileRecord {
 typedef std::vector<FileRecord> FileList;
 
 
+// The decoded text of a static string, shared by all those that are identical.
+struct InternedString {
+    std::shared_ptr<const std::string> text;
+    bool normalized;
+
+    bool operator==(const InternedString &rhs) const {
+        return *text == *rhs.text;
+    }
+};
+struct InternedStringHash {
+    std::size_t operator()(const InternedString &s) const {
+        return std::hash<std::string>()(*s.text);
+    }
+};
+
+// The parts of a game that don't change as it's played: the gamefile's header,
+// vocabulary, bytecode, function headers, and static data. An image is loaded
+// once and shared by every session (GameData) playing the game, which may be
+// on different threads. The gamefile is mapped into memory and used in place,
+// and static strings and objects are only decoded the first time any session
+// uses them; that happens under a lock, so lookups may be made concurrently.
+class GameImage {
+public:
+    GameImage()
+    : mainFunction(0), gameFlags(0),
+      refGamename(0), refVersion(0), refAuthor(0), refGameid(0), refBuild(0),
+      staticStrings(0), staticLists(0), staticMaps(0), staticObjects(0), staticVocab(0),
+      mLists(1), mMaps(1), mObjects(1)
+    { }
+    GameImage(const GameImage&) = delete;
+    GameImage& operator=(const GameImage&) = delete;
+
+    // Returns nullptr, having reported why, if filename isn't a usable gamefile.
+    static std::shared_ptr<const GameImage> load(const std::string &filename);
+    // Give a session's heap the image's static items, shared until changed.
+    void shareWith(GameData &data) const;
+
+    int mainFunction;
+    unsigned gameFlags;
+    int refGamename, refVersion, refAuthor, refGameid, refBuild;
+    unsigned staticStrings, staticLists, staticMaps, staticObjects, staticVocab;
+    std::vector<std::string> vocab;
+    ByteStream bytecode;
+    std::map<int, FunctionDef> functions;   // verified, but not decoded
+private:
+    bool read(const std::string &filename);
+    StringDef* loadString(unsigned ident);
+    ObjectDef* loadObject(unsigned ident);
+    template<class T>
+    const T* findStatic(const HeapTable<T> &table, unsigned ident) const {
+        std::lock_guard<std::mutex> lock(mLock);
+        return table.find(ident);
+    }
+
+    MappedFile mGameFile;
+    std::vector<unsigned> mStringOffsets;   // position of each static string in the gamefile
+    std::vector<unsigned> mObjectOffsets;   // position of each static object, or zero
+    std::unordered_set<InternedString, InternedStringHash> mInternedStrings;
+    HeapTable<StringDef> mStrings;
+    HeapTable<ListDef> mLists;
+    HeapTable<MapDef> mMaps;
+    HeapTable<ObjectDef> mObjects;
+    mutable std::mutex mLock;               // held while static items are looked up
+};
+
+// Checks the bytecode of each function, setting where it ends and whether it
+// was verified. Returns false if any function can't be run at all.
+bool verifyFunctions(std::map<int, FunctionDef> &functions, const ByteStream &bytecode,
+                     unsigned gameFlags);
+
+struct SessionSnapshot;
+
+// A session of a game: everything that changes as it's played. The static data
+// of a loaded game belongs to its image, and a session only gets its own copy
+// of a static item when the game first changes it, so a session's memory
+// grows with its dynamic data rather than the size of the game.
 struct GameData {
     GameData()
-    : showDebug(0), instructionCount(0), optionType(OptionType::None),
-      extraValue(0), gameLoaded(false), mainFunction(0),
+    : showDebug(0), useDecoded(false), useNative(false), checkedOnly(false), gcMode(GcMode::Generational),
+      jitMode(JitMode::Off),
+      instructionCount(0), instructionLimit(NO_INSTRUCTION_LIMIT), turnLimit(0), undoLevels(0), profiler(nullptr), optionType(OptionType::None),
+      extraValue(0), output(nullptr), gameLoaded(false), mainFunction(0), gameFlags(0),
+      lists(1), maps(1), objects(1),
       staticStrings(0), staticLists(0), staticMaps(0), staticObjects(0),
       refGamename(0), refVersion(0), refAuthor(0), refGameid(0), refBuild(0),
-      mCallCount(0)
+      image(std::make_shared<GameImage>()),
+      nativeEnter(nullptr), mCallCount(0), mDecodedReady(false),
+      mHandlers(nullptr), mFastHandlers(nullptr), mGcEpoch(0), mGcMarking(false),
+      mPropertyCache(PROPERTY_CACHE_SIZE), mPropertyVersion(1)
     { }
-    ~GameData();
     void load(const std::string &filename);
+    void attach(std::shared_ptr<const GameImage> newImage);
     void dump() const;
 
+    // The edit functions are for changing an item; a static item still shared
+    // with the image is copied first.
     const StringDef& getString(int index) const;
-    StringDef& getString(int index);
+    StringDef& editString(int index);
     const ListDef& getList(int index) const;
-    ListDef& getList(int index);
+    ListDef& editList(int index);
     const MapDef& getMap(int index) const;
-    MapDef& getMap(int index);
+    MapDef& editMap(int index);
     const ObjectDef& getObject(int index) const;
-    ObjectDef& getObject(int index);
+    ObjectDef& editObject(int index);
+    // A session copies a function from the image the first time it's looked
+    // up, and decodes it the first time the decoded engine runs it. The const
+    // getFunction gives the image's copy of a function the session hasn't
+    // used; findFunction returns nullptr rather than throwing.
     const FunctionDef& getFunction(int index) const;
     FunctionDef& getFunction(int index);
+    FunctionDef* findFunction(int index);
     const std::string& getVocab(int index) const;
     int getVocab(const std::string &text) const;
 
     int collectGarbage();
-    void mark(ObjectDef &object);
-    void mark(ListDef   &list);
-    void mark(MapDef    &map);
-    void mark(StringDef &str);
-    void mark(const Value &value);
+    int collectYoung();
+    int collectIncremental(long budgetMicros);
+    bool collectionInProgress() const {
+        return mGcMarking;
+    }
+    void writeBarrier(Value::Type type, DataItem &container, const Value &value);
+    Value getProperty(unsigned site, int objectId, unsigned propId);
+    void setProperty(ObjectDef &object, unsigned propId, const Value &value);
+    void invalidatePropertyCache() {
+        ++mPropertyVersion;
+    }
+
+    // Freeze the session as it is, between turns or while yielded. Taking a
+    // snapshot copies none of the heap, only the call stack and the tables'
+    // pages changed since the last snapshot; the session and its snapshots
+    // share items until one is changed. Restoring one into any session of
+    // the same game, or a new one, continues it from that point.
+    std::shared_ptr<const SessionSnapshot> snapshot();
+    void restore(const SessionSnapshot &snapshot);
+    // Save the same state as a snapshot in a compact form, to be loaded back
+    // into a session of the same game by this build of the runner; only the
+    // items the session doesn't share with the image are written. loadState
+    // throws a GameError if bytes don't hold a state that fits this session,
+    // leaving it released. releaseState frees the session's heap and call
+    // stack, leaving it as it was just after attaching the image.
+    void saveState(std::vector<uint8_t> &out) const;
+    void loadState(const uint8_t *bytes, std::size_t size);
+    void releaseState();
 
     std::string getSource(const Value &value);
-    Value resume(bool pushValue, const Value &inValue);
+    // Runs the game until it waits for input or ends, or until budget more
+    // instructions have run, when it yields. Compiled games (useNative) don't
+    // count instructions and so never yield.
+    Value resume(bool pushValue, const Value &inValue, long budget = NO_INSTRUCTION_LIMIT);
+    Value resumeDecoded();
+    Value resumeNative();
+    Value resumeProfiled();
+    Value yieldAt(unsigned IP);
+    Value stopValue() const;
+    bool execute(int opcode, unsigned &IP);
+    static bool compareFor(int opcode, const Value &lhs, const Value &rhs);
+    void decodeFunction(FunctionDef &function);
+    void decodeFunctions();
+    void prepareFunction(FunctionDef &function);
+    bool verifyFunctions();
+    bool compileNative(FunctionDef &function, const void *enterHandler);
+    const DecodedOp* runNative(const FunctionDef *&function, const DecodedOp *ip);
     void setExtra(const Value &newValue);
     void say(const std::string &what);
     void say(const Value &what);
@@ -153,20 +413,30 @@ struct GameData {
 
 
     bool showDebug;
+    bool useDecoded;
+    bool useNative;         // every function has a compiled body
+    bool checkedOnly;       // don't run verified functions without checks
+    GcMode gcMode;
+    JitMode jitMode;
     long instructionCount;
+    long instructionLimit;  // resume yields before running the instruction past this
+    long turnLimit;         // instructions a turn may run before the game is stopped; 0 for none
+    unsigned undoLevels;    // turns a player may take back with "undo"; 0 leaves it to the game
+    Profiler *profiler;     // counts what the game does, when run with -profile
     OptionType optionType;
     std::vector<GameOption> options;
     int extraValue;
-    std::string textBuffer;
+    Value returnValue;      // what main returned, once optionType is EndOfProgram
+    OutputSink *output;     // receives everything said; discarded if null
 
     bool gameLoaded;
     int mainFunction;
-    std::map<int, StringDef*> strings;
-    std::map<int, ListDef*> lists;
-    std::map<int, MapDef*> maps;
-    std::map<int, ObjectDef*> objects;
-    std::map<int, FunctionDef> functions;
-    std::vector<std::string> vocab;
+    unsigned gameFlags;
+    HeapTable<StringDef> strings;
+    HeapTable<ListDef> lists;
+    HeapTable<MapDef> maps;
+    HeapTable<ObjectDef> objects;
+    std::map<int, FunctionDef> functions;  // those used so far, copied from the image
     ByteStream bytecode;
     unsigned staticStrings;
     unsigned staticLists;
@@ -174,20 +444,63 @@ struct GameData {
     unsigned staticObjects;
     unsigned staticVocab;
 
-    unsigned nextString;
-    unsigned nextList;
-    unsigned nextMap;
-    unsigned nextObject;
     Value noneValue;
 
     int refGamename, refVersion, refAuthor, refGameid, refBuild;
+    std::shared_ptr<const GameImage> image;
 
     std::array<std::string, INFO_COUNT> infoText;
     gtCallStack callStack;
+    std::exception_ptr nativeError; // thrown inside native code, for runNative
+    const void *nativeEnter;        // decoded engine handler of compiled instructions
 private:
+    bool isStaticRef(const Value &ref) const;
+    const DataItem* gcFind(const Value &ref) const;
+    const DataItem* gcFind(const Value &ref, GcState *&state);
+    void gcAdopt(const Value &ref);
+    void gcFree(const Value &ref);
+    void gcShade(const Value &value, bool youngOnly);
+    void gcTrace(const Value &ref, bool youngOnly);
+    bool gcRefersToDynamic(const Value &ref);
+    void gcMarkRoots(bool youngOnly);
+    bool gcDrain(bool youngOnly, long budgetMicros);
+    void gcBegin();
+    int gcFinish();
+
     unsigned mCallCount;
+    bool mDecodedReady;                 // the handler tables have been set
+    const void *const *mHandlers;       // of the decoded engine, by opcode
+    const void *const *mFastHandlers;   // the same, for verified functions
+
+    unsigned mGcEpoch;
+    bool mGcMarking;
+    std::vector<Value> mGcGray;         // reached but not yet scanned
+    std::vector<Value> mNursery;        // every item in the young generation
+    std::vector<Value> mRemembered;     // old items that may refer to younger ones
+
+    std::vector<PropertyCacheEntry> mPropertyCache;
+    unsigned mPropertyVersion;
+};
+
+// Everything a session needs to continue from where snapshot was called. A
+// snapshot never changes once taken, so it may be restored on any thread.
+struct SessionSnapshot {
+    std::shared_ptr<const GameImage> image;
+    std::shared_ptr<const HeapTable<StringDef>::Snapshot> strings;
+    std::shared_ptr<const HeapTable<ListDef>::Snapshot> lists;
+    std::shared_ptr<const HeapTable<MapDef>::Snapshot> maps;
+    std::shared_ptr<const HeapTable<ObjectDef>::Snapshot> objects;
+    gtCallStack callStack;          // its frames refer to the image's functions
+    OptionType optionType;
+    std::vector<GameOption> options;
+    int extraValue;
+    std::array<std::string, INFO_COUNT> infoText;
+    std::vector<Value> nursery;
+    std::vector<Value> remembered;
+    unsigned gcEpoch;
 };
 
 void gameloop(GameData &gamedata, bool doSilent);
+void reportError(GameData &gamedata, const GameError &e);
 
 #endif
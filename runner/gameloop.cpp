@@ -5,8 +5,54 @@
 #include <string>
 #include "gamedata.h"
 #include "formatter.h"
+#include "io.h"
+#include "player.h"
 #include "textutil.h"
 
+ConsoleOutput::ConsoleOutput(GameData &gamedata, std::ostream &out)
+: mGamedata(gamedata), mOut(out), mFormatter(out), mStarted(false)
+{ }
+
+ConsoleOutput::~ConsoleOutput() {
+    if (mGamedata.output == this) mGamedata.output = nullptr;
+}
+
+void ConsoleOutput::write(const std::string &text) {
+    if (!mStarted) start();
+    mFormatter.write(text);
+}
+
+void ConsoleOutput::endTurn() {
+    if (!mStarted) start();
+    ParseResult formatResult = mFormatter.finish();
+    mOut << '\n';
+    if (!formatResult.errors.empty()) {
+        mOut << "--== ==-- --== ==-- --== ==-- --== ==-- --== ==--\nERRORS OCCURED WHILE PARSING TEXT.\n";
+        for (const std::string &s : formatResult.errors) {
+            mOut << "    " << s << "\n";
+        }
+        mOut << "--== ==-- --== ==-- --== ==-- --== ==-- --== ==--\n";
+    }
+    if (mStatus != status()) start();
+    if (!mGamedata.infoText[INFO_BOTTOM].empty()) {
+        mOut << "[";
+        mOut << mGamedata.infoText[INFO_BOTTOM];
+        mOut << "]\n";
+    }
+    mStarted = false;
+}
+
+std::string ConsoleOutput::status() const {
+    return "\n*** " + mGamedata.infoText[INFO_TITLE] + " ***\n"
+           + mGamedata.infoText[INFO_LEFT] + " : " + mGamedata.infoText[INFO_RIGHT] + '\n';
+}
+
+void ConsoleOutput::start() {
+    mStarted = true;
+    mStatus = status();
+    mOut << mStatus;
+}
+
 int tryAsNumber(const std::string &s) {
     char *endPtr;
     int result = strtol(s.c_str(), &endPtr, 10);
@@ -14,170 +60,306 @@ int tryAsNumber(const std::string &s) {
     return -1;
 }
 
-void gameloop(GameData &gamedata, bool doSilent) {
-    const FunctionDef &funcDef = gamedata.getFunction(gamedata.mainFunction);
-    gamedata.callStack.create(funcDef, gamedata.mainFunction);
-    gamedata.callStack.getStack().setArgs(std::vector<Value>{Value{Value::None, 0}}, funcDef.arg_count, funcDef.local_count);
-    gamedata.callStack.callTop().IP = funcDef.position;
-
-    int garbageCounter = 0, garbageAmount = 0;
-    Value nextValue;
-    bool hasNext, hasValue = false, didGarbage = false;
-    while (1) {
-        ++garbageCounter;
-        if (garbageCounter >= GARBAGE_FREQUENCY) {
-            garbageAmount = gamedata.collectGarbage();
-            garbageCounter = 0;
-            didGarbage = true;
-        } else didGarbage = false;
-        gamedata.textBuffer = "";
-        gamedata.options.clear();
-        gamedata.instructionCount = 0;
-        gamedata.resume(hasValue, nextValue);
-        hasValue = false;
-
-        if (!doSilent) {
-            std::cout << "\n*** " << gamedata.infoText[INFO_TITLE] << " ***\n";
-            std::cout << gamedata.infoText[INFO_LEFT];
-            std::cout << " : ";
-            std::cout << gamedata.infoText[INFO_RIGHT];
-            std::cout << '\n';
-            ParseResult formatResult = formatText(gamedata.textBuffer);
-            if (!formatResult.errors.empty()) {
-                std::cout << "--== ==-- --== ==-- --== ==-- --== ==-- --== ==--\nERRORS OCCURED WHILE PARSING TEXT.\n";
-                for (const std::string &s : formatResult.errors) {
-                    std::cout << "    " << s << "\n";
+TextPlayer::TextPlayer(GameData &gamedata, std::ostream &out, bool doSilent)
+: mGamedata(gamedata), mOut(out), mConsole(gamedata, out), mDoSilent(doSilent),
+  mEnded(false), mTurnStarted(false), mHasValue(false), mGarbageCounter(0)
+{ }
+
+void TextPlayer::start() {
+    const FunctionDef &funcDef = mGamedata.getFunction(mGamedata.mainFunction);
+    mGamedata.callStack.create(funcDef, mGamedata.mainFunction, mGamedata.noneValue, 0);
+    mGamedata.callStack.callTop().IP = funcDef.position;
+    if (!mDoSilent) mGamedata.output = &mConsole;
+    mTurnStarted = false;
+    mHasValue = false;
+}
+
+bool TextPlayer::run(long budget) {
+    if (!mTurnStarted) {
+        mGamedata.options.clear();
+        mGamedata.instructionCount = 0;
+        mTurnStarted = true;
+    }
+    const long turnLimit = mGamedata.turnLimit;
+    if (turnLimit > 0) budget = std::min(budget, turnLimit - mGamedata.instructionCount);
+    mGamedata.resume(mHasValue, mNextValue, budget);
+    mHasValue = false;
+    if (mGamedata.optionType == OptionType::Yield) {
+        if (turnLimit > 0 && mGamedata.instructionCount >= turnLimit) {
+            throw GameError("Turn exceeded the limit of " + std::to_string(turnLimit)
+                            + " instructions.");
+        }
+        return false;
+    }
+    mTurnStarted = false;
+
+    if (!mDoSilent) mConsole.endTurn();
+    collectGarbage();
+
+    if (mGamedata.optionType == OptionType::EndOfProgram) {
+        if (!mDoSilent) {
+            mOut << "\nProgram ended. Goodbye!\n";
+        }
+        mEnded = true;
+        return true;
+    }
+    showOptions();
+    if (mGamedata.undoLevels > 0) mTurnStart = mGamedata.snapshot();
+    prompt();
+    return true;
+}
+
+// Writes what the game is waiting for, numbering any choices that don't have
+// a hotkey.
+void TextPlayer::showOptions() {
+    switch(mGamedata.optionType) {
+        case OptionType::Key:
+        case OptionType::Line: {
+            if (mDoSilent) break;
+            if (!mGamedata.options.empty()) {
+                const GameOption &option = mGamedata.options.back();
+                mOut << '\n' << mGamedata.getString(option.strId).text();
+            }
+            break; }
+        case OptionType::Choice: {
+            if (mDoSilent) break;
+            mOut << '\n';
+            int index = 1;
+            for (GameOption &option : mGamedata.options) {
+                if (option.hotkey > 0) {
+                    option.hotkey = std::toupper(option.hotkey);
+                    mOut << static_cast<char>(option.hotkey) << ") ";
+                    mOut << mGamedata.getString(option.strId).text() << '\n';
+                } else {
+                    mOut << index << ") ";
+                    mOut << mGamedata.getString(option.strId).text() << '\n';
+                    option.hotkey = -index;
+                    ++index;
                 }
-                std::cout << "--== ==-- --== ==-- --== ==-- --== ==-- --== ==--\n";
             }
-            std::cout << formatResult.finalResult << '\n';
-            if (!gamedata.infoText[INFO_BOTTOM].empty()) {
-                std::cout << "[";
-                std::cout << gamedata.infoText[INFO_BOTTOM];
-                std::cout << "]\n";
+            break; }
+        default:
+            ;
+    }
+}
+
+// Collects garbage at the end of a turn, while the only references to values
+// are in the game's own data, the call stack, and the current options.
+void TextPlayer::collectGarbage() {
+    int garbageAmount = 0;
+    bool didGarbage = true;
+    ++mGarbageCounter;
+    switch(mGamedata.gcMode) {
+        case GcMode::Full:
+            if (mGarbageCounter >= GARBAGE_FREQUENCY) {
+                garbageAmount = mGamedata.collectGarbage();
+                mGarbageCounter = 0;
+            } else didGarbage = false;
+            break;
+        case GcMode::Generational:
+            if (mGarbageCounter >= GARBAGE_FREQUENCY) {
+                garbageAmount = mGamedata.collectGarbage();
+                mGarbageCounter = 0;
+            } else {
+                garbageAmount = mGamedata.collectYoung();
             }
-        }
-        if (gamedata.showDebug) {
-            std::cout << ":: GC - ";
-            if (didGarbage) {
-                std::cout << garbageAmount << " collected";
+            break;
+        case GcMode::Incremental:
+            if (mGamedata.collectionInProgress() || mGarbageCounter >= GARBAGE_FREQUENCY) {
+                garbageAmount = mGamedata.collectIncremental(GARBAGE_STEP_BUDGET);
+                mGarbageCounter = 0;
             } else {
-                std::cout << "did't run";
+                garbageAmount = mGamedata.collectYoung();
             }
-            std::cout << " :: " << gamedata.instructionCount << " opcodes executed\n";
+            break;
+    }
+
+    if (mGamedata.showDebug) {
+        mOut << ":: GC - ";
+        if (didGarbage && garbageAmount < 0) {
+            mOut << "marking";
+        } else if (didGarbage) {
+            mOut << garbageAmount << " collected";
+        } else {
+            mOut << "did't run";
         }
+        mOut << " :: " << mGamedata.instructionCount << " opcodes executed\n";
+    }
+}
 
+InputResult TextPlayer::input(std::string inputText) {
+    strToLower(inputText);
+    if (inputText == "quit") {
+        if (!mDoSilent) {
+            mOut << "\nGoodbye!\n";
+        }
+        mEnded = true;
+        return InputResult::Quit;
+    }
+    if (inputText == "undo" && mGamedata.undoLevels > 0) {
+        undo();
+        return InputResult::Rejected;
+    }
 
-        switch(gamedata.optionType) {
-            case OptionType::EndOfProgram:
-                if (!doSilent) {
-                    std::cout << "\nProgram ended. Goodbye!\n";
+    bool hasNext = false;
+    switch(mGamedata.optionType) {
+        case OptionType::EndOfProgram:
+            //should never occur
+            return InputResult::Quit;
+        case OptionType::Key: {
+            int c = 0;
+            if (!inputText.empty()) {
+                c = getFirstCodepoint(inputText);
+                if (c >= 'A' && c <= 'Z') c += 32;
+            }
+            mNextValue = Value(Value::Integer, c);
+            hasNext = true;
+            break; }
+        case OptionType::Line: {
+            mNextValue = mGamedata.makeNewString(inputText);
+            hasNext = true;
+            break; }
+        case OptionType::Choice: {
+            if (inputText.empty()) {
+                if (mGamedata.options.size() == 1) {
+                    mNextValue = mGamedata.options.front().value;
+                    mGamedata.setExtra(mGamedata.options.front().extra);
+                    hasNext = true;
                 }
-                return;
-            case OptionType::Key:
-            case OptionType::Line: {
-                if (doSilent) break;
-                if (!gamedata.options.empty()) {
-                    const GameOption &option = gamedata.options.back();
-                    std::cout << '\n' << gamedata.getString(option.strId).text;
+                break;
+            }
+
+            int optNum = tryAsNumber(inputText);
+            if (optNum >= 0) {
+                // numbered choice
+                optNum = -optNum;
+                for (const GameOption &option : mGamedata.options) {
+                    if (option.hotkey == optNum) {
+                        mNextValue = option.value;
+                        mGamedata.setExtra(option.extra);
+                        hasNext = true;
+                        break;
+                    }
                 }
-                break; }
-            case OptionType::Choice: {
-                if (doSilent) break;
-                std::cout << '\n';
-                int index = 1;
-                for (GameOption &option : gamedata.options) {
-                    if (option.hotkey > 0) {
-                        option.hotkey = std::toupper(option.hotkey);
-                        std::cout << static_cast<char>(option.hotkey) << ") ";
-                        std::cout << gamedata.getString(option.strId).text << '\n';
-                    } else {
-                        std::cout << index << ") ";
-                        std::cout << gamedata.getString(option.strId).text << '\n';
-                        option.hotkey = -index;
-                        ++index;
+            } else if (inputText.size() == 1) {
+                char key = std::toupper(inputText[0]);
+                // hotkey choice
+                for (const GameOption &option : mGamedata.options) {
+                    if (option.hotkey == key) {
+                        mNextValue = option.value;
+                        mGamedata.setExtra(option.extra);
+                        hasNext = true;
+                        break;
                     }
                 }
-                break; }
-            default:
-                ;
-        }
+            }
+            break; }
+        default:
+            std::cerr << "Unknown option type " << static_cast<int>(mGamedata.optionType) << '\n';
+            break;
+    }
 
-        hasNext = false;
+    if (!hasNext) {
+        prompt();
+        return InputResult::Rejected;
+    }
+    mHasValue = true;
+    if (mTurnStart) {
+        mUndo.push_back(mTurnStart);
+        if (mUndo.size() > mGamedata.undoLevels) mUndo.pop_front();
+        mTurnStart.reset();
+    }
+    return InputResult::Accepted;
+}
+
+void TextPlayer::prompt() {
+    mOut << "\n> ";
+}
+
+void TextPlayer::hibernate(std::vector<uint8_t> &out) {
+    mUndo.clear();
+    mTurnStart.reset();
+    mGamedata.saveState(out);
+    mGamedata.releaseState();
+}
+
+void TextPlayer::wake(const std::vector<uint8_t> &in) {
+    mGamedata.loadState(in.data(), in.size());
+    if (mGamedata.undoLevels > 0) mTurnStart = mGamedata.snapshot();
+}
+
+void TextPlayer::undo() {
+    if (mUndo.empty()) {
+        if (!mDoSilent) mOut << "\nThere is nothing to undo.\n";
+        prompt();
+        return;
+    }
+    mTurnStart = mUndo.back();
+    mUndo.pop_back();
+    mGamedata.restore(*mTurnStart);
+    if (!mDoSilent) mOut << "\nUndone.\n";
+    showOptions();
+    prompt();
+}
+
+void gameloop(GameData &gamedata, bool doSilent) {
+    TextPlayer player(gamedata, std::cout, doSilent);
+    player.start();
+    while (1) {
+        player.run();
+        if (player.ended()) return;
+
+        InputResult result;
         do {
-            std::cout << "\n> ";
             std::string inputText;
             std::getline(std::cin, inputText);
-            strToLower(inputText);
-            if (inputText == "quit") {
-                if (!doSilent) {
-                    std::cout << "\nGoodbye!\n";
+            result = player.input(inputText);
+        } while (result == InputResult::Rejected);
+        if (result == InputResult::Quit) return;
+    }
+}
+
+// Describe an error that stopped the game, along with the call stack at the
+// time.
+void reportError(GameData &gamedata, const GameError &e) {
+    std::cerr << "\n" << IO::setFG(IO::Red);
+    std::cerr << "RUNTIME ERROR:";
+    std::cerr << IO::normal();
+    std::cerr << ' ' << e.what() << '\n';
+    std::cerr << "CALL STACK:\n";
+    if (gamedata.callStack.isEmpty()) {
+        std::cerr << "    EMPTY\n";
+    } else {
+        for (int i = gamedata.callStack.size() - 1; i >= 0 ; --i) {
+            const gtCallStack::Frame &frame = gamedata.callStack[i];
+            FunctionDef &fdef = gamedata.getFunction(frame.functionId);
+            std::cerr << "    ";
+            if (fdef.srcName >= 0) {
+                std::cerr << gamedata.getString(fdef.srcName).text();
+            } else {
+                std::cerr << "(no debug info)";
+            }
+            std::cerr << " #" << frame.functionId << ' ';
+            if (fdef.srcFile >= 0) {
+                std::cerr << '(' << gamedata.getString(fdef.srcFile).text();
+                if (fdef.srcLine >= 0) {
+                    std::cerr << ':' << fdef.srcLine;
                 }
-                return;
+                std::cerr << ')';
             }
+            std::cerr << '\n';
 
-            switch(gamedata.optionType) {
-                case OptionType::EndOfProgram:
-                    //should never occur
-                    return;
-                case OptionType::Key: {
-                    int c = 0;
-                    if (!inputText.empty()) {
-                        c = getFirstCodepoint(inputText);
-                        if (c >= 'A' && c <= 'Z') c += 32;
-                    }
-                    nextValue = Value(Value::Integer, c);
-                    hasNext = true;
-                    hasValue = true;
-                    break; }
-                case OptionType::Line: {
-                    nextValue = gamedata.makeNewString(inputText);
-                    hasNext = true;
-                    hasValue = true;
-                    break; }
-                case OptionType::Choice: {
-                    if (inputText.empty()) {
-                        if (gamedata.options.size() == 1) {
-                            nextValue = gamedata.options.front().value;
-                            gamedata.setExtra(gamedata.options.front().extra);
-                            hasNext = true;
-                            hasValue = true;
-                        }
-                        break;
-                    }
-
-                    int optNum = tryAsNumber(inputText);
-                    if (optNum >= 0) {
-                        // numbered choice
-                        optNum = -optNum;
-                        for (const GameOption &option : gamedata.options) {
-                            if (option.hotkey == optNum) {
-                                nextValue = option.value;
-                                gamedata.setExtra(option.extra);
-                                hasNext = true;
-                                hasValue = true;
-                                break;
-                            }
-                        }
-                    } else if (inputText.size() == 1) {
-                        char key = std::toupper(inputText[0]);
-                        // hotkey choice
-                        for (const GameOption &option : gamedata.options) {
-                            if (option.hotkey == key) {
-                                nextValue = option.value;
-                                gamedata.setExtra(option.extra);
-                                hasNext = true;
-                                hasValue = true;
-                                break;
-                            }
-                        }
-                    }
-                    break; }
-                default:
-                    std::cerr << "Unknown option type " << static_cast<int>(gamedata.optionType) << '\n';
-                    break;
+            std::cerr << "        LOCAL:";
+            unsigned stackStart = frame.base + frame.localCount;
+            for (unsigned j = frame.base; j < stackStart; ++j) {
+                std::cerr << ' ' << gamedata.callStack.valueAt(j);
+            }
+            std::cerr << '\n';
+            std::cerr << "        STACK:";
+            for (unsigned j = stackStart; j < gamedata.callStack.frameEnd(i); ++j) {
+                std::cerr << ' ' << gamedata.callStack.valueAt(j);
             }
-        } while (!hasNext);
+            std::cerr << '\n';
+        }
     }
-
 }
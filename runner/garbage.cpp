@@ -0,0 +1,300 @@
+#include <chrono>
+#include <vector>
+#include "gamedata.h"
+
+// The heap is divided into three generations. Static data loaded from the
+// gamefile can never be collected, so it is never marked; the only way it can
+// keep a dynamic item alive is through a store made while the game runs, and
+// every such store adds the static item to the remembered set. Dynamic items
+// start out young and are promoted to the old generation by surviving a
+// collection. Young collections trace only young items, using the roots and
+// the remembered set, and sweep only the nursery.
+//
+// Marks are the number of the collection ("epoch") that last reached an item,
+// so nothing needs to be cleared before a collection begins. Marking uses an
+// explicit worklist of gray items; during an incremental collection the write
+// barrier shades anything stored into an item that has already been reached,
+// and newly created items are born marked. Marks and generations are kept
+// in the heap tables' slots rather than the items, so items shared with the
+// image or a snapshot aren't copied just to be marked.
+
+static bool isHeapType(Value::Type type) {
+    return type == Value::Object || type == Value::List
+        || type == Value::Map    || type == Value::String;
+}
+
+// Checked before looking up a value so static data that has yet to be loaded
+// from the gamefile isn't loaded just to find that it needn't be marked.
+bool GameData::isStaticRef(const Value &ref) const {
+    switch(ref.type) {
+        case Value::Object: return objects.isStaticIdent(ref.value);
+        case Value::List:   return lists.isStaticIdent(ref.value);
+        case Value::Map:    return maps.isStaticIdent(ref.value);
+        case Value::String: return strings.isStaticIdent(ref.value);
+        default:            return false;
+    }
+}
+
+const DataItem* GameData::gcFind(const Value &ref) const {
+    switch(ref.type) {
+        case Value::Object: return objects.find(ref.value);
+        case Value::List:   return lists.find(ref.value);
+        case Value::Map:    return maps.find(ref.value);
+        case Value::String: return strings.find(ref.value);
+        default:            return nullptr;
+    }
+}
+const DataItem* GameData::gcFind(const Value &ref, GcState *&state) {
+    switch(ref.type) {
+        case Value::Object: return objects.find(ref.value, state);
+        case Value::List:   return lists.find(ref.value, state);
+        case Value::Map:    return maps.find(ref.value, state);
+        case Value::String: return strings.find(ref.value, state);
+        default:            return nullptr;
+    }
+}
+
+void GameData::gcFree(const Value &ref) {
+    switch(ref.type) {
+        case Value::Object:
+            objects.remove(ref.value);
+            invalidatePropertyCache();
+            break;
+        case Value::List:   lists.remove(ref.value);    break;
+        case Value::Map:    maps.remove(ref.value);     break;
+        case Value::String: strings.remove(ref.value);  break;
+        default:            break;
+    }
+}
+
+// Called by makeNew for every newly created item.
+void GameData::gcAdopt(const Value &ref) {
+    GcState *state = nullptr;
+    if (!gcFind(ref, state)) return;
+    state->young = true;
+    if (mGcMarking) state->mark = mGcEpoch;
+    mNursery.push_back(ref);
+}
+
+// Must be called after storing a value inside a list, map, or object.
+void GameData::writeBarrier(Value::Type type, DataItem &container, const Value &value) {
+    if (!isHeapType(value.type)) return;
+    const Value ref(type, container.ident);
+    GcState *state = nullptr;
+    if (!gcFind(ref, state)) return;
+    if (!state->young && !state->remembered) {
+        state->remembered = true;
+        mRemembered.push_back(ref);
+    }
+    if (mGcMarking && (container.isStatic || state->mark == mGcEpoch)) {
+        gcShade(value, false);
+    }
+}
+
+void GameData::gcShade(const Value &value, bool youngOnly) {
+    if (isStaticRef(value)) return;
+    GcState *state = nullptr;
+    const DataItem *item = gcFind(value, state);
+    if (!item || item->isStatic || state->mark == mGcEpoch) return;
+    if (youngOnly && !state->young) return;
+    state->mark = mGcEpoch;
+    if (value.type != Value::String) {
+        mGcGray.push_back(Value(value.type, item->ident));
+    }
+}
+
+void GameData::gcTrace(const Value &ref, bool youngOnly) {
+    switch(ref.type) {
+        case Value::Object: {
+            const ObjectDef *def = objects.find(ref.value);
+            if (!def) break;
+            for (const auto &prop : def->properties) gcShade(prop.second, youngOnly);
+            break; }
+        case Value::List: {
+            const ListDef *def = lists.find(ref.value);
+            if (!def) break;
+            for (const Value &value : def->items) gcShade(value, youngOnly);
+            break; }
+        case Value::Map: {
+            const MapDef *def = maps.find(ref.value);
+            if (!def) break;
+            for (const MapDef::Row &row : def->rows) {
+                if (row.deleted) continue;
+                gcShade(row.key, youngOnly);
+                gcShade(row.value, youngOnly);
+            }
+            break; }
+        default:
+            break;
+    }
+}
+
+bool GameData::gcRefersToDynamic(const Value &ref) {
+    auto isDynamic = [this](const Value &value) {
+        const DataItem *item = gcFind(value);
+        return item && !item->isStatic;
+    };
+    switch(ref.type) {
+        case Value::Object:
+            for (const auto &prop : getObject(ref.value).properties) {
+                if (isDynamic(prop.second)) return true;
+            }
+            return false;
+        case Value::List:
+            for (const Value &value : getList(ref.value).items) {
+                if (isDynamic(value)) return true;
+            }
+            return false;
+        case Value::Map:
+            for (const MapDef::Row &row : getMap(ref.value).rows) {
+                if (row.deleted) continue;
+                if (isDynamic(row.key) || isDynamic(row.value)) return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+void GameData::gcMarkRoots(bool youngOnly) {
+    for (const GameOption &option : options) {
+        gcShade(option.extra, youngOnly);
+        gcShade(option.value, youngOnly);
+        gcShade(Value(Value::String, option.strId), youngOnly);
+    }
+    for (unsigned i = 0; i < callStack.valueCount(); ++i) {
+        gcShade(callStack.valueAt(i), youngOnly);
+    }
+}
+
+// Scan gray items until none remain or the time budget runs out. A negative
+// budget means no limit. Returns true if marking is complete.
+bool GameData::gcDrain(bool youngOnly, long budgetMicros) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    unsigned scanned = 0;
+    while (!mGcGray.empty()) {
+        Value ref = mGcGray.back();
+        mGcGray.pop_back();
+        gcTrace(ref, youngOnly);
+        if (budgetMicros >= 0 && ++scanned % 64 == 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+            if (elapsed.count() >= budgetMicros) return mGcGray.empty();
+        }
+    }
+    return true;
+}
+
+// Start a complete collection. The remembered static items stand in for the
+// whole static generation as roots.
+void GameData::gcBegin() {
+    ++mGcEpoch;
+    mGcMarking = true;
+    mGcGray.clear();
+    gcMarkRoots(false);
+    for (const Value &ref : mRemembered) {
+        const DataItem *item = gcFind(ref);
+        if (item && item->isStatic) gcTrace(ref, false);
+    }
+}
+
+// Sweep every dynamic item not reached by a complete collection. Survivors all
+// become old, so only remembered static items that still refer to dynamic
+// data need to stay in the remembered set.
+template<class T>
+static int sweepDynamic(HeapTable<T> &table, unsigned epoch) {
+    int count = 0;
+    for (unsigned slot = table.staticSlotCount(); slot < table.slotCount(); ++slot) {
+        const T *def = table.atSlot(slot);
+        if (!def || def->isStatic) continue;
+        GcState &state = table.gcStateAt(slot);
+        if (state.mark == epoch) {
+            state.young = false;
+        } else {
+            table.remove(def->ident);
+            ++count;
+        }
+    }
+    return count;
+}
+
+int GameData::gcFinish() {
+    int collectionCount = sweepDynamic(objects, mGcEpoch);
+    if (collectionCount > 0) invalidatePropertyCache();
+    collectionCount += sweepDynamic(lists, mGcEpoch);
+    collectionCount += sweepDynamic(maps, mGcEpoch);
+    collectionCount += sweepDynamic(strings, mGcEpoch);
+    mNursery.clear();
+    mGcMarking = false;
+
+    std::vector<Value> remembered;
+    for (const Value &ref : mRemembered) {
+        GcState *state = nullptr;
+        const DataItem *item = gcFind(ref, state);
+        if (!item) continue;
+        if (item->isStatic && gcRefersToDynamic(ref)) {
+            remembered.push_back(ref);
+        } else {
+            state->remembered = false;
+        }
+    }
+    mRemembered.swap(remembered);
+    return collectionCount;
+}
+
+int GameData::collectGarbage() {
+    gcBegin();
+    gcDrain(false, -1);
+    return gcFinish();
+}
+
+// Do up to budgetMicros worth of marking for a complete collection, starting a
+// new one if none is in progress. Returns the number of items collected once
+// the collection finishes, or -1 if it still has more marking to do.
+int GameData::collectIncremental(long budgetMicros) {
+    if (!mGcMarking) gcBegin();
+    if (!gcDrain(false, budgetMicros)) return -1;
+    // the stack and options have changed since marking began, so they are
+    // scanned once more before sweeping
+    gcMarkRoots(false);
+    gcDrain(false, -1);
+    return gcFinish();
+}
+
+int GameData::collectYoung() {
+    if (mGcMarking) return 0;
+
+    ++mGcEpoch;
+    mGcGray.clear();
+    gcMarkRoots(true);
+    for (const Value &ref : mRemembered) gcTrace(ref, true);
+    gcDrain(true, -1);
+
+    int collectionCount = 0;
+    for (const Value &ref : mNursery) {
+        GcState *state = nullptr;
+        if (!gcFind(ref, state)) continue;
+        if (state->mark == mGcEpoch) {
+            state->young = false;
+        } else {
+            gcFree(ref);
+            ++collectionCount;
+        }
+    }
+    mNursery.clear();
+
+    // with no young items left, only the static generation needs remembering
+    std::vector<Value> remembered;
+    for (const Value &ref : mRemembered) {
+        GcState *state = nullptr;
+        const DataItem *item = gcFind(ref, state);
+        if (!item) continue;
+        if (item->isStatic) {
+            remembered.push_back(ref);
+        } else {
+            state->remembered = false;
+        }
+    }
+    mRemembered.swap(remembered);
+    return collectionCount;
+}
@@ -0,0 +1,492 @@
+#ifndef HEAP_H_5820391
+#define HEAP_H_5820391
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gameerror.h"
+
+// Idents handed out by a HeapTable carry the generation of their slot in the
+// high bits. A slot's generation is advanced whenever it is freed, so a stale
+// reference to a slot that has since been reused fails to resolve instead of
+// silently referring to the new occupant. A slot whose generation would wrap
+// around to one already handed out is retired instead of freed, and never
+// used again. Items inserted at a fixed ident
+// (static data from the gamefile) always have generation zero, so their ident
+// is simply their slot number.
+//
+// Static items may also be created on first use rather than up front: their
+// slots are marked as pending, and the table's loader is called to create the
+// item the first time the slot is looked up.
+//
+// A table may instead share the static items of another table, which must
+// outlive it (the game's image, which every session of the game shares). A
+// shared item isn't owned by the table and is never changed through it: find
+// only returns items as const, and edit replaces a shared item with the
+// table's own copy before returning it for changes.
+//
+// A snapshot freezes the table as it is: it takes over the table's own items,
+// which the table goes on sharing with it, so taking one copies no items.
+// Slots are grouped into pages, and the table notes which pages have changed
+// since its last snapshot; the next snapshot reuses the previous one's
+// unchanged pages, so its cost follows how much the table has changed.
+// Restoring a snapshot shares all of its items in the same way, and only
+// rewrites the pages that differ from the last snapshot taken or restored.
+// The free list is threaded through the slots themselves, so it is frozen
+// and restored along with the pages rather than copied whole.
+//
+// What the garbage collector records about each item is kept in its slot, so
+// that collecting doesn't copy items shared with the image or a snapshot.
+//
+// A table can also be saved and loaded, to hibernate a session: only the
+// table's own items are written, while those of the image are noted and
+// shared again when the table is loaded into a session of the same game.
+const unsigned HEAP_SLOT_BITS   = 22;
+const unsigned HEAP_SLOT_MASK   = (1u << HEAP_SLOT_BITS) - 1;
+const unsigned HEAP_GEN_MASK    = 0x1FF;
+const unsigned HEAP_PAGE_BITS   = 6;
+const unsigned HEAP_PAGE_SIZE   = 1u << HEAP_PAGE_BITS;
+const unsigned HEAP_NO_SLOT     = ~0u;  // the end of a free list
+
+struct GcState {
+    unsigned mark;          // number of the last collection that reached the item
+    bool young;             // created since the last collection
+    bool remembered;        // in the remembered set of old items that hold references
+};
+
+template<class T>
+class HeapTable {
+    struct Slot {
+        T *item;
+        unsigned generation;
+        unsigned nextFree;  // the slot freed before this one, while it's free
+        GcState gc;
+        bool pending;
+        bool shared;        // item belongs to the image or a snapshot
+        bool fromImage;     // item is the image's own (so also shared)
+    };
+public:
+    typedef std::function<T*(unsigned ident)> Loader;
+    typedef std::function<const T*(unsigned ident)> SharedLoader;
+
+    struct FrozenSlot {
+        std::shared_ptr<const T> owner;     // null for items of the image
+        const T *item;
+        unsigned generation;
+        unsigned nextFree;
+        bool pending;
+    };
+    typedef std::vector<FrozenSlot> Page;
+    struct Snapshot {
+        std::vector<std::shared_ptr<const Page>> pages;
+        unsigned freeHead, slotCount, count, staticSlots;
+    };
+
+    class iterator {
+    public:
+        iterator(const HeapTable &table, unsigned pos)
+        : mTable(table), mPos(pos) {
+            skipEmpty();
+        }
+        const T* operator*() const {
+            return mTable.atSlot(mPos);
+        }
+        iterator& operator++() {
+            ++mPos;
+            skipEmpty();
+            return *this;
+        }
+        bool operator!=(const iterator &rhs) const {
+            return mPos != rhs.mPos;
+        }
+    private:
+        void skipEmpty() {
+            while (mPos < mTable.slotCount() && !mTable.atSlot(mPos)) ++mPos;
+        }
+        const HeapTable &mTable;
+        unsigned mPos;
+    };
+
+    explicit HeapTable(unsigned firstSlot = 0)
+    : mSlots(firstSlot, emptySlot()), mCount(0), mFreeHead(HEAP_NO_SLOT), mStaticSlots(0)
+    { }
+    HeapTable(const HeapTable&) = delete;
+    HeapTable& operator=(const HeapTable&) = delete;
+    ~HeapTable() {
+        clear();
+    }
+
+    const T* find(int ident) const {
+        unsigned raw = static_cast<unsigned>(ident);
+        unsigned slot = raw & HEAP_SLOT_MASK;
+        if (slot >= mSlots.size()) return nullptr;
+        const Slot &entry = mSlots[slot];
+        if (entry.generation != (raw >> HEAP_SLOT_BITS)) return nullptr;
+        if (!entry.item && entry.pending) return load(slot);
+        return entry.item;
+    }
+    // Find an item in order to change it, first copying it if it's shared.
+    T* edit(int ident) {
+        if (!find(ident)) return nullptr;
+        return editSlot(ident & HEAP_SLOT_MASK);
+    }
+    bool isShared(int ident) const {
+        unsigned slot = static_cast<unsigned>(ident) & HEAP_SLOT_MASK;
+        return slot < mSlots.size() && mSlots[slot].shared;
+    }
+    // Find an item along with the collector's state for it.
+    const T* find(int ident, GcState *&state) {
+        const T *item = find(ident);
+        if (item) state = &mSlots[ident & HEAP_SLOT_MASK].gc;
+        return item;
+    }
+
+    // Reserve a slot for a static item to be created by the loader when it
+    // is first used.
+    void insertPending(unsigned ident) {
+        if (ident > HEAP_SLOT_MASK) {
+            throw GameError("Static ident " + std::to_string(ident) + " is out of range.");
+        }
+        if (ident >= mSlots.size()) mSlots.resize(ident + 1, emptySlot());
+        if (mSlots[ident].item || mSlots[ident].pending) return;
+        mSlots[ident].pending = true;
+        touch(ident);
+        ++mCount;
+    }
+    void setLoader(Loader loader) {
+        mLoader = loader;
+    }
+
+    // Share the static items of source: each is looked up through lookup the
+    // first time it's used. Used on an empty table, before anything is added.
+    void shareStatic(const HeapTable &source, SharedLoader lookup) {
+        clear();
+        // replaced rather than resized, to free the room a session used
+        mSlots = std::vector<Slot>(source.mStaticSlots, emptySlot());
+        for (unsigned slot = 0; slot < source.mStaticSlots; ++slot) {
+            if (!source.mSlots[slot].item && !source.mSlots[slot].pending) continue;
+            mSlots[slot].pending = true;
+            touch(slot);
+            ++mCount;
+        }
+        mSharedLoader = lookup;
+        mStaticSlots = source.mStaticSlots;
+    }
+
+    // Place an item at a specific ident; used for static data.
+    void insert(unsigned ident, T *item) {
+        if (ident > HEAP_SLOT_MASK) {
+            throw GameError("Static ident " + std::to_string(ident) + " is out of range.");
+        }
+        if (ident >= mSlots.size()) mSlots.resize(ident + 1, emptySlot());
+        if (mSlots[ident].item || mSlots[ident].pending) {
+            if (!mSlots[ident].shared) delete mSlots[ident].item;
+            --mCount;
+        }
+        mSlots[ident] = emptySlot();
+        mSlots[ident].item = item;
+        item->ident = ident;
+        touch(ident);
+        ++mCount;
+    }
+
+    // Store an item in the first free slot and return its new ident.
+    unsigned add(T *item) {
+        unsigned slot;
+        if (mFreeHead != HEAP_NO_SLOT) {
+            slot = mFreeHead;
+            mFreeHead = mSlots[slot].nextFree;
+            mSlots[slot].nextFree = HEAP_NO_SLOT;
+        } else {
+            if (mSlots.size() > HEAP_SLOT_MASK) {
+                delete item;
+                throw GameError("Heap exhausted.");
+            }
+            slot = static_cast<unsigned>(mSlots.size());
+            mSlots.push_back(emptySlot());
+        }
+        mSlots[slot].item = item;
+        mSlots[slot].gc = GcState{0, false, false};
+        item->ident = slot | (mSlots[slot].generation << HEAP_SLOT_BITS);
+        touch(slot);
+        ++mCount;
+        return item->ident;
+    }
+
+    // Delete the item in the slot referred to by ident and make the slot
+    // available for reuse, unless it has run out of generations.
+    void remove(unsigned ident) {
+        unsigned slot = ident & HEAP_SLOT_MASK;
+        if (!find(ident)) return;
+        if (!mSlots[slot].shared) delete mSlots[slot].item;
+        mSlots[slot].item = nullptr;
+        mSlots[slot].shared = false;
+        mSlots[slot].fromImage = false;
+        const unsigned next = (mSlots[slot].generation + 1) & HEAP_GEN_MASK;
+        if (next != 0) {
+            mSlots[slot].generation = next;
+            mSlots[slot].nextFree = mFreeHead;
+            mFreeHead = slot;
+        }
+        touch(slot);
+        --mCount;
+    }
+
+    void clear() {
+        for (Slot &slot : mSlots) {
+            if (!slot.shared) delete slot.item;
+            slot.item = nullptr;
+            slot.pending = false;
+            slot.shared = false;
+            slot.fromImage = false;
+            slot.nextFree = HEAP_NO_SLOT;
+        }
+        mFreeHead = HEAP_NO_SLOT;
+        mCount = 0;
+        mBase.reset();
+        mDirty.assign(mDirty.size(), true);
+    }
+
+    bool empty() const {
+        return mCount == 0;
+    }
+    unsigned size() const {
+        return mCount;
+    }
+    unsigned slotCount() const {
+        return static_cast<unsigned>(mSlots.size());
+    }
+    const T* atSlot(unsigned slot) const {
+        if (slot >= mSlots.size()) return nullptr;
+        if (!mSlots[slot].item && mSlots[slot].pending) return load(slot);
+        return mSlots[slot].item;
+    }
+    T* editSlot(unsigned slot) {
+        if (!atSlot(slot)) return nullptr;
+        Slot &entry = mSlots[slot];
+        if (entry.shared) {
+            entry.item = new T(*entry.item);
+            entry.shared = false;
+            entry.fromImage = false;
+            touch(slot);
+        }
+        return entry.item;
+    }
+    GcState& gcStateAt(unsigned slot) {
+        return mSlots[slot].gc;
+    }
+
+    // Freeze the table, handing its own items over to the snapshot; freeze
+    // is called on each of them first, to settle anything computed lazily,
+    // since they may then be used from other threads.
+    std::shared_ptr<const Snapshot> snapshot(const std::function<void(const T&)> &freeze) {
+        std::shared_ptr<Snapshot> frozen(new Snapshot);
+        const unsigned pageCount = (mSlots.size() + HEAP_PAGE_SIZE - 1) >> HEAP_PAGE_BITS;
+        mDirty.resize(pageCount, true);
+        frozen->pages.reserve(pageCount);
+        for (unsigned page = 0; page < pageCount; ++page) {
+            const Page *before = mBase && page < mBase->pages.size() ? mBase->pages[page].get() : nullptr;
+            if (before && !mDirty[page]) {
+                frozen->pages.push_back(mBase->pages[page]);
+                continue;
+            }
+            const unsigned first = page << HEAP_PAGE_BITS;
+            const unsigned last = std::min<unsigned>(first + HEAP_PAGE_SIZE, mSlots.size());
+            std::shared_ptr<Page> copy(new Page(last - first));
+            for (unsigned slot = first; slot < last; ++slot) {
+                Slot &entry = mSlots[slot];
+                FrozenSlot &result = (*copy)[slot - first];
+                result = FrozenSlot{nullptr, entry.item, entry.generation, entry.nextFree, entry.pending};
+                if (!entry.item) continue;
+                if (!entry.shared) {
+                    freeze(*entry.item);
+                    result.owner.reset(entry.item);
+                    entry.shared = true;
+                } else if (before && slot - first < before->size()
+                           && (*before)[slot - first].item == entry.item) {
+                    result.owner = (*before)[slot - first].owner;
+                }
+            }
+            frozen->pages.push_back(copy);
+            mDirty[page] = false;
+        }
+        frozen->freeHead = mFreeHead;
+        frozen->slotCount = mSlots.size();
+        frozen->count = mCount;
+        frozen->staticSlots = mStaticSlots;
+        mBase = frozen;
+        return mBase;
+    }
+    // Make the table what it was when snapshot was taken, sharing its items.
+    // Pages unchanged since the last snapshot taken or restored, and the same
+    // in this one, are left as they are, the collector's state of their items
+    // included; that of every other item is cleared.
+    void restore(const std::shared_ptr<const Snapshot> &snapshot) {
+        const Snapshot *before = mBase.get();
+        for (unsigned slot = snapshot->slotCount; slot < mSlots.size(); ++slot) {
+            if (!mSlots[slot].shared) delete mSlots[slot].item;
+        }
+        mSlots.resize(snapshot->slotCount, emptySlot());
+        mDirty.resize(snapshot->pages.size(), true);
+        for (unsigned page = 0; page < snapshot->pages.size(); ++page) {
+            if (before && page < before->pages.size() && !mDirty[page]
+                    && before->pages[page] == snapshot->pages[page]) {
+                continue;
+            }
+            const Page &frozen = *snapshot->pages[page];
+            for (unsigned i = 0; i < frozen.size(); ++i) {
+                Slot &entry = mSlots[(page << HEAP_PAGE_BITS) + i];
+                if (!entry.shared) delete entry.item;
+                entry = emptySlot();
+                entry.item = const_cast<T*>(frozen[i].item);
+                entry.generation = frozen[i].generation;
+                entry.nextFree = frozen[i].nextFree;
+                entry.pending = frozen[i].pending;
+                entry.shared = frozen[i].item != nullptr;
+                entry.fromImage = entry.shared && !frozen[i].owner;
+            }
+        }
+        mFreeHead = snapshot->freeHead;
+        mCount = snapshot->count;
+        mStaticSlots = snapshot->staticSlots;
+        mBase = snapshot;
+        mDirty.assign(snapshot->pages.size(), false);
+    }
+
+    // Write every slot with out's put functions, using saveItem for each of
+    // the table's own items. The free list is kept in order, from the slot
+    // freed first, so that a table loaded from it goes on handing out the
+    // same idents.
+    template<class Out, class SaveItem>
+    void save(Out &out, SaveItem saveItem) const {
+        out.put_32(mSlots.size());
+        out.put_32(mStaticSlots);
+        for (const Slot &entry : mSlots) {
+            out.put_16(entry.generation);
+            if (entry.pending || entry.fromImage) {
+                out.put_8(SLOT_IMAGE);
+            } else if (entry.item) {
+                out.put_8(SLOT_OWN);
+                saveItem(out, *entry.item);
+            } else {
+                out.put_8(SLOT_EMPTY);
+            }
+        }
+        std::vector<unsigned> free;
+        for (unsigned slot = mFreeHead; slot != HEAP_NO_SLOT; slot = mSlots[slot].nextFree) {
+            free.push_back(slot);
+        }
+        std::reverse(free.begin(), free.end());
+        out.put_32(free.size());
+        out.put_bytes(free.data(), free.size() * sizeof(unsigned));
+    }
+    // Read back what save wrote, using loadItem to create each of the
+    // table's own items. Used on a table sharing the image's static items,
+    // as a session's are once attached. Returns false if what was read
+    // doesn't make sense, leaving the table to be cleared.
+    template<class In, class LoadItem>
+    bool load(In &in, LoadItem loadItem) {
+        clear();
+        const unsigned slotCount = in.read_32();
+        const unsigned staticSlots = in.read_32();
+        if (slotCount > HEAP_SLOT_MASK + 1 || staticSlots > slotCount) return false;
+        if (!in.have(slotCount * 3)) return false;
+        mSlots = std::vector<Slot>(slotCount, emptySlot());
+        for (unsigned slot = 0; slot < slotCount; ++slot) {
+            Slot &entry = mSlots[slot];
+            entry.generation = in.read_16() & HEAP_GEN_MASK;
+            switch(in.read_8()) {
+                case SLOT_IMAGE:
+                    if (slot >= staticSlots) return false;
+                    entry.pending = true;
+                    ++mCount;
+                    break;
+                case SLOT_OWN:
+                    entry.item = loadItem(in);
+                    ++mCount;
+                    if ((entry.item->ident & HEAP_SLOT_MASK) != slot) return false;
+                    break;
+                case SLOT_EMPTY:
+                    break;
+                default:
+                    return false;
+            }
+        }
+        const unsigned freeCount = in.read_32();
+        if (freeCount > slotCount || !in.have(freeCount * sizeof(unsigned))) return false;
+        std::vector<unsigned> free(freeCount);
+        in.read_bytes(free.data(), freeCount * sizeof(unsigned));
+        for (unsigned slot : free) {
+            if (slot >= slotCount || mSlots[slot].item || mSlots[slot].pending) return false;
+            // a slot on the list twice would make it a loop
+            if (slot == mFreeHead || mSlots[slot].nextFree != HEAP_NO_SLOT) return false;
+            mSlots[slot].nextFree = mFreeHead;
+            mFreeHead = slot;
+        }
+        mStaticSlots = staticSlots;
+        mDirty.assign((slotCount + HEAP_PAGE_SIZE - 1) >> HEAP_PAGE_BITS, true);
+        return !in.overrun;
+    }
+
+    // Record that every slot allocated so far holds static data. Slots added
+    // later are never below this point, so the garbage collector can skip
+    // straight past the static items.
+    void sealStatic() {
+        mStaticSlots = static_cast<unsigned>(mSlots.size());
+    }
+    unsigned staticSlotCount() const {
+        return mStaticSlots;
+    }
+    // Whether ident refers to static data, without loading it.
+    bool isStaticIdent(unsigned ident) const {
+        return ident < mStaticSlots;
+    }
+
+    iterator begin() const {
+        return iterator(*this, 0);
+    }
+    iterator end() const {
+        return iterator(*this, static_cast<unsigned>(mSlots.size()));
+    }
+
+private:
+    enum { SLOT_EMPTY, SLOT_IMAGE, SLOT_OWN };
+
+    static Slot emptySlot() {
+        return Slot{nullptr, 0, HEAP_NO_SLOT, GcState{0, false, false}, false, false, false};
+    }
+    // Note that the page holding slot has changed since the last snapshot.
+    void touch(unsigned slot) {
+        const unsigned page = slot >> HEAP_PAGE_BITS;
+        if (page >= mDirty.size()) mDirty.resize(page + 1, true);
+        mDirty[page] = true;
+    }
+
+    T* load(unsigned slot) const {
+        Slot &entry = mSlots[slot];
+        entry.pending = false;
+        if (mSharedLoader) {
+            // only ever returned as const until editSlot copies it
+            entry.item = const_cast<T*>(mSharedLoader(slot));
+            entry.shared = entry.fromImage = entry.item != nullptr;
+        } else {
+            entry.item = mLoader ? mLoader(slot) : nullptr;
+            if (entry.item) entry.item->ident = slot;
+        }
+        if (!entry.item) --mCount;
+        return entry.item;
+    }
+
+    mutable std::vector<Slot> mSlots;   // pending slots are filled in on lookup
+    mutable unsigned mCount;
+    Loader mLoader;
+    SharedLoader mSharedLoader;
+    unsigned mFreeHead;                     // the slot freed last, or HEAP_NO_SLOT
+    unsigned mStaticSlots;
+    std::shared_ptr<const Snapshot> mBase;  // the last snapshot taken or restored
+    std::vector<bool> mDirty;               // pages changed since mBase
+};
+
+#endif
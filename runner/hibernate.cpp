@@ -0,0 +1,316 @@
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "gamedata.h"
+
+// A session's state is saved as one buffer, built up in memory and written in
+// one go. Integers are written a byte at a time, but runs of values (the call
+// stack, list items, map rows) are copied whole, in the runner's own layout,
+// so the state is only meant to be read back by the runner that saved it, as
+// when a host hibernates its sessions. Nothing from the image is written, only
+// which of its items the session still shares.
+const uint32_t STATE_ID = 0x48505251;
+const uint32_t STATE_VERSION = 1;
+
+static_assert(std::is_trivially_copyable<Value>::value, "values are saved by copying them");
+static_assert(std::is_trivially_copyable<MapDef::Row>::value, "map rows are saved by copying them");
+
+struct StateWriter {
+    std::vector<uint8_t> &out;
+
+    void put_8(uint8_t value) {
+        out.push_back(value);
+    }
+    void put_16(uint16_t value) {
+        out.push_back(value & 0xFF);
+        out.push_back(value >> 8);
+    }
+    void put_32(uint32_t value) {
+        out.push_back(value & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back(value >> 24);
+    }
+    void put_bytes(const void *bytes, std::size_t count) {
+        const uint8_t *start = static_cast<const uint8_t*>(bytes);
+        out.insert(out.end(), start, start + count);
+    }
+    void put_str(const std::string &text) {
+        put_32(text.size());
+        put_bytes(text.data(), text.size());
+    }
+    void put_values(const std::vector<Value> &values) {
+        put_32(values.size());
+        put_bytes(values.data(), values.size() * sizeof(Value));
+    }
+};
+
+// Reads back what a StateWriter wrote. Like GameFileReader, reading past the
+// end returns zeroes and sets overrun.
+struct StateReader {
+    const uint8_t *data;
+    std::size_t size;
+    std::size_t pos;
+    bool overrun;
+
+    bool have(std::size_t count) {
+        if (count <= size - pos) return true;
+        overrun = true;
+        pos = size;
+        return false;
+    }
+    uint8_t read_8() {
+        if (!have(1)) return 0;
+        return data[pos++];
+    }
+    uint16_t read_16() {
+        if (!have(2)) return 0;
+        uint16_t value = data[pos] | (data[pos + 1] << 8);
+        pos += 2;
+        return value;
+    }
+    uint32_t read_32() {
+        if (!have(4)) return 0;
+        uint32_t value = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16)
+                         | (static_cast<uint32_t>(data[pos + 3]) << 24);
+        pos += 4;
+        return value;
+    }
+    bool read_bytes(void *bytes, std::size_t count) {
+        if (!have(count)) return false;
+        if (count > 0) std::memcpy(bytes, data + pos, count);
+        pos += count;
+        return true;
+    }
+    std::string read_str() {
+        const uint32_t length = read_32();
+        if (!have(length)) return "";
+        std::string text(reinterpret_cast<const char*>(data + pos), length);
+        pos += length;
+        return text;
+    }
+    template<class T>
+    void read_array(std::vector<T> &items) {
+        items.clear();
+        const uint32_t count = read_32();
+        if (!have(static_cast<std::size_t>(count) * sizeof(T))) return;
+        items.resize(count);
+        read_bytes(items.data(), count * sizeof(T));
+    }
+};
+
+static void saveItem(StateWriter &out, const DataItem &item) {
+    out.put_32(item.ident);
+    out.put_32(item.srcFile);
+    out.put_32(item.srcLine);
+    out.put_32(item.srcName);
+    out.put_8(item.isStatic);
+}
+static void loadItem(StateReader &in, DataItem &item) {
+    item.ident = in.read_32();
+    item.srcFile = in.read_32();
+    item.srcLine = in.read_32();
+    item.srcName = in.read_32();
+    item.isStatic = in.read_8();
+}
+
+static void saveString(StateWriter &out, const StringDef &def) {
+    saveItem(out, def);
+    out.put_8(def.isNormalized());
+    out.put_str(def.text());
+}
+static StringDef* loadString(StateReader &in) {
+    StringDef *def = new StringDef;
+    loadItem(in, *def);
+    const bool normalized = in.read_8();
+    def->setText(std::make_shared<const std::string>(in.read_str()), normalized);
+    return def;
+}
+
+static void saveList(StateWriter &out, const ListDef &def) {
+    saveItem(out, def);
+    out.put_values(def.items);
+}
+static ListDef* loadList(StateReader &in) {
+    ListDef *def = new ListDef;
+    loadItem(in, *def);
+    in.read_array(def->items);
+    return def;
+}
+
+static void saveMap(StateWriter &out, const MapDef &def) {
+    saveItem(out, def);
+    out.put_32(def.rows.size());
+    out.put_bytes(def.rows.data(), def.rows.size() * sizeof(MapDef::Row));
+}
+static MapDef* loadMap(StateReader &in) {
+    MapDef *def = new MapDef;
+    loadItem(in, *def);
+    in.read_array(def->rows);
+    def->rebuildIndex();
+    return def;
+}
+
+static void saveObject(StateWriter &out, const ObjectDef &def) {
+    saveItem(out, def);
+    out.put_32(def.properties.size());
+    for (const ObjectDef::Property &property : def.properties) {
+        out.put_32(property.first);
+        out.put_bytes(&property.second, sizeof(Value));
+    }
+}
+static ObjectDef* loadObject(StateReader &in) {
+    ObjectDef *def = new ObjectDef;
+    loadItem(in, *def);
+    const uint32_t count = in.read_32();
+    if (!in.have(static_cast<std::size_t>(count) * (4 + sizeof(Value)))) return def;
+    def->properties.resize(count);
+    for (ObjectDef::Property &property : def->properties) {
+        property.first = in.read_32();
+        in.read_bytes(&property.second, sizeof(Value));
+    }
+    return def;
+}
+
+// Identifies the image, so that state isn't loaded into a session of another
+// game.
+static void saveGameCheck(StateWriter &out, const GameData &data) {
+    out.put_32(data.mainFunction);
+    out.put_32(data.staticStrings);
+    out.put_32(data.staticLists);
+    out.put_32(data.staticMaps);
+    out.put_32(data.staticObjects);
+    out.put_32(data.bytecode.size());
+}
+static bool loadGameCheck(StateReader &in, const GameData &data) {
+    bool matches = in.read_32() == static_cast<uint32_t>(data.mainFunction);
+    matches = in.read_32() == data.staticStrings && matches;
+    matches = in.read_32() == data.staticLists && matches;
+    matches = in.read_32() == data.staticMaps && matches;
+    matches = in.read_32() == data.staticObjects && matches;
+    return in.read_32() == data.bytecode.size() && matches;
+}
+
+void GameData::saveState(std::vector<uint8_t> &out) const {
+    StateWriter writer{out};
+    writer.put_32(STATE_ID);
+    writer.put_32(STATE_VERSION);
+    saveGameCheck(writer, *this);
+
+    strings.save(writer, saveString);
+    lists.save(writer, saveList);
+    maps.save(writer, saveMap);
+    objects.save(writer, saveObject);
+
+    writer.put_32(callStack.size());
+    for (int i = 0; i < callStack.size(); ++i) {
+        const gtCallStack::Frame &frame = callStack[i];
+        writer.put_32(frame.functionId);
+        writer.put_32(frame.base);
+        writer.put_32(frame.localCount);
+        writer.put_32(frame.IP);
+    }
+    const unsigned valueCount = callStack.valueCount();
+    writer.put_32(valueCount);
+    if (valueCount > 0) writer.put_bytes(&callStack.valueAt(0), valueCount * sizeof(Value));
+
+    writer.put_8(static_cast<uint8_t>(optionType));
+    writer.put_32(options.size());
+    for (const GameOption &option : options) {
+        writer.put_32(option.strId);
+        writer.put_bytes(&option.value, sizeof(Value));
+        writer.put_bytes(&option.extra, sizeof(Value));
+        writer.put_32(option.hotkey);
+    }
+    writer.put_32(extraValue);
+    for (const std::string &text : infoText) writer.put_str(text);
+
+    writer.put_values(mNursery);
+    writer.put_values(mRemembered);
+    writer.put_32(mGcEpoch);
+}
+
+void GameData::loadState(const uint8_t *bytes, std::size_t size) {
+    StateReader reader{bytes, size, 0, false};
+    if (reader.read_32() != STATE_ID || reader.read_32() != STATE_VERSION) {
+        throw GameError("Not a saved session.");
+    }
+    if (!loadGameCheck(reader, *this)) {
+        throw GameError("Saved session is of another game.");
+    }
+
+    bool loaded = strings.load(reader, loadString)
+               && lists.load(reader, loadList)
+               && maps.load(reader, loadMap)
+               && objects.load(reader, loadObject);
+
+    std::vector<gtCallStack::Frame> frames;
+    const uint32_t frameCount = loaded ? reader.read_32() : 0;
+    for (uint32_t i = 0; loaded && i < frameCount; ++i) {
+        const uint32_t functionId = reader.read_32();
+        const FunctionDef *function = findFunction(functionId);
+        if (!function) {
+            loaded = false;
+            break;
+        }
+        const uint32_t base = reader.read_32();
+        const uint32_t localCount = reader.read_32();
+        const int IP = reader.read_32();
+        frames.push_back(gtCallStack::Frame{*function, functionId, base, localCount, IP});
+    }
+    std::vector<Value> values;
+    reader.read_array(values);
+
+    optionType = static_cast<OptionType>(reader.read_8());
+    const uint32_t optionCount = reader.read_32();
+    options.clear();
+    for (uint32_t i = 0; i < optionCount && !reader.overrun; ++i) {
+        GameOption option;
+        option.strId = reader.read_32();
+        reader.read_bytes(&option.value, sizeof(Value));
+        reader.read_bytes(&option.extra, sizeof(Value));
+        option.hotkey = reader.read_32();
+        options.push_back(option);
+    }
+    extraValue = reader.read_32();
+    for (std::string &text : infoText) text = reader.read_str();
+
+    reader.read_array(mNursery);
+    reader.read_array(mRemembered);
+    mGcEpoch = reader.read_32();
+    if (!loaded || reader.overrun || reader.pos != reader.size) {
+        releaseState();
+        throw GameError("Saved session is damaged.");
+    }
+    try {
+        callStack.load(frames, values);
+    } catch (GameError &e) {
+        releaseState();
+        throw;
+    }
+
+    mGcMarking = false;
+    mGcGray.clear();
+    GcState *state = nullptr;
+    for (const Value &ref : mNursery) {
+        if (gcFind(ref, state)) state->young = true;
+    }
+    for (const Value &ref : mRemembered) {
+        if (gcFind(ref, state)) state->remembered = true;
+    }
+    invalidatePropertyCache();
+}
+
+void GameData::releaseState() {
+    image->shareWith(*this);
+    callStack.load(std::vector<gtCallStack::Frame>(), std::vector<Value>());
+    optionType = OptionType::None;
+    options.clear();
+    extraValue = 0;
+    mNursery = std::vector<Value>();
+    mRemembered = std::vector<Value>();
+    mGcGray = std::vector<Value>();
+    mGcMarking = false;
+    invalidatePropertyCache();
+}
@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "player.h"
+
+// One player's game. Only the worker running a session touches its game and
+// output; the lock guards what serve shares with that worker, including the
+// output the connection hasn't taken yet.
+struct HostSession {
+    enum State {
+        Waiting,    // for a line of input
+        Ready,      // queued or running on a worker
+        Finished    // for serve to close its connection
+    };
+
+    HostSession(std::shared_ptr<const GameImage> image, int fd, const HostOptions &options)
+    : player(data, out, false), fd(fd), closing(false), started(false), inTurn(false),
+      state(Ready), hungUp(false)
+    {
+        data.attach(image);
+        data.useDecoded = options.useDecoded;
+        data.checkedOnly = options.checkedOnly;
+        data.jitMode = options.jitMode;
+        data.gcMode = options.gcMode;
+        data.turnLimit = options.turnLimit;
+        data.undoLevels = options.undoLevels;
+        data.infoText[INFO_TITLE] = options.title;
+    }
+    ~HostSession() {
+        if (!hibernated.empty()) unlink(hibernated.c_str());
+    }
+
+    GameData data;
+    std::ostringstream out;
+    TextPlayer player;
+    int fd;
+    bool closing;           // ended, to be closed once its output is sent; used only by serve
+    bool started;
+    bool inTurn;            // whether the game has a turn left to run
+    std::string hibernated; // file holding the session's state while hibernated
+
+    std::mutex lock;
+    std::string pending;    // input that has arrived but not been given to the game
+    std::string unsent;     // output not yet taken by the connection
+    State state;
+    bool hungUp;            // no more input will arrive
+    std::chrono::steady_clock::time_point idleSince;    // when it began waiting
+};
+
+// Sends as much of a session's unsent output as its connection takes without
+// blocking, returning true if some is left. The caller holds the session's
+// lock. A connection that can't be written to will also be found closed when
+// read, ending the session, so on errors the output is dropped.
+static bool flushOutput(HostSession *session) {
+    std::string &text = session->unsent;
+    std::size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t amount = ::send(session->fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (amount < 0 && errno == EINTR) continue;
+        if (amount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (amount <= 0) {
+            text.clear();
+            return false;
+        }
+        sent += amount;
+    }
+    text.erase(0, sent);
+    return !text.empty();
+}
+
+// Writes bytes to a new file in dir, returning its path, or an empty string
+// if it couldn't be written.
+static std::string writeTempFile(const std::string &dir, const std::vector<uint8_t> &bytes) {
+    std::string path = dir + "/quollvm-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) return "";
+    std::size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t amount = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (amount < 0 && errno == EINTR) continue;
+        if (amount <= 0) break;
+        written += amount;
+    }
+    if (::close(fd) != 0 || written < bytes.size()) {
+        unlink(path.c_str());
+        return "";
+    }
+    return path;
+}
+
+static bool readFile(const std::string &path, std::vector<uint8_t> &bytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    bytes.resize(info.st_size);
+    std::size_t got = 0;
+    while (got < bytes.size()) {
+        ssize_t amount = ::read(fd, bytes.data() + got, bytes.size() - got);
+        if (amount < 0 && errno == EINTR) continue;
+        if (amount <= 0) break;
+        got += amount;
+    }
+    ::close(fd);
+    return got == bytes.size();
+}
+
+void WorkQueue::push(HostSession *session) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSessions.push_back(session);
+}
+
+HostSession* WorkQueue::take() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mSessions.empty()) return nullptr;
+    HostSession *session = mSessions.front();
+    mSessions.pop_front();
+    return session;
+}
+
+HostSession* WorkQueue::steal() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mSessions.empty()) return nullptr;
+    HostSession *session = mSessions.back();
+    mSessions.pop_back();
+    return session;
+}
+
+SessionHost::SessionHost(std::shared_ptr<const GameImage> image, const HostOptions &options)
+: mImage(image), mOptions(options), mQueued(0), mNextQueue(0), mStopping(false),
+  mStopRequested(false), mListener(-1)
+{
+    if (pipe(mWake) != 0) {
+        std::cerr << "Could not create pipe: " << strerror(errno) << '\n';
+        mWake[0] = mWake[1] = -1;
+        return;
+    }
+    for (int fd : mWake) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+SessionHost::~SessionHost() {
+    for (int fd : mConnected) ::close(fd);
+    for (auto &entry : mSessions) ::close(entry.first);
+    mSessions.clear();
+    if (mListener >= 0) {
+        ::close(mListener);
+        unlink(mPath.c_str());
+    }
+    for (int fd : mWake) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+bool SessionHost::listen(const std::string &path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path " << path << " is too long.\n";
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Could not create socket: " << strerror(errno) << '\n';
+        return false;
+    }
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "Could not listen on " << path << ": " << strerror(errno) << '\n';
+        ::close(fd);
+        return false;
+    }
+    mListener = fd;
+    mPath = path;
+    return true;
+}
+
+void SessionHost::connect(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(mChangeLock);
+        mConnected.push_back(fd);
+    }
+    wake();
+}
+
+// Sends everything written to the session's output since it was last sent, or
+// as much as the connection takes; serve sends the rest once it can.
+void SessionHost::sendOutput(HostSession *session) {
+    const std::string text = session->out.str();
+    if (text.empty()) return;
+    session->out.str("");
+    bool waiting;
+    {
+        std::lock_guard<std::mutex> lock(session->lock);
+        const bool hadUnsent = !session->unsent.empty();
+        session->unsent += text;
+        waiting = flushOutput(session) && !hadUnsent;
+    }
+    // serve only watches connections for space to write while they have
+    // output waiting
+    if (waiting) wake();
+}
+
+void SessionHost::serve() {
+    unsigned threads = mOptions.threads;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    mStopping = false;
+    mQueues.clear();
+    for (unsigned i = 0; i < threads; ++i) mQueues.emplace_back(new WorkQueue);
+    for (unsigned i = 0; i < threads; ++i) mWorkers.emplace_back(&SessionHost::work, this, i);
+
+    std::vector<pollfd> polled;
+    std::vector<HostSession*> polledSessions;
+    while (!mStopRequested) {
+        {
+            std::lock_guard<std::mutex> lock(mChangeLock);
+            for (HostSession *session : mFinished) session->closing = true;
+            mFinished.clear();
+            for (int fd : mConnected) add(fd);
+            mConnected.clear();
+        }
+
+        // the wake pipe and listener come before the connections
+        polled.clear();
+        polledSessions.clear();
+        polled.push_back(pollfd{mWake[0], POLLIN, 0});
+        if (mListener >= 0) polled.push_back(pollfd{mListener, POLLIN, 0});
+        const unsigned firstSession = polled.size();
+        // ended sessions are closed once their output has been sent
+        for (auto entry = mSessions.begin(); entry != mSessions.end(); ) {
+            HostSession *session = entry->second.get();
+            ++entry;
+            short events = 0;
+            {
+                std::lock_guard<std::mutex> lock(session->lock);
+                if (!session->closing && !session->hungUp) events |= POLLIN;
+                if (!session->unsent.empty()) events |= POLLOUT;
+            }
+            if (events) {
+                polled.push_back(pollfd{session->fd, events, 0});
+                polledSessions.push_back(session);
+            } else if (session->closing) {
+                remove(session);
+            }
+        }
+
+        // with an idle time, wake up often enough to hibernate sessions
+        // that have waited too long
+        const int timeout = mOptions.idleTime > 0
+                          ? static_cast<int>(std::min<long>(mOptions.idleTime, INT_MAX)) : -1;
+        if (poll(polled.data(), polled.size(), timeout) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Could not wait for input: " << strerror(errno) << '\n';
+            break;
+        }
+        if (polled[0].revents) {
+            char buffer[64];
+            while (read(mWake[0], buffer, sizeof(buffer)) > 0) { }
+        }
+        if (mListener >= 0 && polled[1].revents) accept();
+        for (unsigned i = firstSession; i < polled.size(); ++i) {
+            HostSession *session = polledSessions[i - firstSession];
+            const short events = polled[i].events, revents = polled[i].revents;
+            if ((events & POLLIN) && (revents & (POLLIN | POLLHUP | POLLERR))) receive(session);
+            if ((events & POLLOUT) && (revents & (POLLOUT | POLLHUP | POLLERR))) {
+                std::lock_guard<std::mutex> lock(session->lock);
+                flushOutput(session);
+            }
+        }
+        if (mOptions.idleTime > 0) hibernateIdle();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mIdleLock);
+        mStopping = true;
+    }
+    mIdle.notify_all();
+    for (std::thread &worker : mWorkers) worker.join();
+    mWorkers.clear();
+    mStopRequested = false;
+}
+
+void SessionHost::stop() {
+    mStopRequested = true;
+    wake();
+}
+
+void SessionHost::wake() {
+    char signal = 0;
+    ssize_t written = write(mWake[1], &signal, 1);
+    (void)written;
+}
+
+void SessionHost::work(unsigned index) {
+    while (HostSession *session = nextSession(index)) {
+        runSession(session, index);
+    }
+}
+
+// The next session for a worker to run, from its own queue if it has one and
+// otherwise stolen from another worker's. Returns nullptr once the host stops.
+HostSession* SessionHost::nextSession(unsigned index) {
+    const unsigned count = mQueues.size();
+    while (1) {
+        for (unsigned i = 0; i < count; ++i) {
+            WorkQueue &queue = *mQueues[(index + i) % count];
+            HostSession *session = i == 0 ? queue.take() : queue.steal();
+            if (session) {
+                --mQueued;
+                return session;
+            }
+        }
+        std::unique_lock<std::mutex> lock(mIdleLock);
+        mIdle.wait(lock, [this]() { return mStopping || mQueued > 0; });
+        if (mStopping) return nullptr;
+    }
+}
+
+void SessionHost::schedule(HostSession *session, unsigned index) {
+    mQueues[index % mQueues.size()]->push(session);
+    ++mQueued;
+    {
+        // taken so that a worker can't miss the change between checking
+        // mQueued and going to sleep
+        std::lock_guard<std::mutex> lock(mIdleLock);
+    }
+    mIdle.notify_one();
+}
+
+void SessionHost::runSession(HostSession *session, unsigned index) {
+    try {
+        if (step(session)) schedule(session, index);
+    } catch (GameError &e) {
+        session->out << "\nRUNTIME ERROR: " << e.what() << '\n';
+        sendOutput(session);
+        finish(session);
+    } catch (std::exception &e) {
+        // such as running out of memory; escaping the worker would end every
+        // session, so only this one is
+        session->out << "\nFATAL ERROR: " << e.what() << '\n';
+        sendOutput(session);
+        finish(session);
+    }
+}
+
+// Runs a session until its slice runs out, it needs input that hasn't arrived,
+// or it ends. Returns true if it should be queued again to use another slice.
+bool SessionHost::step(HostSession *session) {
+    TextPlayer &player = session->player;
+    if (!session->hibernated.empty()) wakeSession(session);
+    if (!session->started) {
+        player.start();
+        session->started = true;
+        session->inTurn = true;
+    }
+    while (1) {
+        if (session->inTurn) {
+            const bool turnOver = player.run(mOptions.slice);
+            sendOutput(session);
+            if (!turnOver) return true;
+            session->inTurn = false;
+            if (player.ended()) break;
+        }
+
+        std::string line;
+        {
+            std::lock_guard<std::mutex> lock(session->lock);
+            std::string::size_type end = session->pending.find('\n');
+            if (end == std::string::npos) {
+                if (session->hungUp) break;
+                session->state = HostSession::Waiting;
+                session->idleSince = std::chrono::steady_clock::now();
+                return false;
+            }
+            line = session->pending.substr(0, end);
+            session->pending.erase(0, end + 1);
+        }
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        const InputResult result = player.input(line);
+        sendOutput(session);
+        if (result == InputResult::Quit) break;
+        if (result == InputResult::Accepted) session->inTurn = true;
+    }
+    finish(session);
+    return false;
+}
+
+// Hands an ended session back to serve to close.
+void SessionHost::finish(HostSession *session) {
+    {
+        std::lock_guard<std::mutex> lock(session->lock);
+        session->state = HostSession::Finished;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mChangeLock);
+        mFinished.push_back(session);
+    }
+    wake();
+}
+
+void SessionHost::accept() {
+    int fd = ::accept(mListener, nullptr, nullptr);
+    if (fd >= 0) add(fd);
+}
+
+void SessionHost::add(int fd) {
+    // workers send output without waiting for a player to read it
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    HostSession *session = new HostSession(mImage, fd, mOptions);
+    mSessions[fd].reset(session);
+    schedule(session, mNextQueue++);
+}
+
+void SessionHost::receive(HostSession *session) {
+    char buffer[4096];
+    ssize_t amount = read(session->fd, buffer, sizeof(buffer));
+    if (amount < 0 && (errno == EINTR || errno == EAGAIN)) return;
+
+    bool ready = false, ended = false;
+    {
+        std::lock_guard<std::mutex> lock(session->lock);
+        if (amount > 0) {
+            session->pending.append(buffer, amount);
+        } else {
+            // a last line without a newline still counts
+            session->hungUp = true;
+            if (!session->pending.empty() && session->pending.back() != '\n') {
+                session->pending += '\n';
+            }
+        }
+        if (session->state == HostSession::Waiting) {
+            if (session->pending.find('\n') != std::string::npos) {
+                session->state = HostSession::Ready;
+                ready = true;
+            } else if (session->hungUp) {
+                ended = true;
+            }
+        }
+    }
+    if (ready) schedule(session, mNextQueue++);
+    if (ended) finish(session);
+}
+
+// Hibernates every session that has been waiting for input for longer than
+// the idle time. Only serve makes a waiting session ready again, so none of
+// them can be running while serve hibernates them.
+void SessionHost::hibernateIdle() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto idleTime = std::chrono::milliseconds(mOptions.idleTime);
+    for (auto &entry : mSessions) {
+        HostSession *session = entry.second.get();
+        {
+            std::lock_guard<std::mutex> lock(session->lock);
+            if (session->state != HostSession::Waiting || !session->hibernated.empty()) continue;
+            if (now - session->idleSince < idleTime) continue;
+        }
+        hibernate(session);
+    }
+}
+
+// A session that can't be written out is woken again at once, and tried
+// again after another idle time.
+void SessionHost::hibernate(HostSession *session) {
+    std::vector<uint8_t> state;
+    session->player.hibernate(state);
+    session->hibernated = writeTempFile(mOptions.hibernateDir, state);
+    if (session->hibernated.empty()) {
+        std::cerr << "Could not hibernate a session in " << mOptions.hibernateDir << ": "
+                  << strerror(errno) << '\n';
+        session->player.wake(state);
+        session->idleSince = std::chrono::steady_clock::now();
+    }
+}
+
+void SessionHost::wakeSession(HostSession *session) {
+    std::vector<uint8_t> state;
+    const bool haveState = readFile(session->hibernated, state);
+    unlink(session->hibernated.c_str());
+    session->hibernated.clear();
+    if (!haveState) throw GameError("Could not read the hibernated session.");
+    session->player.wake(state);
+}
+
+void SessionHost::remove(HostSession *session) {
+    const int fd = session->fd;
+    ::close(fd);
+    mSessions.erase(fd);
+}
@@ -0,0 +1,124 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gamedata.h"
+
+struct HostSession;
+
+// Instructions a session runs before its worker moves on to another session.
+const long HOST_SLICE = 100000;
+
+// How the host runs each session; the fields match the runner's options.
+struct HostOptions {
+    HostOptions()
+    : threads(0), slice(HOST_SLICE), useDecoded(false), checkedOnly(false),
+      jitMode(JitMode::Off), gcMode(GcMode::Generational), turnLimit(0), undoLevels(0),
+      idleTime(0), hibernateDir("/tmp")
+    { }
+
+    unsigned threads;       // workers to run sessions on; 0 for one per core
+    long slice;
+    bool useDecoded;
+    bool checkedOnly;
+    JitMode jitMode;
+    GcMode gcMode;
+    long turnLimit;
+    unsigned undoLevels;
+    long idleTime;          // milliseconds a session waits for input before it's hibernated; 0 for never
+    std::string hibernateDir;
+    std::string title;      // shown in each session's status line
+};
+
+// The sessions ready to run on one worker. The worker takes them from the
+// front, so that sessions which used up their slice wait behind the others,
+// and idle workers steal from the back.
+class WorkQueue {
+public:
+    void push(HostSession *session);
+    HostSession* take();
+    HostSession* steal();
+private:
+    std::mutex mLock;
+    std::deque<HostSession*> mSessions;
+};
+
+// Plays many sessions of one game at once, each over its own connection,
+// using a pool of worker threads. A single thread waits on every connection;
+// when a line of input arrives for a session waiting on one, the session is
+// queued on one of the workers in turn. A worker runs it for a slice of
+// instructions, until the game is waiting for input again, or until its slice
+// runs out, when it goes to the back of the worker's queue. Workers with
+// nothing queued steal sessions from the others. Each connection starts a new
+// session, which ends, closing the connection, when the game does, the
+// player quits, or the other end is closed. Workers never wait on a
+// connection: output it can't take yet is kept with the session, and serve
+// sends it as the player reads.
+//
+// A session left waiting for input for longer than the idle time is
+// hibernated: serve saves its state to a file and frees it, and the worker
+// that next runs it loads it back.
+class SessionHost {
+public:
+    SessionHost(std::shared_ptr<const GameImage> image, const HostOptions &options);
+    ~SessionHost();
+    SessionHost(const SessionHost&) = delete;
+    SessionHost& operator=(const SessionHost&) = delete;
+
+    // Accepts connections on a Unix-domain socket at path. Returns false,
+    // having reported why, if the socket couldn't be created.
+    bool listen(const std::string &path);
+    // Starts a session playing over fd, a connected stream socket. The host
+    // closes it when the session ends.
+    void connect(int fd);
+    // Plays sessions until stop is called, on the calling thread and the
+    // workers it starts. Sessions left unfinished end with the host.
+    void serve();
+    // Makes serve return; safe to call from a signal handler.
+    void stop();
+private:
+    void work(unsigned index);
+    HostSession* nextSession(unsigned index);
+    void schedule(HostSession *session, unsigned index);
+    void runSession(HostSession *session, unsigned index);
+    bool step(HostSession *session);
+    void finish(HostSession *session);
+    void sendOutput(HostSession *session);
+    void accept();
+    void add(int fd);
+    void receive(HostSession *session);
+    void remove(HostSession *session);
+    void hibernateIdle();
+    void hibernate(HostSession *session);
+    void wakeSession(HostSession *session);
+    void wake();
+
+    std::shared_ptr<const GameImage> mImage;
+    HostOptions mOptions;
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::vector<std::thread> mWorkers;
+    std::atomic<int> mQueued;           // sessions waiting in any queue
+    std::atomic<unsigned> mNextQueue;
+    std::mutex mIdleLock;               // held by workers going to sleep
+    std::condition_variable mIdle;
+    bool mStopping;
+    std::atomic<bool> mStopRequested;
+
+    int mListener;
+    std::string mPath;
+    int mWake[2];                       // a pipe written to wake serve
+    std::mutex mChangeLock;             // guards the two lists below
+    std::vector<int> mConnected;        // connections serve has yet to add
+    std::vector<HostSession*> mFinished;// sessions serve has yet to remove
+    std::map<int, std::unique_ptr<HostSession>> mSessions;  // by connection, used only by serve
+};
+
+#endif
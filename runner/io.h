@@ -15,20 +15,20 @@ namespace IO {
         White
     };
 
-    std::string bold() {
+    inline std::string bold() {
         return "\x1B[1m";
     }
-    std::string underline() {
+    inline std::string underline() {
         return "\x1B[4m";
     }
-    std::string normal() {
+    inline std::string normal() {
         return "\x1B[0m";
     }
 
-    std::string setFG(Color color) {
+    inline std::string setFG(Color color) {
         return "\x1B[" + std::to_string(static_cast<int>(color)) + "m";
     }
-    std::string setBG(Color color) {
+    inline std::string setBG(Color color) {
         return "\x1B[" + std::to_string(10 + static_cast<int>(color)) + "m";
     }
 };
@@ -0,0 +1,943 @@
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "gamedata.h"
+#include "opcode.h"
+#include "stack.h"
+
+// The JIT translates the decoded form of a hot function into x86-64 machine
+// code by stitching together a template for each instruction. Most templates
+// call a helper below that does the work of the instruction, so what the
+// machine code saves is dispatch: control flow within the function, including
+// every jump, is done by the machine code itself. The instructions the decoded
+// engine leaves to execute aren't compiled; reaching one returns to the
+// decoded engine, which runs it and re-enters the machine code at the next
+// compiled instruction. Calls and returns between compiled
+// functions go straight from one function's machine code to the other's
+// without returning to the decoded engine. The helpers mirror the checked
+// handlers of the decoded engine, so compiled code behaves the same whether or
+// not the function was verified; only calls and returns have verified forms,
+// which leave out the checks of the decoded engine's fast handlers. A call
+// of a function pushed just before it has the function looked up when it's
+// compiled. The instruction budget is checked wherever
+// the machine code could loop: on backward and computed jumps, and calls and
+// returns; once it's spent, the decoded engine is left to yield.
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define HAVE_JIT
+#endif
+
+#ifdef HAVE_JIT
+
+struct NativeCode {
+    NativeCode()
+    : code(nullptr), size(0) { }
+    ~NativeCode() {
+        if (code) munmap(code, size);
+    }
+
+    uint8_t *code;
+    size_t size;
+    std::vector<const void*> entries;   // address of each instruction's template
+};
+
+// Kept in rbx while the machine code runs; calls and returns change it to the
+// function they continue in.
+struct NativeState {
+    const void *const *entries;     // of the function now running
+    const DecodedOp *exit;          // where the decoded engine is to continue
+    const FunctionDef *function;
+    long budget;                    // instructions that may run before leaving
+};
+
+// the machine code is entered through its prologue as this
+typedef const DecodedOp* (*NativeEntry)(GameData *data, const void *start,
+                                        long *instructionCount, NativeState *state,
+                                        gtCallStack::Window *window);
+static_assert(sizeof(long) == 8, "the epilogue adds to instructionCount as 64 bits");
+
+typedef void (*StepFn)(GameData &data, const DecodedOp &op);
+typedef int (*BranchFn)(GameData &data, const FunctionDef &function, const DecodedOp &op);
+typedef const void* (*TransferFn)(GameData &data, const DecodedOp &op, NativeState &state,
+                                  FunctionDef *callee);
+
+// Exceptions can't unwind through the machine code, so the helpers catch them
+// and return -1 (nullptr for transfers); runNative throws them again once back
+// in C++.
+template<StepFn step>
+static int runStep(GameData *data, const DecodedOp *op) {
+    try {
+        step(*data, *op);
+        return 0;
+    } catch (...) {
+        data->nativeError = std::current_exception();
+        return -1;
+    }
+}
+template<BranchFn branch>
+static int runBranch(GameData *data, const DecodedOp *op, const FunctionDef *function) {
+    try {
+        return branch(*data, *function, *op);
+    } catch (...) {
+        data->nativeError = std::current_exception();
+        return -1;
+    }
+}
+template<TransferFn transfer>
+static const void* runTransfer(GameData *data, const DecodedOp *op, NativeState *state,
+                               FunctionDef *callee) {
+    try {
+        return transfer(*data, *op, *state, callee);
+    } catch (...) {
+        data->nativeError = std::current_exception();
+        state->exit = op;
+        return nullptr;
+    }
+}
+
+static int indexOf(const FunctionDef &function, const DecodedOp &op) {
+    return &op - function.decoded.ops.data();
+}
+// the index of the instruction at an offset within the function, as locate
+// finds it
+static int indexAt(const FunctionDef &function, int offset) {
+    const DecodedCode &code = function.decoded;
+    unsigned IP = function.position + offset;
+    unsigned relative = IP - function.position;
+    if (IP < function.position || relative >= code.index.size() || code.index[relative] < 0) {
+        throw GameError("Tried to execute invalid code position " + std::to_string(IP) + ".");
+    }
+    return code.index[relative];
+}
+
+static void stepPush32(GameData &data, const DecodedOp &op) {
+    data.callStack.push(op.operand);
+}
+static void stepStore(GameData &data, const DecodedOp &op) {
+    Value localId = data.callStack.popRaw();
+    Value value = data.callStack.pop();
+    localId.requireType(Value::VarRef);
+    if (localId.value < 0 || localId.value >= data.callStack.localCount()) {
+        throw GameError("Illegal local number.");
+    }
+    data.callStack.setLocal(localId.value, value);
+}
+static void stepStackPop(GameData &data, const DecodedOp &op) {
+    data.callStack.pop();
+}
+static void stepStackDup(GameData &data, const DecodedOp &op) {
+    data.callStack.push(data.callStack.peek());
+}
+static void stepGetItem(GameData &data, const DecodedOp &op) {
+    Value from = data.callStack.pop();
+    Value index = data.callStack.pop();
+    Value result;
+    switch(from.type) {
+        case Value::Object:
+            index.requireType(Value::Property);
+            result = data.getProperty(op.nextIP - 1, from.value, index.value);
+            break;
+        case Value::List:
+            index.requireType(Value::Integer);
+            result = data.getList(from.value).get(index.value);
+            break;
+        case Value::Map:
+            result = data.getMap(from.value).get(index);
+            break;
+        default:
+            throw GameError("get requires list, map, or object.");
+    }
+    data.callStack.push(result);
+}
+static void stepSetItem(GameData &data, const DecodedOp &op) {
+    Value from = data.callStack.pop();
+    Value index = data.callStack.pop();
+    Value toValue = data.callStack.pop();
+    switch(from.type) {
+        case Value::Object: {
+            index.requireType(Value::Property);
+            data.setProperty(data.editObject(from.value), index.value, toValue);
+            break; }
+        case Value::List: {
+            index.requireType(Value::Integer);
+            ListDef &listDef = data.editList(from.value);
+            listDef.set(index.value, toValue);
+            data.writeBarrier(Value::List, listDef, toValue);
+            break; }
+        case Value::Map: {
+            MapDef &mapDef = data.editMap(from.value);
+            mapDef.set(index, toValue);
+            data.writeBarrier(Value::Map, mapDef, index);
+            data.writeBarrier(Value::Map, mapDef, toValue);
+            break; }
+        default:
+            throw GameError("setp requires list, map, or object.");
+    }
+}
+
+// NotEqual pushes the result of compare itself rather than a boolean
+template<int opcode>
+static void stepCompare(GameData &data, const DecodedOp &op) {
+    Value rhs = data.callStack.pop();
+    Value lhs = data.callStack.pop();
+    int result = opcode == OpcodeDef::NotEqual ? lhs.compare(rhs)
+                                               : GameData::compareFor(opcode, lhs, rhs);
+    data.callStack.push(Value{Value::Integer, result});
+}
+static void stepNot(GameData &data, const DecodedOp &op) {
+    Value v = data.callStack.pop();
+    data.callStack.push(Value(Value::Integer, v.isTrue() ? 0 : 1));
+}
+
+template<int opcode>
+static void stepArithmetic(GameData &data, const DecodedOp &op) {
+    Value rhs = data.callStack.pop();
+    Value lhs = data.callStack.pop();
+    lhs.requireType(Value::Integer);
+    rhs.requireType(Value::Integer);
+    if (opcode == OpcodeDef::Div || opcode == OpcodeDef::Mod) lhs.requireDivisorOf(rhs.value);
+    int result = 0;
+    switch(opcode) {
+        case OpcodeDef::Add:    result = rhs.value + lhs.value; break;
+        case OpcodeDef::Sub:    result = rhs.value - lhs.value; break;
+        case OpcodeDef::Mult:   result = rhs.value * lhs.value; break;
+        case OpcodeDef::Div:    result = rhs.value / lhs.value; break;
+        case OpcodeDef::Mod:    result = rhs.value % lhs.value; break;
+    }
+    data.callStack.push(Value{Value::Integer, result});
+}
+template<int opcode>
+static void stepLocalArithmetic(GameData &data, const DecodedOp &op) {
+    Value local = data.callStack.localAt(op.operand.value);
+    Value lhs = data.callStack.pop();
+    lhs.requireType(Value::Integer);
+    local.requireType(Value::Integer);
+    int result = opcode == OpcodeDef::AddLocal ? local.value + lhs.value
+                                               : local.value - lhs.value;
+    data.callStack.push(Value{Value::Integer, result});
+}
+static void stepIncLocal(GameData &data, const DecodedOp &op) {
+    Value &local = data.callStack.localAt(op.operand.value);
+    local.requireType(Value::Integer);
+    local.value += op.aux;
+}
+static void stepStoreLocal(GameData &data, const DecodedOp &op) {
+    data.callStack.localAt(op.operand.value) = data.callStack.pop();
+}
+static void stepLoadLocal(GameData &data, const DecodedOp &op) {
+    Value local = data.callStack.localAt(op.operand.value);
+    data.callStack.push(local);
+}
+
+static int branchJump(GameData &data, const FunctionDef &function, const DecodedOp &op) {
+    Value target = data.callStack.pop();
+    target.requireType(Value::JumpTarget);
+    return indexAt(function, target.value);
+}
+template<bool whenTrue>
+static int branchConditional(GameData &data, const FunctionDef &function, const DecodedOp &op) {
+    Value target = data.callStack.pop();
+    Value condition = data.callStack.pop();
+    target.requireType(Value::JumpTarget);
+    if (condition.isTrue() == whenTrue) return indexAt(function, target.value);
+    return indexOf(function, op) + 1;
+}
+template<bool whenTrue>
+static int branchCompare(GameData &data, const FunctionDef &function, const DecodedOp &op) {
+    Value rhs = data.callStack.pop();
+    Value lhs = data.callStack.pop();
+    if (GameData::compareFor(op.aux, lhs, rhs) == whenTrue) {
+        return indexAt(function, op.operand.value);
+    }
+    return indexOf(function, op) + 1;
+}
+
+// Continue at the instruction at index in function: in its machine code if it
+// has any, otherwise in the decoded engine. The exit is set either way, for
+// when the budget is spent.
+static const void* continueAt(NativeState &state, const FunctionDef &function, int index) {
+    state.function = &function;
+    state.exit = &function.decoded.ops[index];
+    if (function.native) {
+        state.entries = function.native->entries.data();
+        return state.entries[index];
+    }
+    return nullptr;
+}
+// callee is the function the call was compiled for, if any; any other
+// function found on the stack is looked up as usual. A verified caller's pops
+// and argument count go unchecked, as in the decoded engine's fast handlers.
+template<bool verified>
+static const void* transferCall(GameData &data, const DecodedOp &op, NativeState &state,
+                                FunctionDef *callee) {
+    gtCallStack &stack = data.callStack;
+    Value functionId = verified ? stack.popUnchecked() : stack.pop();
+    Value argCount = verified ? stack.popUnchecked() : stack.pop();
+    if (functionId.type != Value::Function) functionId.requireType(Value::Function);
+    if (!verified) argCount.requireType(Value::Integer);
+    Value self = data.noneValue;
+    if (functionId.selfObj > 0) self = Value(Value::Object, functionId.selfObj);
+
+    stack.callTop().IP = op.nextIP;
+    FunctionDef &newFunc = callee && functionId.value == static_cast<int>(callee->ident)
+                         ? *callee : data.getFunction(functionId.value);
+    if (!newFunc.isDecoded) data.prepareFunction(newFunc);
+    stack.create(newFunc, functionId.value, self, argCount.value);
+    if (newFunc.typedArgs)
+    for (int i = 0; i < stack.localCount(); ++i) {
+        const Value &arg = stack.getLocal(i);
+        if (newFunc.argTypes[i] != Value::Any && arg.type != newFunc.argTypes[i]) {
+            const std::string &name = data.getString(newFunc.srcName).text();
+            std::stringstream ss;
+            ss << "Function " << name << " expected argument ";
+            ss << i << " to be " <<  newFunc.argTypes[i];
+            ss << " but received " << arg.type;
+            throw GameError(ss.str());
+        }
+    }
+    if (data.jitMode == JitMode::Hot && ++newFunc.callCount == JIT_THRESHOLD) {
+        data.compileNative(newFunc, data.nativeEnter);
+    }
+    if (newFunc.decoded.ops.empty()) indexAt(newFunc, 0);    // reports the bad position
+    return continueAt(state, newFunc, 0);
+}
+template<bool verified>
+static const void* transferReturn(GameData &data, const DecodedOp &op, NativeState &state,
+                                  FunctionDef *callee) {
+    gtCallStack &stack = data.callStack;
+    if (stack.size() <= 1) {
+        // ending the program is left to the decoded engine, which counts the
+        // instruction again
+        --data.instructionCount;
+        state.exit = &op;
+        return nullptr;
+    }
+    Value retValue = data.noneValue;
+    if (!stack.stackEmpty()) {
+        retValue = verified ? stack.popUnchecked() : stack.pop();
+    }
+    stack.drop();
+    stack.push(retValue);
+    const gtCallStack::Frame &caller = stack.callTop();
+    const FunctionDef &function = caller.funcDef;
+    return continueAt(state, function, indexAt(function, caller.IP - function.position));
+}
+
+// the generic form of a quickened instruction; compiled code doesn't quicken
+static int baseOpcode(int opcode) {
+    switch(opcode) {
+        case QuickOpcode::AddInt:                   return OpcodeDef::Add;
+        case QuickOpcode::SubInt:                   return OpcodeDef::Sub;
+        case QuickOpcode::MultInt:                  return OpcodeDef::Mult;
+        case QuickOpcode::EqualInt:
+        case QuickOpcode::EqualIdent:               return OpcodeDef::Equal;
+        case QuickOpcode::NotEqualInt:
+        case QuickOpcode::NotEqualIdent:            return OpcodeDef::NotEqual;
+        case QuickOpcode::LessThanInt:              return OpcodeDef::LessThan;
+        case QuickOpcode::LessThanEqualInt:         return OpcodeDef::LessThanEqual;
+        case QuickOpcode::GreaterThanInt:           return OpcodeDef::GreaterThan;
+        case QuickOpcode::GreaterThanEqualInt:      return OpcodeDef::GreaterThanEqual;
+        case QuickOpcode::CompareJumpZeroInt:       return OpcodeDef::CompareJumpZero;
+        case QuickOpcode::CompareJumpNotZeroInt:    return OpcodeDef::CompareJumpNotZero;
+        case QuickOpcode::AddLocalInt:              return OpcodeDef::AddLocal;
+        case QuickOpcode::SubLocalInt:              return OpcodeDef::SubLocal;
+        case QuickOpcode::GetProperty:              return OpcodeDef::GetItem;
+        default:                                    return opcode;
+    }
+}
+
+static void* stepFor(int opcode) {
+    switch(opcode) {
+        case OpcodeDef::Push32:             return (void*)&runStep<stepPush32>;
+        case OpcodeDef::Store:              return (void*)&runStep<stepStore>;
+        case OpcodeDef::StackPop:           return (void*)&runStep<stepStackPop>;
+        case OpcodeDef::StackDup:           return (void*)&runStep<stepStackDup>;
+        case OpcodeDef::GetItem:            return (void*)&runStep<stepGetItem>;
+        case OpcodeDef::SetItem:            return (void*)&runStep<stepSetItem>;
+        case OpcodeDef::Equal:              return (void*)&runStep<stepCompare<OpcodeDef::Equal> >;
+        case OpcodeDef::NotEqual:           return (void*)&runStep<stepCompare<OpcodeDef::NotEqual> >;
+        case OpcodeDef::LessThan:           return (void*)&runStep<stepCompare<OpcodeDef::LessThan> >;
+        case OpcodeDef::LessThanEqual:      return (void*)&runStep<stepCompare<OpcodeDef::LessThanEqual> >;
+        case OpcodeDef::GreaterThan:        return (void*)&runStep<stepCompare<OpcodeDef::GreaterThan> >;
+        case OpcodeDef::GreaterThanEqual:   return (void*)&runStep<stepCompare<OpcodeDef::GreaterThanEqual> >;
+        case OpcodeDef::Not:                return (void*)&runStep<stepNot>;
+        case OpcodeDef::Add:                return (void*)&runStep<stepArithmetic<OpcodeDef::Add> >;
+        case OpcodeDef::Sub:                return (void*)&runStep<stepArithmetic<OpcodeDef::Sub> >;
+        case OpcodeDef::Mult:               return (void*)&runStep<stepArithmetic<OpcodeDef::Mult> >;
+        case OpcodeDef::Div:                return (void*)&runStep<stepArithmetic<OpcodeDef::Div> >;
+        case OpcodeDef::Mod:                return (void*)&runStep<stepArithmetic<OpcodeDef::Mod> >;
+        case OpcodeDef::AddLocal:           return (void*)&runStep<stepLocalArithmetic<OpcodeDef::AddLocal> >;
+        case OpcodeDef::SubLocal:           return (void*)&runStep<stepLocalArithmetic<OpcodeDef::SubLocal> >;
+        case OpcodeDef::IncLocal:           return (void*)&runStep<stepIncLocal>;
+        case OpcodeDef::StoreLocal:         return (void*)&runStep<stepStoreLocal>;
+        case OpcodeDef::LoadLocal:          return (void*)&runStep<stepLoadLocal>;
+        default:                            return nullptr;
+    }
+}
+static void* branchFor(int opcode) {
+    switch(opcode) {
+        case OpcodeDef::Jump:               return (void*)&runBranch<branchJump>;
+        case OpcodeDef::JumpZero:           return (void*)&runBranch<branchConditional<false> >;
+        case OpcodeDef::JumpNotZero:        return (void*)&runBranch<branchConditional<true> >;
+        case OpcodeDef::CompareJumpZero:    return (void*)&runBranch<branchCompare<false> >;
+        case OpcodeDef::CompareJumpNotZero: return (void*)&runBranch<branchCompare<true> >;
+        default:                            return nullptr;
+    }
+}
+static void* transferFor(int opcode, bool verified) {
+    switch(opcode) {
+        case OpcodeDef::Call:
+            return verified ? (void*)&runTransfer<transferCall<true> >
+                            : (void*)&runTransfer<transferCall<false> >;
+        case OpcodeDef::Return:
+            return verified ? (void*)&runTransfer<transferReturn<true> >
+                            : (void*)&runTransfer<transferReturn<false> >;
+        default:
+            return nullptr;
+    }
+}
+
+// Collects the machine code. Jumps to labels that haven't been placed yet are
+// recorded and patched once every label's position is known.
+class Assembler {
+public:
+    explicit Assembler(unsigned labelCount)
+    : labels(labelCount) { }
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+        code.insert(code.end(), bytes);
+    }
+    void emit32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) code.push_back(value >> (i * 8));
+    }
+    void emit64(uint64_t value) {
+        for (int i = 0; i < 8; ++i) code.push_back(value >> (i * 8));
+    }
+    void place(unsigned label) {
+        labels[label] = code.size();
+    }
+    // emits opcode followed by a rel32 to label
+    void jump(std::initializer_list<uint8_t> opcode, unsigned label) {
+        emit(opcode);
+        fixups.push_back(Fixup{code.size(), label});
+        emit32(0);
+    }
+    void patch() {
+        for (const Fixup &fixup : fixups) {
+            uint32_t rel = labels[fixup.label] - (fixup.at + 4);
+            std::memcpy(&code[fixup.at], &rel, 4);
+        }
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<size_t> labels;
+private:
+    struct Fixup {
+        size_t at;
+        unsigned label;
+    };
+    std::vector<Fixup> fixups;
+};
+
+// Builds the machine code for one function. Labels are numbered: each
+// instruction's template, then the error exit of each, then the slow path of
+// each inlined one, then the shared epilogue, state exit, and budget exit.
+// A verified function has templates that work on the stack directly and the
+// verified forms of calls and returns.
+class NativeCompiler {
+public:
+    NativeCompiler(GameData &data, FunctionDef &function, bool verified)
+    : data(data), function(function), ops(function.decoded.ops), count(ops.size()),
+      verified(verified), epilogue(count * 3), stateExit(count * 3 + 1),
+      budgetExit(count * 3 + 2), a(count * 3 + 3) { }
+
+    bool compile();
+
+    GameData &data;
+    FunctionDef &function;
+    std::vector<DecodedOp> &ops;
+    const unsigned count;
+    const bool verified;
+    const unsigned epilogue, stateExit, budgetExit;
+    Assembler a;
+
+private:
+    unsigned errorExit(unsigned i) const {
+        return count + i;
+    }
+    unsigned slowPath(unsigned i) const {
+        return count * 2 + i;
+    }
+    void toSlowPath(unsigned i, std::initializer_list<uint8_t> jcc) {
+        if (slowPaths.empty() || slowPaths.back() != i) slowPaths.push_back(i);
+        a.jump(jcc, slowPath(i));
+    }
+    bool emitInline(unsigned i, int opcode);
+    void emitHelper(unsigned i, int opcode);
+    void emitTransfer(unsigned i, void *transfer);
+    FunctionDef* knownCallee(unsigned i);
+    void emitExit(unsigned i);
+    void emitIndexJump();
+    void emitBudgetCheck(unsigned exit);
+    void emitPop(int count);
+    void emitIntGuard(int offset);
+
+    std::vector<unsigned> slowPaths;    // instructions that need one
+};
+
+// Instructions are counted before they run, as the decoded engine does.
+void NativeCompiler::emitExit(unsigned i) {
+    a.emit({0x48, 0xB8});                   // mov rax, &ops[i]
+    a.emit64(reinterpret_cast<uintptr_t>(&ops[i]));
+    a.jump({0xE9}, epilogue);               // jmp epilogue
+}
+
+// jump to the instruction at the bytecode offset in ecx
+void NativeCompiler::emitIndexJump() {
+    a.emit({0x48, 0xBA});                   // mov rdx, &index[0]
+    a.emit64(reinterpret_cast<uintptr_t>(function.decoded.index.data()));
+    a.emit({0x48, 0x63, 0x04, 0x8A});       // movsxd rax, [rdx + rcx * 4]
+    emitBudgetCheck(budgetExit);
+    a.emit({0x48, 0x8B, 0x0B});             // mov rcx, [rbx]       entries
+    a.emit({0xFF, 0x24, 0xC1});             // jmp [rcx + rax * 8]
+}
+
+// leave through exit if the budget is spent; rax is left as it was
+void NativeCompiler::emitBudgetCheck(unsigned exit) {
+    a.emit({0x48, 0x3B, 0x6B, 0x18});       // cmp rbp, [rbx + 24]  budget
+    a.jump({0x0F, 0x83}, exit);             // jae exit
+}
+
+void NativeCompiler::emitPop(int values) {
+    a.emit({0x49, 0x83, 0xEF});             // sub r15, 12 * values
+    a.emit({static_cast<uint8_t>(12 * values)});
+}
+
+// guard that the value at offset from the top (in rax) is an integer
+void NativeCompiler::emitIntGuard(int offset) {
+    a.emit({0x83, 0x78, static_cast<uint8_t>(offset)});
+    a.emit({Value::Integer});               // cmp dword [rax + offset], Integer
+}
+
+void NativeCompiler::emitHelper(unsigned i, int opcode) {
+    void *step = stepFor(opcode);
+    void *branch = branchFor(opcode);
+    a.emit({0x4D, 0x89, 0x3E});             // mov [r14], r15
+    a.emit({0x4C, 0x89, 0xEF});             // mov rdi, r13
+    a.emit({0x48, 0xBE});                   // mov rsi, &ops[i]
+    a.emit64(reinterpret_cast<uintptr_t>(&ops[i]));
+    if (branch) {
+        a.emit({0x48, 0xBA});               // mov rdx, &function
+        a.emit64(reinterpret_cast<uintptr_t>(&function));
+    }
+    a.emit({0x48, 0xB8});                   // mov rax, helper
+    a.emit64(reinterpret_cast<uintptr_t>(step ? step : branch));
+    a.emit({0xFF, 0xD0});                   // call rax
+    a.emit({0x4D, 0x8B, 0x3E});             // mov r15, [r14]
+    if (step) {
+        a.emit({0x85, 0xC0});               // test eax, eax
+        a.jump({0x0F, 0x85}, errorExit(i)); // jnz error exit
+        return;
+    }
+    // the helper returned the index of the next instruction
+    a.emit({0x3D});                         // cmp eax, i + 1
+    a.emit32(i + 1);
+    a.jump({0x0F, 0x84}, i + 1);            // je next
+    a.emit({0x83, 0xF8, 0xFF});             // cmp eax, -1
+    a.jump({0x0F, 0x84}, errorExit(i));     // je error exit
+    a.emit({0x89, 0xC0});                   // mov eax, eax
+    emitBudgetCheck(budgetExit);
+    a.emit({0x48, 0x8B, 0x0B});             // mov rcx, [rbx]       entries
+    a.emit({0xFF, 0x24, 0xC1});             // jmp [rcx + rax * 8]
+}
+
+// the function called by the call at i, if it's pushed by the instruction
+// before
+FunctionDef* NativeCompiler::knownCallee(unsigned i) {
+    if (baseOpcode(ops[i].opcode) != OpcodeDef::Call || i == 0) return nullptr;
+    const DecodedOp &push = ops[i - 1];
+    if (push.opcode != OpcodeDef::Push32 || push.operand.type != Value::Function) return nullptr;
+    return data.findFunction(push.operand.value);
+}
+
+// the helper returns the code to continue in, or nullptr to leave it to the
+// decoded engine
+void NativeCompiler::emitTransfer(unsigned i, void *transfer) {
+    a.emit({0x4D, 0x89, 0x3E});             // mov [r14], r15
+    a.emit({0x4C, 0x89, 0xEF});             // mov rdi, r13
+    a.emit({0x48, 0xBE});                   // mov rsi, &ops[i]
+    a.emit64(reinterpret_cast<uintptr_t>(&ops[i]));
+    a.emit({0x48, 0x89, 0xDA});             // mov rdx, rbx
+    a.emit({0x48, 0xB9});                   // mov rcx, callee
+    a.emit64(reinterpret_cast<uintptr_t>(knownCallee(i)));
+    a.emit({0x48, 0xB8});                   // mov rax, helper
+    a.emit64(reinterpret_cast<uintptr_t>(transfer));
+    a.emit({0xFF, 0xD0});                   // call rax
+    a.emit({0x4D, 0x8B, 0x3E});             // mov r15, [r14]
+    a.emit({0x48, 0x85, 0xC0});             // test rax, rax
+    a.jump({0x0F, 0x84}, stateExit);        // jz state exit
+    emitBudgetCheck(stateExit);
+    a.emit({0xFF, 0xE0});                   // jmp rax
+}
+
+// Templates that work on the stack directly, for functions whose stack use
+// was verified. Values are 12 bytes: type, value, then selfObj. Those for
+// integer operations fall back to the helper when their operands aren't
+// integers. Returns false if the instruction has no such template.
+bool NativeCompiler::emitInline(unsigned i, int opcode) {
+    const DecodedOp &op = ops[i];
+    const uint32_t local = op.operand.value * sizeof(Value);
+    switch(opcode) {
+        case OpcodeDef::Push32:
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15         top
+            a.emit({0x49, 0x3B, 0x46, 0x08});       // cmp rax, [r14 + 8]   limit
+            toSlowPath(i, {0x0F, 0x83});           // jae slow path
+            // type and value are stored together so later loads of both
+            // can be forwarded from a single store
+            a.emit({0x48, 0xBA});                   // mov rdx, type | value << 32
+            a.emit64(static_cast<uint32_t>(op.operand.type)
+                     | static_cast<uint64_t>(static_cast<uint32_t>(op.operand.value)) << 32);
+            a.emit({0x48, 0x89, 0x10});             // mov [rax], rdx
+            a.emit({0xC7, 0x40, 0x08});             // mov dword [rax + 8], selfObj
+            a.emit32(op.operand.selfObj);
+            a.emit({0x48, 0x83, 0xC0, 0x0C});       // add rax, 12
+            a.emit({0x49, 0x89, 0xC7});             // mov r15, rax
+            return true;
+        case OpcodeDef::LoadLocal:
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            a.emit({0x49, 0x3B, 0x46, 0x08});       // cmp rax, [r14 + 8]
+            toSlowPath(i, {0x0F, 0x83});           // jae slow path
+            a.emit({0x49, 0x8B, 0x4E, 0x10});       // mov rcx, [r14 + 16]  locals
+            a.emit({0x48, 0x8B, 0x91});             // mov rdx, [rcx + local]
+            a.emit32(local);
+            a.emit({0x8B, 0x89});                   // mov ecx, [rcx + local + 8]
+            a.emit32(local + 8);
+            a.emit({0x48, 0x89, 0x10});             // mov [rax], rdx
+            a.emit({0x89, 0x48, 0x08});             // mov [rax + 8], ecx
+            a.emit({0x48, 0x83, 0xC0, 0x0C});       // add rax, 12
+            a.emit({0x49, 0x89, 0xC7});             // mov r15, rax
+            return true;
+        case OpcodeDef::StoreLocal:
+            a.emit({0x49, 0x83, 0xEF, 0x0C});       // sub r15, 12
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            a.emit({0x49, 0x8B, 0x4E, 0x10});       // mov rcx, [r14 + 16]
+            a.emit({0x48, 0x8B, 0x10});             // mov rdx, [rax]
+            a.emit({0x8B, 0x40, 0x08});             // mov eax, [rax + 8]
+            a.emit({0x48, 0x89, 0x91});             // mov [rcx + local], rdx
+            a.emit32(local);
+            a.emit({0x89, 0x81});                   // mov [rcx + local + 8], eax
+            a.emit32(local + 8);
+            return true;
+        case OpcodeDef::StackPop:
+            emitPop(1);
+            return true;
+        case OpcodeDef::IncLocal:
+            a.emit({0x49, 0x8B, 0x4E, 0x10});       // mov rcx, [r14 + 16]
+            a.emit({0x83, 0xB9});                   // cmp dword [rcx + local], Integer
+            a.emit32(local);
+            a.emit({Value::Integer});
+            toSlowPath(i, {0x0F, 0x85});           // jne slow path
+            a.emit({0x81, 0x81});                   // add dword [rcx + local + 4], aux
+            a.emit32(local + 4);
+            a.emit32(op.aux);
+            return true;
+
+        case OpcodeDef::Add:
+        case OpcodeDef::Sub:
+        case OpcodeDef::Mult:
+            // rhs is the top value and lhs the one below; the result replaces lhs
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            emitIntGuard(-12);
+            toSlowPath(i, {0x0F, 0x85});           // jne slow path
+            emitIntGuard(-24);
+            toSlowPath(i, {0x0F, 0x85});
+            a.emit({0x8B, 0x48, 0xF8});             // mov ecx, [rax - 8]   rhs
+            if (opcode == OpcodeDef::Add) {
+                a.emit({0x03, 0x48, 0xEC});         // add ecx, [rax - 20]  lhs
+            } else if (opcode == OpcodeDef::Sub) {
+                a.emit({0x2B, 0x48, 0xEC});         // sub ecx, [rax - 20]
+            } else {
+                a.emit({0x0F, 0xAF, 0x48, 0xEC});   // imul ecx, [rax - 20]
+            }
+            a.emit({0x89, 0x48, 0xEC});             // mov [rax - 20], ecx
+            a.emit({0xC7, 0x40, 0xF0});             // mov dword [rax - 16], 0
+            a.emit32(0);
+            emitPop(1);
+            return true;
+
+        case OpcodeDef::Equal:
+        case OpcodeDef::NotEqual:
+        case OpcodeDef::LessThan:
+        case OpcodeDef::LessThanEqual:
+        case OpcodeDef::GreaterThan:
+        case OpcodeDef::GreaterThanEqual: {
+            // Value::compare for integers is lhs - rhs, wrapping
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            emitIntGuard(-12);
+            toSlowPath(i, {0x0F, 0x85});
+            emitIntGuard(-24);
+            toSlowPath(i, {0x0F, 0x85});
+            a.emit({0x8B, 0x48, 0xEC});             // mov ecx, [rax - 20]  lhs
+            a.emit({0x2B, 0x48, 0xF8});             // sub ecx, [rax - 8]   rhs
+            if (opcode != OpcodeDef::NotEqual) {
+                uint8_t setcc = 0;
+                switch(opcode) {
+                    case OpcodeDef::Equal:              setcc = 0x94; break;    // sete
+                    case OpcodeDef::LessThan:           setcc = 0x9F; break;    // setg
+                    case OpcodeDef::LessThanEqual:      setcc = 0x9D; break;    // setge
+                    case OpcodeDef::GreaterThan:        setcc = 0x9C; break;    // setl
+                    case OpcodeDef::GreaterThanEqual:   setcc = 0x9E; break;    // setle
+                }
+                a.emit({0x85, 0xC9});               // test ecx, ecx
+                a.emit({0x0F, setcc, 0xC2});        // setcc dl
+                a.emit({0x0F, 0xB6, 0xCA});         // movzx ecx, dl
+            }
+            a.emit({0x89, 0x48, 0xEC});             // mov [rax - 20], ecx
+            a.emit({0xC7, 0x40, 0xF0});             // mov dword [rax - 16], 0
+            a.emit32(0);
+            emitPop(1);
+            return true; }
+
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+            // the result replaces the top value
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            emitIntGuard(-12);
+            toSlowPath(i, {0x0F, 0x85});
+            a.emit({0x49, 0x8B, 0x4E, 0x10});       // mov rcx, [r14 + 16]
+            a.emit({0x83, 0xB9});                   // cmp dword [rcx + local], Integer
+            a.emit32(local);
+            a.emit({Value::Integer});
+            toSlowPath(i, {0x0F, 0x85});
+            a.emit({0x8B, 0x91});                   // mov edx, [rcx + local + 4]
+            a.emit32(local + 4);
+            if (opcode == OpcodeDef::AddLocal) {
+                a.emit({0x03, 0x50, 0xF8});         // add edx, [rax - 8]
+            } else {
+                a.emit({0x2B, 0x50, 0xF8});         // sub edx, [rax - 8]
+            }
+            a.emit({0x89, 0x50, 0xF8});             // mov [rax - 8], edx
+            a.emit({0xC7, 0x40, 0xFC});             // mov dword [rax - 4], 0
+            a.emit32(0);
+            return true;
+
+        case OpcodeDef::CompareJumpZero:
+        case OpcodeDef::CompareJumpNotZero: {
+            // condition codes after testing lhs - rhs for each comparison
+            uint8_t jcc = 0;
+            switch(op.aux) {
+                case OpcodeDef::Equal:              jcc = 0x84; break;  // je
+                case OpcodeDef::NotEqual:           jcc = 0x85; break;  // jne
+                case OpcodeDef::LessThan:           jcc = 0x8F; break;  // jg
+                case OpcodeDef::LessThanEqual:      jcc = 0x8D; break;  // jge
+                case OpcodeDef::GreaterThan:        jcc = 0x8C; break;  // jl
+                case OpcodeDef::GreaterThanEqual:   jcc = 0x8E; break;  // jle
+                default:                            return false;
+            }
+            // the condition codes come in pairs that differ in the low bit
+            if (opcode == OpcodeDef::CompareJumpZero) jcc ^= 1;
+            const std::vector<int> &index = function.decoded.index;
+            if (op.operand.value < 0 || static_cast<unsigned>(op.operand.value) >= index.size()
+                    || index[op.operand.value] < 0) {
+                return false;
+            }
+            const int target = index[op.operand.value];
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            emitIntGuard(-12);
+            toSlowPath(i, {0x0F, 0x85});
+            emitIntGuard(-24);
+            toSlowPath(i, {0x0F, 0x85});
+            a.emit({0x8B, 0x48, 0xEC});             // mov ecx, [rax - 20]
+            a.emit({0x2B, 0x48, 0xF8});             // sub ecx, [rax - 8]
+            emitPop(2);
+            a.emit({0x85, 0xC9});                   // test ecx, ecx
+            if (static_cast<unsigned>(target) > i) {
+                a.jump({0x0F, jcc}, target);        // jcc target
+                return true;
+            }
+            // a loop: check the budget when it's taken
+            a.jump({0x0F, static_cast<uint8_t>(jcc ^ 1)}, i + 1);  // jncc next
+            a.emit({0x48, 0x3B, 0x6B, 0x18});       // cmp rbp, [rbx + 24]
+            a.jump({0x0F, 0x82}, target);           // jb target
+            emitExit(target);
+            return true; }
+
+        case OpcodeDef::Jump:
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            a.emit({0x8B, 0x48, 0xF8});             // mov ecx, [rax - 8]   target
+            emitPop(1);
+            emitIndexJump();
+            return true;
+        case OpcodeDef::JumpZero:
+            // the condition is false if it's None or zero
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            a.emit({0x8B, 0x48, 0xF8});             // mov ecx, [rax - 8]   target
+            emitPop(2);
+            a.emit({0x83, 0x78, 0xE8, Value::None});// cmp dword [rax - 24], None
+            a.emit({0x74, 0x0A});                   // je taken
+            a.emit({0x83, 0x78, 0xEC, 0x00});       // cmp dword [rax - 20], 0
+            a.jump({0x0F, 0x85}, i + 1);            // jne next
+            emitIndexJump();                        // taken:
+            return true;
+        case OpcodeDef::JumpNotZero:
+            a.emit({0x4C, 0x89, 0xF8});             // mov rax, r15
+            a.emit({0x8B, 0x48, 0xF8});             // mov ecx, [rax - 8]
+            emitPop(2);
+            a.emit({0x83, 0x78, 0xE8, Value::None});// cmp dword [rax - 24], None
+            a.jump({0x0F, 0x84}, i + 1);            // je next
+            a.emit({0x83, 0x78, 0xEC, 0x00});       // cmp dword [rax - 20], 0
+            a.jump({0x0F, 0x84}, i + 1);            // je next
+            emitIndexJump();
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool NativeCompiler::compile() {
+    // code that could run past the last instruction is left to the decoded
+    // engine, which reports it
+    const int lastOpcode = baseOpcode(ops.back().opcode);
+    if (stepFor(lastOpcode) || branchFor(lastOpcode)) return false;
+
+    // prologue: keep the arguments in registers the helpers preserve. The
+    // top of the stack is kept in r15, and stored back to the window around
+    // every call to a helper.
+    a.emit({0x53});                         // push rbx
+    a.emit({0x55});                         // push rbp
+    a.emit({0x41, 0x54});                   // push r12
+    a.emit({0x41, 0x55});                   // push r13
+    a.emit({0x41, 0x56});                   // push r14
+    a.emit({0x41, 0x57});                   // push r15
+    a.emit({0x48, 0x83, 0xEC, 0x08});       // sub rsp, 8       keep the stack aligned
+    a.emit({0x49, 0x89, 0xFD});             // mov r13, rdi     GameData*
+    a.emit({0x49, 0x89, 0xD4});             // mov r12, rdx     &instructionCount
+    a.emit({0x48, 0x89, 0xCB});             // mov rbx, rcx     NativeState*
+    a.emit({0x4D, 0x89, 0xC6});             // mov r14, r8      gtCallStack::Window*
+    a.emit({0x4D, 0x8B, 0x3E});             // mov r15, [r14]   top
+    a.emit({0x31, 0xED});                   // xor ebp, ebp     instructions run
+    a.emit({0xFF, 0xE6});                   // jmp rsi
+    // epilogue: rax holds the instruction to continue from
+    a.place(epilogue);
+    a.emit({0x4D, 0x89, 0x3E});             // mov [r14], r15
+    a.emit({0x49, 0x01, 0x2C, 0x24});       // add [r12], rbp
+    a.emit({0x48, 0x83, 0xC4, 0x08});       // add rsp, 8
+    a.emit({0x41, 0x5F});                   // pop r15
+    a.emit({0x41, 0x5E});                   // pop r14
+    a.emit({0x41, 0x5D});                   // pop r13
+    a.emit({0x41, 0x5C});                   // pop r12
+    a.emit({0x5D});                         // pop rbp
+    a.emit({0x5B});                         // pop rbx
+    a.emit({0xC3});                         // ret
+    a.place(stateExit);
+    a.emit({0x48, 0x8B, 0x43, 0x08});       // mov rax, [rbx + 8]   exit
+    a.jump({0xE9}, epilogue);               // jmp epilogue
+    // budget exit: rax holds the index of the instruction to continue from
+    a.place(budgetExit);
+    a.emit({0x48, 0x69, 0xC0});             // imul rax, rax, sizeof(DecodedOp)
+    a.emit32(sizeof(DecodedOp));
+    a.emit({0x48, 0xBA});                   // mov rdx, &ops[0]
+    a.emit64(reinterpret_cast<uintptr_t>(ops.data()));
+    a.emit({0x48, 0x01, 0xD0});             // add rax, rdx
+    a.jump({0xE9}, epilogue);               // jmp epilogue
+
+    bool compiledAny = false;
+    for (unsigned i = 0; i < count; ++i) {
+        const int opcode = baseOpcode(ops[i].opcode);
+        void *transfer = transferFor(opcode, verified);
+        a.place(i);
+        if (!transfer && !stepFor(opcode) && !branchFor(opcode)) {
+            emitExit(i);
+            continue;
+        }
+        compiledAny = true;
+        a.emit({0x48, 0xFF, 0xC5});         // inc rbp
+        if (transfer) {
+            emitTransfer(i, transfer);
+        } else if (!verified || !emitInline(i, opcode)) {
+            emitHelper(i, opcode);
+        }
+    }
+    if (!compiledAny) return false;
+
+    // out of line: the helper calls of inlined instructions, then the error
+    // exits
+    for (unsigned i : slowPaths) {
+        a.place(slowPath(i));
+        emitHelper(i, baseOpcode(ops[i].opcode));
+        if (stepFor(baseOpcode(ops[i].opcode))) a.jump({0xE9}, i + 1);
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        a.place(errorExit(i));
+        emitExit(i);
+    }
+    a.patch();
+    return true;
+}
+
+bool GameData::compileNative(FunctionDef &function, const void *enterHandler) {
+    std::vector<DecodedOp> &ops = function.decoded.ops;
+    if (function.native || ops.empty()) return true;
+
+    NativeCompiler compiler(*this, function, function.verified && !checkedOnly);
+    if (!compiler.compile()) return false;
+    const std::vector<uint8_t> &code = compiler.a.code;
+
+    void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    std::shared_ptr<NativeCode> native(new NativeCode);
+    native->code = static_cast<uint8_t*>(memory);
+    native->size = code.size();
+    std::memcpy(native->code, code.data(), code.size());
+    if (mprotect(native->code, native->size, PROT_READ | PROT_EXEC) != 0) return false;
+    for (unsigned i = 0; i < ops.size(); ++i) {
+        native->entries.push_back(native->code + compiler.a.labels[i]);
+    }
+
+    // the decoded engine runs the returns that end the program, so they are
+    // never entered from it
+    nativeEnter = enterHandler;
+    for (DecodedOp &op : ops) {
+        const int opcode = baseOpcode(op.opcode);
+        if (stepFor(opcode) || branchFor(opcode) || opcode == OpcodeDef::Call) {
+            op.handler = enterHandler;
+        }
+    }
+    function.native = native;
+    return true;
+}
+
+// Run function's machine code from ip. Returns the instruction the decoded
+// engine is to continue from and sets function to the one it's in.
+const DecodedOp* GameData::runNative(const FunctionDef *&function, const DecodedOp *ip) {
+    const NativeCode &native = *function->native;
+    NativeState state{native.entries.data(), nullptr, function,
+                      instructionLimit - instructionCount};
+    NativeEntry enter = reinterpret_cast<NativeEntry>(native.code);
+    const DecodedOp *next = enter(this, native.entries[ip - function->decoded.ops.data()],
+                                  &instructionCount, &state, &callStack.window());
+    function = state.function;
+    if (nativeError) {
+        std::exception_ptr error = nativeError;
+        nativeError = nullptr;
+        std::rethrow_exception(error);
+    }
+    return next;
+}
+
+#else
+
+// no JIT on this platform; everything stays with the decoded engine
+bool GameData::compileNative(FunctionDef &function, const void *enterHandler) {
+    return false;
+}
+const DecodedOp* GameData::runNative(const FunctionDef *&function, const DecodedOp *ip) {
+    throw GameError("No native code on this platform.");
+}
+
+#endif
@@ -1,203 +1,297 @@
-#include <fstream>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <vector>
 
 #include "gamedata.h"
 #include "bytestream.h"
 #include "value.h"
+#include "textutil.h"
 
 const unsigned char STRING_XOR_KEY = 0x7B;
 
-uint32_t read_32(std::istream &in);
-uint16_t read_16(std::istream &in);
-uint8_t read_8(std::istream &in);
-std::string read_str(std::istream &in);
-Value read_value(std::istream &in);
+// Reads fields from a gamefile in memory. Reading past the end of the file
+// returns zeroes and sets overrun.
+struct GameFileReader {
+    const uint8_t *data;
+    std::size_t size;
+    std::size_t pos;
+    bool overrun;
 
+    bool have(std::size_t count) {
+        if (pos + count <= size) return true;
+        overrun = true;
+        pos = size;
+        return false;
+    }
+    uint32_t read_32() {
+        if (!have(4)) return 0;
+        uint32_t value = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16)
+                         | (static_cast<uint32_t>(data[pos + 3]) << 24);
+        pos += 4;
+        return value;
+    }
+    uint16_t read_16() {
+        if (!have(2)) return 0;
+        uint16_t value = data[pos] | (data[pos + 1] << 8);
+        pos += 2;
+        return value;
+    }
+    uint8_t read_8() {
+        if (!have(1)) return 0;
+        return data[pos++];
+    }
+    std::string read_str() {
+        unsigned length = read_16();
+        if (!have(length)) return "";
+        std::string text(reinterpret_cast<const char*>(data + pos), length);
+        for (char &c : text) c ^= STRING_XOR_KEY;
+        pos += length;
+        return text;
+    }
+    void skip(std::size_t count) {
+        if (have(count)) pos += count;
+    }
+    void skip_str() {
+        skip(read_16());
+    }
+};
 
-void GameData::load(const std::string &filename) {
-    std::ifstream inf(filename, std::ios_base::binary);
-    if (!inf) {
+
+std::shared_ptr<const GameImage> GameImage::load(const std::string &filename) {
+    std::shared_ptr<GameImage> image = std::make_shared<GameImage>();
+    if (!image->read(filename)) return nullptr;
+    return image;
+}
+
+// The gamefile is mapped into memory and used in place: the bytecode is read
+// directly from it, and static strings and objects are only decoded the first
+// time they are used. Loading just records where each of them is.
+bool GameImage::read(const std::string &filename) {
+    if (!mGameFile.open(filename)) {
         std::cerr << "Could not open ~" << filename << "~.\n";
-        return;
+        return false;
     }
+    GameFileReader inf{mGameFile.data(), mGameFile.size(), 0, false};
 
-    if(read_32(inf) != FILETYPE_ID) {
+    if(inf.read_32() != FILETYPE_ID) {
         std::cerr << '~' << filename << "~ is not a valid gamefile.\n";
-        return;
+        return false;
     }
-    int version = read_32(inf);
+    int version = inf.read_32();
     if(version != 0) {
         std::cerr << '~' << filename << "~ has format version " << version;
         std::cerr << ", but only version 0 is supported.\n";
-        return;
+        return false;
+    }
+    mainFunction = inf.read_32();
+    gameFlags = inf.read_32();
+    if (gameFlags & ~GAMEFLAG_KNOWN) {
+        std::cerr << '~' << filename << "~ uses features not supported by this runner.\n";
+        return false;
     }
-    mainFunction = read_32(inf);
-    read_32(inf); // skip game flags (currently unused)
-    refGamename = read_32(inf);
-    refAuthor = read_32(inf);
-    refVersion = read_32(inf);
-    refGameid = read_32(inf);
-    refBuild = read_32(inf);
+    refGamename = inf.read_32();
+    refAuthor = inf.read_32();
+    refVersion = inf.read_32();
+    refGameid = inf.read_32();
+    refBuild = inf.read_32();
 
 
     // skip header
-    inf.seekg(HEADER_SIZE);
+    inf.pos = HEADER_SIZE;
 
     // READ STRINGS
-    nextString = 1;
-    staticStrings = read_32(inf);
+    staticStrings = inf.read_32();
+    mStringOffsets.resize(staticStrings);
     for (unsigned i = 0; i < staticStrings; ++i) {
-        StringDef *def = new StringDef;
-        def->ident = i;
-        def->isStatic = true;
-        if (def->ident >= nextString) nextString = def->ident + 1;
-        def->text = read_str(inf);
-        strings.insert(std::make_pair(def->ident, def));
+        mStringOffsets[i] = inf.pos;
+        inf.skip_str();
+        mStrings.insertPending(i);
     }
+    mStrings.setLoader([this](unsigned ident) { return loadString(ident); });
 
     // READ VOCAB
-    staticVocab = read_32(inf);
+    staticVocab = inf.read_32();
     for (unsigned i = 0; i < staticVocab; ++i) {
-        std::string word = read_str(inf);
+        std::string word = inf.read_str();
         vocab.push_back(word);
     }
 
     // // READ LISTS
-    nextList = 1;
-    staticLists = read_32(inf);
+    staticLists = inf.read_32();
     for (unsigned i = 0; i < staticLists; ++i) {
         ListDef *def = new ListDef;
         def->ident = i + 1;
         def->isStatic = true;
         def->srcName = -1;
-        def->srcFile = read_32(inf);
-        def->srcLine = read_32(inf);
-        def->ident = read_32(inf);
-        if (def->ident >= nextList) nextList = def->ident + 1;
-        unsigned itemCount = read_16(inf);
+        def->srcFile = inf.read_32();
+        def->srcLine = inf.read_32();
+        def->ident = inf.read_32();
+        unsigned itemCount = inf.read_16();
+        def->items.reserve(itemCount);
         for (unsigned j = 0; j < itemCount; ++j) {
             Value value;
-            value.type = static_cast<Value::Type>(read_8(inf));
-            value.value = read_32(inf);
+            value.type = static_cast<Value::Type>(inf.read_8());
+            value.value = inf.read_32();
             def->items.push_back(value);
         }
-        lists.insert(std::make_pair(def->ident, def));
+        mLists.insert(def->ident, def);
     }
 
     // READ MAPS
-    nextMap = 1;
-    staticMaps = read_32(inf);
+    staticMaps = inf.read_32();
     for (unsigned i = 0; i < staticMaps; ++i) {
         MapDef *def = new MapDef;
         def->isStatic = true;
         def->srcName = -1;
-        def->srcFile = read_32(inf);
-        def->srcLine = read_32(inf);
-        def->ident = read_32(inf);
-        if (def->ident >= nextMap) nextMap = def->ident + 1;
-        unsigned itemCount = read_16(inf);
+        def->srcFile = inf.read_32();
+        def->srcLine = inf.read_32();
+        def->ident = inf.read_32();
+        unsigned itemCount = inf.read_16();
+        def->rows.reserve(itemCount);
         for (unsigned j = 0; j < itemCount; ++j) {
             Value v1, v2;
-            v1.type = static_cast<Value::Type>(read_8(inf));
-            v1.value = read_32(inf);
-            v2.type = static_cast<Value::Type>(read_8(inf));
-            v2.value = read_32(inf);
-            def->rows.push_back(MapDef::Row{v1,v2});
+            v1.type = static_cast<Value::Type>(inf.read_8());
+            v1.value = inf.read_32();
+            v2.type = static_cast<Value::Type>(inf.read_8());
+            v2.value = inf.read_32();
+            def->rows.push_back(MapDef::Row{v1, v2, false});
         }
-        maps.insert(std::make_pair(def->ident, def));
+        def->rebuildIndex();
+        mMaps.insert(def->ident, def);
     }
 
     // READ OBJECTS
-    nextObject = 1;
-    staticObjects = read_32(inf);
+    staticObjects = inf.read_32();
     for (unsigned i = 0; i < staticObjects; ++i) {
-        ObjectDef *def = new ObjectDef;
-        def->ident = i + 1;
-        def->isStatic = true;
-        def->srcName = read_32(inf);
-        def->srcFile = read_32(inf);
-        def->srcLine = read_32(inf);
-        def->ident = read_32(inf);
-        if (def->ident >= nextObject) nextObject = def->ident + 1;
-        unsigned itemCount = read_16(inf);
-        for (unsigned j = 0; j < itemCount; ++j) {
-            unsigned propId = read_16(inf);
-            Value value;
-            value.type = static_cast<Value::Type>(read_8(inf));
-            value.value = read_32(inf);
-            def->properties.insert(std::make_pair(propId, value));
-        }
-        objects.insert(std::make_pair(def->ident, def));
+        std::size_t start = inf.pos;
+        inf.skip(12); // source name, file, and line
+        unsigned ident = inf.read_32();
+        unsigned itemCount = inf.read_16();
+        inf.skip(itemCount * 7);
+        if (inf.overrun) break;
+        if (ident >= mObjectOffsets.size()) mObjectOffsets.resize(ident + 1, 0);
+        mObjectOffsets[ident] = start;
+        mObjects.insertPending(ident);
     }
+    mObjects.setLoader([this](unsigned ident) { return loadObject(ident); });
+
+    // everything loaded so far belongs to the permanent old generation
+    mStrings.sealStatic();
+    mLists.sealStatic();
+    mMaps.sealStatic();
+    mObjects.sealStatic();
 
     // READ FUNCTION HEADERS
-    unsigned functionCount = read_32(inf);
+    unsigned functionCount = inf.read_32();
     for (unsigned i = 0; i < functionCount; ++i) {
         FunctionDef def;
-        def.srcName = read_32(inf);
-        def.srcFile = read_32(inf);
-        def.srcLine = read_32(inf);
-        def.ident = read_32(inf);
-        def.arg_count = read_16(inf);
-        def.local_count = read_16(inf);
+        def.srcName = inf.read_32();
+        def.srcFile = inf.read_32();
+        def.srcLine = inf.read_32();
+        def.ident = inf.read_32();
+        def.arg_count = inf.read_16();
+        def.local_count = inf.read_16();
         int count = def.arg_count + def.local_count;
         for (int i = 0; i < count; ++i) {
-            def.argTypes.push_back(static_cast<Value::Type>(read_8(inf)));
+            def.argTypes.push_back(static_cast<Value::Type>(inf.read_8()));
         }
-        def.position = read_32(inf);
+        def.position = inf.read_32();
         functions.insert(std::make_pair(def.ident, def));
     }
 
     // READ FUNCTION BYTECODE
-    unsigned bytecodeSize = read_32(inf);
-    for (unsigned i = 0; i < bytecodeSize; ++i) {
-        bytecode.add_8(read_8(inf));
+    unsigned bytecodeSize = inf.read_32();
+    if (inf.have(bytecodeSize)) {
+        bytecode.view(inf.data + inf.pos, bytecodeSize);
+        inf.pos += bytecodeSize;
     }
 
     // VERIFY END OF FILE
-    inf.get();
-    if (!inf.eof()) {
+    if (inf.overrun || inf.pos != inf.size) {
         std::cerr << "End of file not reached at end of game data.\n";
-        return;
+        return false;
     }
 
-    noneValue = Value();
-    gameLoaded = true;
+    return verifyFunctions(functions, bytecode, gameFlags);
 }
 
-uint32_t read_32(std::istream &in) {
-    uint32_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
+void GameImage::shareWith(GameData &data) const {
+    std::lock_guard<std::mutex> lock(mLock);
+    data.strings.shareStatic(mStrings, [this](unsigned ident) { return findStatic(mStrings, ident); });
+    data.lists.shareStatic(mLists, [this](unsigned ident) { return findStatic(mLists, ident); });
+    data.maps.shareStatic(mMaps, [this](unsigned ident) { return findStatic(mMaps, ident); });
+    data.objects.shareStatic(mObjects, [this](unsigned ident) { return findStatic(mObjects, ident); });
 }
 
-uint16_t read_16(std::istream &in) {
-    uint16_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
-}
+// Identical strings share a single buffer.
+StringDef* GameImage::loadString(unsigned ident) {
+    if (ident >= mStringOffsets.size()) return nullptr;
+    GameFileReader inf{mGameFile.data(), mGameFile.size(), mStringOffsets[ident], false};
+    InternedString text{std::make_shared<const std::string>(inf.read_str()), false};
+    auto existing = mInternedStrings.find(text);
+    if (existing != mInternedStrings.end()) {
+        text = *existing;
+    } else {
+        std::string normalized = *text.text;
+        normalize(normalized);
+        text.normalized = normalized == *text.text;
+        mInternedStrings.insert(text);
+    }
 
-uint8_t read_8(std::istream &in) {
-    uint8_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
+    StringDef *def = new StringDef;
+    def->isStatic = true;
+    def->setText(text.text, text.normalized);
+    return def;
 }
 
-std::string read_str(std::istream &in) {
-    int length = read_16(in);
-    std::string text(length, ' ');
-    for (int i = 0; i < length; ++i) {
-        text[i] = read_8(in) ^ STRING_XOR_KEY;
+ObjectDef* GameImage::loadObject(unsigned ident) {
+    if (ident >= mObjectOffsets.size() || mObjectOffsets[ident] == 0) return nullptr;
+    GameFileReader inf{mGameFile.data(), mGameFile.size(), mObjectOffsets[ident], false};
+    ObjectDef *def = new ObjectDef;
+    def->isStatic = true;
+    def->srcName = inf.read_32();
+    def->srcFile = inf.read_32();
+    def->srcLine = inf.read_32();
+    inf.read_32(); // ident
+    unsigned itemCount = inf.read_16();
+    def->properties.reserve(itemCount);
+    for (unsigned j = 0; j < itemCount; ++j) {
+        unsigned propId = inf.read_16();
+        Value value;
+        value.type = static_cast<Value::Type>(inf.read_8());
+        value.value = inf.read_32();
+        def->set(propId, value);
     }
-    return text;
+    return def;
+}
+
+void GameData::load(const std::string &filename) {
+    std::shared_ptr<const GameImage> loaded = GameImage::load(filename);
+    if (loaded) attach(loaded);
 }
 
-Value read_value(std::istream &in) {
-    uint32_t valueSrc = read_32(in);
-    Value value;
-    value.type = static_cast<Value::Type>(valueSrc >> 28);
-    value.value = valueSrc & 0x0FFFFFFF;
-    return value;
+// Start a session of the game in newImage. Nothing of the game is copied up
+// front; the session takes its own copy of a function when it first uses it,
+// since each session decodes and compiles its functions itself.
+void GameData::attach(std::shared_ptr<const GameImage> newImage) {
+    image = newImage;
+    mainFunction = image->mainFunction;
+    gameFlags = image->gameFlags;
+    refGamename = image->refGamename;
+    refVersion = image->refVersion;
+    refAuthor = image->refAuthor;
+    refGameid = image->refGameid;
+    refBuild = image->refBuild;
+    staticStrings = image->staticStrings;
+    staticLists = image->staticLists;
+    staticMaps = image->staticMaps;
+    staticObjects = image->staticObjects;
+    staticVocab = image->staticVocab;
+    functions.clear();
+    bytecode.view(image->bytecode.bytes(), image->bytecode.size());
+    image->shareWith(*this);
+
+    noneValue = Value();
+    gameLoaded = true;
 }
@@ -0,0 +1,57 @@
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+#include "mappedfile.h"
+
+MappedFile::MappedFile()
+: mData(nullptr), mSize(0), mMapped(false)
+{ }
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string &filename) {
+    close();
+#ifdef HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::close(fd);
+            mData = static_cast<const uint8_t*>(addr);
+            mSize = info.st_size;
+            mMapped = true;
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+
+    std::ifstream inf(filename, std::ios_base::binary);
+    if (!inf) return false;
+    mBuffer.assign(std::istreambuf_iterator<char>(inf), std::istreambuf_iterator<char>());
+    mData = mBuffer.data();
+    mSize = mBuffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef HAVE_MMAP
+    if (mMapped) munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+    mBuffer.clear();
+    mData = nullptr;
+    mSize = 0;
+    mMapped = false;
+}
@@ -0,0 +1,33 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A read-only view of an entire file. The file is memory mapped where the
+// platform supports it and read into memory otherwise.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string &filename);
+    void close();
+
+    const uint8_t* data() const {
+        return mData;
+    }
+    std::size_t size() const {
+        return mSize;
+    }
+private:
+    const uint8_t *mData;
+    std::size_t mSize;
+    bool mMapped;
+    std::vector<uint8_t> mBuffer;
+};
+
+#endif
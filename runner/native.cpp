@@ -0,0 +1,216 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "gamedata.h"
+#include "io.h"
+#include "native.h"
+#include "stack.h"
+
+// Runs the compiled body of the function on top of the call stack from the IP
+// saved in its frame, until the game has to wait for input or a body returns
+// because its frame is no longer on top.
+Value GameData::resumeNative() {
+    while (1) {
+        const gtCallStack::Frame &frame = callStack.callTop();
+        if (frame.funcDef.compiled(*this, frame.IP) == NativeResult::Stop) return stopValue();
+    }
+}
+
+void nativeStore(GameData &data) {
+    gtCallStack &stack = data.callStack;
+    Value localId = stack.popRaw();
+    Value value = stack.pop();
+    localId.requireType(Value::VarRef);
+    if (localId.value < 0 || localId.value >= stack.localCount()) {
+        throw GameError("Illegal local number.");
+    }
+    stack.setLocal(localId.value, value);
+}
+
+void nativeCall(GameData &data, unsigned nextIP, bool verified) {
+    gtCallStack &stack = data.callStack;
+    Value functionId = verified ? stack.popUnchecked() : stack.pop();
+    Value argCount = verified ? stack.popUnchecked() : stack.pop();
+    if (functionId.type != Value::Function) functionId.requireType(Value::Function);
+    if (!verified) argCount.requireType(Value::Integer);
+    Value self = data.noneValue;
+    if (functionId.selfObj > 0) self = Value(Value::Object, functionId.selfObj);
+
+    stack.callTop().IP = nextIP;
+    FunctionDef &newFunc = data.getFunction(functionId.value);
+    stack.create(newFunc, functionId.value, self, argCount.value);
+    if (!verified || newFunc.typedArgs)
+    for (int i = 0; i < stack.localCount(); ++i) {
+        const Value &arg = stack.getLocal(i);
+        if (newFunc.argTypes[i] != Value::Any && arg.type != newFunc.argTypes[i]) {
+            const std::string &name = data.getString(newFunc.srcName).text();
+            std::stringstream ss;
+            ss << "Function " << name << " expected argument ";
+            ss << i << " to be " <<  newFunc.argTypes[i];
+            ss << " but received " << arg.type;
+            throw GameError(ss.str());
+        }
+    }
+    stack.callTop().IP = newFunc.position;
+}
+
+NativeResult nativeReturn(GameData &data, bool verified) {
+    gtCallStack &stack = data.callStack;
+    Value retValue = data.noneValue;
+    if (!stack.stackEmpty()) {
+        retValue = verified ? stack.popUnchecked() : stack.pop();
+    }
+    stack.drop();
+    if (stack.isEmpty()) {
+        data.optionType = OptionType::EndOfProgram;
+        data.returnValue = retValue;
+        return NativeResult::Stop;
+    }
+    stack.push(retValue);
+    return NativeResult::Continue;
+}
+
+void nativeGetItem(GameData &data, unsigned site) {
+    gtCallStack &stack = data.callStack;
+    Value from = stack.pop();
+    Value index = stack.pop();
+    Value result;
+    switch(from.type) {
+        case Value::Object:
+            index.requireType(Value::Property);
+            result = data.getProperty(site, from.value, index.value);
+            break;
+        case Value::List:
+            index.requireType(Value::Integer);
+            result = data.getList(from.value).get(index.value);
+            break;
+        case Value::Map:
+            result = data.getMap(from.value).get(index);
+            break;
+        default:
+            throw GameError("get requires list, map, or object.");
+    }
+    stack.push(result);
+}
+
+void nativeSetItem(GameData &data) {
+    gtCallStack &stack = data.callStack;
+    Value from = stack.pop();
+    Value index = stack.pop();
+    Value toValue = stack.pop();
+    switch(from.type) {
+        case Value::Object: {
+            index.requireType(Value::Property);
+            data.setProperty(data.editObject(from.value), index.value, toValue);
+            break; }
+        case Value::List: {
+            index.requireType(Value::Integer);
+            ListDef &listDef = data.editList(from.value);
+            listDef.set(index.value, toValue);
+            data.writeBarrier(Value::List, listDef, toValue);
+            break; }
+        case Value::Map: {
+            MapDef &mapDef = data.editMap(from.value);
+            mapDef.set(index, toValue);
+            data.writeBarrier(Value::Map, mapDef, index);
+            data.writeBarrier(Value::Map, mapDef, toValue);
+            break; }
+        default:
+            throw GameError("setp requires list, map, or object.");
+    }
+}
+
+bool nativeExecute(GameData &data, int opcode, unsigned nextIP, NativeResult &result) {
+    const int frames = data.callStack.size();
+    unsigned IP = nextIP;
+    if (!data.execute(opcode, IP)) {
+        result = NativeResult::Stop;
+        return true;
+    }
+    if (IP != nextIP || data.callStack.size() != frames) {
+        data.callStack.callTop().IP = IP;
+        result = NativeResult::Continue;
+        return true;
+    }
+    return false;
+}
+
+void nativeBadPosition(unsigned IP) {
+    throw GameError("Tried to execute invalid code position " + std::to_string(IP) + ".");
+}
+
+// Attach the compiled bodies to the functions of the loaded game, making sure
+// the gamefile is the one they were translated from: its bytecode must have
+// the same checksum, and its functions must be where they were.
+static bool bindNative(GameData &data, const NativeFunction *functions, unsigned count,
+                       uint32_t checksum) {
+    if (data.bytecode.checksum() != checksum) return false;
+    if (count != data.image->functions.size()) return false;
+    for (unsigned i = 0; i < count; ++i) {
+        FunctionDef *def = data.findFunction(functions[i].id);
+        if (!def) return false;
+        FunctionDef &function = *def;
+        if (function.position != functions[i].position || function.end != functions[i].end) {
+            return false;
+        }
+        function.compiled = functions[i].body;
+    }
+    data.useNative = true;
+    return true;
+}
+
+int nativeMain(int argc, char *argv[], const NativeFunction *functions,
+               unsigned count, uint32_t checksum, const char *gameFile) {
+    std::string gameFilename;
+    bool doSilent = false;
+    GcMode gcMode = GcMode::Generational;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0) {
+            std::cerr << "USAGE: " << argv[0] << " [options] [game file]\n";
+            std::cerr << "    -silent    Run initial game function then quit.\n";
+            std::cerr << "    -gc-full   Only use complete garbage collections.\n";
+            std::cerr << "    -gc-incremental  Spread complete garbage collections over several turns.\n";
+            std::cerr << "The game file defaults to " << gameFile << ".\n";
+            return 0;
+        } else if (strcmp(argv[i], "-silent") == 0) {
+            doSilent = true;
+        } else if (strcmp(argv[i], "-gc-full") == 0) {
+            gcMode = GcMode::Full;
+        } else if (strcmp(argv[i], "-gc-incremental") == 0) {
+            gcMode = GcMode::Incremental;
+        } else if (argv[i][0] == '-') {
+            std::cerr << "Unrecognized option " << argv[i] << ".\n";
+            return 1;
+        } else if (gameFilename.empty()) {
+            gameFilename = argv[i];
+        } else {
+            std::cerr << "Only one game file may be specified.\n";
+            return 1;
+        }
+    }
+    if (gameFilename.empty()) gameFilename = gameFile;
+
+    GameData data;
+    data.load(gameFilename);
+    if (!data.gameLoaded) return 1;
+    if (!bindNative(data, functions, count, checksum)) {
+        std::cerr << gameFilename << " is not the game this program was compiled from.\n";
+        return 1;
+    }
+    data.gcMode = gcMode;
+
+    for (int i = 0; i < INFO_COUNT; ++i) {
+        data.infoText[i] = "";
+    }
+    data.infoText[INFO_TITLE] = gameFilename;
+    try {
+        gameloop(data, doSilent);
+    } catch (GameError &e) {
+        reportError(data, e);
+        return 1;
+    }
+    std::cout << IO::normal();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "gamedata.h"
+#include "opcode.h"
+#include "stack.h"
+
+// The interface between the runtime library and the C++ that compile generates
+// from a gamefile. Each function of the game becomes a NativeBody working on
+// the same call stack as the interpreters, so the game can still wait for
+// input between turns, collect garbage, and report errors as the runner does.
+// A call runs the body of the function called directly, continuing after the
+// call once it returns; if the function has to wait for input, every body
+// returns and resumeNative later enters the one on top again at the IP saved
+// in its frame. Past NATIVE_CALL_DEPTH frames, calls also go back through
+// resumeNative so that deep recursion in the game doesn't exhaust the native
+// stack. The generated source ends with a table of its bodies and a call to
+// nativeMain.
+// Helpers taking verified as a template argument pop without checks when the
+// function passed verifyFunctions, as the decoded engine does.
+
+struct NativeFunction {
+    int id;
+    unsigned position;      // where the function's bytecode was when translated
+    unsigned end;
+    NativeBody body;
+};
+
+const int NATIVE_CALL_DEPTH = 1000;
+
+// checksum is that of the bytecode the functions were translated from.
+int nativeMain(int argc, char *argv[], const NativeFunction *functions,
+               unsigned count, uint32_t checksum, const char *gameFile);
+
+void nativeStore(GameData &data);
+void nativeCall(GameData &data, unsigned nextIP, bool verified);
+NativeResult nativeReturn(GameData &data, bool verified);
+void nativeGetItem(GameData &data, unsigned site);
+void nativeSetItem(GameData &data);
+// Runs an opcode the translation has no special form for. Returns true if the
+// body must return result, either because the game is waiting for input or
+// because the opcode moved execution elsewhere.
+bool nativeExecute(GameData &data, int opcode, unsigned nextIP, NativeResult &result);
+[[noreturn]] void nativeBadPosition(unsigned IP);
+
+// Runs the function just called by the body whose frame is at depth. Returns
+// true if the body must return result, or false to continue after the call.
+inline bool nativeRunCall(GameData &data, int depth, NativeResult &result) {
+    gtCallStack &stack = data.callStack;
+    if (depth >= NATIVE_CALL_DEPTH) {
+        result = NativeResult::Continue;
+        return true;
+    }
+    const gtCallStack::Frame &callee = stack.callTop();
+    result = callee.funcDef.compiled(data, callee.IP);
+    return result == NativeResult::Stop || stack.size() != depth;
+}
+
+template<bool verified>
+inline Value nativePop(gtCallStack &stack) {
+    return verified ? stack.popUnchecked() : stack.pop();
+}
+
+template<bool verified>
+inline unsigned nativeJumpTarget(gtCallStack &stack) {
+    Value target = nativePop<verified>(stack);
+    if (!verified && target.type != Value::JumpTarget) target.requireType(Value::JumpTarget);
+    return target.value;
+}
+
+// Value::compare for two integers
+inline int nativeCompareInts(int lhs, int rhs) {
+    return static_cast<int>(static_cast<unsigned>(lhs) - static_cast<unsigned>(rhs));
+}
+
+// GameData::compareFor, without leaving the generated code for integers
+template<int opcode>
+inline bool nativeCompareFor(const Value &lhs, const Value &rhs) {
+    if (lhs.type != Value::Integer || rhs.type != Value::Integer) {
+        return GameData::compareFor(opcode, lhs, rhs);
+    }
+    const int result = nativeCompareInts(lhs.value, rhs.value);
+    switch(opcode) {
+        case OpcodeDef::Equal:              return result == 0;
+        case OpcodeDef::NotEqual:           return result != 0;
+        case OpcodeDef::LessThan:           return result > 0;
+        case OpcodeDef::LessThanEqual:      return result >= 0;
+        case OpcodeDef::GreaterThan:        return result < 0;
+        case OpcodeDef::GreaterThanEqual:   return result <= 0;
+        default:                            return GameData::compareFor(opcode, lhs, rhs);
+    }
+}
+
+// the comparison opcodes; NotEqual pushes the result of compare itself
+template<int opcode, bool verified>
+inline void nativeCompare(gtCallStack &stack) {
+    Value rhs = nativePop<verified>(stack);
+    Value lhs = nativePop<verified>(stack);
+    int result;
+    if (opcode != OpcodeDef::NotEqual) {
+        result = nativeCompareFor<opcode>(lhs, rhs);
+    } else if (lhs.type == Value::Integer && rhs.type == Value::Integer) {
+        result = nativeCompareInts(lhs.value, rhs.value);
+    } else {
+        result = lhs.compare(rhs);
+    }
+    stack.push(Value(Value::Integer, result));
+}
+
+// pops two values and reports whether compare holds for them
+template<int compare, bool verified>
+inline bool nativeCompareJump(gtCallStack &stack) {
+    Value rhs = nativePop<verified>(stack);
+    Value lhs = nativePop<verified>(stack);
+    return nativeCompareFor<compare>(lhs, rhs);
+}
+
+template<int opcode, bool verified>
+inline void nativeArithmetic(gtCallStack &stack) {
+    Value rhs = nativePop<verified>(stack);
+    Value lhs = nativePop<verified>(stack);
+    if (lhs.type != Value::Integer) lhs.requireType(Value::Integer);
+    if (rhs.type != Value::Integer) rhs.requireType(Value::Integer);
+    if (opcode == OpcodeDef::Div || opcode == OpcodeDef::Mod) lhs.requireDivisorOf(rhs.value);
+    int result = 0;
+    switch(opcode) {
+        case OpcodeDef::Add:    result = rhs.value + lhs.value; break;
+        case OpcodeDef::Sub:    result = rhs.value - lhs.value; break;
+        case OpcodeDef::Mult:   result = rhs.value * lhs.value; break;
+        case OpcodeDef::Div:    result = rhs.value / lhs.value; break;
+        case OpcodeDef::Mod:    result = rhs.value % lhs.value; break;
+    }
+    stack.push(Value(Value::Integer, result));
+}
+
+template<bool verified>
+inline void nativeNot(gtCallStack &stack) {
+    Value v = nativePop<verified>(stack);
+    stack.push(Value(Value::Integer, v.isTrue() ? 0 : 1));
+}
+
+// local numbers were checked by verifyFunctions
+template<int opcode, bool verified>
+inline void nativeLocalArithmetic(gtCallStack &stack, int localId) {
+    Value local = stack.localAt(localId);
+    Value lhs = nativePop<verified>(stack);
+    if (lhs.type != Value::Integer) lhs.requireType(Value::Integer);
+    if (local.type != Value::Integer) local.requireType(Value::Integer);
+    stack.push(Value(Value::Integer, opcode == OpcodeDef::AddLocal ? local.value + lhs.value
+                                                                   : local.value - lhs.value));
+}
+inline void nativeIncLocal(gtCallStack &stack, int localId, int amount) {
+    Value &local = stack.localAt(localId);
+    if (local.type != Value::Integer) local.requireType(Value::Integer);
+    local.value += amount;
+}
+
+#endif
@@ -89,6 +89,17 @@ struct OpcodeDef {
         FileWrite           = 81,
         FileDelete          = 82,
         Tokenize            = 83,
+
+        // these take their operands from the bytecode; the superinstructions
+        // may only be used by gamefiles with GAMEFLAG_SUPERINSTRUCTIONS set
+        // and the local opcodes by those with GAMEFLAG_LOCAL_OPCODES
+        AddLocal            = 84, // [local:16] push local + pop
+        SubLocal            = 85, // [local:16] push local - pop
+        CompareJumpZero     = 86, // [compare:8 target:32] compare and jz
+        CompareJumpNotZero  = 87, // [compare:8 target:32] compare and jnz
+        IncLocal            = 88, // [local:16 amount:32] add amount to local
+        StoreLocal          = 89, // [local:16] store pop in local
+        LoadLocal           = 90, // [local:16] push local
     };
 
     std::string name;
@@ -0,0 +1,91 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+#include "formatter.h"
+#include "gamedata.h"
+
+// Writes the game's text to a stream as it is said. The status line is
+// written just before the first text of each turn; if the game changes it
+// after that, it is written again once the turn ends.
+class ConsoleOutput : public OutputSink {
+public:
+    ConsoleOutput(GameData &gamedata, std::ostream &out);
+    ~ConsoleOutput();
+
+    void write(const std::string &text) override;
+    void endTurn();
+private:
+    std::string status() const;
+    void start();
+
+    GameData &mGamedata;
+    std::ostream &mOut;
+    TextFormatter mFormatter;
+    bool mStarted;
+    std::string mStatus;    // the status line as it was last written
+};
+
+enum class InputResult {
+    Accepted, Rejected, Quit
+};
+
+// Plays a game as a conversation in lines of text. Everything the game says,
+// its prompts, and the choices it offers are written to out, and each line
+// passed to input answers the prompt. Turns may be run a slice of
+// instructions at a time, so that one thread can take turns between many
+// players; gameloop plays a single game on the console with one.
+//
+// When the game's undoLevels allows it, the session is snapshotted at each
+// prompt, and entering "undo" restores the snapshot from before the last
+// turn, up to undoLevels turns back. A snapshot shares everything that hasn't
+// changed with the one before it, so each kept turn costs only what it
+// changed.
+class TextPlayer {
+public:
+    TextPlayer(GameData &gamedata, std::ostream &out, bool doSilent);
+
+    // Starts the game at its main function. Its first turn is run by run.
+    void start();
+    // Runs the current turn for up to budget instructions. Returns true once
+    // the turn is over, having collected garbage and written the game's
+    // output and prompt, or false if the budget ran out first. Throws a
+    // GameError if the turn runs past the session's turnLimit.
+    bool run(long budget = NO_INSTRUCTION_LIMIT);
+    // Answers the prompt written at the end of the last turn. A line that
+    // doesn't answer it is rejected and the prompt written again; an accepted
+    // one starts the next turn. "undo" is also rejected, once the last turn
+    // has been taken back and its prompt written again.
+    InputResult input(std::string inputText);
+    bool ended() const {
+        return mEnded;
+    }
+    // Save the game's state to out and free it, while it waits for input;
+    // wake loads it back from in. Turns that could have been undone are
+    // forgotten.
+    void hibernate(std::vector<uint8_t> &out);
+    void wake(const std::vector<uint8_t> &in);
+private:
+    void collectGarbage();
+    void showOptions();
+    void prompt();
+    void undo();
+
+    GameData &mGamedata;
+    std::ostream &mOut;
+    ConsoleOutput mConsole;
+    bool mDoSilent;
+    bool mEnded;
+    bool mTurnStarted;          // whether the current turn has begun running
+    bool mHasValue;             // whether nextValue answers the last prompt
+    Value mNextValue;
+    int mGarbageCounter;
+    std::shared_ptr<const SessionSnapshot> mTurnStart;  // the session at the current prompt
+    std::deque<std::shared_ptr<const SessionSnapshot>> mUndo;  // before each turn, oldest first
+};
+
+#endif
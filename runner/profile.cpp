@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "gamedata.h"
+#include "opcode.h"
+#include "profile.h"
+#include "stack.h"
+
+// The basic interpreter loop of GameData::resume, timing each instruction and
+// counting it against the call path it ran on.
+Value GameData::resumeProfiled() {
+    unsigned IP = callStack.callTop().IP;
+    while (1) {
+        if (instructionCount >= instructionLimit) return yieldAt(IP);
+        ++instructionCount;
+        profiler->follow(callStack);
+
+        int opcode = bytecode.read_8(IP);
+        ++IP;
+        auto start = std::chrono::steady_clock::now();
+        bool running = execute(opcode, IP);
+        auto taken = std::chrono::steady_clock::now() - start;
+        profiler->count(opcode, std::chrono::duration_cast<std::chrono::nanoseconds>(taken).count());
+        if (!running) return stopValue();
+    }
+}
+
+Profiler::Profiler()
+: mOpcodeCounts(PROFILE_OPCODES), mOpcodeNanos(PROFILE_OPCODES),
+  mPairCounts(PROFILE_OPCODES * PROFILE_OPCODES), mLastOpcode(-1)
+{
+    mNodes.push_back(Node{-1, -1, 0, 0, {}});
+}
+
+void Profiler::followFrames(const gtCallStack &stack) {
+    const unsigned depth = stack.size();
+    while (mPath.size() > depth) mPath.pop_back();
+    while (mPath.size() < depth) {
+        const int parent = mPath.empty() ? 0 : mPath.back();
+        const int functionId = stack[mPath.size()].functionId;
+        auto child = mNodes[parent].children.find(functionId);
+        int node;
+        if (child != mNodes[parent].children.end()) {
+            node = child->second;
+        } else {
+            node = mNodes.size();
+            mNodes[parent].children.insert(std::make_pair(functionId, node));
+            mNodes.push_back(Node{functionId, parent, 0, 0, {}});
+        }
+        ++mNodes[node].calls;
+        mPath.push_back(node);
+    }
+}
+
+// the instructions run at each node and every node below it; a node is always
+// added after its parent, so working backwards reaches each node's children
+// before the node itself
+std::vector<long> Profiler::subtreeTotals() const {
+    std::vector<long> totals(mNodes.size());
+    for (unsigned i = mNodes.size() - 1; i > 0; --i) {
+        totals[i] += mNodes[i].instructions;
+        totals[mNodes[i].parent] += totals[i];
+    }
+    return totals;
+}
+
+std::vector<FunctionProfile> Profiler::functions() const {
+    std::vector<long> totals = subtreeTotals();
+    std::map<int, FunctionProfile> byFunction;
+    for (unsigned i = 1; i < mNodes.size(); ++i) {
+        const Node &node = mNodes[i];
+        auto entry = byFunction.find(node.functionId);
+        if (entry == byFunction.end()) {
+            entry = byFunction.insert(std::make_pair(node.functionId,
+                                      FunctionProfile{node.functionId, 0, 0, 0})).first;
+        }
+        FunctionProfile &function = entry->second;
+        function.calls += node.calls;
+        function.exclusive += node.instructions;
+
+        // when a function is further up the same path, its total there
+        // already includes this one's
+        bool outermost = true;
+        for (int up = node.parent; up > 0; up = mNodes[up].parent) {
+            if (mNodes[up].functionId == node.functionId) {
+                outermost = false;
+                break;
+            }
+        }
+        if (outermost) function.inclusive += totals[i];
+    }
+
+    std::vector<FunctionProfile> result;
+    for (const auto &entry : byFunction) result.push_back(entry.second);
+    std::stable_sort(result.begin(), result.end(),
+        [](const FunctionProfile &lhs, const FunctionProfile &rhs) {
+            if (lhs.inclusive != rhs.inclusive) return lhs.inclusive > rhs.inclusive;
+            return lhs.exclusive > rhs.exclusive;
+        });
+    return result;
+}
+
+static std::string functionLabel(GameData &data, int functionId) {
+    const FunctionDef &def = data.getFunction(functionId);
+    std::string text;
+    if (def.srcName >= 0) {
+        text = data.getString(def.srcName).text();
+    } else {
+        text = "#" + std::to_string(functionId);
+    }
+    if (def.srcFile >= 0) {
+        text += " (" + data.getString(def.srcFile).text();
+        if (def.srcLine >= 0) text += ":" + std::to_string(def.srcLine);
+        text += ")";
+    }
+    // semicolons separate the frames of folded stacks
+    std::replace(text.begin(), text.end(), ';', ':');
+    return text;
+}
+
+static std::string opcodeName(int code) {
+    const OpcodeDef *opcode = getOpcodeByCode(code);
+    if (opcode) return opcode->name;
+    return "#" + std::to_string(code);
+}
+
+static double percentOf(long amount, long total) {
+    return total ? 100.0 * amount / total : 0.0;
+}
+
+void Profiler::report(GameData &data, std::ostream &out) const {
+    std::ios::fmtflags oldFlags = out.flags();
+    std::streamsize oldPrecision = out.precision();
+    out << std::fixed << std::setprecision(1);
+
+    long total = 0, totalNanos = 0;
+    std::vector<int> byCount;
+    for (unsigned i = 0; i < PROFILE_OPCODES; ++i) {
+        if (mOpcodeCounts[i] == 0) continue;
+        total += mOpcodeCounts[i];
+        totalNanos += mOpcodeNanos[i];
+        byCount.push_back(i);
+    }
+    std::stable_sort(byCount.begin(), byCount.end(), [this](int lhs, int rhs) {
+        return mOpcodeCounts[lhs] > mOpcodeCounts[rhs];
+    });
+
+    out << "\nPROFILE: " << total << " opcodes executed in "
+        << totalNanos / 1000 << " microseconds\n";
+    out << "\nOPCODE                COUNT       %   MICROSECONDS   NS EACH\n";
+    for (int code : byCount) {
+        out << std::left << std::setw(16) << opcodeName(code) << std::right;
+        out << std::setw(11) << mOpcodeCounts[code];
+        out << std::setw(8) << percentOf(mOpcodeCounts[code], total);
+        out << std::setw(15) << mOpcodeNanos[code] / 1000;
+        out << std::setw(10) << static_cast<double>(mOpcodeNanos[code]) / mOpcodeCounts[code];
+        out << '\n';
+    }
+
+    std::vector<unsigned> pairs;
+    for (unsigned i = 0; i < mPairCounts.size(); ++i) {
+        if (mPairCounts[i] > 0) pairs.push_back(i);
+    }
+    std::stable_sort(pairs.begin(), pairs.end(), [this](unsigned lhs, unsigned rhs) {
+        return mPairCounts[lhs] > mPairCounts[rhs];
+    });
+    if (pairs.size() > PROFILE_TOP_PAIRS) pairs.resize(PROFILE_TOP_PAIRS);
+    out << "\nOPCODE PAIR                           COUNT       %\n";
+    for (unsigned pair : pairs) {
+        std::string name = opcodeName(pair / PROFILE_OPCODES) + " -> "
+                         + opcodeName(pair % PROFILE_OPCODES);
+        out << std::left << std::setw(32) << name << std::right;
+        out << std::setw(11) << mPairCounts[pair];
+        out << std::setw(8) << percentOf(mPairCounts[pair], total) << '\n';
+    }
+
+    out << "\n     CALLS   INCLUSIVE       %   EXCLUSIVE       %  FUNCTION\n";
+    for (const FunctionProfile &function : functions()) {
+        out << std::setw(10) << function.calls;
+        out << std::setw(12) << function.inclusive;
+        out << std::setw(8) << percentOf(function.inclusive, total);
+        out << std::setw(12) << function.exclusive;
+        out << std::setw(8) << percentOf(function.exclusive, total);
+        out << "  " << functionLabel(data, function.functionId);
+        out << " #" << function.functionId << '\n';
+    }
+
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+}
+
+void Profiler::writeFolded(GameData &data, std::ostream &out) const {
+    std::map<int, std::string> labels;
+    std::vector<std::string> paths(mNodes.size());
+    for (unsigned i = 1; i < mNodes.size(); ++i) {
+        const Node &node = mNodes[i];
+        auto label = labels.find(node.functionId);
+        if (label == labels.end()) {
+            label = labels.insert(std::make_pair(node.functionId,
+                                  functionLabel(data, node.functionId))).first;
+        }
+        if (node.parent > 0) paths[i] = paths[node.parent] + ';';
+        paths[i] += label->second;
+        if (node.instructions > 0) out << paths[i] << ' ' << node.instructions << '\n';
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+#include "stack.h"
+
+struct GameData;
+
+const unsigned PROFILE_OPCODES = 256;
+const unsigned PROFILE_TOP_PAIRS = 20;
+
+struct FunctionProfile {
+    int functionId;
+    long calls;
+    long inclusive;         // instructions run by the function and those it called
+    long exclusive;         // instructions run by the function itself
+};
+
+// Collects what a game run with -profile spent its time on: how often each
+// opcode was executed and the time taken by it, how often each opcode was
+// executed directly after each other, and the number of instructions executed
+// along each distinct path through the call stack. Function totals are worked
+// out from the paths when they're asked for, so each instruction costs only a
+// few counter updates.
+class Profiler {
+public:
+    Profiler();
+
+    // Follow any change to the call stack since the last instruction; the
+    // only opcodes that change it are calls and returns, so this is rarely
+    // more than a single step.
+    void follow(const gtCallStack &stack) {
+        if (mPath.size() != static_cast<unsigned>(stack.size())) followFrames(stack);
+    }
+    void count(int opcode, long nanos) {
+        if (!mPath.empty()) ++mNodes[mPath.back()].instructions;
+        ++mOpcodeCounts[opcode];
+        mOpcodeNanos[opcode] += nanos;
+        if (mLastOpcode >= 0) ++mPairCounts[mLastOpcode * PROFILE_OPCODES + opcode];
+        mLastOpcode = opcode;
+    }
+
+    long opcodeCount(int opcode) const {
+        return mOpcodeCounts[opcode];
+    }
+    long pairCount(int first, int second) const {
+        return mPairCounts[first * PROFILE_OPCODES + second];
+    }
+    // every function that was called, most instructions first
+    std::vector<FunctionProfile> functions() const;
+
+    void report(GameData &data, std::ostream &out) const;
+    // one line for each call path that executed instructions, in the form
+    // taken by flamegraph.pl and similar tools
+    void writeFolded(GameData &data, std::ostream &out) const;
+private:
+    struct Node {
+        int functionId;
+        int parent;
+        long calls;
+        long instructions;
+        std::map<int, int> children;    // node of each function called from here
+    };
+    void followFrames(const gtCallStack &stack);
+    std::vector<long> subtreeTotals() const;
+
+    std::vector<Node> mNodes;           // the first is the root, outside any function
+    std::vector<int> mPath;             // the node of each frame on the call stack
+    std::vector<long> mOpcodeCounts;
+    std::vector<long> mOpcodeNanos;
+    std::vector<long> mPairCounts;
+    int mLastOpcode;
+};
+
+#endif
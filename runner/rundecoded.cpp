@@ -0,0 +1,260 @@
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "gamedata.h"
+#include "opcode.h"
+#include "stack.h"
+
+// The decoded engine is direct-threaded when the compiler supports taking the
+// address of a label (GCC and Clang); otherwise it falls back to dispatching
+// through a switch on the decoded opcode. With computed goto, the functions
+// that passed verifyFunctions run on a second set of handlers that leave out
+// the checks the verifier has made unnecessary. Either way, instructions are
+// quickened into forms specialised for the operand types they have seen.
+// Functions compiled by the JIT (computed goto only) have their compiled
+// instructions' handlers replaced by native_Enter, which runs the machine code
+// until it reaches an instruction it left to the decoded engine. Dispatch
+// yields once the instruction budget given to resume is spent.
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+#define TARGET(name)        LABEL(name):
+#define QUICK_TARGET(name)  LABEL(name):
+#define TARGET_DEFAULT      LABEL(Generic):
+#define DISPATCH()          do { if (++instructionCount > instructionLimit) goto out_of_budget; \
+                                 goto *ip->handler; } while (0)
+#define REWRITE(code, name) do { ip->opcode = (code); ip->handler = &&LABEL(name); } while (0)
+#define COUNT_CALL(function) \
+    if (jitMode == JitMode::Hot && ++(function).callCount == JIT_THRESHOLD) \
+        compileNative((function), &&native_Enter)
+#else
+#define TARGET(name)        case OpcodeDef::name:
+#define QUICK_TARGET(name)  case QuickOpcode::name:
+#define TARGET_DEFAULT      default:
+#define DISPATCH()          continue
+#define REWRITE(code, name) ip->opcode = (code)
+#define COUNT_CALL(function)
+#endif
+
+// Quickening replaces the current instruction with a specialised form. When
+// the guard of a specialised form fails, the instruction is changed back and
+// dispatched again to run generically.
+#define CAN_QUICKEN()       (ip->deopts < QUICKEN_LIMIT)
+#define QUICKEN(name)       REWRITE(QuickOpcode::name, name)
+#define DEOPTIMIZE(name)    { ++ip->deopts; REWRITE(OpcodeDef::name, name); \
+                              --instructionCount; DISPATCH(); }
+
+// the guards of the specialised forms; STACK_HOLDS is defined for each set of
+// handlers
+#define TOP_TYPES(top, next)    (STACK_HOLDS(2) && callStack.peekUnchecked(0).type == (top) \
+                                 && callStack.peekUnchecked(1).type == (next))
+#define TOP_IDENT()             (STACK_HOLDS(2) && isIdentType(callStack.peekUnchecked(0).type) \
+                                 && callStack.peekUnchecked(0).type == callStack.peekUnchecked(1).type)
+#define LOCAL_AND_TOP_INTS()    (STACK_HOLDS(1) && callStack.peekUnchecked(0).type == Value::Integer \
+                                 && callStack.localAt(ip->operand.value).type == Value::Integer)
+
+// Value::compare for two integers
+static inline int compareInts(int lhs, int rhs) {
+    return static_cast<int>(static_cast<unsigned>(lhs) - static_cast<unsigned>(rhs));
+}
+// GameData::compareFor for two integers
+static inline bool compareIntsFor(int opcode, int lhs, int rhs) {
+    switch(opcode) {
+        case OpcodeDef::Equal:              return compareInts(lhs, rhs) == 0;
+        case OpcodeDef::NotEqual:           return compareInts(lhs, rhs) != 0;
+        case OpcodeDef::LessThan:           return compareInts(lhs, rhs) > 0;
+        case OpcodeDef::LessThanEqual:      return compareInts(lhs, rhs) >= 0;
+        case OpcodeDef::GreaterThan:        return compareInts(lhs, rhs) < 0;
+        case OpcodeDef::GreaterThanEqual:   return compareInts(lhs, rhs) <= 0;
+        default:
+            return GameData::compareFor(opcode, Value(Value::Integer, lhs),
+                                        Value(Value::Integer, rhs));
+    }
+}
+// the types Value::compare compares by identity alone
+static inline bool isIdentType(Value::Type type) {
+    return type != Value::None && type != Value::Integer && type != Value::LocalVar;
+}
+
+static const DecodedOp* locate(const FunctionDef &function, unsigned IP) {
+    const DecodedCode &code = function.decoded;
+    unsigned offset = IP - function.position;
+    if (IP < function.position || offset >= code.index.size() || code.index[offset] < 0) {
+        throw GameError("Tried to execute invalid code position " + std::to_string(IP) + ".");
+    }
+    return &code.ops[code.index[offset]];
+}
+// the bytecode position of a decoded instruction; the reverse of locate
+static unsigned positionOf(const FunctionDef &function, const DecodedOp *ip) {
+    const DecodedCode &code = function.decoded;
+    const int index = ip - code.ops.data();
+    for (unsigned offset = 0; offset < code.index.size(); ++offset) {
+        if (code.index[offset] == index) return function.position + offset;
+    }
+    throw GameError("Decoded instruction has no code position.");
+}
+#ifdef USE_COMPUTED_GOTO
+// for jumps in functions that passed verification
+static const DecodedOp* locateVerified(const FunctionDef &function, unsigned IP) {
+    const DecodedCode &code = function.decoded;
+    return &code.ops[code.index[IP - function.position]];
+}
+#endif
+
+// Decode function the first time the decoded engine is to run it, giving its
+// instructions their handlers and, with JitMode::Always, compiling it.
+void GameData::prepareFunction(FunctionDef &function) {
+    decodeFunction(function);
+#ifdef USE_COMPUTED_GOTO
+    const bool verified = function.verified && !checkedOnly;
+    for (DecodedOp &op : function.decoded.ops) {
+        op.handler = verified ? mFastHandlers[op.opcode & 0xFF]
+                              : mHandlers[op.opcode & 0xFF];
+    }
+    if (jitMode == JitMode::Always) compileNative(function, nativeEnter);
+#endif
+}
+
+Value GameData::resumeDecoded() {
+#ifdef USE_COMPUTED_GOTO
+    // the handler tables are the same for every session, so only the first
+    // fills them in
+    static const void *handlers[256];
+    static const void *fastHandlers[256];
+    static std::mutex handlersLock;
+    static bool handlersSet = false;
+    if (!mDecodedReady) {
+        std::lock_guard<std::mutex> lock(handlersLock);
+        if (!handlersSet) {
+            for (const void *&handler : handlers) handler = &&op_Generic;
+            handlers[OpcodeDef::Return]             = &&op_Return;
+            handlers[OpcodeDef::Push32]             = &&op_Push32;
+            handlers[OpcodeDef::Store]              = &&op_Store;
+            handlers[OpcodeDef::StackPop]           = &&op_StackPop;
+            handlers[OpcodeDef::StackDup]           = &&op_StackDup;
+            handlers[OpcodeDef::Call]               = &&op_Call;
+            handlers[OpcodeDef::GetItem]            = &&op_GetItem;
+            handlers[OpcodeDef::SetItem]            = &&op_SetItem;
+            handlers[OpcodeDef::Equal]              = &&op_Equal;
+            handlers[OpcodeDef::NotEqual]           = &&op_NotEqual;
+            handlers[OpcodeDef::LessThan]           = &&op_LessThan;
+            handlers[OpcodeDef::LessThanEqual]      = &&op_LessThanEqual;
+            handlers[OpcodeDef::GreaterThan]        = &&op_GreaterThan;
+            handlers[OpcodeDef::GreaterThanEqual]   = &&op_GreaterThanEqual;
+            handlers[OpcodeDef::Jump]               = &&op_Jump;
+            handlers[OpcodeDef::JumpZero]           = &&op_JumpZero;
+            handlers[OpcodeDef::JumpNotZero]        = &&op_JumpNotZero;
+            handlers[OpcodeDef::Not]                = &&op_Not;
+            handlers[OpcodeDef::Add]                = &&op_Add;
+            handlers[OpcodeDef::Sub]                = &&op_Sub;
+            handlers[OpcodeDef::Mult]               = &&op_Mult;
+            handlers[OpcodeDef::Div]                = &&op_Div;
+            handlers[OpcodeDef::Mod]                = &&op_Mod;
+            handlers[OpcodeDef::AddLocal]           = &&op_AddLocal;
+            handlers[OpcodeDef::SubLocal]           = &&op_SubLocal;
+            handlers[OpcodeDef::CompareJumpZero]    = &&op_CompareJumpZero;
+            handlers[OpcodeDef::CompareJumpNotZero] = &&op_CompareJumpNotZero;
+            handlers[OpcodeDef::IncLocal]           = &&op_IncLocal;
+            handlers[OpcodeDef::StoreLocal]         = &&op_StoreLocal;
+            handlers[OpcodeDef::LoadLocal]          = &&op_LoadLocal;
+
+            for (const void *&handler : fastHandlers) handler = &&fast_Generic;
+            fastHandlers[OpcodeDef::Return]             = &&fast_Return;
+            fastHandlers[OpcodeDef::Push32]             = &&fast_Push32;
+            fastHandlers[OpcodeDef::Store]              = &&fast_Store;
+            fastHandlers[OpcodeDef::StackPop]           = &&fast_StackPop;
+            fastHandlers[OpcodeDef::StackDup]           = &&fast_StackDup;
+            fastHandlers[OpcodeDef::Call]               = &&fast_Call;
+            fastHandlers[OpcodeDef::GetItem]            = &&fast_GetItem;
+            fastHandlers[OpcodeDef::SetItem]            = &&fast_SetItem;
+            fastHandlers[OpcodeDef::Equal]              = &&fast_Equal;
+            fastHandlers[OpcodeDef::NotEqual]           = &&fast_NotEqual;
+            fastHandlers[OpcodeDef::LessThan]           = &&fast_LessThan;
+            fastHandlers[OpcodeDef::LessThanEqual]      = &&fast_LessThanEqual;
+            fastHandlers[OpcodeDef::GreaterThan]        = &&fast_GreaterThan;
+            fastHandlers[OpcodeDef::GreaterThanEqual]   = &&fast_GreaterThanEqual;
+            fastHandlers[OpcodeDef::Jump]               = &&fast_Jump;
+            fastHandlers[OpcodeDef::JumpZero]           = &&fast_JumpZero;
+            fastHandlers[OpcodeDef::JumpNotZero]        = &&fast_JumpNotZero;
+            fastHandlers[OpcodeDef::Not]                = &&fast_Not;
+            fastHandlers[OpcodeDef::Add]                = &&fast_Add;
+            fastHandlers[OpcodeDef::Sub]                = &&fast_Sub;
+            fastHandlers[OpcodeDef::Mult]               = &&fast_Mult;
+            fastHandlers[OpcodeDef::Div]                = &&fast_Div;
+            fastHandlers[OpcodeDef::Mod]                = &&fast_Mod;
+            fastHandlers[OpcodeDef::AddLocal]           = &&fast_AddLocal;
+            fastHandlers[OpcodeDef::SubLocal]           = &&fast_SubLocal;
+            fastHandlers[OpcodeDef::CompareJumpZero]    = &&fast_CompareJumpZero;
+            fastHandlers[OpcodeDef::CompareJumpNotZero] = &&fast_CompareJumpNotZero;
+            fastHandlers[OpcodeDef::IncLocal]           = &&fast_IncLocal;
+            fastHandlers[OpcodeDef::StoreLocal]         = &&fast_StoreLocal;
+            fastHandlers[OpcodeDef::LoadLocal]          = &&fast_LoadLocal;
+            handlersSet = true;
+        }
+        mHandlers = handlers;
+        mFastHandlers = fastHandlers;
+        nativeEnter = &&native_Enter;
+        mDecodedReady = true;
+    }
+#endif
+    // frames below the top may have been restored or loaded rather than called
+    for (int i = 0; i < callStack.size(); ++i) {
+        const gtCallStack::Frame &frame = callStack[i];
+        if (!frame.funcDef.isDecoded) prepareFunction(getFunction(frame.functionId));
+    }
+
+    const FunctionDef *func = &callStack.callTop().funcDef;
+    const DecodedOp *ip = locate(*func, callStack.callTop().IP);
+
+#ifdef USE_COMPUTED_GOTO
+    DISPATCH();
+#else
+    while (1) {
+        if (++instructionCount > instructionLimit) goto out_of_budget;
+        switch(ip->opcode) {
+#endif
+
+#define CHECKED             1
+#define LABEL(name)         op_##name
+#define POP()               callStack.pop()
+#define BRANCH(offset)      locate(*func, func->position + (offset))
+#define STACK_HOLDS(count)  (callStack.stackSize() >= (count))
+#include "decodedops.inc"
+#undef CHECKED
+#undef LABEL
+#undef POP
+#undef BRANCH
+#undef STACK_HOLDS
+
+#ifdef USE_COMPUTED_GOTO
+#define CHECKED             0
+#define LABEL(name)         fast_##name
+#define POP()               callStack.popUnchecked()
+#define BRANCH(offset)      locateVerified(*func, func->position + (offset))
+#define STACK_HOLDS(count)  true
+#include "decodedops.inc"
+#undef CHECKED
+#undef LABEL
+#undef POP
+#undef BRANCH
+#undef STACK_HOLDS
+
+native_Enter:
+    --instructionCount;
+    ip = runNative(func, ip);
+    DISPATCH();
+#endif
+
+#ifndef USE_COMPUTED_GOTO
+        }
+    }
+#endif
+
+out_of_budget:
+    // the instruction at ip hasn't run
+    --instructionCount;
+    return yieldAt(positionOf(*func, ip));
+}
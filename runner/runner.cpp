@@ -1,14 +1,61 @@
+#include <csignal>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <stdlib.h>
 #include <string.h>
 #include "gamedata.h"
+#include "host.h"
 #include "io.h"
+#include "profile.h"
+
+const char *PROFILE_FOLDED_FILE = "profile.folded";
+
+static void writeProfile(GameData &data, const Profiler &profiler) {
+    profiler.report(data, std::cerr);
+    std::ofstream folded(PROFILE_FOLDED_FILE);
+    profiler.writeFolded(data, folded);
+    std::cerr << "\nCall stacks written to " << PROFILE_FOLDED_FILE << ".\n";
+}
+
+static SessionHost *runningHost = nullptr;
+
+static void stopHost(int) {
+    if (runningHost) runningHost->stop();
+}
+
+// Plays the game for everyone who connects to the socket at socketPath, until
+// interrupted.
+static int runHost(const std::string &gameFile, const std::string &socketPath,
+                   const HostOptions &options) {
+    std::shared_ptr<const GameImage> image = GameImage::load(gameFile);
+    if (!image) return 1;
+    SessionHost host(image, options);
+    if (!host.listen(socketPath)) return 1;
+    runningHost = &host;
+    std::signal(SIGINT, stopHost);
+    std::signal(SIGTERM, stopHost);
+    std::cerr << "Playing " << gameFile << " on " << socketPath << ".\n";
+    host.serve();
+    runningHost = nullptr;
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
     std::string gameFile;
     bool doDump = false;
     bool doSilent = false;
     bool showDebug = false;
+    bool doProfile = false;
+    bool useDecoded = false;
+    bool checkedOnly = false;
+    long turnLimit = 0;
+    int undoLevels = 0;
+    std::string socketPath;
+    int threads = 0;
+    int idleSeconds = 0;
+    JitMode jitMode = JitMode::Off;
+    GcMode gcMode = GcMode::Generational;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0) {
@@ -16,6 +63,18 @@ int main(int argc, char *argv[]) {
             std::cerr << "    -version   Display version data then quit.\n";
             std::cerr << "    -dump      Dump game data then quit.\n";
             std::cerr << "    -silent    Run initial game function then quit.\n";
+            std::cerr << "    -decoded   Run using the pre-decoded execution engine.\n";
+            std::cerr << "    -checked   Keep all runtime checks in the pre-decoded engine.\n";
+            std::cerr << "    -jit       Compile frequently called functions to machine code.\n";
+            std::cerr << "    -jit-always  Compile each function to machine code when first called.\n";
+            std::cerr << "    -gc-full   Only use complete garbage collections.\n";
+            std::cerr << "    -gc-incremental  Spread complete garbage collections over several turns.\n";
+            std::cerr << "    -profile   Report where execution time went when the game ends.\n";
+            std::cerr << "    -limit N   Stop the game if a single turn runs more than N instructions.\n";
+            std::cerr << "    -undo N    Let the player take back up to N turns by entering \"undo\".\n";
+            std::cerr << "    -host PATH Play a separate session for each connection to the socket PATH.\n";
+            std::cerr << "    -threads N Run hosted sessions on N threads (default one per core).\n";
+            std::cerr << "    -hibernate N  Save hosted sessions idle for N seconds to disk until their next input.\n";
             return 0;
         } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "-version") == 0) {
             std::cerr << "Console Runner RatVM, V1.0\n";
@@ -26,6 +85,52 @@ int main(int argc, char *argv[]) {
             doSilent = true;
         } else if (strcmp(argv[i], "-debug") == 0) {
             showDebug = true;
+        } else if (strcmp(argv[i], "-decoded") == 0) {
+            useDecoded = true;
+        } else if (strcmp(argv[i], "-checked") == 0) {
+            checkedOnly = true;
+        } else if (strcmp(argv[i], "-jit") == 0) {
+            useDecoded = true;
+            jitMode = JitMode::Hot;
+        } else if (strcmp(argv[i], "-jit-always") == 0) {
+            useDecoded = true;
+            jitMode = JitMode::Always;
+        } else if (strcmp(argv[i], "-gc-full") == 0) {
+            gcMode = GcMode::Full;
+        } else if (strcmp(argv[i], "-gc-incremental") == 0) {
+            gcMode = GcMode::Incremental;
+        } else if (strcmp(argv[i], "-profile") == 0) {
+            doProfile = true;
+        } else if (strcmp(argv[i], "-limit") == 0) {
+            if (i + 1 >= argc || (turnLimit = atol(argv[i + 1])) <= 0) {
+                std::cerr << "-limit requires a positive number of instructions.\n";
+                return 1;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "-undo") == 0) {
+            if (i + 1 >= argc || (undoLevels = atoi(argv[i + 1])) <= 0) {
+                std::cerr << "-undo requires a positive number of turns.\n";
+                return 1;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "-host") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "-host requires the path of a socket.\n";
+                return 1;
+            }
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            if (i + 1 >= argc || (threads = atoi(argv[i + 1])) <= 0) {
+                std::cerr << "-threads requires a positive number of threads.\n";
+                return 1;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "-hibernate") == 0) {
+            if (i + 1 >= argc || (idleSeconds = atoi(argv[i + 1])) <= 0) {
+                std::cerr << "-hibernate requires a positive number of seconds.\n";
+                return 1;
+            }
+            ++i;
         } else if (argv[i][0] == '-') {
             std::cerr << "Unrecognized option " << argv[i] << ".\n";
             return 1;
@@ -38,11 +143,36 @@ int main(int argc, char *argv[]) {
     }
     if (gameFile.empty()) gameFile = "game.qvm";
 
+    if (!socketPath.empty()) {
+        if (doDump || doProfile) {
+            std::cerr << "-dump and -profile can't be used with -host.\n";
+            return 1;
+        }
+        HostOptions options;
+        options.threads = threads;
+        options.useDecoded = useDecoded;
+        options.checkedOnly = checkedOnly;
+        options.jitMode = jitMode;
+        options.gcMode = gcMode;
+        options.turnLimit = turnLimit;
+        options.undoLevels = undoLevels;
+        options.idleTime = idleSeconds * 1000L;
+        const char *tempDir = getenv("TMPDIR");
+        if (tempDir && tempDir[0]) options.hibernateDir = tempDir;
+        options.title = gameFile;
+        return runHost(gameFile, socketPath, options);
+    }
 
     GameData data;
     data.load(gameFile);
     if (!data.gameLoaded) return 1;
     data.showDebug = showDebug;
+    data.useDecoded = useDecoded;
+    data.checkedOnly = checkedOnly;
+    data.jitMode = jitMode;
+    data.gcMode = gcMode;
+    data.turnLimit = turnLimit;
+    data.undoLevels = undoLevels;
 
     if (doDump) {
         data.dump();
@@ -53,50 +183,19 @@ int main(int argc, char *argv[]) {
         data.infoText[i] = "";
     }
     data.infoText[INFO_TITLE] = gameFile;
+
+    // profiling always uses the basic interpreter, so that the counts are of
+    // the opcodes in the gamefile
+    Profiler profiler;
+    if (doProfile) data.profiler = &profiler;
     try {
         gameloop(data, doSilent);
     } catch (GameError &e) {
-        std::cerr << "\n" << IO::setFG(IO::Red);
-        std::cerr << "RUNTIME ERROR:";
-        std::cerr << IO::normal();
-        std::cerr << ' ' << e.what() << '\n';
-        std::cerr << "CALL STACK:\n";
-        if (data.callStack.isEmpty()) {
-            std::cerr << "    EMPTY\n";
-        } else {
-            for (int i = data.callStack.size() - 1; i >= 0 ; --i) {
-                const gtCallStack::Frame &frame = data.callStack[i];
-                FunctionDef &fdef = data.getFunction(frame.functionId);
-                std::cerr << "    ";
-                if (fdef.srcName >= 0) {
-                    std::cerr << data.getString(fdef.srcName).text;
-                } else {
-                    std::cerr << "(no debug info)";
-                }
-                std::cerr << " #" << frame.functionId << ' ';
-                if (fdef.srcFile >= 0) {
-                    std::cerr << '(' << data.getString(fdef.srcFile).text;
-                    if (fdef.srcLine >= 0) {
-                        std::cerr << ':' << fdef.srcLine;
-                    }
-                    std::cerr << ')';
-                }
-                std::cerr << '\n';
-
-                std::cerr << "        LOCAL:";
-                for (const Value &v : frame.stack.argList) {
-                    std::cerr << ' ' << v;
-                }
-                std::cerr << '\n';
-                std::cerr << "        STACK:";
-                for (const Value &v : frame.stack.mValues) {
-                    std::cerr << ' ' << v;
-                }
-                std::cerr << '\n';
-            }
-        }
+        reportError(data, e);
+        if (doProfile) writeProfile(data, profiler);
         return 1;
     }
+    if (doProfile) writeProfile(data, profiler);
     std::cout << IO::normal();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include "gamedata.h"
+
+// A snapshot takes over the items the session owns and shares them from then
+// on, so that changing one afterwards copies it first, just as with the
+// image's static items; the tables only copy the pages of slots that changed
+// since their last snapshot. Strings are flattened before being frozen since
+// a snapshot may be restored on other threads.
+//
+// The idents the tables will hand out next follow from their free lists and
+// slot counts, which are part of their snapshots. Caches (decoded functions,
+// compiled code, and the property cache) aren't, and any collection in
+// progress is dropped; which items are young or remembered is kept. Restoring
+// leaves the garbage collector's marks on items the tables don't rewrite, so
+// the collection count never goes back, lest a later collection take those
+// marks for its own.
+
+std::shared_ptr<const SessionSnapshot> GameData::snapshot() {
+    std::shared_ptr<SessionSnapshot> frozen(new SessionSnapshot);
+    frozen->image = image;
+    frozen->strings = strings.snapshot([](const StringDef &s) { s.text(); });
+    frozen->lists = lists.snapshot([](const ListDef&) { });
+    frozen->maps = maps.snapshot([](const MapDef&) { });
+    frozen->objects = objects.snapshot([](const ObjectDef&) { });
+    const std::map<int, FunctionDef> &imageFunctions = image->functions;
+    frozen->callStack.assign(callStack, [&imageFunctions](unsigned id) -> const FunctionDef& {
+        return imageFunctions.at(id);
+    });
+    frozen->optionType = optionType;
+    frozen->options = options;
+    frozen->extraValue = extraValue;
+    frozen->infoText = infoText;
+    frozen->nursery = mNursery;
+    frozen->remembered = mRemembered;
+    frozen->gcEpoch = mGcEpoch;
+    return frozen;
+}
+
+void GameData::restore(const SessionSnapshot &snapshot) {
+    // items the tables leave as they are keep their state, so what is young
+    // or remembered now is forgotten first
+    GcState *state = nullptr;
+    for (const Value &ref : mNursery) {
+        if (gcFind(ref, state)) state->young = false;
+    }
+    for (const Value &ref : mRemembered) {
+        if (gcFind(ref, state)) state->remembered = false;
+    }
+
+    if (image != snapshot.image) attach(snapshot.image);
+    strings.restore(snapshot.strings);
+    lists.restore(snapshot.lists);
+    maps.restore(snapshot.maps);
+    objects.restore(snapshot.objects);
+    callStack.assign(snapshot.callStack, [this](unsigned id) -> const FunctionDef& {
+        return getFunction(id);
+    });
+    optionType = snapshot.optionType;
+    options = snapshot.options;
+    extraValue = snapshot.extraValue;
+    infoText = snapshot.infoText;
+
+    mGcEpoch = std::max(mGcEpoch, snapshot.gcEpoch);
+    mGcMarking = false;
+    mGcGray.clear();
+    mNursery = snapshot.nursery;
+    mRemembered = snapshot.remembered;
+    for (const Value &ref : mNursery) {
+        if (gcFind(ref, state)) state->young = true;
+    }
+    for (const Value &ref : mRemembered) {
+        if (gcFind(ref, state)) state->remembered = true;
+    }
+    invalidatePropertyCache();
+}
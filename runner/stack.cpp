@@ -1,95 +1,155 @@
+#include <algorithm>
 #include <sstream>
 #include <string>
 
 #include "gameerror.h"
+#include "gamedata.h"
 #include "stack.h"
 
+// initial capacity of the value and frame stacks; both grow as needed
+const unsigned STACK_RESERVE = 1024;
+const unsigned FRAME_RESERVE = 64;
 
-void gtStack::setArgs(const std::vector<Value> &rawArgs, int argCount, int localCount) {
-    argList = rawArgs;
+gtCallStack::gtCallStack()
+: mStorage(STACK_RESERVE) {
+    mFrames.reserve(FRAME_RESERVE);
+    mWindow.top = mStorage.data();
+    mWindow.limit = mStorage.data() + mStorage.size();
+    setWindow();
+}
 
-    if (static_cast<int>(argList.size()) != argCount) {
-        argList.resize(argCount);
-    }
-    for (int i = 0; i < localCount; ++i) argList.push_back(Value());
+gtCallStack::gtCallStack(const gtCallStack &rhs)
+: mStorage(rhs.mStorage), mFrames(rhs.mFrames) {
+    mWindow.top = mStorage.data() + rhs.valueCount();
+    mWindow.limit = mStorage.data() + mStorage.size();
+    setWindow();
 }
 
-void gtStack::setArg(unsigned index, const Value &newValue) {
-    if (index >= argList.size()) {
-        throw GameError("Tried to set illegal local number " + std::to_string(index) + ".");
+void gtCallStack::assign(const gtCallStack &rhs,
+                         const std::function<const FunctionDef&(unsigned)> &lookup) {
+    const unsigned used = rhs.valueCount();
+    mFrames.clear();
+    mWindow.top = mStorage.data();
+    reserve(used);
+    std::copy(rhs.mStorage.begin(), rhs.mStorage.begin() + used, mStorage.begin());
+    for (const Frame &frame : rhs.mFrames) {
+        mFrames.push_back(Frame{lookup(frame.functionId), frame.functionId,
+                                frame.base, frame.localCount, frame.IP});
     }
-    argList[index] = newValue;
+    mWindow.top = mStorage.data() + used;
+    setWindow();
 }
 
-Value gtStack::peek(int index) const {
-    if (index < 0) throw GameError("Tried to peek at negative stack index.");
-    if (index >= static_cast<int>(mValues.size())) {
-        throw GameError("Tried to peek beyond stack size.");
+void gtCallStack::load(const std::vector<Frame> &frames, const std::vector<Value> &values) {
+    unsigned end = 0;
+    for (const Frame &frame : frames) {
+        if (frame.base < end || frame.base + frame.localCount > values.size()) {
+            throw GameError("Saved call stack is damaged.");
+        }
+        end = frame.base + frame.localCount;
     }
-    return mValues[mValues.size() - 1 - index];
+    mFrames.clear();
+    mWindow.top = mStorage.data();
+    reserve(values.size());
+    std::copy(values.begin(), values.end(), mStorage.begin());
+    for (const Frame &frame : frames) mFrames.push_back(frame);
+    mWindow.top = mStorage.data() + values.size();
+    setWindow();
 }
 
-Value gtStack::popRaw() {
-    if (mValues.empty()) {
-        throw GameError("Stack underflow.");
-    }
-    Value value = mValues.back();
-    mValues.pop_back();
-    return value;
+// value may lie within the storage, so it's copied before the storage moves
+void gtCallStack::pushGrowing(Value value) {
+    reserve(valueCount() + 1);
+    *mWindow.top++ = value;
 }
-Value gtStack::pop() {
-    Value value = popRaw();
-    if (value.type == Value::LocalVar) {
-        if (value.value < 0 || value.value >= static_cast<int>(argList.size())) {
-            throw GameError("Illegal argument number.");
-        }
-        return argList[value.value];
+
+// make room for the stack to hold count values
+void gtCallStack::reserve(unsigned count) {
+    if (count <= mStorage.size()) return;
+    const unsigned used = valueCount();
+    mStorage.resize(std::max<size_t>(count, mStorage.size() * 2));
+    mWindow.top = mStorage.data() + used;
+    mWindow.limit = mStorage.data() + mStorage.size();
+    setWindow();
+}
+
+Value gtCallStack::peek(int index) const {
+    if (index < 0) throw GameError("Tried to peek at negative stack index.");
+    if (index >= static_cast<int>(stackSize())) {
+        throw GameError("Tried to peek beyond stack size.");
     }
-    return value;
+    return mWindow.top[-1 - index];
 }
 
-Value& gtStack::operator[](int index) {
-    if (index < 0 || index >= static_cast<int>(mValues.size())) {
+Value& gtCallStack::stackItem(int index) {
+    if (index < 0 || index >= static_cast<int>(stackSize())) {
         throw GameError("Tried to access invalid stack position.");
     }
-    return mValues[index];
+    return mWindow.floor[index];
 }
 
-const Value& gtStack::operator[](int index) const {
-    if (index < 0 || index >= static_cast<int>(mValues.size())) {
-        throw GameError("Tried to access invalid stack position.");
+void gtCallStack::setLocal(int index, const Value &newValue) {
+    if (index < 0 || index >= localCount()) {
+        throw GameError("Tried to set illegal local number " + std::to_string(index) + ".");
     }
-    return mValues[index];
+    mWindow.locals[index] = newValue;
 }
 
+void gtCallStack::create(const FunctionDef &funcDef, unsigned functionId, const Value &self, int argCount) {
+    if (argCount < 0) argCount = 0;
+    if (static_cast<unsigned>(argCount) > stackSize()) {
+        throw GameError("Stack underflow.");
+    }
 
-void gtCallStack::create(const FunctionDef &funcDef, unsigned functionId) {
-    mFrames.push_back(Frame{funcDef, functionId});
+    // arguments are used where they lie; references to the caller's locals
+    // must be resolved before the caller's frame stops being current
+    const Value selfValue = self;
+    const unsigned base = valueCount() - argCount;
+    for (Value *arg = mWindow.top - argCount; arg < mWindow.top; ++arg) {
+        if (arg->type == Value::LocalVar) *arg = getLocal(arg->value);
+    }
+    std::reverse(mWindow.top - argCount, mWindow.top);
+
+    // self goes before the arguments; extra arguments are dropped and
+    // missing ones cleared along with the locals
+    const unsigned frameSize = funcDef.arg_count + funcDef.local_count;
+    reserve(base + std::max<unsigned>(frameSize, argCount + 1));
+    Value *first = mStorage.data() + base;
+    std::copy_backward(first, first + argCount, first + argCount + 1);
+    *first = selfValue;
+    const unsigned kept = std::min<unsigned>(argCount + 1, funcDef.arg_count);
+    std::fill(first + kept, first + frameSize, Value());
+    mWindow.top = first + frameSize;
+
+    mFrames.push_back(Frame{funcDef, functionId, base,
+                            static_cast<unsigned>(funcDef.arg_count + funcDef.local_count), 0});
+    setWindow();
 }
 
 void gtCallStack::drop() {
+    mWindow.top = mStorage.data() + mFrames.back().base;
     mFrames.pop_back();
+    setWindow();
 }
 
-gtStack& gtCallStack::getStack() {
+void gtCallStack::setWindow() {
     if (mFrames.empty()) {
-        throw GameError("Tried to access stack with empty call stack.");
+        mWindow.locals = mWindow.floor = mStorage.data();
+    } else {
+        mWindow.locals = mStorage.data() + mFrames.back().base;
+        mWindow.floor = mWindow.locals + mFrames.back().localCount;
     }
-    return mFrames[mFrames.size() - 1].stack;
 }
 
 
-bool gtCallStack::isEmpty() const {
-    return mFrames.size() == 0;
-}
-
-int gtCallStack::size() const {
-    return mFrames.size();
-}
-
-const gtCallStack::Frame& gtCallStack::operator[](int index) {
+const gtCallStack::Frame& gtCallStack::operator[](int index) const {
     if (index < 0 || index >= static_cast<int>(mFrames.size())) {
         throw GameError("Tried to read non-exstant stack frame.");
     }
     return mFrames[index];
 }
+
+unsigned gtCallStack::frameEnd(int index) const {
+    if (index + 1 < static_cast<int>(mFrames.size())) return (*this)[index + 1].base;
+    return valueCount();
+}
@@ -1,60 +1,99 @@
 #ifndef STACK_H_735463546
 #define STACK_H_735463546
 
+#include <functional>
 #include <string>
 #include <vector>
+#include "gameerror.h"
 #include "value.h"
 
 struct FunctionDef;
 
-class gtStack {
-public:
-    void setArgs(const std::vector<Value> &rawArgs, int argCount, int localCount);
-    void setArg(unsigned index, const Value &newValue);
-    int argCount() const {
-        return static_cast<int>(argList.size());
-    }
-
-    Value peek(int index = 0) const;
-    void push(const Value &value) {
-        mValues.push_back(value);
-    }
-    Value popRaw();
-    Value pop();
-    bool isEmpty() const {
-        return mValues.empty();
-    }
-    unsigned size() const {
-        return static_cast<unsigned>(mValues.size());
-    }
-
-    Value& operator[](int index);
-    const Value& operator[](int index) const;
-
-    std::vector<Value> argList;
-    std::vector<Value> mValues;
-};
-
+// All frames share one contiguous stack of values. Each frame is a window
+// onto it: first the function's arguments and locals, then its working stack,
+// which extends up to the start of the next frame (or the top of the stack for
+// the current frame). Since the storage is only ever truncated, never freed,
+// calls and returns don't allocate once the stack has grown large enough.
 class gtCallStack {
 public:
     struct Frame {
         const FunctionDef &funcDef;
         unsigned functionId;
-        gtStack stack;
+        unsigned base;          // position of the first local
+        unsigned localCount;    // number of arguments plus locals
         int IP;
     };
+    // Where the current frame's values lie in the storage; moved whenever the
+    // storage grows. Machine code compiled by the JIT works on these directly.
+    struct Window {
+        Value *top;             // just past the top value
+        Value *limit;           // end of the storage
+        Value *locals;          // the current frame's first local
+        Value *floor;           // the start of its working stack
+    };
 
-    Value peek(int index = 0) const {
-        return mFrames.back().stack.peek(index);
-    }
+    gtCallStack();
+    gtCallStack(const gtCallStack &rhs);
+    gtCallStack& operator=(const gtCallStack &rhs) = delete;
+    // Make this a copy of rhs, with each frame's function found by lookup
+    // from its functionId, so the copy may belong to another session.
+    void assign(const gtCallStack &rhs, const std::function<const FunctionDef&(unsigned)> &lookup);
+    // Rebuild the stack from the frames and values of a saved one. Throws a
+    // GameError if the frames don't fit the values.
+    void load(const std::vector<Frame> &frames, const std::vector<Value> &values);
+
+    Value peek(int index = 0) const;
     void push(const Value &value) {
-        mFrames.back().stack.push(value);
+        if (mWindow.top == mWindow.limit) {
+            pushGrowing(value);
+        } else {
+            *mWindow.top++ = value;
+        }
     }
     Value popRaw() {
-        return mFrames.back().stack.popRaw();
+        if (mWindow.top <= mWindow.floor) {
+            throw GameError("Stack underflow.");
+        }
+        return *--mWindow.top;
     }
     Value pop() {
-        return mFrames.back().stack.pop();
+        Value value = popRaw();
+        if (value.type == Value::LocalVar) return getLocal(value.value);
+        return value;
+    }
+    // for code that was verified never to underflow or push local references
+    Value popUnchecked() {
+        return *--mWindow.top;
+    }
+
+    // the working stack of the current frame
+    bool stackEmpty() const {
+        return mWindow.top <= mWindow.floor;
+    }
+    unsigned stackSize() const {
+        return static_cast<unsigned>(mWindow.top - mWindow.floor);
+    }
+    Value& stackItem(int index);
+    // the value index places from the top, for callers that have already made
+    // sure the working stack is deep enough
+    const Value& peekUnchecked(int index) const {
+        return mWindow.top[-1 - index];
+    }
+
+    // the arguments and locals of the current frame
+    int localCount() const {
+        return static_cast<int>(mWindow.floor - mWindow.locals);
+    }
+    const Value& getLocal(int index) const {
+        if (index < 0 || index >= localCount()) {
+            throw GameError("Illegal argument number.");
+        }
+        return mWindow.locals[index];
+    }
+    void setLocal(int index, const Value &newValue);
+    // for local numbers that have already been checked against the function
+    Value& localAt(int index) {
+        return mWindow.locals[index];
     }
 
     const Frame& callTop() const {
@@ -70,15 +109,40 @@ public:
         return callTop().IP;
     }
 
-    void create(const FunctionDef &funcDef, unsigned functionId);
+    // Start a new frame for funcDef. The top argCount values of the current
+    // frame's working stack become its arguments (the topmost being the first
+    // argument) following self; missing arguments are set to None and extra
+    // ones discarded.
+    void create(const FunctionDef &funcDef, unsigned functionId, const Value &self, int argCount);
     void drop();
-    gtStack& getStack();
 
-    bool isEmpty() const;
-    int size() const;
-    const Frame& operator[](int index);
+    bool isEmpty() const {
+        return mFrames.empty();
+    }
+    int size() const {
+        return static_cast<int>(mFrames.size());
+    }
+    const Frame& operator[](int index) const;
+    // position just past the last value belonging to the frame at index
+    unsigned frameEnd(int index) const;
+    // every value of every frame, from the bottom of the stack
+    unsigned valueCount() const {
+        return static_cast<unsigned>(mWindow.top - mStorage.data());
+    }
+    const Value& valueAt(unsigned position) const {
+        return mStorage[position];
+    }
+    Window& window() {
+        return mWindow;
+    }
 private:
+    void pushGrowing(Value value);
+    void reserve(unsigned count);
+    void setWindow();
+
+    std::vector<Value> mStorage;    // always its full size; the window says what's in use
     std::vector<Frame> mFrames;
+    Window mWindow;
 };
 
 #endif
@@ -6,6 +6,7 @@
  *
  * Part of GTRPE by Gren Drake
  * **************************************************************************/
+#include <climits>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -110,6 +111,15 @@ void Value::forbidType(Value::Type theType) const {
     }
 }
 
+void Value::requireDivisorOf(int dividend) const {
+    if (value == 0) {
+        throw GameError("Division by zero.");
+    }
+    if (value == -1 && dividend == INT_MIN) {
+        throw GameError("Result of division out of range.");
+    }
+}
+
 bool Value::isTrue() const {
     return type != None && value != 0;
 }
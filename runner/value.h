@@ -36,6 +36,8 @@ struct Value {
     void requireType(Value::Type theType) const;
     void requireType(Value::Type typeOne, Value::Type typeTwo) const;
     void forbidType(Value::Type theType) const;
+    // Throws unless dividend can be divided by this value.
+    void requireDivisorOf(int dividend) const;
     bool isTrue() const;
     int compare(const Value &rhs) const;
 };
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "gamedata.h"
+#include "opcode.h"
+
+// Returns the number of bytes of operands following opcode in the bytecode.
+static unsigned operandSize(int opcode) {
+    switch(opcode) {
+        case OpcodeDef::Push0:
+        case OpcodeDef::Push1:              return 1;
+        case OpcodeDef::Push8:              return 2;
+        case OpcodeDef::Push16:             return 3;
+        case OpcodeDef::Push32:             return 5;
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+        case OpcodeDef::StoreLocal:
+        case OpcodeDef::LoadLocal:          return 2;
+        case OpcodeDef::CompareJumpZero:
+        case OpcodeDef::CompareJumpNotZero: return 5;
+        case OpcodeDef::IncLocal:           return 6;
+        default:                            return 0;
+    }
+}
+
+// The gamefile flag an opcode requires, if any.
+static unsigned requiredFlag(int opcode) {
+    switch(opcode) {
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+        case OpcodeDef::CompareJumpZero:
+        case OpcodeDef::CompareJumpNotZero: return GAMEFLAG_SUPERINSTRUCTIONS;
+        case OpcodeDef::IncLocal:
+        case OpcodeDef::StoreLocal:
+        case OpcodeDef::LoadLocal:          return GAMEFLAG_LOCAL_OPCODES;
+        default:                            return 0;
+    }
+}
+
+// The number of values an opcode pops from the stack and pushes onto it, for
+// those whose stack use doesn't depend on their operands. Returns false for
+// the others and for anything that isn't an opcode. The opcodes that wait for
+// input pop one value and have another pushed when execution resumes.
+static bool stackEffect(int opcode, unsigned &inputs, unsigned &outputs) {
+    switch(opcode) {
+        case OpcodeDef::IncLocal:
+            inputs = 0; outputs = 0; return true;
+        case OpcodeDef::CollectGarbage:
+        case OpcodeDef::StackSize:
+        case OpcodeDef::LoadLocal:
+            inputs = 0; outputs = 1; return true;
+        case OpcodeDef::SayUCFirst:
+        case OpcodeDef::Say:
+        case OpcodeDef::SayUnsigned:
+        case OpcodeDef::SayChar:
+        case OpcodeDef::StackPop:
+        case OpcodeDef::Sort:
+        case OpcodeDef::StringClear:
+        case OpcodeDef::StoreLocal:
+            inputs = 1; outputs = 0; return true;
+        case OpcodeDef::StackPeek:
+        case OpcodeDef::IsValid:
+        case OpcodeDef::ListPop:
+        case OpcodeDef::GetSize:
+        case OpcodeDef::TypeOf:
+        case OpcodeDef::Not:
+        case OpcodeDef::BitNot:
+        case OpcodeDef::NextObject:
+        case OpcodeDef::GetRandom:
+        case OpcodeDef::GetKeys:
+        case OpcodeDef::GetKey:
+        case OpcodeDef::GetOption:
+        case OpcodeDef::GetLine:
+        case OpcodeDef::Origin:
+        case OpcodeDef::New:
+        case OpcodeDef::IsStatic:
+        case OpcodeDef::EncodeString:
+        case OpcodeDef::DecodeString:
+        case OpcodeDef::FileList:
+        case OpcodeDef::FileRead:
+        case OpcodeDef::FileDelete:
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+            inputs = 1; outputs = 1; return true;
+        case OpcodeDef::ListPush:
+        case OpcodeDef::DelItem:
+        case OpcodeDef::SetSetting:
+        case OpcodeDef::StringAppend:
+        case OpcodeDef::StringAppendUF:
+            inputs = 2; outputs = 0; return true;
+        case OpcodeDef::GetItem:
+        case OpcodeDef::HasItem:
+        case OpcodeDef::AsType:
+        case OpcodeDef::Equal:
+        case OpcodeDef::NotEqual:
+        case OpcodeDef::LessThan:
+        case OpcodeDef::LessThanEqual:
+        case OpcodeDef::GreaterThan:
+        case OpcodeDef::GreaterThanEqual:
+        case OpcodeDef::Add:
+        case OpcodeDef::Sub:
+        case OpcodeDef::Mult:
+        case OpcodeDef::Div:
+        case OpcodeDef::Mod:
+        case OpcodeDef::Pow:
+        case OpcodeDef::BitLeft:
+        case OpcodeDef::BitRight:
+        case OpcodeDef::BitAnd:
+        case OpcodeDef::BitOr:
+        case OpcodeDef::BitXor:
+        case OpcodeDef::Random:
+        case OpcodeDef::IndexOf:
+        case OpcodeDef::StringCompare:
+        case OpcodeDef::FileWrite:
+            inputs = 2; outputs = 1; return true;
+        case OpcodeDef::SetItem:
+        case OpcodeDef::InsItem:
+        case OpcodeDef::Tokenize:
+            inputs = 3; outputs = 0; return true;
+        case OpcodeDef::AddOption:
+            inputs = 4; outputs = 0; return true;
+        default:
+            return false;
+    }
+}
+
+static bool isComparison(int opcode) {
+    return opcode >= OpcodeDef::Equal && opcode <= OpcodeDef::GreaterThanEqual;
+}
+
+static bool hasLocalOperand(int opcode) {
+    switch(opcode) {
+        case OpcodeDef::AddLocal:
+        case OpcodeDef::SubLocal:
+        case OpcodeDef::IncLocal:
+        case OpcodeDef::StoreLocal:
+        case OpcodeDef::LoadLocal:          return true;
+        default:                            return false;
+    }
+}
+
+// What the verifier knows about a value on the stack: either nothing, or that
+// it is always the same constant.
+struct StackEntry {
+    bool known;
+    Value value;
+};
+typedef std::vector<StackEntry> StackState;
+
+static StackEntry constant(Value::Type type, int value) {
+    return StackEntry{true, Value(type, value)};
+}
+static StackEntry unknown() {
+    return StackEntry{false, Value()};
+}
+
+// Follow every path through a function, tracking the stack depth and any
+// constants on the stack, to prove that it can be run without runtime checks.
+// This holds if, on every path, it never pops more values than its own frame
+// holds, every instruction is always reached with the same stack depth, every
+// jump goes to an instruction in the function, every store is to a constant
+// local number in range, every call has a constant argument count, and it
+// never pushes a reference to a local (so no popped value needs resolving).
+static bool verifyStack(const ByteStream &bytecode, const FunctionDef &function) {
+    if (function.position >= function.end) return false;
+    const int localCount = function.arg_count + function.local_count;
+
+    // instructions are numbered by their position within the function
+    std::vector<int> number(function.end - function.position, -1);
+    unsigned instructionCount = 0;
+    for (unsigned IP = function.position; IP < function.end;
+            IP += 1 + operandSize(bytecode.read_8(IP))) {
+        number[IP - function.position] = instructionCount++;
+    }
+    std::vector<StackState> states(instructionCount);
+    std::vector<bool> reached(instructionCount, false);
+    std::vector<unsigned> worklist;
+
+    // merge a state into that of the instruction at target, queueing the
+    // instruction if this tells us something new about it
+    auto flowTo = [&](unsigned target, const StackState &state) {
+        if (target < function.position || target >= function.end) return false;
+        int n = number[target - function.position];
+        if (n < 0) return false;
+        if (!reached[n]) {
+            reached[n] = true;
+            states[n] = state;
+            worklist.push_back(target);
+            return true;
+        }
+        StackState &old = states[n];
+        if (old.size() != state.size()) return false;
+        bool changed = false;
+        for (unsigned i = 0; i < old.size(); ++i) {
+            if (!old[i].known) continue;
+            if (!state[i].known || old[i].value.type != state[i].value.type
+                    || old[i].value.value != state[i].value.value) {
+                old[i].known = false;
+                changed = true;
+            }
+        }
+        if (changed) worklist.push_back(target);
+        return true;
+    };
+    // the constant of the given type at depth from the top of the stack
+    auto constantAt = [](const StackState &stack, unsigned depth, Value::Type type,
+                         int &value) {
+        const StackEntry &entry = stack[stack.size() - 1 - depth];
+        if (!entry.known || entry.value.type != type) return false;
+        value = entry.value.value;
+        return true;
+    };
+
+    flowTo(function.position, StackState());
+    while (!worklist.empty()) {
+        unsigned IP = worklist.back();
+        worklist.pop_back();
+        StackState stack = states[number[IP - function.position]];
+        int opcode = bytecode.read_8(IP);
+        unsigned nextIP = IP + 1 + operandSize(opcode);
+        unsigned inputs = 0, outputs = 0;
+        int value, target;
+
+        switch(opcode) {
+            case OpcodeDef::Return:
+            case OpcodeDef::Error:
+                continue;
+
+            case OpcodeDef::PushNone:
+                stack.push_back(constant(Value::None, 0));
+                break;
+            case OpcodeDef::Push0:
+            case OpcodeDef::Push1:
+            case OpcodeDef::Push8:
+            case OpcodeDef::Push16:
+            case OpcodeDef::Push32: {
+                Value::Type type = static_cast<Value::Type>(bytecode.read_8(IP + 1));
+                if (type == Value::LocalVar) return false;
+                if (opcode == OpcodeDef::Push0)       value = 0;
+                else if (opcode == OpcodeDef::Push1)  value = 1;
+                else if (opcode == OpcodeDef::Push8)  value = static_cast<int8_t>(bytecode.read_8(IP + 2));
+                else if (opcode == OpcodeDef::Push16) value = static_cast<int16_t>(bytecode.read_16(IP + 2));
+                else                                  value = bytecode.read_32(IP + 2);
+                stack.push_back(constant(type, value));
+                break; }
+
+            case OpcodeDef::Store:
+                if (stack.size() < 2) return false;
+                if (!constantAt(stack, 0, Value::VarRef, value)) return false;
+                if (value < 0 || value >= localCount) return false;
+                stack.resize(stack.size() - 2);
+                break;
+
+            case OpcodeDef::StackDup:
+                if (stack.empty()) return false;
+                stack.push_back(stack.back());
+                break;
+            case OpcodeDef::StackSwap: {
+                if (stack.size() < 2) return false;
+                int first = 0, second = 0;
+                bool known = constantAt(stack, 0, Value::Integer, first)
+                          && constantAt(stack, 1, Value::Integer, second);
+                stack.resize(stack.size() - 2);
+                int top = static_cast<int>(stack.size()) - 1;
+                if (known && first >= 0 && first <= top && second >= 0 && second <= top) {
+                    std::swap(stack[top - first], stack[top - second]);
+                } else {
+                    for (StackEntry &entry : stack) entry.known = false;
+                }
+                break; }
+
+            case OpcodeDef::Call: {
+                if (stack.size() < 2) return false;
+                if (!constantAt(stack, 1, Value::Integer, value)) return false;
+                unsigned argCount = value < 0 ? 0 : value;
+                if (stack.size() < 2 + argCount) return false;
+                stack.resize(stack.size() - 2 - argCount);
+                stack.push_back(unknown());
+                break; }
+
+            case OpcodeDef::Jump:
+                if (stack.empty()) return false;
+                if (!constantAt(stack, 0, Value::JumpTarget, target)) return false;
+                stack.pop_back();
+                if (!flowTo(function.position + target, stack)) return false;
+                continue;
+            case OpcodeDef::JumpZero:
+            case OpcodeDef::JumpNotZero:
+                if (stack.size() < 2) return false;
+                if (!constantAt(stack, 0, Value::JumpTarget, target)) return false;
+                stack.resize(stack.size() - 2);
+                if (!flowTo(function.position + target, stack)) return false;
+                break;
+            case OpcodeDef::CompareJumpZero:
+            case OpcodeDef::CompareJumpNotZero:
+                if (stack.size() < 2) return false;
+                if (!isComparison(bytecode.read_8(IP + 1))) return false;
+                stack.resize(stack.size() - 2);
+                target = bytecode.read_32(IP + 2);
+                if (!flowTo(function.position + target, stack)) return false;
+                break;
+
+            default:
+                if (!stackEffect(opcode, inputs, outputs)) return false;
+                if (stack.size() < inputs) return false;
+                stack.resize(stack.size() - inputs);
+                stack.resize(stack.size() + outputs, unknown());
+        }
+        if (!flowTo(nextIP, stack)) return false;
+    }
+    return true;
+}
+
+// Check the bytecode of every function when the game is loaded so the engines
+// can skip checks that would otherwise be made each time an instruction runs.
+// Each function is assumed to extend up to the start of the next function (or
+// the end of the bytecode), which is how the builder lays them out. Returns
+// false after reporting the first problem found. Functions whose stack use
+// can't be proven safe are still allowed, but are marked as unverified.
+bool verifyFunctions(std::map<int, FunctionDef> &functions, const ByteStream &bytecode,
+                     unsigned gameFlags) {
+    std::vector<unsigned> starts;
+    for (const auto &def : functions) starts.push_back(def.second.position);
+    std::sort(starts.begin(), starts.end());
+
+    for (auto &def : functions) {
+        FunctionDef &function = def.second;
+        function.end = bytecode.size();
+        auto next = std::upper_bound(starts.begin(), starts.end(), function.position);
+        if (next != starts.end() && *next < function.end) function.end = *next;
+
+        const int localCount = function.arg_count + function.local_count;
+        unsigned IP = function.position;
+        while (IP < function.end) {
+            int opcode = bytecode.read_8(IP);
+            unsigned flag = requiredFlag(opcode);
+            if (flag && !(gameFlags & flag)) {
+                std::cerr << "Function #" << def.first << " uses opcode " << opcode;
+                std::cerr << " at " << IP << ", which the gamefile does not enable.\n";
+                return false;
+            }
+            unsigned size = operandSize(opcode);
+            if (IP + 1 + size > function.end) {
+                std::cerr << "Function #" << def.first << " has an incomplete instruction at ";
+                std::cerr << IP << ".\n";
+                return false;
+            }
+            if (hasLocalOperand(opcode)) {
+                int local = bytecode.read_16(IP + 1);
+                if (local >= localCount) {
+                    std::cerr << "Function #" << def.first << " uses local " << local;
+                    std::cerr << " at " << IP << " but has only " << localCount << ".\n";
+                    return false;
+                }
+            }
+            IP += 1 + size;
+        }
+
+        function.typedArgs = false;
+        for (Value::Type type : function.argTypes) {
+            if (type != Value::Any) function.typedArgs = true;
+        }
+        function.verified = verifyStack(bytecode, function);
+    }
+    return true;
+}
+
+bool GameData::verifyFunctions() {
+    return ::verifyFunctions(functions, bytecode, gameFlags);
+}
@@ -0,0 +1,25 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete so that a test or benchmark can
+// count every allocation made by the code it runs. Only one source file of a
+// program may include this.
+static unsigned long allocationCount = 0;
+
+void* operator new(std::size_t size) {
+    ++allocationCount;
+    void *ptr = std::malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+    Measures formatting speed over large generated documents, both through
+    formatText and by reusing one TextFormatter and output buffer the way the
+    runner does, along with the allocations each makes per document.
+*/
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "../runner/formatter.h"
+#include "allocations.h"
+
+// Build a document of roughly the given size from paragraphs of plain text
+// mixed with nested styling and the other tags.
+std::string makeDocument(std::size_t size) {
+    const char *colors[] = { "red", "green", "blue", "cyan" };
+    std::string text;
+    text.reserve(size + 256);
+    for (unsigned i = 0; text.size() < size; ++i) {
+        text += "The quick brown fox jumps over the lazy dog. ";
+        text += "[b]Bold text with [i]nested [color ";
+        text += colors[i % 4];
+        text += "]coloured[/color] words[/i][/b] and\tmore text.";
+        if (i % 5 == 4) text += "[br]A new line.";
+        text += i % 20 == 19 ? "[hr]" : "\n\n";
+    }
+    return text;
+}
+
+template<class Function>
+void measure(const char *name, std::size_t size, int repeats, Function format) {
+    unsigned long allocations = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i) format();
+    auto end = std::chrono::steady_clock::now();
+    allocations = allocationCount - allocations;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double mbPerSecond = size * static_cast<double>(repeats) / seconds / 1e6;
+    std::cout << std::setw(10) << size << std::setw(14) << name;
+    std::cout << std::setw(12) << std::fixed << std::setprecision(1) << mbPerSecond;
+    std::cout << std::setw(16) << allocations / repeats << '\n';
+}
+
+int main() {
+    const std::size_t sizes[] = { 1000, 100000, 10000000 };
+    const std::size_t totalBytes = 100000000;
+
+    std::cout << std::setw(10) << "bytes" << std::setw(14) << "method";
+    std::cout << std::setw(12) << "MB/s" << std::setw(16) << "allocs/doc" << '\n';
+    for (std::size_t size : sizes) {
+        const std::string document = makeDocument(size);
+        const int repeats = totalBytes / document.size() + 1;
+
+        std::size_t checksum = 0;
+        measure("formatText", document.size(), repeats, [&]() {
+            ParseResult results = formatText(document);
+            checksum += results.finalResult.size() + results.errors.size();
+        });
+
+        std::string out;
+        TextFormatter formatter(out);
+        formatter.write(document);
+        formatter.finish();
+        measure("reused", document.size(), repeats, [&]() {
+            out.clear();
+            formatter.write(document);
+            checksum += out.size() + formatter.finish().errors.size();
+        });
+        std::cout << "    (checksum " << checksum << ")\n";
+    }
+    return 0;
+}
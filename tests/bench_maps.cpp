@@ -0,0 +1,34 @@
+/*
+    Measures the cost of MapDef lookups as maps grow. With the hash index the
+    time per lookup should stay roughly constant from a few hundred keys up to
+    100,000 keys.
+*/
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "../runner/gamedata.h"
+
+int main() {
+    const int lookups = 1000000;
+    const int sizes[] = { 4, 8, 16, 100, 1000, 10000, 100000 };
+
+    std::cout << std::setw(10) << "keys" << std::setw(16) << "ns/lookup" << '\n';
+    for (int size : sizes) {
+        MapDef map;
+        for (int i = 0; i < size; ++i) {
+            map.set(Value(Value::Integer, i), Value(Value::Integer, i));
+        }
+
+        long checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i) {
+            checksum += map.get(Value(Value::Integer, (i * 7919) % size)).value;
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+        std::cout << std::setw(10) << size << std::setw(16) << std::fixed << std::setprecision(1) << ns;
+        std::cout << "    (checksum " << checksum << ")\n";
+    }
+    return 0;
+}
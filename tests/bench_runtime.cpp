@@ -0,0 +1,259 @@
+/*
+    Times the primitives the runner is built from: reading bytecode, the list,
+    map, and object operations, string lookups, garbage collection at several
+    heap sizes, formatting, and the text utilities. Run it before and after a
+    change to one of them to catch a slowdown before it shows up in whole games.
+*/
+#include <string>
+#include <vector>
+
+#include "../runner/bytestream.h"
+#include "../runner/formatter.h"
+#include "../runner/gamedata.h"
+#include "textutil.h"
+#include "benchmark.h"
+
+const int ITEMS = 10000;
+
+void bench_bytestream(BenchmarkSuite &suite) {
+    ByteStream bytes;
+    for (int i = 0; i < ITEMS * 4; ++i) bytes.add_8(i * 31);
+
+    suite.run("ByteStream::read_8", ITEMS * 4, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS * 4; ++i) total += bytes.read_8(i);
+        return total;
+    });
+    suite.run("ByteStream::read_16", ITEMS * 2, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS * 2; ++i) total += bytes.read_16(i * 2);
+        return total;
+    });
+    suite.run("ByteStream::read_32", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += bytes.read_32(i * 4);
+        return total;
+    });
+}
+
+void bench_lists(BenchmarkSuite &suite) {
+    ListDef list;
+    for (int i = 0; i < ITEMS; ++i) list.items.push_back(Value(Value::Integer, i));
+
+    suite.run("ListDef::get", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += list.get(i).value;
+        return total;
+    });
+    suite.run("ListDef::set", ITEMS, [&]() {
+        for (int i = 0; i < ITEMS; ++i) list.set(i, Value(Value::Integer, ITEMS - i));
+        return static_cast<long>(list.items.size());
+    });
+    suite.run("ListDef::del (from end)", ITEMS, [&]() {
+        ListDef copy = list;
+        for (int i = ITEMS - 1; i >= 0; --i) copy.del(i);
+        return static_cast<long>(copy.items.size());
+    });
+    suite.run("ListDef::del (from start)", ITEMS / 10, [&]() {
+        ListDef copy = list;
+        for (int i = 0; i < ITEMS / 10; ++i) copy.del(0);
+        return static_cast<long>(copy.items.size());
+    });
+}
+
+void bench_maps(BenchmarkSuite &suite) {
+    // below MAP_INDEX_THRESHOLD maps are searched row by row
+    const int sizes[] = { 8, ITEMS };
+    for (int size : sizes) {
+        const std::string suffix = " [" + std::to_string(size) + " keys]";
+        MapDef map;
+        for (int i = 0; i < size; ++i) {
+            map.set(Value(Value::Integer, i * 7), Value(Value::Integer, i));
+        }
+
+        suite.run("MapDef::get" + suffix, ITEMS, [&]() {
+            long total = 0;
+            for (int i = 0; i < ITEMS; ++i) total += map.get(Value(Value::Integer, (i % size) * 7)).value;
+            return total;
+        });
+        suite.run("MapDef::has (missing)" + suffix, ITEMS, [&]() {
+            long total = 0;
+            for (int i = 0; i < ITEMS; ++i) total += map.has(Value(Value::Integer, i * 7 + 1));
+            return total;
+        });
+        suite.run("MapDef::set (existing)" + suffix, ITEMS, [&]() {
+            for (int i = 0; i < ITEMS; ++i) {
+                map.set(Value(Value::Integer, (i % size) * 7), Value(Value::Integer, i));
+            }
+            return static_cast<long>(map.size());
+        });
+        suite.run("MapDef::set then del" + suffix, 100, [&]() {
+            for (int i = 0; i < 100; ++i) map.set(Value(Value::Integer, -1 - i), Value());
+            for (int i = 0; i < 100; ++i) map.del(Value(Value::Integer, -1 - i));
+            return static_cast<long>(map.size());
+        });
+    }
+}
+
+void bench_objects(BenchmarkSuite &suite) {
+    // a chain of objects 1 through 5, each the parent of the next, with the
+    // properties 10 through 29 on the first
+    GameData data;
+    for (int i = 1; i <= 5; ++i) {
+        ObjectDef *object = new ObjectDef;
+        object->ident = i;
+        object->isStatic = true;
+        if (i > 1) object->set(PROP_PARENT, Value(Value::Object, i - 1));
+        data.objects.insert(i, object);
+    }
+    ObjectDef &root = data.editObject(1);
+    for (int i = 10; i < 30; ++i) root.set(i, Value(Value::Integer, i));
+    const ObjectDef &leaf = data.getObject(5);
+
+    suite.run("ObjectDef::get (own)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += root.get(data, 10 + i % 20).value;
+        return total;
+    });
+    suite.run("ObjectDef::get (4 parents up)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += leaf.get(data, 10 + i % 20).value;
+        return total;
+    });
+    suite.run("ObjectDef::has", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += root.has(i % 40);
+        return total;
+    });
+    suite.run("ObjectDef::set (existing)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += root.set(10 + i % 20, Value(Value::Integer, i));
+        return total;
+    });
+}
+
+void bench_strings(BenchmarkSuite &suite) {
+    GameData data;
+    for (int i = 1; i <= ITEMS; ++i) {
+        StringDef *def = new StringDef;
+        def->setText("static string " + std::to_string(i));
+        def->isStatic = true;
+        data.strings.insert(i, def);
+    }
+    data.strings.sealStatic();
+    data.lists.sealStatic();
+    data.maps.sealStatic();
+    data.objects.sealStatic();
+    std::vector<int> dynamic;
+    for (int i = 0; i < ITEMS; ++i) {
+        dynamic.push_back(data.makeNewString("dynamic string " + std::to_string(i)).value);
+    }
+
+    suite.run("GameData::getString (static)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 1; i <= ITEMS; ++i) total += data.getString(i).text().size();
+        return total;
+    });
+    suite.run("GameData::getString (dynamic)", ITEMS, [&]() {
+        long total = 0;
+        for (int ident : dynamic) total += data.getString(ident).text().size();
+        return total;
+    });
+}
+
+void bench_garbage(BenchmarkSuite &suite) {
+    const int sizes[] = { 1000, 10000, 100000 };
+    for (int size : sizes) {
+        // size live values: a rooted list of lists each holding a string,
+        // along with as many unreachable lists made before each collection
+        GameData data;
+        data.strings.sealStatic();
+        data.lists.sealStatic();
+        data.maps.sealStatic();
+        data.objects.sealStatic();
+        FunctionDef main;
+        main.arg_count = 0;
+        main.local_count = 0;
+        main.position = 0;
+        data.callStack.create(main, 0, Value(), 0);
+
+        Value root = data.makeNew(Value::List);
+        data.callStack.push(root);
+        for (int i = 0; i < size / 2; ++i) {
+            Value item = data.makeNew(Value::List);
+            data.editList(item.value).items.push_back(data.makeNewString("item"));
+            data.editList(root.value).items.push_back(item);
+        }
+
+        suite.run("collectGarbage (" + std::to_string(size) + " live)", 1, [&]() {
+            for (int i = 0; i < size; ++i) data.makeNew(Value::List);
+            return static_cast<long>(data.collectGarbage());
+        });
+    }
+}
+
+void bench_formatter(BenchmarkSuite &suite) {
+    std::string document;
+    for (int i = 0; i < 100; ++i) {
+        document += "The quick brown fox jumps over the lazy dog. ";
+        document += "[b]Bold text with [i]nested [color red]coloured[/color] words[/i][/b]";
+        document += i % 5 == 4 ? "[br]" : "\n\n";
+    }
+
+    suite.run("formatText (per KB)", document.size() / 1000, [&]() {
+        return static_cast<long>(formatText(document).finalResult.size());
+    });
+}
+
+void bench_textutil(BenchmarkSuite &suite) {
+    const std::string ascii = "An entirely plain sentence of text to be normalized.";
+    // U+03D2 U+0301 composes to U+03D3
+    const std::string composing = "Some \xCF\x92\xCC\x81 text \xCF\x92\xCC\x81 to compose.";
+    const std::string sentence = "take the brass lamp, then go north and open the door.";
+
+    suite.run("normalize (ASCII)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) {
+            std::string text = ascii;
+            normalize(text);
+            total += text.size();
+        }
+        return total;
+    });
+    suite.run("normalize (composing)", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) {
+            std::string text = composing;
+            normalize(text);
+            total += text.size();
+        }
+        return total;
+    });
+    suite.run("explodeString", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) total += explodeString(sentence).size();
+        return total;
+    });
+    suite.run("upperFirst", ITEMS, [&]() {
+        long total = 0;
+        for (int i = 0; i < ITEMS; ++i) {
+            std::string text = sentence;
+            upperFirst(text);
+            total += text[0];
+        }
+        return total;
+    });
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkSuite suite(argc, argv);
+    bench_bytestream(suite);
+    bench_lists(suite);
+    bench_maps(suite);
+    bench_objects(suite);
+    bench_strings(suite);
+    bench_garbage(suite);
+    bench_formatter(suite);
+    bench_textutil(suite);
+    return suite.finish();
+}
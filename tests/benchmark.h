@@ -0,0 +1,147 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A small harness for timing runtime primitives. Each benchmark is a function
+// performing a fixed number of operations and returning a checksum of its
+// results, so that the work can't be optimized away. It is run a few times
+// untimed to warm caches and allocators, then timed over several repetitions;
+// the time per operation of each repetition is summarized as its minimum,
+// median, mean, standard deviation, and maximum.
+//
+// Programs using it accept these options:
+//     -repeat N    timed repetitions of each benchmark (default 10)
+//     -warmup N    untimed runs before timing starts (default 2)
+//     -filter S    only run benchmarks whose names contain S
+//     -json FILE   also write the results to FILE as JSON
+
+struct BenchmarkResult {
+    std::string name;
+    long operations;                // performed by each repetition
+    std::vector<double> samples;    // nanoseconds per operation of each repetition
+    double min, median, mean, stddev, max;
+};
+
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(int argc, char *argv[])
+    : mRepeat(10), mWarmup(2), mChecksum(0), mBadArguments(false)
+    {
+        for (int i = 1; i < argc; ++i) {
+            const bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "-repeat") == 0 && hasValue) {
+                mRepeat = std::max(1, atoi(argv[++i]));
+            } else if (strcmp(argv[i], "-warmup") == 0 && hasValue) {
+                mWarmup = std::max(0, atoi(argv[++i]));
+            } else if (strcmp(argv[i], "-filter") == 0 && hasValue) {
+                mFilter = argv[++i];
+            } else if (strcmp(argv[i], "-json") == 0 && hasValue) {
+                mJsonFile = argv[++i];
+            } else {
+                std::cerr << "USAGE: " << argv[0];
+                std::cerr << " [-repeat N] [-warmup N] [-filter TEXT] [-json FILE]\n";
+                mBadArguments = true;
+                return;
+            }
+        }
+        std::cout << std::left << std::setw(36) << "benchmark" << std::right;
+        std::cout << std::setw(12) << "min ns/op" << std::setw(12) << "median";
+        std::cout << std::setw(12) << "mean" << std::setw(10) << "stddev" << '\n';
+    }
+
+    template<class Body>
+    void run(const std::string &name, long operations, Body body) {
+        if (mBadArguments) return;
+        if (!mFilter.empty() && name.find(mFilter) == std::string::npos) return;
+
+        for (int i = 0; i < mWarmup; ++i) mChecksum += body();
+        BenchmarkResult result{name, operations, {}, 0, 0, 0, 0, 0};
+        for (int i = 0; i < mRepeat; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            mChecksum += body();
+            auto end = std::chrono::steady_clock::now();
+            double ns = std::chrono::duration<double, std::nano>(end - start).count();
+            result.samples.push_back(ns / operations);
+        }
+        summarize(result);
+        mResults.push_back(result);
+
+        std::cout << std::left << std::setw(36) << name << std::right;
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << std::setw(12) << result.min << std::setw(12) << result.median;
+        std::cout << std::setw(12) << result.mean << std::setw(10) << result.stddev << '\n';
+    }
+
+    // Writes the JSON file, if one was asked for, and returns the program's
+    // exit status.
+    int finish() {
+        if (mBadArguments) return 1;
+        std::cout << "(checksum " << mChecksum << ")\n";
+        if (mJsonFile.empty()) return 0;
+
+        std::ofstream out(mJsonFile);
+        if (!out) {
+            std::cerr << "Could not open " << mJsonFile << " for writing.\n";
+            return 1;
+        }
+        out << "{\n    \"unit\": \"ns/op\",\n    \"repetitions\": " << mRepeat << ",\n";
+        out << "    \"warmup\": " << mWarmup << ",\n    \"benchmarks\": [";
+        out << std::fixed << std::setprecision(3);
+        for (unsigned i = 0; i < mResults.size(); ++i) {
+            const BenchmarkResult &result = mResults[i];
+            out << (i ? ",\n" : "\n");
+            out << "        { \"name\": \"" << jsonEscape(result.name) << "\"";
+            out << ", \"operations\": " << result.operations;
+            out << ", \"min\": " << result.min << ", \"median\": " << result.median;
+            out << ", \"mean\": " << result.mean << ", \"stddev\": " << result.stddev;
+            out << ", \"max\": " << result.max << " }";
+        }
+        out << "\n    ]\n}\n";
+        std::cout << "Results written to " << mJsonFile << ".\n";
+        return 0;
+    }
+
+private:
+    static void summarize(BenchmarkResult &result) {
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        const unsigned count = sorted.size();
+        result.min = sorted.front();
+        result.max = sorted.back();
+        result.median = count % 2 ? sorted[count / 2]
+                                  : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+        double total = 0;
+        for (double sample : sorted) total += sample;
+        result.mean = total / count;
+        double squares = 0;
+        for (double sample : sorted) squares += (sample - result.mean) * (sample - result.mean);
+        result.stddev = count > 1 ? std::sqrt(squares / (count - 1)) : 0;
+    }
+
+    static std::string jsonEscape(const std::string &text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') result += '\\';
+            result += c;
+        }
+        return result;
+    }
+
+    int mRepeat, mWarmup;
+    std::string mFilter, mJsonFile;
+    long mChecksum;
+    bool mBadArguments;
+    std::vector<BenchmarkResult> mResults;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/formatter.h"
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+#include "gamefile.h"
+#include "testing.h"
+
+const int LOOPS = 100;
+
+enum class Engine {
+    Basic, Decoded, DecodedVerified, Jit, JitVerified
+};
+
+// Builds a game whose main function (ident 1) counts a local up to LOOPS with
+// a compare-and-jump, calling function 2 each time around, and then says and
+// returns the count. Function 2 counts a local down from three with a pushed jump target.
+struct TestGame : BytecodeGame {
+    TestGame(Engine engine) {
+        data.gameFlags = GAMEFLAG_KNOWN;
+        addFunction(1, 1, 1);
+        push(Value::Integer, 0).push(Value::VarRef, 1).op(OpcodeDef::Store);
+        const unsigned mainLoop = position();
+        incLocal(1, 1);
+        push(Value::Integer, 0).push(Value::Function, 2).op(OpcodeDef::Call);
+        op(OpcodeDef::StackPop);
+        push(Value::LocalVar, 1).push(Value::Integer, LOOPS);
+        compareJump(OpcodeDef::CompareJumpNotZero, OpcodeDef::NotEqual, mainLoop);
+        push(Value::LocalVar, 1).op(OpcodeDef::Say);
+        push(Value::LocalVar, 1).op(OpcodeDef::Return);
+
+        const unsigned calleeStart = addFunction(2, 1, 1);
+        push(Value::Integer, 3).push(Value::VarRef, 1).op(OpcodeDef::Store);
+        const unsigned calleeLoop = position() - calleeStart;
+        incLocal(1, -1);
+        push(Value::LocalVar, 1).push(Value::JumpTarget, calleeLoop);
+        op(OpcodeDef::JumpNotZero);
+        op(OpcodeDef::Return);
+
+        assert_true(data.verifyFunctions(), "game rejected");
+        data.useDecoded = engine != Engine::Basic;
+        data.checkedOnly = engine == Engine::Decoded || engine == Engine::Jit;
+        if (engine == Engine::Jit || engine == Engine::JitVerified) {
+            data.jitMode = JitMode::Always;
+        }
+        data.output = &output;
+        const FunctionDef &main = data.getFunction(1);
+        data.callStack.create(main, 1, data.noneValue, 0);
+        data.callStack.callTop().IP = main.position;
+    }
+
+    // Resumes with budget until the game ends, keeping track of the yields,
+    // the most instructions run by one resume and what the last one returned.
+    void run(long budget) {
+        long last = 0;
+        do {
+            returned = data.resume(false, data.noneValue, budget);
+            longestSlice = std::max(longestSlice, data.instructionCount - last);
+            last = data.instructionCount;
+            if (data.optionType == OptionType::Yield) ++yields;
+        } while (data.optionType == OptionType::Yield);
+    }
+
+    CaptureOutput output;
+    Value returned;
+    int yields = 0;
+    long longestSlice = 0;
+};
+
+void test_engine(Engine engine, const std::string &name) {
+    TestGame unlimited(engine);
+    unlimited.run(NO_INSTRUCTION_LIMIT);
+    const long total = unlimited.data.instructionCount;
+    assert_equal(unlimited.yields, 0, name + ": unlimited yielded");
+    assert_equal(unlimited.output.text, std::to_string(LOOPS), name + ": unlimited output");
+    assert_true(unlimited.returned == Value(Value::Integer, LOOPS), name + ": unlimited return value");
+
+    const long budgets[] = { 1, 7, 1000 };
+    for (long budget : budgets) {
+        const std::string label = name + " [budget " + std::to_string(budget) + "]";
+        TestGame game(engine);
+        game.run(budget);
+        assert_true(game.data.optionType == OptionType::EndOfProgram, label + ": not ended");
+        assert_equal(game.output.text, std::to_string(LOOPS), label + ": output");
+        assert_true(game.returned == Value(Value::Integer, LOOPS), label + ": return value");
+        assert_equal(game.data.instructionCount, total, label + ": instructions");
+        if (engine == Engine::Jit || engine == Engine::JitVerified) {
+            // machine code checks the budget only where it could loop
+            assert_true(game.yields > 0, label + ": never yielded");
+        } else {
+            assert_equal(game.yields, (total - 1) / budget, label + ": yields");
+            assert_equal(game.longestSlice, std::min(budget, total), label + ": slice");
+        }
+    }
+}
+
+void test_unlimited_after_yield() {
+    TestGame game(Engine::Decoded);
+    game.data.resume(false, game.data.noneValue, 10);
+    assert_true(game.data.optionType == OptionType::Yield, "after_yield: didn't yield");
+    assert_equal(game.data.instructionCount, 10, "after_yield: instructions");
+    game.data.resume(false, game.data.noneValue);
+    assert_true(game.data.optionType == OptionType::EndOfProgram, "after_yield: not ended");
+    assert_equal(game.output.text, std::to_string(LOOPS), "after_yield: output");
+}
+
+int main() {
+
+    try {
+        test_engine(Engine::Basic, "basic");
+        test_engine(Engine::Decoded, "decoded");
+        test_engine(Engine::DecodedVerified, "decoded verified");
+        test_engine(Engine::Jit, "jit");
+        test_engine(Engine::JitVerified, "jit verified");
+        test_unlimited_after_yield();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    } catch (GameError &e) {
+        std::cerr << "Game Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
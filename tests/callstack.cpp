@@ -0,0 +1,115 @@
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "allocations.h"
+#include "testing.h"
+
+
+FunctionDef makeFunction(int argCount, int localCount) {
+    FunctionDef def;
+    def.arg_count = argCount;
+    def.local_count = localCount;
+    def.position = 0;
+    def.argTypes.assign(argCount + localCount, Value::Any);
+    return def;
+}
+
+void test_arguments() {
+    FunctionDef outer = makeFunction(2, 1);
+    FunctionDef inner = makeFunction(3, 2);
+    gtCallStack stack;
+    stack.create(outer, 1, Value(), 0);
+    stack.setLocal(1, Value(Value::Integer, 77));
+    stack.push(Value(Value::Integer, 5));
+    stack.push(Value(Value::LocalVar, 1));
+    stack.push(Value(Value::Integer, 3));
+    stack.push(Value(Value::Integer, 4));
+
+    // the top value is the first argument; the extra one is discarded
+    stack.create(inner, 2, Value(Value::Object, 9), 3);
+    assert_equal(stack.localCount(), 5, "arguments: wrong local count");
+    assert_equal(stack.getLocal(0).value, 9, "arguments: wrong self");
+    assert_equal(stack.getLocal(1).value, 4, "arguments: wrong first argument");
+    assert_equal(stack.getLocal(2).value, 3, "arguments: wrong second argument");
+    assert_equal(stack.getLocal(2).type, Value::Integer, "arguments: wrong second argument type");
+    assert_equal(stack.getLocal(3).type, Value::None, "arguments: local not cleared");
+    assert_true(stack.stackEmpty(), "arguments: new frame has values on its stack");
+
+    // arguments referring to the caller's locals are resolved
+    stack.drop();
+    stack.push(Value(Value::LocalVar, 1));
+    stack.create(inner, 2, Value(), 1);
+    assert_equal(stack.getLocal(1).value, 77, "arguments: local reference not resolved");
+    stack.drop();
+
+    assert_equal(stack.size(), 1, "arguments: wrong frame count");
+    assert_equal(stack.stackSize(), 1, "arguments: caller stack not restored");
+    assert_equal(stack.pop().value, 5, "arguments: caller stack damaged");
+    assert_true(stack.stackEmpty(), "arguments: caller stack not empty");
+}
+
+void test_underflow() {
+    FunctionDef outer = makeFunction(1, 0);
+    gtCallStack stack;
+    stack.create(outer, 1, Value(), 0);
+    stack.push(Value(Value::Integer, 5));
+    stack.create(outer, 1, Value(), 0);
+    bool threw = false;
+    try {
+        stack.pop();
+    } catch (GameError&) {
+        threw = true;
+    }
+    assert_true(threw, "underflow: popped value belonging to caller");
+    threw = false;
+    try {
+        stack.create(outer, 1, Value(), 1);
+    } catch (GameError&) {
+        threw = true;
+    }
+    assert_true(threw, "underflow: used caller's value as argument");
+}
+
+void test_no_allocations() {
+    FunctionDef outer = makeFunction(1, 2);
+    FunctionDef inner = makeFunction(3, 4);
+    gtCallStack stack;
+    stack.create(outer, 1, Value(), 0);
+
+    // warm up by going a few calls deep
+    for (int depth = 0; depth < 20; ++depth) {
+        stack.push(Value(Value::Integer, depth));
+        stack.push(Value(Value::Integer, depth));
+        stack.create(inner, 2, Value(), 2);
+    }
+    unsigned long before = allocationCount;
+    for (int i = 0; i < 1000; ++i) {
+        stack.push(Value(Value::Integer, i));
+        stack.push(Value(Value::Integer, i));
+        stack.create(inner, 2, Value(), 2);
+        stack.push(Value(Value::Integer, i));
+        Value result = stack.pop();
+        stack.drop();
+        stack.push(result);
+        stack.pop();
+    }
+    unsigned long allocations = allocationCount - before;
+    assert_equal(allocations, 0, "no_allocations: calls allocated memory");
+}
+
+int main() {
+
+    try {
+        test_arguments();
+        test_underflow();
+        test_no_allocations();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
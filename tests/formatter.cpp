@@ -0,0 +1,95 @@
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/formatter.h"
+#include "allocations.h"
+#include "testing.h"
+
+// Text written in pieces, even when tags and paragraph breaks are split across
+// them, must format the same as when written all at once.
+void test_split_writes() {
+    const std::string text = "\n\nHello [b]bold [color red]red[/color][/b]\n\n\nworld[br]\tend[hr]\n\n";
+    ParseResult whole = formatText(text);
+    assert_equal(whole.errors.size(), 0, "split_writes: errors formatting whole text");
+
+    for (unsigned size = 1; size < 8; ++size) {
+        std::ostringstream out;
+        TextFormatter formatter(out);
+        for (unsigned pos = 0; pos < text.size(); pos += size) {
+            formatter.write(text.substr(pos, size));
+        }
+        ParseResult results = formatter.finish();
+        assert_equal(results.errors.size(), 0, "split_writes: errors formatting pieces");
+        assert_equal(out.str(), whole.finalResult, "split_writes: text differs");
+    }
+}
+
+void test_formatting() {
+    ParseResult results = formatText("one\n\n\ntwo[b]three[i]four[/i][/b]\n");
+    assert_equal(results.finalResult, "one\n\ntwo\x1b[1mthree\x1b[4mfour\x1b[0m\x1b[1m\x1b[0m",
+                 "formatting: wrong text");
+    results = formatText("a[hr]b");
+    assert_equal(results.finalResult, "a\n\n--------------------------------------------------\n\nb",
+                 "formatting: wrong horizontal rule");
+    results = formatText("[b]hello");
+    assert_equal(results.finalResult, "\x1b[1mhello\x1b[0m", "formatting: unclosed tag not reset");
+}
+
+void test_errors() {
+    std::ostringstream out;
+    TextFormatter formatter(out);
+    formatter.write("[b]one[/i][nope]\n[b");
+    ParseResult results = formatter.finish();
+    assert_equal(results.errors.size(), 5, "errors: wrong error count");
+    assert_equal(results.errors[0], "Closing tag i does not match opening tag b.", "errors: wrong first error");
+    assert_equal(results.errors[3], "Tag b not closed.", "errors: wrong last error");
+
+    // the formatter starts over after finishing a turn
+    formatter.write("two");
+    results = formatter.finish();
+    assert_equal(results.errors.size(), 0, "errors: errors carried over to next turn");
+}
+
+void test_no_allocations() {
+    const std::string first = "Some [b]bold and [color green]green[/color][/b] text,";
+    const std::string second = " [i]split [colo";
+    const std::string third = "r cyan]across[/color] writes[/i].\n\nThe end.[hr]";
+    std::string out;
+    TextFormatter formatter(out);
+
+    // warm up so the buffers have grown to the needed size
+    for (int i = 0; i < 2; ++i) {
+        formatter.write(first);
+        formatter.write(second);
+        formatter.write(third);
+        formatter.finish();
+        out.clear();
+    }
+    unsigned long before = allocationCount;
+    for (int i = 0; i < 100; ++i) {
+        formatter.write(first);
+        formatter.write(second);
+        formatter.write(third);
+        ParseResult results = formatter.finish();
+        out.clear();
+    }
+    unsigned long allocations = allocationCount - before;
+    assert_equal(allocations, 0, "no_allocations: formatting allocated memory");
+}
+
+int main() {
+
+    try {
+        test_split_writes();
+        test_formatting();
+        test_errors();
+        test_no_allocations();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
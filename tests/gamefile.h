@@ -0,0 +1,173 @@
+#ifndef GAMEFILE_H
+#define GAMEFILE_H
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../runner/formatter.h"
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+
+// Helpers for tests that build games of their own, either as gamefiles to
+// load or straight into a GameData.
+
+const unsigned char STRING_XOR_KEY = 0x7B;
+
+// Collects everything a game says.
+class CaptureOutput : public OutputSink {
+public:
+    void write(const std::string &text) override {
+        this->text += text;
+    }
+    std::string text;
+};
+
+// Appends an instruction pushing a value to code.
+inline void push(ByteStream &code, Value::Type type, int value) {
+    code.add_8(OpcodeDef::Push32);
+    code.add_8(type);
+    code.add_32(value);
+}
+
+// Writes a gamefile a section at a time. Every section must be added, in the
+// order they appear in the file: strings, lists, maps, objects, functions,
+// and then the bytecode. Items are numbered from 1 in the order given and
+// have no source file or line. There is never any vocabulary.
+class GameFileWriter {
+public:
+    typedef std::vector<std::pair<Value, Value>> Map;
+    typedef std::vector<std::pair<int, Value>> Object;   // property numbers and values
+    struct Function {
+        int argCount;       // including self
+        int localCount;
+        unsigned position;  // in the bytecode
+    };
+
+    GameFileWriter(int mainFunction, unsigned flags) {
+        mOut.add_32(FILETYPE_ID);
+        mOut.add_32(0);             // version
+        mOut.add_32(mainFunction);
+        mOut.add_32(flags);
+        for (int i = 0; i < 5; ++i) mOut.add_32(0);
+        mOut.padTo(HEADER_SIZE);
+    }
+
+    void strings(const std::vector<std::string> &texts) {
+        mOut.add_32(texts.size());
+        for (const std::string &text : texts) {
+            mOut.add_16(text.size());
+            for (char c : text) mOut.add_8(c ^ STRING_XOR_KEY);
+        }
+        mOut.add_32(0);             // vocab
+    }
+    void lists(const std::vector<std::vector<Value>> &lists) {
+        mOut.add_32(lists.size());
+        for (unsigned i = 0; i < lists.size(); ++i) {
+            mOut.add_32(0); mOut.add_32(0); mOut.add_32(i + 1);
+            mOut.add_16(lists[i].size());
+            for (const Value &item : lists[i]) addValue(item);
+        }
+    }
+    void maps(const std::vector<Map> &maps) {
+        mOut.add_32(maps.size());
+        for (unsigned i = 0; i < maps.size(); ++i) {
+            mOut.add_32(0); mOut.add_32(0); mOut.add_32(i + 1);
+            mOut.add_16(maps[i].size());
+            for (const std::pair<Value, Value> &row : maps[i]) {
+                addValue(row.first);
+                addValue(row.second);
+            }
+        }
+    }
+    void objects(const std::vector<Object> &objects) {
+        mOut.add_32(objects.size());
+        for (unsigned i = 0; i < objects.size(); ++i) {
+            mOut.add_32(0); mOut.add_32(0); mOut.add_32(0); mOut.add_32(i + 1);
+            mOut.add_16(objects[i].size());
+            for (const std::pair<int, Value> &property : objects[i]) {
+                mOut.add_16(property.first);
+                addValue(property.second);
+            }
+        }
+    }
+    // Every argument and local may hold any type.
+    void functions(const std::vector<Function> &functions) {
+        mOut.add_32(functions.size());
+        for (unsigned i = 0; i < functions.size(); ++i) {
+            const Function &function = functions[i];
+            mOut.add_32(0); mOut.add_32(0); mOut.add_32(0); mOut.add_32(i + 1);
+            mOut.add_16(function.argCount);
+            mOut.add_16(function.localCount);
+            for (int j = 0; j < function.argCount + function.localCount; ++j) {
+                mOut.add_8(Value::Any);
+            }
+            mOut.add_32(function.position);
+        }
+    }
+    void bytecode(const ByteStream &code) {
+        mOut.add_32(code.size());
+        mOut.append(code);
+    }
+
+    void write(const std::string &filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        mOut.write(file);
+    }
+
+private:
+    void addValue(const Value &value) {
+        mOut.add_8(value.type);
+        mOut.add_32(value.value);
+    }
+
+    ByteStream mOut;
+};
+
+// A game built straight into a GameData, for tests of the runner that don't
+// need a gamefile. Functions are added one after another at the end of the
+// bytecode.
+struct BytecodeGame {
+    // Starts a function where the bytecode ends, returning that position.
+    // Every argument and local may hold any type.
+    unsigned addFunction(int ident, int argCount, int localCount) {
+        FunctionDef def;
+        def.ident = ident;
+        def.arg_count = argCount;
+        def.local_count = localCount;
+        def.argTypes.assign(argCount + localCount, Value::Any);
+        def.position = data.bytecode.size();
+        data.functions.insert(std::make_pair(ident, def));
+        return def.position;
+    }
+    BytecodeGame& op(int opcode) {
+        data.bytecode.add_8(opcode);
+        return *this;
+    }
+    BytecodeGame& push(Value::Type type, int value) {
+        ::push(data.bytecode, type, value);
+        return *this;
+    }
+    BytecodeGame& incLocal(int local, int amount) {
+        data.bytecode.add_8(OpcodeDef::IncLocal);
+        data.bytecode.add_16(local);
+        data.bytecode.add_32(amount);
+        return *this;
+    }
+    // jump is CompareJumpZero or CompareJumpNotZero, compare the comparison
+    // opcode, and target a position in the bytecode.
+    BytecodeGame& compareJump(int jump, int compare, unsigned target) {
+        data.bytecode.add_8(jump);
+        data.bytecode.add_8(compare);
+        data.bytecode.add_32(target);
+        return *this;
+    }
+    unsigned position() const {
+        return data.bytecode.size();
+    }
+
+    GameData data;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "testing.h"
+
+// Set up a game with a single static list (ident 1) and an empty main
+// function on the call stack so values can be rooted by pushing them.
+struct TestGame {
+    TestGame() {
+        ListDef *def = new ListDef;
+        def->isStatic = true;
+        data.lists.insert(1, def);
+        data.strings.sealStatic();
+        data.lists.sealStatic();
+        data.maps.sealStatic();
+        data.objects.sealStatic();
+        main.arg_count = 0;
+        main.local_count = 0;
+        main.position = 0;
+        data.callStack.create(main, 0, Value(), 0);
+    }
+
+    ListDef& staticList() {
+        return data.editList(1);
+    }
+    void store(const Value &listId, const Value &value) {
+        ListDef &list = data.editList(listId.value);
+        list.items.push_back(value);
+        data.writeBarrier(Value::List, list, value);
+    }
+
+    GameData data;
+    FunctionDef main;
+};
+
+void test_young_collection() {
+    TestGame game;
+    Value root = game.data.makeNew(Value::List);
+    Value child = game.data.makeNewString("child");
+    Value garbage = game.data.makeNew(Value::List);
+    game.store(root, child);
+    game.data.callStack.push(root);
+
+    assert_equal(game.data.collectYoung(), 1, "young_collection: wrong collection count");
+    assert_true(game.data.isValid(root), "young_collection: rooted list collected");
+    assert_true(game.data.isValid(child), "young_collection: reachable string collected");
+    assert_true(!game.data.isValid(garbage), "young_collection: unreachable list survived");
+}
+
+void test_old_to_young() {
+    TestGame game;
+    Value root = game.data.makeNew(Value::List);
+    game.data.callStack.push(root);
+    game.data.collectYoung();
+
+    // root is now old; a young value stored in it must be found through the
+    // remembered set rather than by tracing root
+    Value child = game.data.makeNewString("child");
+    game.store(root, child);
+    Value garbage = game.data.makeNewString("garbage");
+    assert_equal(game.data.collectYoung(), 1, "old_to_young: wrong collection count");
+    assert_true(game.data.isValid(child), "old_to_young: remembered value collected");
+    assert_true(!game.data.isValid(garbage), "old_to_young: unreachable string survived");
+
+    game.data.editList(root.value).items.clear();
+    game.data.collectGarbage();
+    assert_true(!game.data.isValid(child), "old_to_young: removed value survived");
+}
+
+void test_static_remembered() {
+    TestGame game;
+    Value staticList(Value::List, 1);
+    Value dynamic = game.data.makeNew(Value::List);
+    game.store(staticList, dynamic);
+
+    game.data.collectYoung();
+    assert_true(game.data.isValid(dynamic), "static_remembered: young collection freed value held by static");
+    game.data.collectGarbage();
+    assert_true(game.data.isValid(dynamic), "static_remembered: full collection freed value held by static");
+
+    game.staticList().items.clear();
+    assert_equal(game.data.collectGarbage(), 1, "static_remembered: wrong collection count");
+    assert_true(!game.data.isValid(dynamic), "static_remembered: unreachable value survived");
+    assert_true(game.data.isValid(staticList), "static_remembered: static list collected");
+}
+
+void test_incremental() {
+    const int count = 2000;
+    TestGame game;
+    Value staticList(Value::List, 1);
+    for (int i = 0; i < count; ++i) {
+        Value list = game.data.makeNew(Value::List);
+        game.store(list, game.data.makeNewString("item"));
+        game.store(staticList, list);
+    }
+    game.data.collectYoung();
+
+    assert_equal(game.data.collectIncremental(0), -1, "incremental: marking finished without any budget");
+    assert_true(game.data.collectionInProgress(), "incremental: collection not in progress");
+
+    // the first list is still waiting to be scanned and the last has already
+    // been scanned; moving the string from one to the other must not lose it
+    ListDef &first = game.data.editList(game.staticList().items.front().value);
+    ListDef &last = game.data.editList(game.staticList().items.back().value);
+    Value moved = first.items.front();
+    first.items.clear();
+    last.items.push_back(moved);
+    game.data.writeBarrier(Value::List, last, moved);
+
+    // values created while marking survive the collection they were made in
+    Value fresh = game.data.makeNewString("fresh");
+    game.data.callStack.push(fresh);
+    Value garbage = game.data.makeNew(Value::Map);
+
+    int collected = -1;
+    while (collected < 0) collected = game.data.collectIncremental(1000);
+    assert_true(!game.data.collectionInProgress(), "incremental: collection still in progress");
+    assert_equal(collected, 0, "incremental: wrong collection count");
+    assert_true(game.data.isValid(moved), "incremental: moved value collected");
+    assert_true(game.data.isValid(fresh), "incremental: new value collected");
+
+    game.data.callStack.pop();
+    assert_equal(game.data.collectGarbage(), 2, "incremental: wrong collection count after finishing");
+    assert_true(!game.data.isValid(garbage), "incremental: unreachable value survived");
+}
+
+// A slot freed and reused until its generation would come round again must
+// not let the first reference to it resolve.
+void test_generation_wrap() {
+    TestGame game;
+    Value first = game.data.makeNew(Value::List);
+    for (unsigned i = 0; i <= 2 * (HEAP_GEN_MASK + 1); ++i) {
+        game.data.collectGarbage();
+        Value reused = game.data.makeNew(Value::List);
+        assert_true(!game.data.isValid(first), "generation_wrap: stale reference resolved");
+        assert_true(game.data.isValid(reused), "generation_wrap: new list not valid");
+    }
+}
+
+int main() {
+
+    try {
+        test_young_collection();
+        test_old_to_young();
+        test_static_remembered();
+        test_incremental();
+        test_generation_wrap();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
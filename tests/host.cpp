@@ -0,0 +1,327 @@
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../runner/gamedata.h"
+#include "../runner/host.h"
+#include "../runner/opcode.h"
+#include "gamefile.h"
+#include "testing.h"
+
+const char *GAME_FILE = "test_host.rvm";
+const char *DIVIDE_FILE = "test_host_divide.rvm";
+const int LOOPS = 2000;
+const int SESSIONS = 20;
+const int READ_TIMEOUT = 10000;     // milliseconds
+const char *HIBERNATE_DIR = "test_host.dir";
+
+// Writes a gamefile whose only function, main, has one local and the given
+// bytecode.
+static void writeGameFile(const char *filename, const ByteStream &code) {
+    GameFileWriter out(1, GAMEFLAG_KNOWN);
+    out.strings({ "", "? ", " done " });
+    out.lists({});
+    out.maps({});
+    out.objects({});
+    out.functions({ { 0, 1, 0 } });
+    out.bytecode(code);
+    out.write(filename);
+}
+
+// Writes a gamefile whose main function reads a line and says it, counts a
+// local up to LOOPS, says "done", then reads and says another line.
+static void writeGame() {
+    ByteStream code;
+    push(code, Value::String, 1);
+    code.add_8(OpcodeDef::GetLine);
+    code.add_8(OpcodeDef::Say);
+    push(code, Value::Integer, 0);
+    push(code, Value::VarRef, 0);
+    code.add_8(OpcodeDef::Store);
+    const int loop = code.size();
+    code.add_8(OpcodeDef::IncLocal); code.add_16(0); code.add_32(1);
+    push(code, Value::LocalVar, 0);
+    push(code, Value::Integer, LOOPS);
+    code.add_8(OpcodeDef::CompareJumpNotZero);
+    code.add_8(OpcodeDef::NotEqual);
+    code.add_32(loop);
+    push(code, Value::String, 2);
+    code.add_8(OpcodeDef::Say);
+    push(code, Value::String, 1);
+    code.add_8(OpcodeDef::GetLine);
+    code.add_8(OpcodeDef::Say);
+    code.add_8(OpcodeDef::Return);
+    writeGameFile(GAME_FILE, code);
+}
+
+// Writes a gamefile whose main function says what dividend divided by divisor
+// (using the opcode Div or Mod) gives.
+static void writeDivideGame(int opcode, int dividend, int divisor) {
+    ByteStream code;
+    push(code, Value::Integer, divisor);
+    push(code, Value::Integer, dividend);
+    code.add_8(opcode);
+    code.add_8(OpcodeDef::Say);
+    push(code, Value::Integer, 0);
+    code.add_8(OpcodeDef::Return);
+    writeGameFile(DIVIDE_FILE, code);
+}
+
+// A host serving on its own thread, with the player's ends of its connections.
+struct TestHost {
+    TestHost(const HostOptions &options, const char *filename = GAME_FILE)
+    : image(GameImage::load(filename)), host(image, options) {
+        assert_true(image != nullptr, "game not loaded");
+        server = std::thread([this]() { host.serve(); });
+    }
+    ~TestHost() {
+        host.stop();
+        server.join();
+        for (int fd : players) close(fd);
+    }
+
+    int connect(const std::string &input) {
+        int ends[2];
+        assert_true(socketpair(AF_UNIX, SOCK_STREAM, 0, ends) == 0, "socketpair failed");
+        host.connect(ends[0]);
+        players.push_back(ends[1]);
+        if (!input.empty()) {
+            assert_true(write(ends[1], input.data(), input.size()) == (ssize_t)input.size(),
+                        "couldn't send input");
+        }
+        return ends[1];
+    }
+    // Everything sent to a player until the host closed the connection.
+    std::string read(int fd) {
+        std::string text;
+        char buffer[1024];
+        while (1) {
+            pollfd ready{fd, POLLIN, 0};
+            assert_true(poll(&ready, 1, READ_TIMEOUT) == 1, "timed out waiting for output");
+            ssize_t amount = ::read(fd, buffer, sizeof(buffer));
+            if (amount <= 0) return text;
+            text.append(buffer, amount);
+        }
+    }
+
+    std::shared_ptr<const GameImage> image;
+    SessionHost host;
+    std::thread server;
+    std::vector<int> players;
+};
+
+static bool contains(const std::string &text, const std::string &part) {
+    return text.find(part) != std::string::npos;
+}
+
+void test_sessions() {
+    HostOptions options;
+    options.threads = 3;
+    options.slice = 50;
+    options.useDecoded = true;
+    TestHost test(options);
+
+    std::vector<int> players;
+    for (int i = 0; i < SESSIONS; ++i) {
+        players.push_back(test.connect("player " + std::to_string(i) + "\nsecond\n"));
+    }
+    for (int i = 0; i < SESSIONS; ++i) {
+        const std::string label = "sessions: " + std::to_string(i);
+        const std::string text = test.read(players[i]);
+        const std::string::size_type name = text.find("player " + std::to_string(i));
+        const std::string::size_type done = text.find("done");
+        const std::string::size_type second = text.find("second");
+        assert_true(name != std::string::npos, label + " didn't say the first line");
+        assert_true(done != std::string::npos && done > name, label + " didn't finish the loop");
+        assert_true(second != std::string::npos && second > done, label + " didn't say the second line");
+        assert_true(contains(text, "Program ended. Goodbye!"), label + " didn't end");
+    }
+}
+
+void test_input_arriving_later() {
+    HostOptions options;
+    options.threads = 2;
+    options.useDecoded = true;
+    options.jitMode = JitMode::Always;
+    TestHost test(options);
+
+    // input sent in pieces, after the game is already waiting for it
+    int player = test.connect("");
+    usleep(10000);
+    assert_true(write(player, "fir", 3) == 3, "later: couldn't send input");
+    usleep(10000);
+    assert_true(write(player, "st\r\nlast", 8) == 8, "later: couldn't send input");
+    // the last line counts without a newline once the player hangs up
+    shutdown(player, SHUT_WR);
+    const std::string text = test.read(player);
+    assert_true(contains(text, "first") && !contains(text, "first\r"), "later: first line");
+    assert_true(contains(text, "last"), "later: last line");
+    assert_true(contains(text, "Program ended. Goodbye!"), "later: didn't end");
+}
+
+void test_quit_and_hang_up() {
+    HostOptions options;
+    options.threads = 2;
+    TestHost test(options);
+
+    int quitter = test.connect("quit\n");
+    int leaver = test.connect("");
+    shutdown(leaver, SHUT_WR);
+    const std::string quit = test.read(quitter);
+    assert_true(contains(quit, "Goodbye!") && !contains(quit, "Program ended"), "quit: didn't quit");
+    const std::string left = test.read(leaver);
+    assert_true(!contains(left, "done"), "hang up: kept playing");
+}
+
+void test_turn_limit() {
+    HostOptions options;
+    options.threads = 2;
+    options.slice = 100;
+    options.turnLimit = LOOPS;
+    TestHost test(options);
+
+    int player = test.connect("name\n");
+    const std::string text = test.read(player);
+    assert_true(contains(text, "RUNTIME ERROR: Turn exceeded"), "limit: game not stopped");
+    assert_true(!contains(text, "done"), "limit: turn finished");
+}
+
+void test_player_not_reading() {
+    HostOptions options;
+    options.threads = 1;
+    TestHost test(options);
+
+    // a player whose first line is said back to it, but who doesn't read,
+    // mustn't keep the only worker from running other sessions
+    const std::string line(2 * 1024 * 1024, 'x');
+    int stalled = test.connect(line + "\nsecond\n");
+    usleep(100000);
+    int player = test.connect("first\nsecond\n");
+    const std::string text = test.read(player);
+    assert_true(contains(text, "Program ended. Goodbye!"), "not reading: other session didn't end");
+
+    // and the output held back is all sent once the player reads again
+    const std::string held = test.read(stalled);
+    assert_true(contains(held, line), "not reading: output lost");
+    assert_true(contains(held, "second") && contains(held, "Program ended. Goodbye!"),
+                "not reading: didn't end");
+}
+
+void test_bad_division() {
+    struct Division {
+        int opcode, dividend, divisor;
+        const char *error;
+    };
+    const Division divisions[] = {
+        { OpcodeDef::Div, 7, 0, "Division by zero." },
+        { OpcodeDef::Mod, 7, 0, "Division by zero." },
+        { OpcodeDef::Div, INT_MIN, -1, "Result of division out of range." },
+        { OpcodeDef::Mod, INT_MIN, -1, "Result of division out of range." },
+    };
+    const JitMode jitModes[] = { JitMode::Off, JitMode::Off, JitMode::Always };
+    for (const Division &division : divisions) {
+        writeDivideGame(division.opcode, division.dividend, division.divisor);
+        for (int engine = 0; engine < 3; ++engine) {
+            const std::string label = "bad division: " + std::to_string(division.opcode) + " "
+                                    + std::to_string(division.dividend) + " engine "
+                                    + std::to_string(engine);
+            HostOptions options;
+            options.threads = 1;
+            options.useDecoded = engine > 0;
+            options.jitMode = jitModes[engine];
+            TestHost test(options, DIVIDE_FILE);
+
+            // the session ends with an error, and the host keeps serving
+            int first = test.connect("");
+            int second = test.connect("");
+            const std::string text = test.read(first);
+            assert_true(contains(text, std::string("RUNTIME ERROR: ") + division.error), label);
+            assert_true(contains(test.read(second), division.error), label + " second session");
+        }
+    }
+    std::remove(DIVIDE_FILE);
+}
+
+static int countFiles(const char *dir) {
+    DIR *listing = opendir(dir);
+    if (!listing) return -1;
+    int count = 0;
+    while (dirent *entry = readdir(listing)) {
+        if (entry->d_name[0] != '.') ++count;
+    }
+    closedir(listing);
+    return count;
+}
+
+// Waits up to READ_TIMEOUT for dir to hold count files.
+static bool waitForFiles(const char *dir, int count) {
+    for (int waited = 0; waited < READ_TIMEOUT; waited += 10) {
+        if (countFiles(dir) == count) return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+void test_hibernate() {
+    mkdir(HIBERNATE_DIR, 0700);
+    {
+        HostOptions options;
+        options.threads = 2;
+        options.idleTime = 20;
+        options.hibernateDir = HIBERNATE_DIR;
+        TestHost test(options);
+
+        int first = test.connect("");
+        int second = test.connect("");
+        assert_true(waitForFiles(HIBERNATE_DIR, 2), "hibernate: sessions not hibernated");
+        assert_true(write(first, "one\n", 4) == 4, "hibernate: couldn't send input");
+        // the session goes back to sleep waiting for its second line
+        usleep(100000);
+        assert_true(waitForFiles(HIBERNATE_DIR, 2), "hibernate: session not hibernated again");
+        assert_true(write(first, "two\n", 4) == 4, "hibernate: couldn't send input");
+        const std::string text = test.read(first);
+        assert_true(contains(text, "one") && contains(text, "done"), "hibernate: first line");
+        assert_true(contains(text, "two"), "hibernate: second line");
+        assert_true(contains(text, "Program ended. Goodbye!"), "hibernate: didn't end");
+
+        // a session that ends while hibernated leaves no file behind
+        shutdown(second, SHUT_WR);
+        test.read(second);
+        assert_true(waitForFiles(HIBERNATE_DIR, 0), "hibernate: file left behind");
+    }
+    rmdir(HIBERNATE_DIR);
+}
+
+int main() {
+    writeGame();
+
+    try {
+        test_sessions();
+        test_input_arriving_later();
+        test_quit_and_hang_up();
+        test_turn_limit();
+        test_player_not_reading();
+        test_bad_division();
+        test_hibernate();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        std::remove(GAME_FILE);
+        std::remove(DIVIDE_FILE);
+        rmdir(HIBERNATE_DIR);
+        return 1;
+    }
+
+    std::remove(GAME_FILE);
+    return 0;
+}
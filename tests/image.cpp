@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+#include "gamefile.h"
+#include "testing.h"
+
+const char *GAME_FILE = "test_image.rvm";
+const unsigned PROP_WEIGHT = 5;
+
+// Writes a gamefile with two strings, the list 1 holding 1 and 2, the map 1
+// from 1 to 2, the object 1 with a weight of 10, a main function (ident 1)
+// that returns straight away, and a function 2 that nothing calls.
+static void writeGame() {
+    ByteStream code;
+    code.add_8(OpcodeDef::Return);
+    code.add_8(OpcodeDef::Return);
+
+    GameFileWriter out(1, 0);
+    out.strings({ "", "hello" });
+    out.lists({ { Value(Value::Integer, 1), Value(Value::Integer, 2) } });
+    out.maps({ { { Value(Value::Integer, 1), Value(Value::Integer, 2) } } });
+    out.objects({ { { PROP_WEIGHT, Value(Value::Integer, 10) } } });
+    out.functions({ { 1, 0, 0 }, { 1, 0, 1 } });
+    out.bytecode(code);
+    out.write(GAME_FILE);
+}
+
+void test_load() {
+    std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+    assert_true(image != nullptr, "load: not loaded");
+    GameData session;
+    session.attach(image);
+    assert_true(session.gameLoaded, "load: session not started");
+    assert_equal(session.mainFunction, 1, "load: main function");
+    assert_equal(session.getString(1).text(), "hello", "load: string");
+    assert_equal(session.getList(1).items.size(), 2, "load: list");
+    assert_equal(session.getMap(1).get(Value(Value::Integer, 1)).value, 2, "load: map");
+    assert_equal(session.getObject(1).get(session, PROP_WEIGHT).value, 10, "load: object");
+    assert_true(session.getFunction(1).verified, "load: function not verified");
+}
+
+void test_shared_until_changed() {
+    std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+    GameData first, second;
+    first.attach(image);
+    second.attach(image);
+    assert_true(&first.getList(1) == &second.getList(1), "shared: list copied");
+    assert_true(&first.getObject(1) == &second.getObject(1), "shared: object copied");
+    assert_true(&first.getString(1) == &second.getString(1), "shared: string copied");
+
+    first.editList(1).items.push_back(Value(Value::Integer, 3));
+    first.editMap(1).set(Value(Value::Integer, 1), Value(Value::Integer, 4));
+    first.setProperty(first.editObject(1), PROP_WEIGHT, Value(Value::Integer, 20));
+    first.stringAppend(Value(Value::String, 1), Value(Value::Integer, 5));
+
+    assert_true(&first.getList(1) != &second.getList(1), "shared: list not copied");
+    assert_equal(first.getList(1).items.size(), 3, "shared: changed list");
+    assert_equal(second.getList(1).items.size(), 2, "shared: other list");
+    assert_equal(first.getMap(1).get(Value(Value::Integer, 1)).value, 4, "shared: changed map");
+    assert_equal(second.getMap(1).get(Value(Value::Integer, 1)).value, 2, "shared: other map");
+    assert_equal(first.getObject(1).get(first, PROP_WEIGHT).value, 20, "shared: changed object");
+    assert_equal(second.getObject(1).get(second, PROP_WEIGHT).value, 10, "shared: other object");
+    assert_equal(first.getString(1).text(), "hello5", "shared: changed string");
+    assert_equal(second.getString(1).text(), "hello", "shared: other string");
+    assert_true(first.getList(1).isStatic, "shared: copy not static");
+
+    // a session started later still sees the image as loaded
+    GameData third;
+    third.attach(image);
+    assert_equal(third.getList(1).items.size(), 2, "shared: later list");
+}
+
+void test_property_cache() {
+    std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+    GameData session;
+    session.attach(image);
+    assert_equal(session.getProperty(0, 1, PROP_WEIGHT).value, 10, "cache: before");
+    // the cached lookup points into the image's object, which the change
+    // doesn't touch
+    session.setProperty(session.editObject(1), PROP_WEIGHT, Value(Value::Integer, 30));
+    assert_equal(session.getProperty(0, 1, PROP_WEIGHT).value, 30, "cache: after");
+}
+
+void test_functions_on_first_use() {
+    std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+    GameData session;
+    session.attach(image);
+    assert_true(session.functions.empty(), "first use: functions copied");
+    assert_true(session.isValid(Value(Value::Function, 2)), "first use: function 2");
+
+    session.useDecoded = true;
+    session.jitMode = JitMode::Always;
+    const FunctionDef &main = session.getFunction(1);
+    session.callStack.create(main, 1, session.noneValue, 0);
+    session.callStack.callTop().IP = main.position;
+    session.resume(false, session.noneValue);
+    assert_true(session.optionType == OptionType::EndOfProgram, "first use: not ended");
+    assert_true(main.isDecoded, "first use: main not decoded");
+    assert_equal(session.functions.size(), 1, "first use: uncalled function copied");
+    assert_true(!image->functions.at(1).isDecoded, "first use: image decoded");
+}
+
+void test_collect() {
+    std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+    GameData first, second;
+    first.attach(image);
+    second.attach(image);
+    const FunctionDef &main = first.getFunction(1);
+    first.callStack.create(main, 1, first.noneValue, 0);
+
+    // a static list kept alive only because it holds a new item
+    Value item = first.makeNew(Value::List);
+    ListDef &list = first.editList(1);
+    list.items.push_back(item);
+    first.writeBarrier(Value::List, list, item);
+    first.collectGarbage();
+    assert_true(first.isValid(item), "collect: reachable item freed");
+    assert_equal(second.getList(1).items.size(), 2, "collect: other list");
+}
+
+int main() {
+    writeGame();
+
+    try {
+        test_load();
+        test_shared_until_changed();
+        test_property_cache();
+        test_functions_on_first_use();
+        test_collect();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        std::remove(GAME_FILE);
+        return 1;
+    }
+
+    std::remove(GAME_FILE);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "testing.h"
+
+
+void test_small_map() {
+    MapDef map;
+    map.set(Value(Value::Integer, 5), Value(Value::String, 1));
+    map.set(Value(Value::String, 5), Value(Value::String, 2));
+    assert_equal(map.size(), 2, "small_map: wrong row count");
+    assert_equal(map.get(Value(Value::Integer, 5)).value, 1, "small_map: wrong value for integer key");
+    assert_equal(map.get(Value(Value::String, 5)).value, 2, "small_map: wrong value for string key");
+    assert_true(!map.has(Value(Value::Object, 5)), "small_map: found key of wrong type");
+
+    map.set(Value(Value::Integer, 5), Value(Value::String, 3));
+    assert_equal(map.size(), 2, "small_map: updating key added row");
+    assert_equal(map.get(Value(Value::Integer, 5)).value, 3, "small_map: value not updated");
+
+    map.del(Value(Value::Integer, 5));
+    assert_equal(map.size(), 1, "small_map: delete did not remove row");
+    assert_true(!map.has(Value(Value::Integer, 5)), "small_map: deleted key still present");
+}
+
+void test_large_map() {
+    const int count = 1000;
+    MapDef map;
+    for (int i = 0; i < count; ++i) {
+        map.set(Value(Value::Integer, i * 7), Value(Value::Integer, i));
+    }
+    assert_equal(map.size(), count, "large_map: wrong row count");
+    for (int i = 0; i < count; ++i) {
+        assert_equal(map.get(Value(Value::Integer, i * 7)).value, i, "large_map: wrong value");
+    }
+    assert_true(!map.has(Value(Value::Integer, 1)), "large_map: found missing key");
+    assert_true(!map.has(Value(Value::String, 7)), "large_map: found key of wrong type");
+
+    // delete every odd row and make sure the rest are still reachable
+    for (int i = 1; i < count; i += 2) {
+        map.del(Value(Value::Integer, i * 7));
+    }
+    assert_equal(map.size(), count / 2, "large_map: wrong row count after delete");
+    for (int i = 0; i < count; ++i) {
+        bool expected = i % 2 == 0;
+        assert_equal(map.has(Value(Value::Integer, i * 7)), expected, "large_map: wrong key after delete");
+        if (expected) {
+            assert_equal(map.get(Value(Value::Integer, i * 7)).value, i, "large_map: wrong value after delete");
+        }
+    }
+}
+
+void test_insertion_order() {
+    MapDef map;
+    for (int i = 0; i < 100; ++i) {
+        map.set(Value(Value::Integer, 100 - i), Value(Value::Integer, i));
+    }
+    map.del(Value(Value::Integer, 50));
+    map.set(Value(Value::Integer, 50), Value(Value::Integer, 0));
+    assert_equal(map.rows.front().key.value, 100, "insertion_order: wrong first key");
+    assert_equal(map.rows.back().key.value, 50, "insertion_order: re-added key not last");
+    for (unsigned i = 1; i + 1 < map.rows.size(); ++i) {
+        assert_true(map.rows[i - 1].key.value > map.rows[i].key.value, "insertion_order: rows out of order");
+    }
+}
+
+void test_shrink() {
+    MapDef map;
+    for (int i = 0; i < 50; ++i) {
+        map.set(Value(Value::Integer, i), Value(Value::Integer, i));
+    }
+    for (int i = 0; i < 48; ++i) {
+        map.del(Value(Value::Integer, i));
+    }
+    assert_equal(map.size(), 2, "shrink: wrong row count");
+    assert_equal(map.get(Value(Value::Integer, 49)).value, 49, "shrink: lost remaining key");
+    map.set(Value(Value::Integer, 3), Value(Value::Integer, 3));
+    assert_equal(map.get(Value(Value::Integer, 3)).value, 3, "shrink: failed to add key");
+}
+
+void test_none_key() {
+    MapDef map;
+    for (int i = 0; i < 20; ++i) {
+        map.set(Value(Value::Integer, i), Value(Value::Integer, i));
+    }
+    map.set(Value(Value::None, 0), Value(Value::Integer, 99));
+    assert_equal(map.get(Value(Value::None, 12)).value, 99, "none_key: None keys should all compare equal");
+}
+
+void test_delete_all() {
+    const int count = 100000;
+    MapDef map;
+    for (int i = 0; i < count; ++i) {
+        map.set(Value(Value::Integer, i), Value(Value::Integer, i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        map.del(Value(Value::Integer, i));
+        if (i == count / 4) {
+            assert_true(!map.has(Value(Value::Integer, i)), "delete_all: deleted key still present");
+            assert_equal(map.get(Value(Value::Integer, i + 1)).value, i + 1, "delete_all: lost remaining key");
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    assert_equal(map.size(), 0, "delete_all: rows left over");
+    assert_true(map.rows.empty(), "delete_all: deleted rows kept");
+    // renumbering the index on every delete took minutes here
+    assert_true(elapsed < std::chrono::seconds(2), "delete_all: deleting every key is too slow");
+}
+
+void test_duplicate_keys() {
+    // only a gamefile can give a key twice; the first row is the one used
+    MapDef map;
+    for (int i = 0; i < 20; ++i) {
+        map.rows.push_back(MapDef::Row{Value(Value::Integer, i % 10), Value(Value::Integer, i), false});
+    }
+    map.rebuildIndex();
+    assert_equal(map.get(Value(Value::Integer, 3)).value, 3, "duplicate_keys: wrong row found");
+    map.set(Value(Value::Integer, 3), Value(Value::Integer, 30));
+    assert_equal(map.rows[3].value.value, 30, "duplicate_keys: wrong row updated");
+    map.del(Value(Value::Integer, 3));
+    assert_true(map.has(Value(Value::Integer, 3)), "duplicate_keys: second row not found");
+    assert_equal(map.get(Value(Value::Integer, 3)).value, 13, "duplicate_keys: wrong second row");
+    map.del(Value(Value::Integer, 3));
+    assert_true(!map.has(Value(Value::Integer, 3)), "duplicate_keys: deleted key still present");
+    assert_equal(map.get(Value(Value::Integer, 4)).value, 4, "duplicate_keys: lost other key");
+}
+
+int main() {
+
+    try {
+        test_small_map();
+        test_large_map();
+        test_insertion_order();
+        test_shrink();
+        test_none_key();
+        test_delete_all();
+        test_duplicate_keys();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
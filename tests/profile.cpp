@@ -0,0 +1,76 @@
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+#include "../runner/profile.h"
+#include "gamefile.h"
+#include "testing.h"
+
+// Builds a game whose main function (ident 1) calls function 2, which adds
+// two numbers and returns the result for main to discard.
+struct TestGame : BytecodeGame {
+    TestGame() {
+        addFunction(1, 1, 0);
+        push(Value::Integer, 0).push(Value::Function, 2).op(OpcodeDef::Call);
+        op(OpcodeDef::StackPop).op(OpcodeDef::Return);
+        addFunction(2, 1, 0);
+        push(Value::Integer, 1).push(Value::Integer, 2).op(OpcodeDef::Add);
+        op(OpcodeDef::Return);
+
+        data.profiler = &profiler;
+        const FunctionDef &main = data.getFunction(1);
+        data.callStack.create(main, 1, data.noneValue, 0);
+        data.callStack.callTop().IP = main.position;
+        data.resume(false, data.noneValue);
+    }
+
+    Profiler profiler;
+};
+
+void test_opcodes() {
+    TestGame game;
+    assert_true(game.data.optionType == OptionType::EndOfProgram, "opcodes: game still running");
+    assert_equal(game.profiler.opcodeCount(OpcodeDef::Push32), 4, "opcodes: push_32");
+    assert_equal(game.profiler.opcodeCount(OpcodeDef::Call), 1, "opcodes: call");
+    assert_equal(game.profiler.opcodeCount(OpcodeDef::Return), 2, "opcodes: ret");
+    assert_equal(game.profiler.pairCount(OpcodeDef::Push32, OpcodeDef::Push32), 2, "opcodes: push_32 pairs");
+    assert_equal(game.profiler.pairCount(OpcodeDef::Call, OpcodeDef::Push32), 1, "opcodes: call pairs");
+    assert_equal(game.profiler.pairCount(OpcodeDef::Return, OpcodeDef::StackPop), 1, "opcodes: ret pairs");
+}
+
+void test_functions() {
+    TestGame game;
+    std::vector<FunctionProfile> functions = game.profiler.functions();
+    assert_equal(functions.size(), 2, "functions: count");
+    assert_equal(functions[0].functionId, 1, "functions: main first");
+    assert_equal(functions[0].calls, 1, "functions: main calls");
+    assert_equal(functions[0].inclusive, 9, "functions: main inclusive");
+    assert_equal(functions[0].exclusive, 5, "functions: main exclusive");
+    assert_equal(functions[1].functionId, 2, "functions: callee second");
+    assert_equal(functions[1].calls, 1, "functions: callee calls");
+    assert_equal(functions[1].inclusive, 4, "functions: callee inclusive");
+    assert_equal(functions[1].exclusive, 4, "functions: callee exclusive");
+}
+
+void test_folded() {
+    TestGame game;
+    std::stringstream folded;
+    game.profiler.writeFolded(game.data, folded);
+    assert_equal(folded.str(), "#1 5\n#1;#2 4\n", "folded");
+}
+
+int main() {
+
+    try {
+        test_opcodes();
+        test_functions();
+        test_folded();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
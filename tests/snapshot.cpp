@@ -0,0 +1,339 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+
+#include "../runner/formatter.h"
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+#include "../runner/player.h"
+#include "gamefile.h"
+#include "testing.h"
+
+const char *GAME_FILE = "test_snapshot.rvm";
+const unsigned PROP_WEIGHT = 5;
+const int MANY_LISTS = 200;         // enough to fill several heap pages
+
+// Writes a gamefile with the list 1 holding 1 and 2, the object 1 with a
+// weight of 10, and a main function that reads and says two lines. Function
+// 2 reads lines forever, saying each and adding it to list 1, then saying the
+// size of the list.
+static void writeGame() {
+    ByteStream code;
+    for (int i = 0; i < 2; ++i) {
+        push(code, Value::String, 1);
+        code.add_8(OpcodeDef::GetLine);
+        code.add_8(OpcodeDef::Say);
+    }
+    code.add_8(OpcodeDef::Return);
+    const int loop = code.size();
+    push(code, Value::String, 1);
+    code.add_8(OpcodeDef::GetLine);
+    code.add_8(OpcodeDef::StackDup);
+    code.add_8(OpcodeDef::Say);
+    push(code, Value::List, 1);
+    code.add_8(OpcodeDef::ListPush);
+    push(code, Value::List, 1);
+    code.add_8(OpcodeDef::GetSize);
+    code.add_8(OpcodeDef::Say);
+    push(code, Value::JumpTarget, 0);
+    code.add_8(OpcodeDef::Jump);
+
+    GameFileWriter out(1, 0);
+    out.strings({ "", "? " });
+    out.lists({ { Value(Value::Integer, 1), Value(Value::Integer, 2) } });
+    out.maps({});
+    out.objects({ { { PROP_WEIGHT, Value(Value::Integer, 10) } } });
+    out.functions({ { 0, 0, 0 }, { 0, 0, static_cast<unsigned>(loop) } });
+    out.bytecode(code);
+    out.write(GAME_FILE);
+}
+
+// A session started on the image and run until it asks for its first line.
+struct TestSession {
+    TestSession(std::shared_ptr<const GameImage> image) {
+        data.attach(image);
+        data.output = &output;
+        const FunctionDef &main = data.getFunction(image->mainFunction);
+        data.callStack.create(main, image->mainFunction, data.noneValue, 0);
+        data.callStack.callTop().IP = main.position;
+        data.resume(false, data.noneValue);
+    }
+    // Answers the game's prompt and returns what it said in reply.
+    std::string answer(const std::string &line) {
+        output.text.clear();
+        data.resume(true, data.makeNewString(line));
+        return output.text;
+    }
+
+    GameData data;
+    CaptureOutput output;
+};
+
+void test_restore(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    assert_true(session.data.optionType == OptionType::Line, "restore: not waiting");
+    std::shared_ptr<const SessionSnapshot> snap = session.data.snapshot();
+
+    session.data.editList(1).items.push_back(Value(Value::Integer, 3));
+    session.data.setProperty(session.data.editObject(1), PROP_WEIGHT, Value(Value::Integer, 20));
+    session.data.stringAppend(Value(Value::String, 1), Value(Value::Integer, 5));
+    session.data.infoText[INFO_TITLE] = "changed";
+    const Value added = session.data.makeNew(Value::List);
+    assert_equal(session.answer("first"), "first", "restore: first answer");
+
+    session.data.restore(*snap);
+    assert_true(!session.data.isValid(added), "restore: new list kept");
+    assert_equal(session.data.getList(1).items.size(), 2, "restore: list");
+    assert_equal(session.data.getProperty(0, 1, PROP_WEIGHT).value, 10, "restore: object");
+    assert_equal(session.data.getString(1).text(), "? ", "restore: string");
+    assert_equal(session.data.infoText[INFO_TITLE], "", "restore: info text");
+    assert_true(session.data.optionType == OptionType::Line, "restore: not waiting again");
+    // idents are handed out just as they were after the snapshot was taken
+    assert_equal(session.data.makeNew(Value::List).value, added.value, "restore: next ident");
+
+    assert_equal(session.answer("second"), "second", "restore: second answer");
+    assert_true(session.data.optionType == OptionType::Line, "restore: not on the second line");
+    assert_equal(session.answer("last"), "last", "restore: last answer");
+    assert_true(session.data.optionType == OptionType::EndOfProgram, "restore: not ended");
+}
+
+void test_fork(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    const Value list = session.data.makeNew(Value::List);
+    session.data.editList(list.value).items.push_back(Value(Value::Integer, 7));
+    std::shared_ptr<const SessionSnapshot> snap = session.data.snapshot();
+
+    TestSession fork(image);
+    fork.data.restore(*snap);
+    assert_true(&fork.data.getList(list.value) == &session.data.getList(list.value),
+                "fork: list copied");
+    fork.data.editList(list.value).items.push_back(Value(Value::Integer, 8));
+    assert_equal(fork.data.getList(list.value).items.size(), 2, "fork: changed list");
+    assert_equal(session.data.getList(list.value).items.size(), 1, "fork: original list");
+
+    // a session that has yet to attach the image takes it from the snapshot
+    GameData later;
+    CaptureOutput laterOutput;
+    later.output = &laterOutput;
+    later.restore(*snap);
+    assert_true(later.gameLoaded, "fork: later session not loaded");
+    assert_equal(later.getList(list.value).items.size(), 1, "fork: later list");
+    later.resume(true, later.makeNewString("later"));
+    assert_equal(laterOutput.text, "later", "fork: later answer");
+
+    assert_equal(fork.answer("forked"), "forked", "fork: fork answer");
+    assert_equal(session.answer("original"), "original", "fork: original answer");
+}
+
+void test_pages(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    std::vector<Value> lists;
+    for (int i = 0; i < MANY_LISTS; ++i) {
+        lists.push_back(session.data.makeNew(Value::List));
+        session.data.editList(lists.back().value).items.push_back(Value(Value::Integer, i));
+    }
+    std::shared_ptr<const SessionSnapshot> first = session.data.snapshot();
+    std::shared_ptr<const SessionSnapshot> same = session.data.snapshot();
+    assert_true(first->lists->pages.size() > 2, "pages: too few pages");
+    for (unsigned i = 0; i < first->lists->pages.size(); ++i) {
+        assert_true(first->lists->pages[i] == same->lists->pages[i], "pages: unchanged page copied");
+    }
+
+    // only the page of the changed list is copied
+    session.data.editList(lists.back().value).items[0] = Value(Value::Integer, -1);
+    std::shared_ptr<const SessionSnapshot> changed = session.data.snapshot();
+    const unsigned last = changed->lists->pages.size() - 1;
+    assert_true(changed->lists->pages[0] == first->lists->pages[0], "pages: first page copied");
+    assert_true(changed->lists->pages[last] != first->lists->pages[last], "pages: last page shared");
+
+    TestSession before(image), after(image);
+    before.data.restore(*first);
+    after.data.restore(*changed);
+    assert_equal(before.data.getList(lists.back().value).items[0].value, MANY_LISTS - 1, "pages: first snapshot");
+    assert_equal(after.data.getList(lists.back().value).items[0].value, -1, "pages: later snapshot");
+}
+
+void test_collect(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    std::vector<Value> lists;
+    for (int i = 0; i < MANY_LISTS; ++i) {
+        lists.push_back(session.data.makeNew(Value::List));
+        session.data.editList(lists.back().value).items.push_back(Value(Value::Integer, i));
+    }
+    std::shared_ptr<const SessionSnapshot> snap = session.data.snapshot();
+
+    // nothing refers to the lists, so they're collected from the session,
+    // but not from the snapshot that shares them
+    session.data.collectYoung();
+    session.data.collectGarbage();
+    assert_true(!session.data.isValid(lists.front()), "collect: list kept");
+
+    TestSession fork(image);
+    fork.data.restore(*snap);
+    for (int i = 0; i < MANY_LISTS; ++i) {
+        assert_equal(fork.data.getList(lists[i].value).items[0].value, i, "collect: snapshot list");
+    }
+    // restored lists are still young, and collected in their turn
+    assert_true(fork.data.collectYoung() >= MANY_LISTS, "collect: restored lists not young");
+    assert_true(!fork.data.isValid(lists.front()), "collect: restored list kept");
+}
+
+// Restoring leaves the pages that haven't changed as they are; the items on
+// them must still be traced by later collections, and the free list must be
+// what it was.
+void test_restore_unchanged(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    std::vector<Value> lists;
+    for (int i = 0; i < MANY_LISTS; ++i) {
+        lists.push_back(session.data.makeNew(Value::List));
+        ListDef &root = session.data.editList(1);
+        root.items.push_back(lists.back());
+        session.data.writeBarrier(Value::List, root, lists.back());
+    }
+    const Value freed = session.data.makeNew(Value::List);
+    session.data.collectGarbage();
+    std::shared_ptr<const SessionSnapshot> snap = session.data.snapshot();
+
+    // marks the lists again before going back to the snapshot
+    session.data.collectGarbage();
+    session.data.restore(*snap);
+    const Value text = session.data.makeNewString("kept");
+    ListDef &list = session.data.editList(lists.front().value);
+    list.items.push_back(text);
+    session.data.writeBarrier(Value::List, list, text);
+    session.data.collectGarbage();
+    assert_true(session.data.isValid(text), "restore_unchanged: string in restored list collected");
+
+    const Value reused = session.data.makeNew(Value::List);
+    assert_equal(reused.value, freed.value + (1 << HEAP_SLOT_BITS), "restore_unchanged: freed slot");
+    session.data.restore(*snap);
+    assert_true(session.data.isValid(lists.back()), "restore_unchanged: list lost");
+    assert_true(!session.data.isValid(reused), "restore_unchanged: new list kept");
+    assert_equal(session.data.makeNew(Value::List).value, reused.value, "restore_unchanged: next ident");
+}
+
+void test_save_state(std::shared_ptr<const GameImage> image) {
+    TestSession session(image);
+    session.data.editList(1).items.push_back(Value(Value::Integer, 3));
+    session.data.setProperty(session.data.editObject(1), PROP_WEIGHT, Value(Value::Integer, 20));
+    const Value text = session.data.makeNewString("some text");
+    const Value map = session.data.makeNew(Value::Map);
+    for (int i = 0; i < MANY_LISTS; ++i) {
+        session.data.editMap(map.value).set(Value(Value::Integer, i), Value(Value::Integer, i * 2));
+    }
+    const Value object = session.data.makeNew(Value::Object);
+    session.data.setProperty(session.data.editObject(object.value), PROP_WEIGHT, text);
+    const Value freed = session.data.makeNew(Value::List);
+    session.data.lists.remove(freed.value);
+    session.data.infoText[INFO_LEFT] = "left";
+
+    std::vector<uint8_t> state;
+    session.data.saveState(state);
+    session.data.releaseState();
+    assert_equal(session.data.getList(1).items.size(), 2, "save: released list");
+    assert_true(!session.data.isValid(map), "save: released map");
+    assert_true(session.data.callStack.isEmpty(), "save: released stack");
+
+    TestSession other(image);
+    other.data.loadState(state.data(), state.size());
+    assert_equal(other.data.getList(1).items.size(), 3, "save: list");
+    assert_equal(other.data.getProperty(0, 1, PROP_WEIGHT).value, 20, "save: object");
+    assert_equal(other.data.getString(text.value).text(), "some text", "save: string");
+    assert_equal(other.data.getMap(map.value).get(Value(Value::Integer, 150)).value, 300, "save: map");
+    assert_equal(other.data.getObject(object.value).get(other.data, PROP_WEIGHT).value, text.value, "save: new object");
+    assert_true(!other.data.isValid(freed), "save: freed list");
+    assert_equal(other.data.infoText[INFO_LEFT], "left", "save: info text");
+    // the image's items are still shared rather than saved
+    assert_true(&other.data.getString(1) == &session.data.getString(1), "save: image string copied");
+    assert_equal(other.data.makeNew(Value::List).value, freed.value + (1 << HEAP_SLOT_BITS), "save: next ident");
+
+    assert_equal(other.answer("loaded"), "loaded", "save: answer");
+    assert_true(other.data.optionType == OptionType::Line, "save: not on the second line");
+    other.data.collectGarbage();
+    assert_true(other.data.isValid(Value(Value::String, 1)), "save: static string collected");
+
+    // state cut short is refused, leaving the session released
+    TestSession damaged(image);
+    bool refused = false;
+    try {
+        damaged.data.loadState(state.data(), state.size() - 1);
+    } catch (GameError &e) {
+        refused = true;
+    }
+    assert_true(refused, "save: damaged state loaded");
+    assert_true(damaged.data.callStack.isEmpty(), "save: damaged session not released");
+}
+
+static bool contains(const std::string &text, const std::string &part) {
+    return text.find(part) != std::string::npos;
+}
+
+void test_undo(std::shared_ptr<const GameImage> image) {
+    GameData data;
+    data.attach(image);
+    data.mainFunction = 2;
+    data.undoLevels = 2;
+    std::ostringstream out;
+    TextPlayer player(data, out, false);
+    player.start();
+    player.run();
+
+    const char *lines[] = { "a", "b", "c" };
+    for (const char *line : lines) {
+        assert_true(player.input(line) == InputResult::Accepted, "undo: line rejected");
+        player.run();
+    }
+    assert_true(contains(out.str(), "c5"), "undo: third turn");
+    assert_equal(data.getList(1).items.size(), 5, "undo: list before");
+
+    out.str("");
+    assert_true(player.input("undo") == InputResult::Rejected, "undo: started a turn");
+    assert_true(contains(out.str(), "Undone."), "undo: not undone");
+    assert_equal(data.getList(1).items.size(), 4, "undo: one turn");
+    player.input("UNDO");
+    assert_equal(data.getList(1).items.size(), 3, "undo: two turns");
+    out.str("");
+    player.input("undo");
+    assert_true(contains(out.str(), "nothing to undo"), "undo: past the limit");
+    assert_equal(data.getList(1).items.size(), 3, "undo: past the limit list");
+
+    // play carries on from the restored turn, which can be undone in turn
+    out.str("");
+    assert_true(player.input("d") == InputResult::Accepted, "undo: later line rejected");
+    player.run();
+    assert_true(contains(out.str(), "d4"), "undo: later turn");
+    player.input("undo");
+    assert_equal(data.getList(1).items.size(), 3, "undo: later turn undone");
+    assert_equal(data.getList(1).items[2].type, Value::String, "undo: earlier line lost");
+    assert_equal(data.getString(data.getList(1).items[2].value).text(), "a", "undo: earlier line");
+}
+
+int main() {
+    writeGame();
+
+    try {
+        std::shared_ptr<const GameImage> image = GameImage::load(GAME_FILE);
+        assert_true(image != nullptr, "game not loaded");
+        test_restore(image);
+        test_fork(image);
+        test_pages(image);
+        test_collect(image);
+        test_restore_unchanged(image);
+        test_undo(image);
+        test_save_state(image);
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        std::remove(GAME_FILE);
+        return 1;
+    } catch (GameError &e) {
+        std::cerr << "Game Error: " << e.what() << '\n';
+        std::remove(GAME_FILE);
+        return 1;
+    }
+
+    std::remove(GAME_FILE);
+    return 0;
+}
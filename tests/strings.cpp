@@ -0,0 +1,64 @@
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "testing.h"
+
+void test_append() {
+    StringDef def;
+    def.setText("abc");
+    def.append("def");
+    def.append("");
+    def.append("ghi");
+    assert_true(def.text() == "abcdefghi", "append: wrong text");
+    def.clear();
+    assert_true(def.empty(), "append: clear left text behind");
+    def.append("xyz");
+    assert_true(def.text() == "xyz", "append: wrong text after clear");
+}
+
+void test_append_normalizes() {
+    // U+03D2 followed by U+0301 composes to U+03D3, even when the two are
+    // appended separately and the first has been flattened already
+    StringDef def;
+    def.append("ab\xCF\x92");
+    assert_true(def.text() == "ab\xCF\x92", "append_normalizes: wrong text before join");
+    def.append("\xCC\x81" "c");
+    assert_true(def.text() == "ab\xCF\x93" "c", "append_normalizes: join not composed");
+
+    StringDef unnormalized;
+    unnormalized.setText("\xCF\x92\xCC\x81");
+    unnormalized.append("d");
+    assert_true(unnormalized.text() == "\xCF\x93" "d", "append_normalizes: original text not normalized");
+}
+
+void test_shared() {
+    std::shared_ptr<const std::string> buffer = std::make_shared<const std::string>("shared");
+    StringDef first, second;
+    first.setText(buffer, true);
+    second.share(first);
+    assert_true(&first.text() == buffer.get(), "shared: first copied the buffer");
+    assert_true(&second.text() == buffer.get(), "shared: second copied the buffer");
+
+    second.append(" text");
+    assert_true(second.text() == "shared text", "shared: wrong appended text");
+    assert_true(first.text() == "shared", "shared: append changed the shared text");
+    assert_true(*buffer == "shared", "shared: append changed the buffer");
+    assert_true(first.isNormalized(), "shared: normalized flag lost");
+}
+
+int main() {
+
+    try {
+        test_append();
+        test_append_normalizes();
+        test_shared();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
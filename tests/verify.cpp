@@ -0,0 +1,117 @@
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include "../runner/gamedata.h"
+#include "../runner/opcode.h"
+#include "gamefile.h"
+#include "testing.h"
+
+// Builds a game with a single function (ident 1) taking self plus one
+// argument and having one local, so that locals 0 through 2 are valid.
+struct TestFunction : BytecodeGame {
+    TestFunction() {
+        addFunction(1, 2, 1);
+    }
+
+    bool verified() {
+        assert_true(data.verifyFunctions(), "function rejected");
+        return data.getFunction(1).verified;
+    }
+};
+
+void test_straight_line() {
+    TestFunction f;
+    f.push(Value::Integer, 1).push(Value::Integer, 2).op(OpcodeDef::Add);
+    f.push(Value::VarRef, 2).op(OpcodeDef::Store);
+    f.push(Value::Integer, 0).push(Value::Function, 1).op(OpcodeDef::Call);
+    f.op(OpcodeDef::Return);
+    assert_true(f.verified(), "straight_line: not verified");
+}
+
+void test_underflow() {
+    TestFunction f;
+    f.push(Value::Integer, 1).op(OpcodeDef::Add).op(OpcodeDef::Return);
+    assert_true(!f.verified(), "underflow: verified");
+
+    // the arguments of a call are counted against the stack
+    TestFunction call;
+    call.push(Value::Integer, 1).push(Value::Function, 1).op(OpcodeDef::Call);
+    call.op(OpcodeDef::Return);
+    assert_true(!call.verified(), "underflow: call verified");
+}
+
+void test_loops() {
+    // a loop that leaves its stack as it found it
+    TestFunction f;
+    unsigned top = f.position();
+    f.push(Value::Integer, 1).op(OpcodeDef::StackPop);
+    f.push(Value::Integer, 1).push(Value::JumpTarget, top).op(OpcodeDef::JumpNotZero);
+    f.op(OpcodeDef::Return);
+    assert_true(f.verified(), "loops: balanced loop not verified");
+
+    // one that grows it every time around
+    TestFunction grows;
+    top = grows.position();
+    grows.push(Value::Integer, 1);
+    grows.push(Value::Integer, 1).push(Value::JumpTarget, top).op(OpcodeDef::JumpNotZero);
+    grows.op(OpcodeDef::Return);
+    assert_true(!grows.verified(), "loops: growing loop verified");
+}
+
+void test_jump_targets() {
+    // into the middle of an instruction
+    TestFunction middle;
+    middle.push(Value::JumpTarget, 1).op(OpcodeDef::Jump).op(OpcodeDef::Return);
+    assert_true(!middle.verified(), "jump_targets: jump into instruction verified");
+
+    // beyond the end of the function
+    TestFunction beyond;
+    beyond.push(Value::JumpTarget, 100).op(OpcodeDef::Jump).op(OpcodeDef::Return);
+    assert_true(!beyond.verified(), "jump_targets: jump outside function verified");
+
+    // to somewhere that can't be known in advance
+    TestFunction computed;
+    computed.push(Value::JumpTarget, 0).push(Value::JumpTarget, 0).op(OpcodeDef::Add);
+    computed.op(OpcodeDef::Jump).op(OpcodeDef::Return);
+    assert_true(!computed.verified(), "jump_targets: computed jump verified");
+
+    // off the end of the function's code
+    TestFunction falls;
+    falls.push(Value::Integer, 1);
+    assert_true(!falls.verified(), "jump_targets: falling off the end verified");
+}
+
+void test_locals() {
+    TestFunction range;
+    range.push(Value::Integer, 1).push(Value::VarRef, 3).op(OpcodeDef::Store);
+    range.op(OpcodeDef::Return);
+    assert_true(!range.verified(), "locals: store out of range verified");
+
+    TestFunction reference;
+    reference.push(Value::LocalVar, 1).op(OpcodeDef::StackPop).op(OpcodeDef::Return);
+    assert_true(!reference.verified(), "locals: local reference verified");
+}
+
+void test_unknown_opcode() {
+    TestFunction f;
+    f.push(Value::Integer, 1).op(OpcodeDef::GetSetting).op(OpcodeDef::Return);
+    assert_true(!f.verified(), "unknown_opcode: verified");
+}
+
+int main() {
+
+    try {
+        test_straight_line();
+        test_underflow();
+        test_loops();
+        test_jump_targets();
+        test_locals();
+        test_unknown_opcode();
+    } catch (TestFailed &e) {
+        std::cerr << "Test Failed: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}